@@ -57,6 +57,24 @@ float adc_sample_to_voltage(uint16_t sample, struct adc_cal *cal)
     return scaled;
 }
 
+/* Converts a block of samples to voltages; same as <adc_sample_to_voltage>
+ * a sample at a time, but the scale is worked out once for the lot.
+ */
+void adc_samples_to_voltage(const uint16_t *src, size_t n, float *dst,
+    struct adc_cal *cal)
+{
+    const float adc_max = 4095.0;
+    float vmax, vmin, scale;
+
+    vmax = (cal) ? cal->vmax : VMAX_DEFAULT;
+    vmin = (cal) ? cal->vmin : VMIN_DEFAULT;
+    scale = (vmax - vmin) / adc_max;
+
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = src[i] * scale + vmin;
+    }
+}
+
 uint16_t adc_voltage_to_sample(float voltage, struct adc_cal *cal)
 {
     const float adc_max = 4095.0;
@@ -0,0 +1,484 @@
+/* File: bgzf.c
+ *
+ * Block gzip'd captures.  A block gzip file is a string of small gzip
+ * members, each carrying its own compressed size in a 'BC' extra field
+ * (the same layout as BGZF from samtools).  That makes it possible to
+ * find every member without inflating anything, and the ISIZE trailers
+ * give the exact size of the output, so members can be inflated in
+ * parallel straight into their spot in a single buffer.  To everything
+ * else it's just a multi-member gzip file.
+ *
+ * Author: Jack Bradach <jack@bradach.net>
+ *
+ * Copyright (C) 2016 Jack Bradach <jack@bradach.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "bgzf.h"
+#include "file_utils.h"
+
+/* Fixed header: gzip header with FEXTRA plus one 'BC' subfield */
+#define BGZF_HDR_LEN 18
+
+/* CRC32 and ISIZE */
+#define BGZF_TRAILER_LEN 8
+
+/* Largest a whole block can be; BSIZE is stored minus one in 16 bits */
+#define BGZF_MAX_BLOCK 0x10000
+
+/* Blocks compressed at once by the writer */
+#define BGZF_BATCH_BLOCKS 64
+
+/* Window bits for inflateInit2() when expecting gzip headers */
+#define GZIP_WBITS (15 + 16)
+
+/* Flag for the extra field in the gzip header's FLG byte */
+#define GZIP_FEXTRA 0x04
+
+/* Empty block that marks a clean end of file */
+static const uint8_t bgzf_eof[28] = {
+    0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00,
+    0x42, 0x43, 0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00
+};
+
+/* Struct: bgzf_block
+ *
+ * Where a block lives in the compressed and inflated data.
+ *
+ * Fields:
+ *  in - offset of the block in the compressed data
+ *  out - offset of the block's data once inflated
+ *  len - compressed length, header and trailer included
+ *  isize - inflated length, from the trailer
+ */
+struct bgzf_block {
+    size_t in;
+    size_t out;
+    uint32_t len;
+    uint32_t isize;
+};
+
+/* Struct: bgzf_writer
+ *
+ * Buffers up a batch of blocks' worth of data so they can be
+ * compressed in parallel before being written out in order.
+ */
+struct bgzf_writer {
+    FILE *fp;
+    int level;
+    size_t in_len;
+    uint8_t *in;
+    uint8_t *out;
+    uint32_t out_len[BGZF_BATCH_BLOCKS];
+};
+
+static uint32_t block_size(const uint8_t *src, size_t len);
+static int scan_blocks(const uint8_t *src, size_t len,
+    struct bgzf_block **blocks, size_t *nblocks, size_t *total);
+static uint32_t compress_block(const uint8_t *src, size_t len, uint8_t *dst,
+    int level);
+static int writer_flush(bgzf_writer_t *w);
+
+static inline uint16_t get_le16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static inline void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/* Function: bgzf_detect
+ *
+ * Checks whether a buffer starts with a block gzip header.
+ */
+bool bgzf_detect(const void *src, size_t len)
+{
+    return 0 != block_size(src, len);
+}
+
+/* Function: bgzf_inflate
+ *
+ * Inflates a block gzip'd buffer, splitting the blocks up between
+ * threads.  The output buffer is sized up front from the blocks'
+ * ISIZE trailers and each block is inflated straight into its place.
+ *
+ * Parameters:
+ *  src - compressed data
+ *  len - length of the compressed data
+ *  dst - pointer to the inflated data, which the caller frees
+ *  dst_len - length of the inflated data
+ *
+ * Returns:
+ *  0 on success, -1 on failure with errno set.  EINVAL means the
+ *  buffer isn't block gzip'd (but might still be regular gzip) and
+ *  EILSEQ that one of the blocks is corrupt.
+ */
+int bgzf_inflate(const void *src, size_t len, void **dst, size_t *dst_len)
+{
+    struct bgzf_block *blocks;
+    size_t nblocks, total;
+    uint8_t *buf;
+    int err = 0;
+
+    if (scan_blocks(src, len, &blocks, &nblocks, &total))
+        return -1;
+
+    buf = malloc(total ? total : 1);
+    if (NULL == buf) {
+        free(blocks);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    #pragma omp parallel for schedule(dynamic, 16) reduction(|:err)
+    for (size_t i = 0; i < nblocks; i++) {
+        struct bgzf_block *b = &blocks[i];
+        z_stream strm = { 0 };
+        int rc;
+
+        if (Z_OK != inflateInit2(&strm, GZIP_WBITS)) {
+            err |= 1;
+            continue;
+        }
+
+        /* zlib checks the CRC and ISIZE on the way out */
+        strm.next_in = (Bytef *) src + b->in;
+        strm.avail_in = b->len;
+        strm.next_out = buf + b->out;
+        strm.avail_out = b->isize;
+        rc = inflate(&strm, Z_FINISH);
+        if (Z_STREAM_END != rc || strm.total_out != b->isize)
+            err |= 1;
+
+        inflateEnd(&strm);
+    }
+
+    free(blocks);
+
+    if (err) {
+        free(buf);
+        errno = EILSEQ;
+        return -1;
+    }
+
+    *dst = buf;
+    *dst_len = total;
+    return 0;
+}
+
+/* Function: bgzf_writer_open
+ *
+ * Opens a writer that block gzips everything written to it.
+ *
+ * Parameters:
+ *  fp - file to write to
+ *  level - zlib compression level
+ *  w - handle to the new writer
+ *
+ * Returns:
+ *  0 on success, -1 on failure with errno set.
+ *
+ * See Also:
+ *  <bgzf_writer_close>
+ */
+int bgzf_writer_open(FILE *fp, int level, bgzf_writer_t **new_w)
+{
+    bgzf_writer_t *w;
+
+    if (NULL == fp) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    w = calloc(1, sizeof(struct bgzf_writer));
+    w->fp = fp;
+    w->level = level;
+    w->in = malloc(BGZF_BATCH_BLOCKS * BGZF_BLOCK_LEN);
+    w->out = malloc(BGZF_BATCH_BLOCKS * BGZF_MAX_BLOCK);
+
+    *new_w = w;
+    return 0;
+}
+
+/* Function: bgzf_write
+ *
+ * Writes len bytes through the writer.
+ *
+ * Returns:
+ *  0 on success, -1 on failure with errno set.
+ */
+int bgzf_write(bgzf_writer_t *w, const void *buf, size_t len)
+{
+    const uint8_t *src = buf;
+
+    while (len) {
+        size_t n = BGZF_BATCH_BLOCKS * BGZF_BLOCK_LEN - w->in_len;
+        if (n > len)
+            n = len;
+
+        memcpy(w->in + w->in_len, src, n);
+        w->in_len += n;
+        src += n;
+        len -= n;
+
+        if (w->in_len == BGZF_BATCH_BLOCKS * BGZF_BLOCK_LEN &&
+                writer_flush(w))
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Function: bgzf_writer_close
+ *
+ * Writes out anything still buffered, followed by the end of file
+ * marker, and frees the writer.  The file itself is left open.
+ *
+ * Returns:
+ *  0 on success, -1 on failure with errno set.
+ */
+int bgzf_writer_close(bgzf_writer_t *w)
+{
+    int rc = 0;
+
+    if (NULL == w)
+        return 0;
+
+    if (writer_flush(w) ||
+            (1 != fwrite(bgzf_eof, sizeof(bgzf_eof), 1, w->fp)) ||
+            fflush(w->fp)) {
+        errno = EIO;
+        rc = -1;
+    }
+
+    free(w->in);
+    free(w->out);
+    free(w);
+    return rc;
+}
+
+/* Function: bgzf_compress_file
+ *
+ * Block gzips a file (which may itself be gzip'd, or a pipe) into
+ * another, a batch at a time.
+ *
+ * Parameters:
+ *  in - file to read
+ *  out - file to write the block gzip'd copy to
+ *  level - zlib compression level
+ *
+ * Returns:
+ *  0 on success, -1 on failure with errno set.
+ */
+int bgzf_compress_file(FILE *in, FILE *out, int level)
+{
+    const size_t chunk = BGZF_BATCH_BLOCKS * BGZF_BLOCK_LEN;
+    file_stream_t *fs;
+    bgzf_writer_t *w;
+    uint8_t *buf;
+    int64_t n;
+    int rc = 0;
+
+    if (file_stream_open(in, &fs))
+        return -1;
+
+    if (bgzf_writer_open(out, level, &w)) {
+        file_stream_close(fs);
+        return -1;
+    }
+
+    buf = malloc(chunk);
+    while ((n = file_stream_read(fs, buf, chunk)) > 0) {
+        if (bgzf_write(w, buf, n)) {
+            rc = -1;
+            break;
+        }
+    }
+
+    if (n < 0)
+        rc = -1;
+
+    if (bgzf_writer_close(w))
+        rc = -1;
+
+    free(buf);
+    file_stream_close(fs);
+    return rc;
+}
+
+/* Returns the total size of the block starting at src, or zero if
+ * there isn't a block gzip header there.
+ */
+static uint32_t block_size(const uint8_t *src, size_t len)
+{
+    uint16_t xlen;
+    const uint8_t *x, *end;
+
+    if (len < BGZF_HDR_LEN + BGZF_TRAILER_LEN)
+        return 0;
+
+    if (0x1f != src[0] || 0x8b != src[1] || Z_DEFLATED != src[2] ||
+            !(src[3] & GZIP_FEXTRA))
+        return 0;
+
+    xlen = get_le16(src + 10);
+    if ((size_t) xlen + 12 > len)
+        return 0;
+
+    /* Look for the 'BC' subfield amongst the extras */
+    x = src + 12;
+    end = x + xlen;
+    while (x + 4 <= end) {
+        uint16_t slen = get_le16(x + 2);
+        if ('B' == x[0] && 'C' == x[1] && 2 == slen && x + 6 <= end)
+            return get_le16(x + 4) + 1;
+        x += 4 + slen;
+    }
+
+    return 0;
+}
+
+/* Walks the chain of blocks, working out where each one's data ends up.
+ * Anything that isn't a well formed block (including junk at the end)
+ * means this isn't something we can split up.
+ */
+static int scan_blocks(const uint8_t *src, size_t len,
+    struct bgzf_block **blocks, size_t *nblocks, size_t *total)
+{
+    struct bgzf_block *b = NULL;
+    size_t n = 0, alloc = 0, in = 0, out = 0;
+
+    while (in < len) {
+        uint32_t bsize = block_size(src + in, len - in);
+
+        if (0 == bsize || bsize < BGZF_HDR_LEN + BGZF_TRAILER_LEN ||
+                bsize > len - in) {
+            free(b);
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (n == alloc) {
+            alloc = alloc ? alloc * 2 : 1024;
+            b = realloc(b, alloc * sizeof(struct bgzf_block));
+        }
+
+        b[n] = (struct bgzf_block) {
+            .in = in,
+            .out = out,
+            .len = bsize,
+            .isize = get_le32(src + in + bsize - 4)
+        };
+        out += b[n].isize;
+        in += bsize;
+        n++;
+    }
+
+    if (0 == n) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *blocks = b;
+    *nblocks = n;
+    *total = out;
+    return 0;
+}
+
+/* Compresses up to BGZF_BLOCK_LEN bytes into a complete block at dst,
+ * which needs room for BGZF_MAX_BLOCK bytes.  Returns the block size.
+ */
+static uint32_t compress_block(const uint8_t *src, size_t len, uint8_t *dst,
+    int level)
+{
+    const uint8_t hdr[BGZF_HDR_LEN] = {
+        0x1f, 0x8b, Z_DEFLATED, GZIP_FEXTRA, 0, 0, 0, 0, 0, 0xff,
+        6, 0, 'B', 'C', 2, 0, 0, 0
+    };
+    z_stream strm = { 0 };
+    uint32_t bsize;
+    int rc;
+
+    deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    strm.next_in = (Bytef *) src;
+    strm.avail_in = len;
+    strm.next_out = dst + BGZF_HDR_LEN;
+    strm.avail_out = BGZF_MAX_BLOCK - BGZF_HDR_LEN - BGZF_TRAILER_LEN;
+    rc = deflate(&strm, Z_FINISH);
+    deflateEnd(&strm);
+
+    /* Data that doesn't compress gets stored, which always fits. */
+    if (Z_STREAM_END != rc)
+        return compress_block(src, len, dst, Z_NO_COMPRESSION);
+
+    bsize = BGZF_HDR_LEN + strm.total_out + BGZF_TRAILER_LEN;
+    memcpy(dst, hdr, BGZF_HDR_LEN);
+    put_le16(dst + 16, bsize - 1);
+    put_le32(dst + bsize - 8, crc32(0, src, len));
+    put_le32(dst + bsize - 4, len);
+
+    return bsize;
+}
+
+/* Compresses the buffered batch a block per thread and writes it out. */
+static int writer_flush(bgzf_writer_t *w)
+{
+    size_t nblocks = (w->in_len + BGZF_BLOCK_LEN - 1) / BGZF_BLOCK_LEN;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < nblocks; i++) {
+        size_t off = i * BGZF_BLOCK_LEN;
+        size_t n = w->in_len - off;
+        if (n > BGZF_BLOCK_LEN)
+            n = BGZF_BLOCK_LEN;
+
+        w->out_len[i] = compress_block(w->in + off, n,
+            w->out + i * BGZF_MAX_BLOCK, w->level);
+    }
+
+    for (size_t i = 0; i < nblocks; i++) {
+        if (1 != fwrite(w->out + i * BGZF_MAX_BLOCK, w->out_len[i], 1, w->fp)) {
+            errno = EIO;
+            return -1;
+        }
+    }
+
+    w->in_len = 0;
+    return 0;
+}
@@ -0,0 +1,51 @@
+/* File: bgzf.h
+ *
+ * Block gzip'd captures (headers)
+ *
+ * Author: Jack Bradach <jack@bradach.net>
+ *
+ * Copyright (C) 2016 Jack Bradach <jack@bradach.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _BGZF_H_
+#define _BGZF_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Most uncompressed bytes stored in one block (same limit as BGZF) */
+#define BGZF_BLOCK_LEN 0xff00
+
+typedef struct bgzf_writer bgzf_writer_t;
+
+bool bgzf_detect(const void *src, size_t len);
+int bgzf_inflate(const void *src, size_t len, void **dst, size_t *dst_len);
+
+int bgzf_writer_open(FILE *fp, int level, bgzf_writer_t **w);
+int bgzf_write(bgzf_writer_t *w, const void *buf, size_t len);
+int bgzf_writer_close(bgzf_writer_t *w);
+
+int bgzf_compress_file(FILE *in, FILE *out, int level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
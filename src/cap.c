@@ -20,25 +20,120 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "adc.h"
 #include "cap.h"
+#include "file_utils.h"
 #include "queue.h"
 #include "proto.h"
+#include "simd.h"
 
 #define CAP_MAX_NOTE_LEN 64
 
+/* Digital samples are packed a bit apiece into 64-bit words, with
+ * sample idx at bit (idx % 64) of word (idx / 64).
+ */
+#define CAP_DIGITAL_WORD_BITS 64
+#define CAP_DIGITAL_NWORDS(n) (((n) + CAP_DIGITAL_WORD_BITS - 1) / CAP_DIGITAL_WORD_BITS)
+
+/* Edges per block of the edge index; a lookup decodes at most this
+ * many gaps after its binary search.
+ */
+#define CAP_EDGE_BLOCK 64
+
+/* Samples per ADC segment, converted in parallel, and per block of
+ * threshold compares within a segment.  Both are whole words.
+ */
+#define CAP_ADC_SEGMENT (1 << 20)
+#define CAP_ADC_BLOCK 4096
+
+/* Auto thresholds need each level to hold at least 1/CAP_HIST_MIN_SHARE
+ * of the samples, and the levels to be at least CAP_HIST_MIN_SWING
+ * apart, or it's not a logic signal.
+ */
+#define CAP_HIST_MIN_SHARE 1000
+#define CAP_HIST_MIN_SWING 32
+
+/* Entries of the level below summarized by each entry of the analog
+ * min/max pyramid, and enough levels for any capture.
+ */
+#define CAP_LOD_FANOUT 64
+#define CAP_LOD_MAX_LEVELS 11
+
 enum cap_types {
     CAP_TYPE_INVALID = 0,
     CAP_TYPE_ANALOG,
     CAP_TYPE_DIGITAL
 };
 
+struct edge_block {
+    uint64_t idx;
+    size_t off;
+};
+
+/* Struct: edge_index
+ *
+ * Sorted list of a capture's digital edges, where an edge is a sample
+ * whose level differs from the one before it.  The gaps between edges
+ * are stored as LEB128 varints, so a sparse signal costs a byte or two
+ * per edge.  Every CAP_EDGE_BLOCK'th edge is kept in full, along with
+ * where the gaps after it start, and that's what gets binary searched.
+ *
+ * Fields:
+ *  count - number of edges
+ *  last - sample index of the last edge
+ *  gaps - varint gaps between edges that don't start a block
+ *  len - bytes of gaps in use
+ *  alloc - bytes of gaps allocated
+ *  blocks - the edges that start each block
+ *  nblocks_alloc - blocks allocated
+ *  valid - false once the digital samples have changed since it was built
+ */
+struct edge_index {
+    uint64_t count;
+    uint64_t last;
+    uint8_t *gaps;
+    size_t len;
+    size_t alloc;
+    struct edge_block *blocks;
+    size_t nblocks_alloc;
+    bool valid;
+};
+
+/* Struct: analog_lod
+ *
+ * Min/max pyramid over a capture's analog samples.  Entry i of level 0
+ * holds the extremes of samples [64i, 64i + 64), and each level above
+ * summarizes 64 entries of the one below, up to a single entry for the
+ * whole capture.  Any range comes down to at most a partial block on
+ * either end at each level, so its extremes come back in O(log n)
+ * whatever the zoom.
+ *
+ * Fields:
+ *  nlevels - levels built
+ *  len - entries in each level
+ *  min - smallest sample under each entry
+ *  max - largest sample under each entry
+ *  valid - false once the analog samples have changed since it was built
+ */
+struct analog_lod {
+    unsigned nlevels;
+    uint64_t len[CAP_LOD_MAX_LEVELS];
+    uint16_t *min[CAP_LOD_MAX_LEVELS];
+    uint16_t *max[CAP_LOD_MAX_LEVELS];
+    bool valid;
+};
+
 struct cap {
-    TAILQ_ENTRY(cap) entry;
+    /* Bundle this capture belongs to, and where in it */
+    struct cap_bundle *bundle;
+    unsigned bundle_idx;
     /* Parent for a subcap (NULL for top level) */
     struct cap *parent;
     char note[64];
@@ -49,17 +144,50 @@ struct cap {
     uint16_t analog_min;
     uint16_t analog_max;
     uint16_t *analog;
+    /* Analog samples packed 12 bits apiece instead, if asked for */
+    uint8_t *analog12;
+    struct analog_lod lod;
     adc_cal_t *analog_cal;
-    uint8_t *digital;
+    /* Thresholds the digital samples were last made with */
+    uint16_t adc_lo;
+    uint16_t adc_hi;
+    uint64_t *digital;
+    struct edge_index edges;
+    /* Capture holding the samples of a view (a subcap or a looped
+     * capture), which has none of its own.  The view is a window of
+     * loop_len samples of it from top_begin on, repeated end to end,
+     * and starting loop_skew samples into the window.
+     */
+    struct cap *top;
+    uint64_t top_begin;
+    uint64_t loop_len;
+    uint64_t loop_skew;
+    void *packed;
+    uint8_t packed_width;
+    file_map_t *packed_map;
     proto_t *proto;
     struct refcnt rcnt;
 };
-TAILQ_HEAD(cap_list, cap);
 
+/* Struct: cap_bundle
+ *
+ * A set of captures, kept in an array in the order they were added,
+ * along with a table of them by physical channel.  Both lookups are
+ * O(1), which matters to multi-channel decoders fetching their
+ * channels for every chunk.
+ *
+ * Fields:
+ *  caps - the captures, in order
+ *  len - number of captures
+ *  alloc - slots allocated in caps
+ *  by_ch - first capture of each physical channel, or NULL
+ */
 struct cap_bundle {
     struct refcnt rcnt;
-    struct cap_list head;
+    struct cap **caps;
     unsigned len;
+    unsigned alloc;
+    struct cap *by_ch[CAP_BUNDLE_MAX_CH];
 };
 
 /* Static prototypes - these get automatically called by
@@ -67,24 +195,257 @@ struct cap_bundle {
  */
 static void cap_free(const struct refcnt *ref);
 static void cap_bundle_free(const struct refcnt *ref);
-
-/* Populates the analog min/max fields of a capture */
+static void bundle_reindex(struct cap_bundle *b);
+static uint64_t adc_segment(struct cap *c, uint64_t *digital, uint64_t begin,
+    uint16_t v_lo, uint16_t v_hi);
+static void set_digital_run(uint64_t *digital, uint64_t begin, uint64_t end);
+static void edges_reset(struct edge_index *e);
+static void edges_add_word(struct edge_index *e, uint64_t base, uint64_t word,
+    uint64_t prev, unsigned n);
+static struct edge_index *get_edges(struct cap *c);
+static uint64_t edge_rank(struct cap *c, uint64_t idx);
+static uint64_t edge_at(struct cap *c, uint64_t k);
+static uint64_t window_edges_before(struct cap *c, uint64_t q);
+static uint64_t digital_bits(struct cap *c, uint64_t p, uint64_t n);
+static struct cap *cap_create_view(struct cap *src);
+static struct cap *cap_copy(struct cap *src);
+static uint64_t edges_rank(struct edge_index *e, uint64_t idx);
+static const uint16_t *analog_block(struct cap *c, uint64_t idx, size_t n,
+    uint16_t *buf);
+static void write_analog12(struct cap *c, uint64_t idx, const uint16_t *src,
+    size_t n);
+static inline uint64_t top_idx(struct cap *c, uint64_t idx);
+static inline uint64_t top_run(struct cap *c, uint64_t idx);
+static void lod_reset(struct analog_lod *l);
+static void lod_minmax(struct cap *c, uint64_t begin, uint64_t end,
+    uint16_t *min, uint16_t *max);
+static uint64_t edges_get(struct edge_index *e, uint64_t k);
+
+/* Populates the analog min/max fields of a capture, from the top of
+ * its min/max pyramid.
+ */
 void cap_update_analog_minmax(struct cap *c)
 {
-    uint16_t min = 4095;
-    uint16_t max = 0;
+    assert(NULL == c->top);
+    lod_minmax(c, 0, c->nsamples, &c->analog_min, &c->analog_max);
+}
+
+/* Function: cap_index_analog
+ *
+ * Builds the min/max pyramid over a capture's analog samples, if it
+ * isn't already up to date.  Range queries build it on demand, but
+ * this should be called up front (imports do) if they're going to
+ * happen from more than one thread.  Views use their top capture's.
+ *
+ * See Also:
+ *  <cap_get_analog_range>, <cap_get_analog_envelope>
+ */
+void cap_index_analog(struct cap *c)
+{
+    struct analog_lod *l;
+    uint64_t len;
+
+    if (c->top)
+        c = c->top;
 
-    for (uint64_t i = 0; i < c->nsamples; i++) {
-        uint16_t sample = c->analog[i];
-        if (sample < min) {
-            min = sample;
-        } else if (sample > max) {
-            max = sample;
+    l = &c->lod;
+    if (l->valid || !(c->analog || c->analog12))
+        return;
+
+    lod_reset(l);
+    len = c->nsamples;
+    while ((len > 1) && (l->nlevels < CAP_LOD_MAX_LEVELS)) {
+        const uint16_t *lo = l->nlevels ? l->min[l->nlevels - 1] : NULL;
+        const uint16_t *hi = l->nlevels ? l->max[l->nlevels - 1] : NULL;
+        uint64_t n = (len + CAP_LOD_FANOUT - 1) / CAP_LOD_FANOUT;
+        uint16_t *min = malloc(n * sizeof(uint16_t));
+        uint16_t *max = malloc(n * sizeof(uint16_t));
+
+        /* Only the bottom level is worth spreading across threads */
+        #pragma omp parallel for schedule(static) if (n > CAP_ADC_BLOCK)
+        for (uint64_t i = 0; i < n; i++) {
+            uint64_t begin = i * CAP_LOD_FANOUT;
+            uint64_t end = (i + 1) * CAP_LOD_FANOUT;
+            uint16_t buf[CAP_LOD_FANOUT];
+            const uint16_t *x, *y;
+            uint16_t a = UINT16_MAX, b = 0;
+
+            if (end > len)
+                end = len;
+
+            /* The bottom level summarizes samples */
+            x = lo ? lo + begin : analog_block(c, begin, end - begin, buf);
+            y = hi ? hi + begin : x;
+            for (uint64_t j = 0; j < end - begin; j++) {
+                a = (x[j] < a) ? x[j] : a;
+                b = (y[j] > b) ? y[j] : b;
+            }
+            min[i] = a;
+            max[i] = b;
         }
+
+        l->len[l->nlevels] = n;
+        l->min[l->nlevels] = min;
+        l->max[l->nlevels] = max;
+        l->nlevels++;
+        len = n;
     }
 
-    c->analog_min = min;
-    c->analog_max = max;
+    l->valid = true;
+}
+
+/* Function: cap_get_analog_range
+ *
+ * Finds the smallest and largest analog samples in [begin, end) using
+ * the min/max pyramid, so it costs the same at any zoom.
+ *
+ * Parameters:
+ *  c - capture to look at
+ *  begin - first sample of the range
+ *  end - one past the last sample; clamped to the end of the capture
+ *  min - smallest sample, or UINT16_MAX for an empty range
+ *  max - largest sample, or 0 for an empty range
+ */
+void cap_get_analog_range(struct cap *c, uint64_t begin, uint64_t end,
+    uint16_t *min, uint16_t *max)
+{
+    *min = UINT16_MAX;
+    *max = 0;
+
+    if (end > c->nsamples)
+        end = c->nsamples;
+    if (begin >= end)
+        return;
+
+    if (NULL == c->top) {
+        lod_minmax(c, begin, end, min, max);
+        return;
+    }
+
+    /* A view covering its whole window is just the window */
+    if (end - begin >= c->loop_len) {
+        lod_minmax(c->top, c->top_begin, c->top_begin + c->loop_len, min, max);
+        return;
+    }
+
+    /* Otherwise it's at most two runs of the top capture */
+    while (begin < end) {
+        uint64_t p = top_idx(c, begin);
+        uint64_t run = top_run(c, begin);
+
+        if (run > end - begin)
+            run = end - begin;
+        lod_minmax(c->top, p, p + run, min, max);
+        begin += run;
+    }
+}
+
+/* Function: cap_get_analog_envelope
+ *
+ * Splits [begin, end) into n equal buckets and finds the smallest and
+ * largest analog samples in each; that's what a plot of the range
+ * squeezed into n columns needs to show.
+ *
+ * Parameters:
+ *  c - capture to look at
+ *  begin - first sample of the range
+ *  end - one past the last sample; clamped to the end of the capture
+ *  n - number of buckets
+ *  min - n smallest samples
+ *  max - n largest samples
+ *
+ * See Also:
+ *  <cap_get_analog_range>
+ */
+void cap_get_analog_envelope(struct cap *c, uint64_t begin, uint64_t end,
+    size_t n, uint16_t *min, uint16_t *max)
+{
+    if (end > c->nsamples)
+        end = c->nsamples;
+    if (begin > end)
+        begin = end;
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t b0 = begin + ((end - begin) * i) / n;
+        uint64_t b1 = begin + ((end - begin) * (i + 1)) / n;
+
+        cap_get_analog_range(c, b0, b1, &min[i], &max[i]);
+    }
+}
+
+static void lod_reset(struct analog_lod *l)
+{
+    for (unsigned i = 0; i < l->nlevels; i++) {
+        free(l->min[i]);
+        free(l->max[i]);
+    }
+    memset(l, 0, sizeof(*l));
+}
+
+/* Folds the extremes of entries [begin, end) of a level into min/max */
+static void lod_scan(const uint16_t *lo, const uint16_t *hi,
+    uint64_t begin, uint64_t end, uint16_t *min, uint16_t *max)
+{
+    for (uint64_t i = begin; i < end; i++) {
+        *min = (lo[i] < *min) ? lo[i] : *min;
+        *max = (hi[i] > *max) ? hi[i] : *max;
+    }
+}
+
+/* Same, where a level of NULL means the samples themselves, which are
+ * only ever scanned a partial block at a time.
+ */
+static void lod_scan_level(struct cap *c, const uint16_t *lo,
+    const uint16_t *hi, uint64_t begin, uint64_t end,
+    uint16_t *min, uint16_t *max)
+{
+    uint16_t buf[CAP_LOD_FANOUT];
+
+    if (lo) {
+        lod_scan(lo, hi, begin, end, min, max);
+        return;
+    }
+
+    for (uint64_t i = begin; i < end; i += CAP_LOD_FANOUT) {
+        size_t n = (end - i < CAP_LOD_FANOUT) ? end - i : CAP_LOD_FANOUT;
+        const uint16_t *x = analog_block(c, i, n, buf);
+
+        lod_scan(x, x, 0, n, min, max);
+    }
+}
+
+/* Folds the extremes of samples [begin, end) of a top-level capture
+ * into min/max; the partial blocks on either end are scanned at each
+ * level, and the whole blocks between them left to the level above.
+ */
+static void lod_minmax(struct cap *c, uint64_t begin, uint64_t end,
+    uint16_t *min, uint16_t *max)
+{
+    const uint16_t *lo = NULL, *hi = NULL;
+    struct analog_lod *l = &c->lod;
+    unsigned level = 0;
+
+    cap_index_analog(c);
+    if (!(c->analog || c->analog12))
+        return;
+
+    while (begin < end) {
+        uint64_t a = (begin + CAP_LOD_FANOUT - 1) / CAP_LOD_FANOUT;
+        uint64_t b = end / CAP_LOD_FANOUT;
+
+        if ((level >= l->nlevels) || (a >= b)) {
+            lod_scan_level(c, lo, hi, begin, end, min, max);
+            break;
+        }
+
+        lod_scan_level(c, lo, hi, begin, a * CAP_LOD_FANOUT, min, max);
+        lod_scan_level(c, lo, hi, b * CAP_LOD_FANOUT, end, min, max);
+        lo = l->min[level];
+        hi = l->max[level];
+        level++;
+        begin = a;
+        end = b;
+    }
 }
 
 void cap_analog_adc_ttl(struct cap *c)
@@ -94,23 +455,203 @@ void cap_analog_adc_ttl(struct cap *c)
     cap_analog_adc(c, ttl_low, ttl_high);
 }
 
-void cap_analog_adc(struct cap *c, uint16_t v_lo, uint16_t v_hi)
+/* Function: cap_analog_histogram
+ *
+ * Counts a capture's analog samples into CAP_HIST_BINS bins, one per
+ * 12-bit value, with anything bigger in the last one.  Segments of the
+ * capture are counted in parallel.
+ *
+ * Parameters:
+ *  c - capture to count
+ *  hist - CAP_HIST_BINS counts
+ */
+void cap_analog_histogram(struct cap *c, uint64_t *hist)
+{
+    const uint64_t nseg = (c->nsamples + CAP_ADC_SEGMENT - 1) / CAP_ADC_SEGMENT;
+
+    memset(hist, 0, CAP_HIST_BINS * sizeof(uint64_t));
+
+    #pragma omp parallel if (nseg > 1)
+    {
+        uint32_t *ways = malloc(SIMD_HIST_WAYS * SIMD_HIST_BINS * sizeof(uint32_t));
+        uint16_t buf[CAP_ADC_BLOCK];
+
+        /* A segment's counts fit in 32 bits; the capture's might not */
+        #pragma omp for schedule(dynamic)
+        for (uint64_t seg = 0; seg < nseg; seg++) {
+            uint64_t begin = seg * CAP_ADC_SEGMENT;
+            uint64_t end = begin + CAP_ADC_SEGMENT;
+
+            if (end > c->nsamples)
+                end = c->nsamples;
+
+            memset(ways, 0, SIMD_HIST_WAYS * SIMD_HIST_BINS * sizeof(uint32_t));
+            for (uint64_t i = begin; i < end; i += CAP_ADC_BLOCK) {
+                uint64_t n = (end - i < CAP_ADC_BLOCK) ? end - i : CAP_ADC_BLOCK;
+                simd_u12_histogram(analog_block(c, i, n, buf), n, ways);
+            }
+
+            #pragma omp critical(cap_histogram)
+            for (unsigned b = 0; b < CAP_HIST_BINS; b++) {
+                for (unsigned w = 0; w < SIMD_HIST_WAYS; w++)
+                    hist[b] += ways[w * SIMD_HIST_BINS + b];
+            }
+        }
+
+        free(ways);
+    }
+}
+
+/* Function: cap_analog_auto_thresholds
+ *
+ * Works out ADC thresholds for a capture from its histogram, so buses
+ * that don't swing TTL levels still come out right.  Otsu's method
+ * splits the histogram where the two halves are best separated, and
+ * the biggest peak in each half is taken as the low and high level.
+ * The thresholds go a third of the way in from each level, leaving
+ * the middle third as hysteresis.
+ *
+ * Parameters:
+ *  c - capture to look at
+ *  v_lo - set to the low threshold, as a raw sample
+ *  v_hi - set to the high threshold, as a raw sample
+ *
+ * Returns:
+ *  0 on success, -1 with errno set to ERANGE if the samples don't have
+ *  two clear levels.
+ */
+int cap_analog_auto_thresholds(struct cap *c, uint16_t *v_lo, uint16_t *v_hi)
 {
-    uint8_t *digital = calloc(c->nsamples, sizeof(uint8_t));
-
-    for (uint64_t i = 0; i < c->nsamples; i++) {
-        static uint8_t adc = 0;
-        /* Digital samples only change when crossing the voltage
-         * thresholds.
-         */
-        uint16_t ch_sample = c->analog[i];
-        if (ch_sample <= v_lo) {
-            adc = 0;
-        } else if (ch_sample >= v_hi) {
-            adc = 1;
+    uint64_t *hist = malloc(CAP_HIST_BINS * sizeof(uint64_t));
+    double total = 0, sum = 0, w_lo = 0, sum_lo = 0, best = -1;
+    unsigned split = 0, lo = 0, hi;
+    uint64_t n_lo = 0;
+
+    cap_analog_histogram(c, hist);
+    for (unsigned b = 0; b < CAP_HIST_BINS; b++) {
+        total += hist[b];
+        sum += (double) b * hist[b];
+    }
+
+    /* Split after the bin that maximizes the between-class variance */
+    for (unsigned b = 0; b + 1 < CAP_HIST_BINS; b++) {
+        double w_hi, d;
+
+        w_lo += hist[b];
+        sum_lo += (double) b * hist[b];
+        w_hi = total - w_lo;
+        if ((0 == w_lo) || (0 == w_hi))
+            continue;
+
+        d = (sum_lo / w_lo) - ((sum - sum_lo) / w_hi);
+        if (w_lo * w_hi * d * d > best) {
+            best = w_lo * w_hi * d * d;
+            split = b;
+        }
+    }
+
+    hi = split + 1;
+    for (unsigned b = 0; b < CAP_HIST_BINS; b++) {
+        if (b <= split) {
+            n_lo += hist[b];
+            lo = (hist[b] > hist[lo]) ? b : lo;
+        } else {
+            hi = (hist[b] > hist[hi]) ? b : hi;
         }
-        digital[i] = adc;
     }
+    free(hist);
+
+    if ((best < 0) || (n_lo * CAP_HIST_MIN_SHARE < total) ||
+            ((total - n_lo) * CAP_HIST_MIN_SHARE < total) ||
+            (hi - lo < CAP_HIST_MIN_SWING)) {
+        errno = ERANGE;
+        return -1;
+    }
+
+    *v_lo = lo + (hi - lo) / 3;
+    *v_hi = hi - (hi - lo) / 3;
+    return 0;
+}
+
+/* Function: cap_analog_adc_auto
+ *
+ * Makes the digital version of an analog capture with thresholds picked
+ * from its own samples, falling back to TTL ones if there's no telling
+ * where they should go (a line that never changes, say).
+ *
+ * See Also:
+ *  <cap_analog_auto_thresholds>, <cap_analog_adc_ttl>
+ */
+void cap_analog_adc_auto(struct cap *c)
+{
+    uint16_t v_lo, v_hi;
+
+    if (cap_analog_auto_thresholds(c, &v_lo, &v_hi))
+        cap_analog_adc_ttl(c);
+    else
+        cap_analog_adc(c, v_lo, v_hi);
+}
+
+/* Gets the thresholds a capture's digital samples were made with */
+void cap_get_adc_thresholds(struct cap *c, uint16_t *v_lo, uint16_t *v_hi)
+{
+    if (c->top) {
+        cap_get_adc_thresholds(c->top, v_lo, v_hi);
+        return;
+    }
+
+    *v_lo = c->adc_lo;
+    *v_hi = c->adc_hi;
+}
+
+/* Function: cap_analog_adc
+ *
+ * Makes the digital version of an analog capture with a Schmitt
+ * trigger: the level goes low at or below v_lo, high at or above v_hi,
+ * and holds in between.  It starts out low.
+ *
+ * The threshold compares are vectorized, and each word of 64 samples
+ * is resolved with a few integer ops given the level coming into it.
+ * Long captures are split into segments that are converted in
+ * parallel as if each started low, then fixed up in order; only the
+ * samples before a segment's first threshold crossing depend on what
+ * came before it.
+ *
+ * Parameters:
+ *  c - capture to convert
+ *  v_lo - low threshold, as a raw sample
+ *  v_hi - high threshold, as a raw sample
+ */
+void cap_analog_adc(struct cap *c, uint16_t v_lo, uint16_t v_hi)
+{
+    assert(NULL == c->top);
+
+    const uint64_t nseg = (c->nsamples + CAP_ADC_SEGMENT - 1) / CAP_ADC_SEGMENT;
+    uint64_t *digital = calloc(CAP_DIGITAL_NWORDS(c->nsamples), sizeof(uint64_t));
+    uint64_t *first = malloc(nseg * sizeof(uint64_t));
+    uint64_t level = 0;
+
+    #pragma omp parallel for schedule(dynamic) if (nseg > 1)
+    for (uint64_t seg = 0; seg < nseg; seg++) {
+        first[seg] = adc_segment(c, digital, seg * CAP_ADC_SEGMENT, v_lo, v_hi);
+    }
+
+    /* Carry each segment's final level into the next one */
+    for (uint64_t seg = 0; seg < nseg; seg++) {
+        uint64_t begin = seg * CAP_ADC_SEGMENT;
+        uint64_t end = begin + CAP_ADC_SEGMENT;
+
+        if (end > c->nsamples)
+            end = c->nsamples;
+
+        if (level)
+            set_digital_run(digital, begin, (first[seg] < end) ? first[seg] : end);
+
+        if (first[seg] < end)
+            level = (digital[(end - 1) / CAP_DIGITAL_WORD_BITS] >>
+                ((end - 1) % CAP_DIGITAL_WORD_BITS)) & 1;
+    }
+    free(first);
 
     /* Shred any existing digital capture */
     if (c->digital) {
@@ -118,28 +659,182 @@ void cap_analog_adc(struct cap *c, uint16_t v_lo, uint16_t v_hi)
     }
 
     c->digital = digital;
+    c->adc_lo = v_lo;
+    c->adc_hi = v_hi;
+    c->edges.valid = false;
+    cap_index_edges(c);
+}
+
+/* Converts one ADC segment as if the level coming into it were low.
+ * Returns the first sample in it that crosses a threshold, or the end
+ * of the capture if none do.
+ */
+static uint64_t adc_segment(struct cap *c, uint64_t *digital, uint64_t begin,
+    uint16_t v_lo, uint16_t v_hi)
+{
+    uint64_t below[CAP_ADC_BLOCK / CAP_DIGITAL_WORD_BITS];
+    uint64_t above[CAP_ADC_BLOCK / CAP_DIGITAL_WORD_BITS];
+    uint16_t buf[CAP_ADC_BLOCK];
+    uint64_t end = begin + CAP_ADC_SEGMENT;
+    uint64_t first = c->nsamples;
+    uint64_t level = 0;
+
+    if (end > c->nsamples)
+        end = c->nsamples;
+
+    for (uint64_t i = begin; i < end; i += CAP_ADC_BLOCK) {
+        uint64_t n = (end - i < CAP_ADC_BLOCK) ? end - i : CAP_ADC_BLOCK;
+
+        simd_u16_thresholds(analog_block(c, i, n, buf), n, v_lo, v_hi,
+            below, above);
+
+        for (uint64_t w = 0; w < CAP_DIGITAL_NWORDS(n); w++) {
+            uint64_t bits = n - w * CAP_DIGITAL_WORD_BITS;
+            uint64_t mask = UINT64_MAX;
+            uint64_t word, set, hold;
+
+            if (bits < CAP_DIGITAL_WORD_BITS)
+                mask = (1ULL << bits) - 1;
+            else
+                bits = CAP_DIGITAL_WORD_BITS;
+
+            /* Low wins if the thresholds overlap.  A run of samples
+             * between the thresholds holds the level before it; adding
+             * a one at the start of each run that follows a high sample
+             * carries through the run, clearing it, and that's the fill.
+             */
+            set = above[w] & ~below[w];
+            hold = ~(above[w] | below[w]);
+            word = set | (hold & ~(hold + (((set << 1) | level) & hold)));
+            word &= mask;
+
+            if ((first == c->nsamples) && ((above[w] | below[w]) & mask))
+                first = i + w * CAP_DIGITAL_WORD_BITS +
+                    __builtin_ctzll((above[w] | below[w]) & mask);
+
+            digital[(i / CAP_DIGITAL_WORD_BITS) + w] = word;
+            level = (word >> (bits - 1)) & 1;
+        }
+    }
+
+    return first;
 }
 
+/* Sets digital samples [begin, end) high. */
+static void set_digital_run(uint64_t *digital, uint64_t begin, uint64_t end)
+{
+    for (uint64_t i = begin; i < end; ) {
+        uint64_t w = i / CAP_DIGITAL_WORD_BITS;
+        unsigned bit = i % CAP_DIGITAL_WORD_BITS;
+        uint64_t n = end - i;
+
+        if (n >= CAP_DIGITAL_WORD_BITS - bit) {
+            digital[w] |= UINT64_MAX << bit;
+            i += CAP_DIGITAL_WORD_BITS - bit;
+        } else {
+            digital[w] |= ((1ULL << n) - 1) << bit;
+            i += n;
+        }
+    }
+}
 
+/* Function: cap_clone_to_bundle
+ *
+ * Adds a looped copy of a capture to a bundle: the source's samples
+ * nloops times over, starting skew_us into it and wrapping around.
+ * Nothing is copied; the new capture is a read-only view that maps its
+ * samples back to the source, which it holds a reference to.
+ *
+ * Parameters:
+ *  bun - bundle to add the copy to
+ *  src - capture to loop
+ *  nloops - how many times over
+ *  skew_us - how far into the source to start, in microseconds
+ */
 void cap_clone_to_bundle(struct cap_bundle *bun, struct cap *src, unsigned nloops, unsigned skew_us)
+{
+    uint64_t skew = (skew_us * 1E-6) / src->period;
+    uint64_t len = src->nsamples;
+    struct cap *dst;
+
+    /* Looping a view is just a different window of its top capture,
+     * unless it wraps partway through its own window.
+     */
+    if (src->top && len && (src->loop_skew + len > src->loop_len) &&
+        (len % src->loop_len)) {
+        struct cap *copy = cap_copy(src);
+
+        cap_clone_to_bundle(bun, copy, nloops, skew_us);
+        cap_dropref(copy);
+        return;
+    }
+
+    dst = cap_create_view(src);
+    dst->nsamples = len * nloops;
+
+    if (NULL == src->top) {
+        dst->loop_len = len;
+        dst->loop_skew = len ? skew % len : 0;
+    } else if (src->loop_skew + len <= src->loop_len) {
+        dst->top_begin += src->loop_skew;
+        dst->loop_len = len;
+        dst->loop_skew = len ? skew % len : 0;
+    } else {
+        dst->loop_skew = (src->loop_skew + skew) % src->loop_len;
+    }
+
+    cap_bundle_add(bun, dst);
+}
+
+/* Starts a view of src's samples, mapped one for one onto its top
+ * capture for the caller to adjust.
+ */
+static struct cap *cap_create_view(struct cap *src)
 {
     struct cap *dst;
-    unsigned src_len = src->nsamples;
-    unsigned dst_len = src_len * nloops;
-    unsigned skew = (skew_us * 1E-6) / src->period;
 
-    dst = cap_create(dst_len);
+    dst = calloc(1, sizeof(struct cap));
+    dst->rcnt = (struct refcnt) { cap_free, 1 };
     dst->period = src->period;
+    dst->physical_ch = src->physical_ch;
     dst->analog_min = src->analog_min;
     dst->analog_max = src->analog_max;
     dst->analog_cal = src->analog_cal;
+    dst->packed_width = src->packed_width;
+
+    if (src->top) {
+        dst->top = cap_addref(src->top);
+        dst->top_begin = src->top_begin;
+        dst->loop_len = src->loop_len;
+        dst->loop_skew = src->loop_skew;
+    } else {
+        dst->top = cap_addref(src);
+        dst->loop_len = src->nsamples;
+    }
+    cap_index_edges(dst->top);
+
+    return dst;
+}
 
+/* Copies a capture's samples into a new top-level capture */
+static struct cap *cap_copy(struct cap *src)
+{
+    struct cap *dst = cap_create(src->nsamples);
 
-    for (unsigned i = 0; i < dst_len; i++) {
-        dst->analog[i] = src->analog[(i + skew) % src_len];
+    cap_read_analog(src, 0, dst->analog, src->nsamples);
+    for (uint64_t w = 0; w < CAP_DIGITAL_NWORDS(src->nsamples); w++) {
+        dst->digital[w] = cap_get_digital_word(src, w);
     }
-    cap_analog_adc_ttl(dst);
-    cap_bundle_add(bun, dst);
+
+    dst->period = src->period;
+    dst->physical_ch = src->physical_ch;
+    dst->analog_min = src->analog_min;
+    dst->analog_max = src->analog_max;
+    dst->analog_cal = src->analog_cal;
+    dst->edges.valid = false;
+    cap_index_edges(dst);
+
+    return dst;
 }
 
 /* Function: cap_create
@@ -162,7 +857,78 @@ struct cap *cap_create(size_t len)
     c->rcnt = (struct refcnt) { cap_free, 1 };
     c->nsamples = len;
     c->analog = calloc(len, sizeof(uint16_t));
-    c->digital = calloc(len, sizeof(uint8_t));
+    c->analog_min = UINT16_MAX;
+    c->digital = calloc(CAP_DIGITAL_NWORDS(len), sizeof(uint64_t));
+    c->edges.valid = true;
+    return c;
+}
+
+/* Function: cap_create_analog12
+ *
+ * Allocates a capture that stores its analog samples packed 12 bits
+ * apiece, which is all the Saleae's ADC produces, instead of 16.  That
+ * saves a quarter of the biggest allocation there is.  It's otherwise
+ * the same as any other capture, except that samples too big for 12
+ * bits saturate when they're stored.
+ *
+ * Parameters:
+ *  len - Number of samples this capture will contain
+ *
+ * Returns:
+ *  pointer to new capture with refcnt = 1.
+ *
+ * See Also:
+ *  <cap_create>, <cap_get_analog_bits>
+ */
+struct cap *cap_create_analog12(size_t len)
+{
+    struct cap *c;
+    c = calloc(1, sizeof(struct cap));
+    c->rcnt = (struct refcnt) { cap_free, 1 };
+    c->nsamples = len;
+    c->analog12 = calloc((3 * len + 1) / 2, 1);
+    c->analog_min = UINT16_MAX;
+    c->digital = calloc(CAP_DIGITAL_NWORDS(len), sizeof(uint64_t));
+    c->edges.valid = true;
+    return c;
+}
+
+/* Returns how many bits each analog sample is stored in */
+uint8_t cap_get_analog_bits(struct cap *c)
+{
+    if (c->top)
+        c = c->top;
+
+    return c->analog12 ? 12 : 16;
+}
+
+/* Function: cap_create_packed
+ *
+ * Creates a multi-channel digital capture around a buffer of sample
+ * words, one bit per channel, exactly as the analyzer exported them.
+ * There's no analog (or per-channel digital) data in a packed capture.
+ *
+ * Parameters:
+ *  words - array of len sample words
+ *  len - number of samples
+ *  width - bytes per sample word; 1, 2, 4 or 8.
+ *  map - file the words live in, which the capture takes a reference
+ *        to.  If NULL, the capture takes ownership of the words and
+ *        frees them when it goes away.
+ *
+ * Returns:
+ *  pointer to new capture with refcnt = 1.
+ */
+struct cap *cap_create_packed(void *words, size_t len, uint8_t width,
+    file_map_t *map)
+{
+    struct cap *c;
+    c = calloc(1, sizeof(struct cap));
+    c->rcnt = (struct refcnt) { cap_free, 1 };
+    c->nsamples = len;
+    c->packed = words;
+    c->packed_width = width;
+    c->packed_map = file_map_addref(map);
     return c;
 }
 
@@ -210,11 +976,6 @@ void cap_dropref(struct cap *c)
     if (NULL == c)
         return;
 
-    if (c->parent) {
-        cap_dropref(c->parent);
-        c->parent = NULL;
-    }
-
     refcnt_dec(&c->rcnt);
 }
 
@@ -257,9 +1018,22 @@ static void cap_free(const struct refcnt *ref)
     if (c->analog)
         free(c->analog);
 
+    if (c->analog12)
+        free(c->analog12);
+
     if (c->digital)
         free(c->digital);
 
+    edges_reset(&c->edges);
+    lod_reset(&c->lod);
+    cap_dropref(c->top);
+    cap_dropref(c->parent);
+
+    if (c->packed_map)
+        file_map_dropref(c->packed_map);
+    else if (c->packed)
+        free(c->packed);
+
     if (c->proto)
         proto_dropref(c->proto);
 
@@ -282,9 +1056,6 @@ struct cap_bundle *cap_bundle_create(void)
     b = calloc(1, sizeof(struct cap_bundle));
     b->rcnt = (struct refcnt) { cap_bundle_free, 1 };
 
-    /* Set up an empty capture list */
-    TAILQ_INIT(&b->head);
-
     return b;
 }
 
@@ -364,15 +1135,15 @@ unsigned cap_bundle_nref(struct cap_bundle *b)
  */
 static void cap_bundle_free(const struct refcnt *ref)
 {
-    cap_t *cur, *tmp;
     struct cap_bundle *b =
         container_of(ref, struct cap_bundle, rcnt);
 
     /* Drop reference count on all child structures. */
-    TAILQ_FOREACH_SAFE(cur, &b->head, entry, tmp) {
-        TAILQ_REMOVE(&b->head, cur, entry);
-        cap_dropref(cur);
+    for (unsigned i = 0; i < b->len; i++) {
+        b->caps[i]->bundle = NULL;
+        cap_dropref(b->caps[i]);
     }
+    free(b->caps);
     free(b);
 }
 
@@ -386,14 +1157,37 @@ uint64_t cap_get_nsamples(struct cap *c)
     return c->nsamples;
 }
 
+/* Maps a sample of a view back to its top capture */
+static inline uint64_t top_idx(struct cap *c, uint64_t idx)
+{
+    return c->top_begin + (idx + c->loop_skew) % c->loop_len;
+}
+
+/* Returns how many samples of a view from idx on are contiguous in its
+ * top capture.
+ */
+static inline uint64_t top_run(struct cap *c, uint64_t idx)
+{
+    return c->loop_len - (idx + c->loop_skew) % c->loop_len;
+}
+
 uint16_t cap_get_analog(struct cap *c, uint64_t idx)
 {
-    return c->analog[idx];
+    const uint8_t *p;
+
+    if (c->top)
+        return cap_get_analog(c->top, top_idx(c, idx));
+
+    if (c->analog)
+        return c->analog[idx];
+
+    p = c->analog12 + (idx / 2) * 3;
+    return (idx & 1) ? (p[1] >> 4) | (p[2] << 4) : p[0] | ((p[1] & 0xf) << 8);
 }
 
 float cap_get_analog_voltage(struct cap *c, uint64_t idx)
 {
-    return adc_sample_to_voltage(c->analog[idx], c->analog_cal);
+    return adc_sample_to_voltage(cap_get_analog(c, idx), c->analog_cal);
 }
 
 float cap_get_analog_vmin(struct cap *c)
@@ -409,17 +1203,333 @@ float cap_get_analog_vmax(struct cap *c)
 
 void cap_set_analog(struct cap *c, uint64_t idx, uint16_t sample)
 {
-    c->analog[idx] = sample;
+    assert(NULL == c->top);
+    c->lod.valid = false;
+
+    if (c->analog12) {
+        uint8_t *p = c->analog12 + (idx / 2) * 3;
+
+        if (sample > 0xfff)
+            sample = 0xfff;
+        if (idx & 1) {
+            p[1] = (p[1] & 0x0f) | (sample << 4);
+            p[2] = sample >> 4;
+        } else {
+            p[0] = sample;
+            p[1] = (p[1] & 0xf0) | (sample >> 8);
+        }
+        return;
+    }
+
+    c->analog[idx] = sample;
+}
+
+/* Function: cap_convert_analog
+ *
+ * Converts a block of float samples to raw analog samples, starting at
+ * sample idx, and widens the capture's min/max to cover them.  A
+ * capture filled in entirely this way doesn't need a separate
+ * <cap_update_analog_minmax> pass.
+ *
+ * Parameters:
+ *  c - capture to fill in
+ *  idx - first sample to write
+ *  src - float samples
+ *  n - number of samples
+ */
+void cap_convert_analog(struct cap *c, uint64_t idx, const float *src, size_t n)
+{
+    assert(NULL == c->top);
+    c->lod.valid = false;
+
+    if (c->analog12) {
+        uint16_t buf[CAP_ADC_BLOCK];
+
+        for (size_t i = 0; i < n; i += CAP_ADC_BLOCK) {
+            size_t m = (n - i < CAP_ADC_BLOCK) ? n - i : CAP_ADC_BLOCK;
+
+            simd_f32_to_u16(src + i, buf, m, &c->analog_min, &c->analog_max);
+            write_analog12(c, idx + i, buf, m);
+        }
+
+        /* The min/max should match what was stored */
+        if (n && (c->analog_min > 0xfff))
+            c->analog_min = 0xfff;
+        if (c->analog_max > 0xfff)
+            c->analog_max = 0xfff;
+        return;
+    }
+
+    simd_f32_to_u16(src, c->analog + idx, n, &c->analog_min, &c->analog_max);
+}
+
+/* Function: cap_read_analog
+ *
+ * Copies n raw analog samples, starting at idx, out of a capture.
+ */
+void cap_read_analog(struct cap *c, uint64_t idx, uint16_t *dst, size_t n)
+{
+    /* Views come out in runs up to where their window wraps */
+    if (c->top) {
+        while (n) {
+            uint64_t p = top_idx(c, idx);
+            uint64_t run = top_run(c, idx);
+
+            if (run > n)
+                run = n;
+            cap_read_analog(c->top, p, dst, run);
+            dst += run;
+            idx += run;
+            n -= run;
+        }
+        return;
+    }
+
+    if (c->analog) {
+        memcpy(dst, c->analog + idx, n * sizeof(uint16_t));
+        return;
+    }
+
+    /* Packed samples unpack from the start of a pair */
+    if ((idx & 1) && n) {
+        *dst++ = cap_get_analog(c, idx++);
+        n--;
+    }
+    simd_unpack_u12(c->analog12 + (idx / 2) * 3, n, dst);
+}
+
+/* Function: cap_write_analog
+ *
+ * Copies n raw analog samples into a capture, starting at idx.  Unlike
+ * <cap_convert_analog>, this leaves the min/max alone.
+ */
+void cap_write_analog(struct cap *c, uint64_t idx, const uint16_t *src, size_t n)
+{
+    assert(NULL == c->top);
+    c->lod.valid = false;
+
+    if (c->analog12)
+        write_analog12(c, idx, src, n);
+    else
+        memcpy(c->analog + idx, src, n * sizeof(uint16_t));
+}
+
+/* Packs samples into a 12-bit capture; only whole pairs can be packed
+ * in bulk, so a stray sample on either end gets merged in by itself.
+ */
+static void write_analog12(struct cap *c, uint64_t idx, const uint16_t *src,
+    size_t n)
+{
+    size_t pairs;
+
+    if ((idx & 1) && n) {
+        cap_set_analog(c, idx++, *src++);
+        n--;
+    }
+
+    pairs = n & ~(size_t) 1;
+    simd_pack_u12(src, pairs, c->analog12 + (idx / 2) * 3);
+    if (n & 1)
+        cap_set_analog(c, idx + pairs, src[pairs]);
+}
+
+/* Returns n analog samples from idx of a top-level capture, straight
+ * out of its storage if they're 16 bits or unpacked into buf if not.
+ */
+static const uint16_t *analog_block(struct cap *c, uint64_t idx, size_t n,
+    uint16_t *buf)
+{
+    if (c->analog)
+        return c->analog + idx;
+
+    cap_read_analog(c, idx, buf, n);
+    return buf;
+}
+
+/* Sets the analog min/max when it's already known */
+void cap_set_analog_minmax(struct cap *c, uint16_t min, uint16_t max)
+{
+    c->analog_min = min;
+    c->analog_max = max;
 }
 
 uint8_t cap_get_digital(struct cap *c, uint64_t idx)
 {
-    return c->digital[idx];
+    if (c->top)
+        return cap_get_digital(c->top, top_idx(c, idx));
+
+    return (c->digital[idx / CAP_DIGITAL_WORD_BITS] >>
+        (idx % CAP_DIGITAL_WORD_BITS)) & 1;
 }
 
 void cap_set_digital(struct cap *c, uint64_t idx, uint8_t sample)
 {
-    c->digital[idx] = sample;
+    uint64_t bit = 1ULL << (idx % CAP_DIGITAL_WORD_BITS);
+
+    assert(NULL == c->top);
+    if (sample)
+        c->digital[idx / CAP_DIGITAL_WORD_BITS] |= bit;
+    else
+        c->digital[idx / CAP_DIGITAL_WORD_BITS] &= ~bit;
+
+    c->edges.valid = false;
+}
+
+/* Function: cap_get_digital_word
+ *
+ * Returns 64 digital samples at once, starting at sample widx * 64.
+ * The first sample is in bit 0.  Bits past the end of the capture
+ * are zero.
+ *
+ * See Also:
+ *  <cap_get_digital_nwords>
+ */
+uint64_t cap_get_digital_word(struct cap *c, uint64_t widx)
+{
+    uint64_t begin = widx * CAP_DIGITAL_WORD_BITS;
+    uint64_t n = c->nsamples - begin;
+    uint64_t word = 0;
+
+    if (NULL == c->top)
+        return c->digital[widx];
+
+    if (n > CAP_DIGITAL_WORD_BITS)
+        n = CAP_DIGITAL_WORD_BITS;
+
+    /* Stitched together from the top capture, wrapping if need be */
+    for (uint64_t got = 0; got < n; ) {
+        uint64_t p = top_idx(c, begin + got);
+        uint64_t run = top_run(c, begin + got);
+
+        if (run > n - got)
+            run = n - got;
+        word |= digital_bits(c->top, p, run) << got;
+        got += run;
+    }
+
+    return word;
+}
+
+/* Returns how many words <cap_get_digital_word> can return */
+uint64_t cap_get_digital_nwords(struct cap *c)
+{
+    return CAP_DIGITAL_NWORDS(c->nsamples);
+}
+
+/* Returns the sample word at idx of a packed capture */
+uint64_t cap_get_packed(struct cap *c, uint64_t idx)
+{
+    if (c->top)
+        return cap_get_packed(c->top, top_idx(c, idx));
+
+    switch (c->packed_width) {
+    case 1:
+        return ((uint8_t *) c->packed)[idx];
+    case 2:
+        return ((uint16_t *) c->packed)[idx];
+    case 4:
+        return ((uint32_t *) c->packed)[idx];
+    default:
+        return ((uint64_t *) c->packed)[idx];
+    }
+}
+
+uint8_t cap_get_packed_width(struct cap *c)
+{
+    return c->packed_width;
+}
+
+/* Function: cap_span_init
+ *
+ * Sets up a <cap_span> iterator over a range of a capture.
+ *
+ * Parameters:
+ *  s - iterator to set up
+ *  c - capture to walk
+ *  begin - first sample
+ *  end - one past the last sample; clamped to the end of the capture
+ *  what - CAP_GATHER_DIGITAL and/or CAP_GATHER_ANALOG
+ */
+void cap_span_init(struct cap_span *s, struct cap *c, uint64_t begin,
+    uint64_t end, unsigned what)
+{
+    s->cap = c;
+    s->end = (end > c->nsamples) ? c->nsamples : end;
+    s->pos = (begin > s->end) ? s->end : begin;
+    s->what = what;
+    s->idx = s->pos;
+    s->len = 0;
+    s->analog = NULL;
+    s->digital = NULL;
+}
+
+/* Function: cap_span_next
+ *
+ * Moves on to the next span.  A view's spans stop where its window
+ * wraps around, so they can point straight into the top capture.
+ *
+ * Returns:
+ *  Number of samples in the span, or zero once the range is done.
+ */
+size_t cap_span_next(struct cap_span *s)
+{
+    struct cap *c = s->cap;
+    size_t n = s->end - s->pos;
+
+    s->idx = s->pos;
+    s->len = 0;
+    if (0 == n)
+        return 0;
+
+    if (n > CAP_SPAN_LEN)
+        n = CAP_SPAN_LEN;
+
+    if (s->what & CAP_GATHER_ANALOG) {
+        if (c->top) {
+            uint64_t run = top_run(c, s->idx);
+
+            n = (n > run) ? run : n;
+            s->analog = analog_block(c->top, top_idx(c, s->idx), n, s->abuf);
+        } else {
+            s->analog = analog_block(c, s->idx, n, s->abuf);
+        }
+    }
+
+    if (s->what & CAP_GATHER_DIGITAL) {
+        for (size_t i = 0; i < n; i += CAP_DIGITAL_WORD_BITS) {
+            size_t m = (n - i < CAP_DIGITAL_WORD_BITS) ?
+                n - i : CAP_DIGITAL_WORD_BITS;
+            uint64_t x = digital_bits(c, s->idx + i, m);
+
+            for (size_t j = 0; j < m; j++)
+                s->dbuf[i + j] = (x >> j) & 1;
+        }
+        s->digital = s->dbuf;
+    }
+
+    s->len = n;
+    s->pos += n;
+    return n;
+}
+
+/* Copies n digital samples, starting at idx, out of a capture a byte
+ * per sample.
+ */
+void cap_read_digital(struct cap *c, uint64_t idx, uint8_t *dst, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = cap_get_digital(c, idx + i);
+    }
+}
+
+/* Copies n digital samples, a byte per sample, into a capture starting
+ * at idx.
+ */
+void cap_write_digital(struct cap *c, uint64_t idx, const uint8_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        cap_set_digital(c, idx + i, src[i]);
+    }
 }
 
 uint16_t cap_get_analog_min(struct cap *c)
@@ -440,6 +1550,8 @@ uint8_t cap_get_physical_ch(struct cap *c)
 void cap_set_physical_ch(struct cap *c, uint8_t ch)
 {
     c->physical_ch = ch;
+    if (c->bundle)
+        bundle_reindex(c->bundle);
 }
 
 float cap_get_period(struct cap *c)
@@ -452,25 +1564,283 @@ void cap_set_period(struct cap *c, float t)
     c->period = t;
 }
 
+/* Function: cap_bundle_add
+ *
+ * Adds a capture to the end of a bundle, which takes over the caller's
+ * reference to it.  A capture can only be in one bundle at a time.
+ */
 void cap_bundle_add(struct cap_bundle *b, struct cap *c)
 {
-    TAILQ_INSERT_TAIL(&b->head, c, entry);
-    b->len++;
+    assert(NULL == c->bundle);
+
+    if (b->len == b->alloc) {
+        b->alloc = b->alloc ? 2 * b->alloc : 8;
+        b->caps = realloc(b->caps, b->alloc * sizeof(struct cap *));
+    }
+
+    c->bundle = b;
+    c->bundle_idx = b->len;
+    b->caps[b->len++] = c;
+    if (NULL == b->by_ch[c->physical_ch])
+        b->by_ch[c->physical_ch] = c;
+}
+
+/* Function: cap_bundle_remove
+ *
+ * Takes a capture out of a bundle and drops the bundle's reference to
+ * it.  The captures after it move up a place.
+ */
+void cap_bundle_remove(struct cap_bundle *b, struct cap *c)
+{
+    if (c->bundle != b)
+        return;
+
+    memmove(b->caps + c->bundle_idx, b->caps + c->bundle_idx + 1,
+        (b->len - c->bundle_idx - 1) * sizeof(struct cap *));
+    b->len--;
+    c->bundle = NULL;
+    bundle_reindex(b);
+    cap_dropref(c);
+}
+
+/* Function: cap_bundle_get
+ *
+ * Returns:
+ *  The idx'th capture in a bundle, or NULL if there aren't that many.
+ */
+struct cap *cap_bundle_get(struct cap_bundle *b, unsigned idx)
+{
+    return (idx < b->len) ? b->caps[idx] : NULL;
+}
+
+/* Function: cap_bundle_get_ch
+ *
+ * Returns:
+ *  The first capture in a bundle of physical channel ch, or NULL if
+ *  there isn't one.
+ */
+struct cap *cap_bundle_get_ch(struct cap_bundle *b, unsigned ch)
+{
+    return (ch < CAP_BUNDLE_MAX_CH) ? b->by_ch[ch] : NULL;
 }
 
 struct cap *cap_bundle_first(struct cap_bundle *b)
 {
-    return TAILQ_FIRST(&b->head);
+    return cap_bundle_get(b, 0);
 }
 
 struct cap *cap_next(struct cap *c)
 {
-    return TAILQ_NEXT(c, entry);
+    return c->bundle ? cap_bundle_get(c->bundle, c->bundle_idx + 1) : NULL;
 }
 
 struct cap *cap_bundle_last(struct cap_bundle *b)
 {
-    return TAILQ_LAST(&b->head, cap_list);
+    return b->len ? b->caps[b->len - 1] : NULL;
+}
+
+/* Rebuilds the positions and channel table after the bundle changes */
+static void bundle_reindex(struct cap_bundle *b)
+{
+    memset(b->by_ch, 0, sizeof(b->by_ch));
+    for (unsigned i = b->len; i-- > 0; ) {
+        b->caps[i]->bundle_idx = i;
+        b->by_ch[b->caps[i]->physical_ch] = b->caps[i];
+    }
+}
+
+/* Function: cap_bundle_gather
+ *
+ * Lines up the same sample range of several channels for kernels that
+ * work across them, like a multi-channel decoder's.  Blocks point
+ * straight into the captures where they can, which is where a range
+ * starts on a word boundary (for digital samples) of a plain capture;
+ * anything else gets copied into 64-byte aligned scratch.  Either way,
+ * bits past the end of the range in the last digital word are zero.
+ *
+ * Parameters:
+ *  b - bundle to gather from
+ *  chs - physical channels to gather, in the order they're wanted
+ *  n - number of channels; up to CAP_GATHER_MAX
+ *  begin - first sample of the range
+ *  end - one past the last sample; clamped to the shortest channel
+ *  what - CAP_GATHER_DIGITAL and/or CAP_GATHER_ANALOG
+ *  g - filled in with the blocks; release with <cap_gather_release>
+ *
+ * Returns:
+ *  0 on success, -1 with errno set to EINVAL if there are too many
+ *  channels or one isn't in the bundle.
+ */
+int cap_bundle_gather(struct cap_bundle *b, const uint8_t *chs, unsigned n,
+    uint64_t begin, uint64_t end, unsigned what, struct cap_gather *g)
+{
+    struct cap *caps[CAP_GATHER_MAX];
+    bool copy_d[CAP_GATHER_MAX], copy_a[CAP_GATHER_MAX];
+    size_t dlen, alen, len = 0;
+    uint8_t *scratch;
+
+    memset(g, 0, sizeof(*g));
+    if (n > CAP_GATHER_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (unsigned i = 0; i < n; i++) {
+        caps[i] = cap_bundle_get_ch(b, chs[i]);
+        if (NULL == caps[i]) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (end > caps[i]->nsamples)
+            end = caps[i]->nsamples;
+    }
+    if (begin > end)
+        begin = end;
+
+    g->begin = begin;
+    g->nsamples = end - begin;
+    g->nwords = CAP_DIGITAL_NWORDS(g->nsamples);
+    g->n = n;
+
+    /* Work out what has to be copied, and how much room that takes */
+    dlen = (g->nwords * sizeof(uint64_t) + 63) & ~(size_t) 63;
+    alen = (g->nsamples * sizeof(uint16_t) + 63) & ~(size_t) 63;
+    for (unsigned i = 0; i < n; i++) {
+        struct cap *c = caps[i];
+
+        copy_d[i] = (what & CAP_GATHER_DIGITAL) && (c->top || !c->digital ||
+            (begin % CAP_DIGITAL_WORD_BITS) ||
+            ((end % CAP_DIGITAL_WORD_BITS) && (end != c->nsamples)));
+        copy_a[i] = (what & CAP_GATHER_ANALOG) && (c->top || !c->analog);
+        len += (copy_d[i] ? dlen : 0) + (copy_a[i] ? alen : 0);
+    }
+
+    scratch = len ? aligned_alloc(64, len) : NULL;
+    g->buf = scratch;
+
+    for (unsigned i = 0; i < n; i++) {
+        struct cap *c = caps[i];
+
+        if (copy_d[i]) {
+            uint64_t *words = (uint64_t *) scratch;
+
+            for (uint64_t w = 0; w < g->nwords; w++) {
+                uint64_t pos = w * CAP_DIGITAL_WORD_BITS;
+                uint64_t bits = g->nsamples - pos;
+
+                if (bits > CAP_DIGITAL_WORD_BITS)
+                    bits = CAP_DIGITAL_WORD_BITS;
+                words[w] = digital_bits(c, begin + pos, bits);
+            }
+            g->digital[i] = words;
+            scratch += dlen;
+        } else if (what & CAP_GATHER_DIGITAL) {
+            g->digital[i] = c->digital + begin / CAP_DIGITAL_WORD_BITS;
+        }
+
+        if (copy_a[i]) {
+            cap_read_analog(c, begin, (uint16_t *) scratch, g->nsamples);
+            g->analog[i] = (uint16_t *) scratch;
+            scratch += alen;
+        } else if (what & CAP_GATHER_ANALOG) {
+            g->analog[i] = c->analog + begin;
+        }
+    }
+
+    return 0;
+}
+
+/* Frees whatever scratch a gather needed. */
+void cap_gather_release(struct cap_gather *g)
+{
+    free(g->buf);
+    g->buf = NULL;
+}
+
+/* Function: cap_bundle_words_init
+ *
+ * Sets up a <cap_words> iterator over a range of a bundle's samples.
+ * Channels 0 to CAP_WORDS_MAX_CH - 1 go in the sample words; a channel
+ * the bundle doesn't have reads as zero.
+ *
+ * Parameters:
+ *  it - iterator to set up; release it with <cap_bundle_words_release>
+ *  b - bundle to walk
+ *  begin - first sample
+ *  end - one past the last sample; clamped to the shortest channel
+ */
+void cap_bundle_words_init(struct cap_words *it, struct cap_bundle *b,
+    uint64_t begin, uint64_t end)
+{
+    memset(it, 0, sizeof(*it));
+    it->bundle = cap_bundle_addref(b);
+    it->pos = begin;
+    it->end = end;
+    it->words = aligned_alloc(64, CAP_WORDS_BLOCK * sizeof(uint32_t));
+
+    for (unsigned ch = 0; ch < CAP_WORDS_MAX_CH; ch++) {
+        if (b->by_ch[ch])
+            it->chs[it->n++] = ch;
+    }
+
+    /* Nothing to bound the range by */
+    if (0 == it->n)
+        it->end = begin;
+}
+
+/* Function: cap_bundle_words_next
+ *
+ * Transposes the next block of samples into sample words.  Blocks after
+ * the first start on a multiple of CAP_WORDS_BLOCK, so they line up
+ * with the captures' words and get transposed in place.
+ *
+ * Parameters:
+ *  it - iterator
+ *  idx - set to the first sample of the block
+ *  n - set to the number of samples in the block
+ *
+ * Returns:
+ *  The block's sample words, good until the next call, or NULL once the
+ *  range is done.
+ */
+const uint32_t *cap_bundle_words_next(struct cap_words *it, uint64_t *idx,
+    uint64_t *n)
+{
+    const uint64_t *planes[CAP_WORDS_MAX_CH] = { NULL };
+    uint64_t stop = (it->pos / CAP_WORDS_BLOCK + 1) * CAP_WORDS_BLOCK;
+    struct cap_gather g;
+
+    if (it->pos >= it->end)
+        return NULL;
+
+    if (stop > it->end)
+        stop = it->end;
+    cap_bundle_gather(it->bundle, it->chs, it->n, it->pos, stop,
+        CAP_GATHER_DIGITAL, &g);
+    if (0 == g.nsamples) {
+        cap_gather_release(&g);
+        it->end = it->pos;
+        return NULL;
+    }
+
+    for (unsigned i = 0; i < it->n; i++)
+        planes[it->chs[i]] = g.digital[i];
+    simd_transpose_bits(planes, it->chs[it->n - 1] + 1, g.nwords, it->words);
+    cap_gather_release(&g);
+
+    *idx = it->pos;
+    *n = g.nsamples;
+    it->pos += g.nsamples;
+
+    return it->words;
+}
+
+void cap_bundle_words_release(struct cap_words *it)
+{
+    free(it->words);
+    it->words = NULL;
+    cap_bundle_dropref(it->bundle);
+    it->bundle = NULL;
 }
 
 adc_cal_t *cap_get_analog_cal(struct cap *c)
@@ -505,59 +1875,66 @@ void cap_set_note(struct cap *c, const char *s)
     strncpy(c->note, s, CAP_MAX_NOTE_LEN);
 }
 
-#if 0
 /* Function: cap_create_subcap
  *
- * Creates a subcapture, which is a structure containing a
- * slice of the samples in the parent structure.  It should be
- * treated identically to a normal capture structure and needs to
- * be dropref'd when done for garbage collection.
+ * Creates a subcapture, which is a view of a slice of the samples in
+ * the parent.  Nothing is copied; it shares the top-level capture's
+ * analog and digital samples and edge index, and holds a reference to
+ * its parent.  It should be treated identically to a normal capture
+ * structure, except that it's read-only, and needs to be dropref'd
+ * when done for garbage collection.
+ *
+ * Parameters:
+ *  src - capture to take a slice of
+ *  begin - first sample of the slice, relative to src
+ *  end - one past the last sample; clamped to the end of src
+ *
+ * Returns:
+ *  pointer to the new subcapture with refcnt = 1.
  */
 cap_t *cap_create_subcap(struct cap *src, int64_t begin, int64_t end)
 {
-    struct cap *dst, *top;
-    int64_t abs_begin = begin + src->offset;
-    int64_t abs_end = end + src->offset;
-
-    if (abs_begin < 0)
-        abs_begin = 0;
-
-    top = cap_get_top(src);
-
-    if (abs_end >= top->nsamples)
-        abs_end = top->nsamples - 1;
+    struct cap *dst;
 
-    dst = cap_create(src->nsamples);
+    if (begin < 0)
+        begin = 0;
+    if ((end < 0) || ((uint64_t) end > src->nsamples))
+        end = src->nsamples;
+    if (begin > end)
+        begin = end;
 
-    /* Subcaptures get an offset pointer into the top-level captures's
-     * data but they report their own sample lengths.
+    /* Note that we don't update the min/max on a subcap; it should
+     * be the same as the parent!
      */
-    if (src->analog) {
-        dst->analog = top->analog + (abs_begin * sizeof(uint16_t));
-
-        /* Note that we don't update the min/max
-         * on a subcap; it should be the same as the parent!
-         */
-        dst->analog_min = src->analog_min;
-        dst->analog_max = src->analog_max;
-        dst->analog_cal = src->analog_cal;
-    }
-
-    if (src->digital) {
-        dst->digital = top->digital + abs_begin;
-    }
+    dst = cap_create_view(src);
+    dst->nsamples = end - begin;
+    if (dst->loop_len)
+        dst->loop_skew = (dst->loop_skew + begin) % dst->loop_len;
 
     /* Copy the rest of the capture structure data */
     dst->parent = cap_addref(src);
     cap_set_note(dst, cap_get_note(src));
-    dst->physical_ch = src->physical_ch;
-    dst->period = src->period;
-    dst->offset = abs_begin;
+    dst->offset = src->offset + begin;
 
     return dst;
 }
 
+/* Function: cap_get_parent
+ *
+ * Returns:
+ *  The capture a subcapture was sliced from, or NULL for a top-level
+ *  capture.
+ */
+cap_t *cap_get_parent(struct cap *c)
+{
+    return c->parent;
+}
 
+/* Function: cap_get_nparents
+ *
+ * Returns:
+ *  How many subcaptures deep c is; zero for a top-level capture.
+ */
 int cap_get_nparents(struct cap *c)
 {
     struct cap *top = c;
@@ -569,35 +1946,374 @@ int cap_get_nparents(struct cap *c)
     }
     return nparents;
 }
-#endif
 
+/* Function: cap_get_top
+ *
+ * Returns:
+ *  The top-level capture a subcapture was ultimately sliced from, or
+ *  c itself if it isn't a subcapture.
+ */
+cap_t *cap_get_top(struct cap *c)
+{
+    while (NULL != c->parent)
+        c = c->parent;
+
+    return c;
+}
+
+/* Function: cap_next_edge
+ *
+ * Finds where the view reticle should land on the next digital edge
+ * after sample from; that's one past the second sample that differs
+ * from the level at from.  Looked up in the edge index.
+ *
+ * Returns:
+ *  Index of the edge, or the number of samples if there isn't one.
+ */
 uint64_t cap_next_edge(struct cap *c, uint64_t from)
 {
-    uint64_t next = from + 1;
+    uint64_t k, first, second, count;
+
+    if (from + 1 >= c->nsamples)
+        return c->nsamples;
+
+    count = cap_get_nedges(c);
+    k = edge_rank(c, from + 1);
+    if (k >= count)
+        return c->nsamples;
+
+    /* The sample after the edge is the second one off the level at
+     * from, unless the level flips straight back.
+     */
+    first = edge_at(c, k);
+    if (first + 1 >= c->nsamples)
+        return c->nsamples;
+
+    second = first + 1;
+    if ((k + 1 < count) && (edge_at(c, k + 1) == second)) {
+        if (k + 2 >= count)
+            return c->nsamples;
+        second = edge_at(c, k + 2);
+    }
+
+    return second + 1;
+}
+
+/* Function: cap_prev_edge
+ *
+ * Finds the last sample before from - 1 that differs from the level
+ * at from.  Looked up in the edge index.
+ *
+ * Returns:
+ *  Index of the edge, or zero if there isn't one.
+ */
+uint64_t cap_prev_edge(struct cap *c, uint64_t from)
+{
+    uint64_t p = from - 2;
+    uint64_t k;
+
+    if (from < 2)
+        return 0;
+
+    if (cap_get_digital(c, p) != cap_get_digital(c, from))
+        return p;
+
+    /* Otherwise it's the sample just before the last edge up to p */
+    k = edge_rank(c, p + 1);
+    return k ? edge_at(c, k - 1) - 1 : 0;
+}
+
+/* Function: cap_index_edges
+ *
+ * Brings a capture's edge index up to date with its digital samples.
+ * The ADC builds it when it's done, and changing digital samples any
+ * other way leaves it to be rebuilt by the next edge lookup; call this first
+ * if lookups are going to happen from more than one thread.  Looped
+ * captures use their source's index.
+ */
+void cap_index_edges(struct cap *c)
+{
+    uint64_t prev = 0;
+
+    if (c->top)
+        c = c->top;
+
+    if (c->edges.valid)
+        return;
+
+    edges_reset(&c->edges);
+    for (uint64_t w = 0; c->digital && w < CAP_DIGITAL_NWORDS(c->nsamples); w++) {
+        uint64_t base = w * CAP_DIGITAL_WORD_BITS;
+        uint64_t n = c->nsamples - base;
+        uint64_t word = c->digital[w];
 
-    for (int i = 0; i < 2 && next < c->nsamples; next++) {
-        if (c->digital[from] != c->digital[next]) {
-            i++;
+        if (n > CAP_DIGITAL_WORD_BITS)
+            n = CAP_DIGITAL_WORD_BITS;
+
+        edges_add_word(&c->edges, base, word, w ? prev : (word & 1), n);
+        prev = (word >> (n - 1)) & 1;
+    }
+    c->edges.valid = true;
+}
+
+/* Returns how many digital edges a capture has */
+uint64_t cap_get_nedges(struct cap *c)
+{
+    if (c->top)
+        return edge_rank(c, c->nsamples);
+
+    return get_edges(c)->count;
+}
+
+/* Function: cap_get_edge
+ *
+ * Returns the sample index of the n'th digital edge (from zero), or the
+ * number of samples if there aren't that many.
+ */
+uint64_t cap_get_edge(struct cap *c, uint64_t n)
+{
+    return (n < cap_get_nedges(c)) ? edge_at(c, n) : c->nsamples;
+}
+
+/* Function: cap_count_edges
+ *
+ * Returns the number of digital edges at samples [begin, end).
+ */
+uint64_t cap_count_edges(struct cap *c, uint64_t begin, uint64_t end)
+{
+    if (begin >= end)
+        return 0;
+
+    return edge_rank(c, end) - edge_rank(c, begin);
+}
+
+/* Function: cap_get_edges
+ *
+ * Copies out the sample indices of the digital edges at samples
+ * [begin, end), up to max of them.
+ *
+ * Returns:
+ *  Number of edges copied.
+ */
+size_t cap_get_edges(struct cap *c, uint64_t begin, uint64_t end,
+    uint64_t *dst, size_t max)
+{
+    uint64_t count = cap_get_nedges(c);
+    uint64_t k = edge_rank(c, begin);
+    size_t n = 0;
+
+    for (; (n < max) && (k < count); k++, n++) {
+        uint64_t idx = edge_at(c, k);
+        if (idx >= end)
+            break;
+        dst[n] = idx;
+    }
+
+    return n;
+}
+
+static void edges_reset(struct edge_index *e)
+{
+    free(e->gaps);
+    free(e->blocks);
+    memset(e, 0, sizeof(struct edge_index));
+}
+
+static void edges_append(struct edge_index *e, uint64_t idx)
+{
+    if (0 == (e->count % CAP_EDGE_BLOCK)) {
+        size_t b = e->count / CAP_EDGE_BLOCK;
+
+        if (b == e->nblocks_alloc) {
+            e->nblocks_alloc = e->nblocks_alloc ? 2 * e->nblocks_alloc : 16;
+            e->blocks = realloc(e->blocks,
+                e->nblocks_alloc * sizeof(struct edge_block));
+        }
+        e->blocks[b] = (struct edge_block) { idx, e->len };
+    } else {
+        uint64_t gap = idx - e->last;
+
+        /* Room for the longest varint */
+        if (e->alloc - e->len < 10) {
+            e->alloc = e->alloc ? 2 * e->alloc : 256;
+            e->gaps = realloc(e->gaps, e->alloc);
+        }
+
+        while (gap >= 0x80) {
+            e->gaps[e->len++] = gap | 0x80;
+            gap >>= 7;
         }
+        e->gaps[e->len++] = gap;
     }
 
-    if (next > c->nsamples)
-        next = c->nsamples;
+    e->last = idx;
+    e->count++;
+}
+
+/* Adds the edges in a word of n digital samples starting at sample
+ * base; prev is the level of the sample before it.
+ */
+static void edges_add_word(struct edge_index *e, uint64_t base, uint64_t word,
+    uint64_t prev, unsigned n)
+{
+    uint64_t x = word ^ ((word << 1) | prev);
+
+    if (n < CAP_DIGITAL_WORD_BITS)
+        x &= (1ULL << n) - 1;
 
-    return next;
+    while (x) {
+        edges_append(e, base + __builtin_ctzll(x));
+        x &= x - 1;
+    }
 }
 
-uint64_t cap_prev_edge(struct cap *c, uint64_t from)
+static struct edge_index *get_edges(struct cap *c)
+{
+    cap_index_edges(c);
+    return &c->edges;
+}
+
+/* Returns the number of edges before sample idx of any capture. */
+static uint64_t edge_rank(struct cap *c, uint64_t idx)
+{
+    uint64_t s;
+
+    if (NULL == c->top)
+        return edges_rank(get_edges(c), idx);
+
+    /* Sample v of a view is sample v + skew of its window unrolled;
+     * the first sample can't be an edge.
+     */
+    if (idx > c->nsamples)
+        idx = c->nsamples;
+    if (idx <= 1)
+        return 0;
+
+    s = c->loop_skew;
+    return window_edges_before(c, idx + s) - window_edges_before(c, 1 + s);
+}
+
+/* Returns whether a view's window has an edge where it wraps around */
+static bool window_wraps(struct cap *c)
+{
+    return cap_get_digital(c->top, c->top_begin) !=
+        cap_get_digital(c->top, c->top_begin + c->loop_len - 1);
+}
+
+/* Returns the sample index of edge k of any capture; it must exist. */
+static uint64_t edge_at(struct cap *c, uint64_t k)
 {
-    int64_t prev;
+    struct edge_index *e;
+    uint64_t first, target, per_loop, wrap, r, p;
+
+    if (NULL == c->top)
+        return edges_get(get_edges(c), k);
+
+    /* Find the edge in the unrolled window, then map it back */
+    e = get_edges(c->top);
+    first = edges_rank(e, c->top_begin + 1);
+    wrap = window_wraps(c);
+    per_loop = edges_rank(e, c->top_begin + c->loop_len) - first + wrap;
+    target = k + window_edges_before(c, 1 + c->loop_skew);
+    r = target % per_loop;
+
+    if (wrap)
+        p = r ? edges_get(e, first + r - 1) - c->top_begin : 0;
+    else
+        p = edges_get(e, first + r) - c->top_begin;
+
+    return (target / per_loop) * c->loop_len + p - c->loop_skew;
+}
 
-    for (prev = from - 2; prev > 0; prev--) {
-        if (c->digital[from] != c->digital[prev])
+/* Returns the number of edges before position q of a view's window
+ * repeated end to end forever, counting where it wraps around if the
+ * levels differ there.
+ */
+static uint64_t window_edges_before(struct cap *c, uint64_t q)
+{
+    struct edge_index *e = get_edges(c->top);
+    uint64_t first = edges_rank(e, c->top_begin + 1);
+    uint64_t wrap = window_wraps(c);
+    uint64_t per_loop = edges_rank(e, c->top_begin + c->loop_len) - first + wrap;
+    uint64_t r = q % c->loop_len;
+
+    if (0 == r)
+        return (q / c->loop_len) * per_loop;
+
+    return (q / c->loop_len) * per_loop + wrap +
+        edges_rank(e, c->top_begin + r) - first;
+}
+
+/* Returns n (up to 64) digital samples of a capture starting at p. */
+static uint64_t digital_bits(struct cap *c, uint64_t p, uint64_t n)
+{
+    uint64_t w = p / CAP_DIGITAL_WORD_BITS;
+    unsigned bit = p % CAP_DIGITAL_WORD_BITS;
+    uint64_t x = cap_get_digital_word(c, w) >> bit;
+
+    if (bit && (bit + n > CAP_DIGITAL_WORD_BITS))
+        x |= cap_get_digital_word(c, w + 1) << (CAP_DIGITAL_WORD_BITS - bit);
+
+    return (n < CAP_DIGITAL_WORD_BITS) ? x & ((1ULL << n) - 1) : x;
+}
+
+static uint64_t read_gap(const uint8_t **p)
+{
+    uint64_t gap = 0;
+    unsigned shift = 0;
+    uint8_t byte;
+
+    do {
+        byte = *(*p)++;
+        gap |= (uint64_t) (byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    return gap;
+}
+
+/* Returns the number of edges before sample idx. */
+static uint64_t edges_rank(struct edge_index *e, uint64_t idx)
+{
+    size_t lo = 0, hi = (e->count + CAP_EDGE_BLOCK - 1) / CAP_EDGE_BLOCK;
+    const uint8_t *p;
+    uint64_t k, cur;
+
+    /* Find the last block that starts before idx */
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (e->blocks[mid].idx < idx)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (0 == lo)
+        return 0;
+
+    /* ...then walk its gaps; the next block starts at or past idx. */
+    k = (lo - 1) * CAP_EDGE_BLOCK;
+    cur = e->blocks[lo - 1].idx;
+    p = e->gaps + e->blocks[lo - 1].off;
+    for (k++; (k < e->count) && (k % CAP_EDGE_BLOCK); k++) {
+        cur += read_gap(&p);
+        if (cur >= idx)
             break;
     }
 
-    if (prev < 0)
-        prev = 0;
+    return k;
+}
+
+/* Returns the sample index of edge k, which must exist. */
+static uint64_t edges_get(struct edge_index *e, uint64_t k)
+{
+    const struct edge_block *b = &e->blocks[k / CAP_EDGE_BLOCK];
+    const uint8_t *p = e->gaps + b->off;
+    uint64_t idx = b->idx;
+
+    for (unsigned i = 0; i < k % CAP_EDGE_BLOCK; i++) {
+        idx += read_gap(&p);
+    }
 
-    return prev;
+    return idx;
 }
@@ -23,6 +23,7 @@
 #ifndef _CAP_H_
 #define _CAP_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -35,10 +36,117 @@ extern "C" {
 typedef struct cap cap_t;
 typedef struct cap_bundle cap_bundle_t;
 
+/* Physical channels a bundle can index, and channels per gather */
+#define CAP_BUNDLE_MAX_CH 256
+#define CAP_GATHER_MAX 32
+
+enum cap_gather_flags {
+    CAP_GATHER_DIGITAL = 0x1,
+    CAP_GATHER_ANALOG = 0x2
+};
+
+/* Struct: cap_gather
+ *
+ * The same sample range of several channels, lined up for kernels that
+ * work across channels.
+ *
+ * Fields:
+ *  begin - first sample of the range
+ *  nsamples - samples in the range
+ *  nwords - digital words per channel
+ *  n - number of channels
+ *  digital - per channel, nwords words of digital samples, with the
+ *            first sample of the range in bit 0 of the first word.
+ *  analog - per channel, nsamples raw analog samples
+ *  buf - scratch the blocks that had to be copied live in
+ */
+struct cap_gather {
+    uint64_t begin;
+    uint64_t nsamples;
+    uint64_t nwords;
+    unsigned n;
+    const uint64_t *digital[CAP_GATHER_MAX];
+    const uint16_t *analog[CAP_GATHER_MAX];
+    void *buf;
+};
+
+/* Most samples in a span from a <cap_span> iterator */
+#define CAP_SPAN_LEN 4096
+
+/* Struct: cap_span
+ *
+ * Walks a range of a capture's samples as contiguous spans, so a loop
+ * over them is a plain loop over arrays that the compiler can inline
+ * and vectorize, rather than a call per sample.  Analog spans point
+ * straight into the capture when it stores them 16 bits apiece;
+ * anything else is copied into the iterator's own buffers.
+ *
+ * Fields:
+ *  cap - capture being walked
+ *  pos - first sample of the next span
+ *  end - one past the last sample
+ *  what - CAP_GATHER_DIGITAL and/or CAP_GATHER_ANALOG
+ *  idx - first sample of the current span
+ *  len - samples in the current span
+ *  analog - the current span's analog samples
+ *  digital - the current span's digital samples, a byte (0 or 1) each
+ */
+struct cap_span {
+    cap_t *cap;
+    uint64_t pos;
+    uint64_t end;
+    unsigned what;
+    uint64_t idx;
+    size_t len;
+    const uint16_t *analog;
+    const uint8_t *digital;
+    uint16_t abuf[CAP_SPAN_LEN];
+    uint8_t dbuf[CAP_SPAN_LEN];
+};
+
+/* Bins in an analog histogram, one per 12-bit sample value */
+#define CAP_HIST_BINS 4096
+
+/* Channels that fit in a sample word, and sample words per block */
+#define CAP_WORDS_MAX_CH 32
+#define CAP_WORDS_BLOCK 4096
+
+/* Struct: cap_words
+ *
+ * Walks a bundle's samples a block at a time as sample words, with bit
+ * k of each holding physical channel k, the way a logic analyzer that
+ * samples every channel at once hands them over.  That's what the
+ * stream decoders take, so multi-channel protocols can be run on
+ * captures imported a channel at a time.
+ *
+ * Fields:
+ *  bundle - bundle being walked
+ *  pos - first sample of the next block
+ *  end - one past the last sample
+ *  chs - physical channels in the sample words
+ *  n - number of channels
+ *  words - the current block
+ */
+struct cap_words {
+    cap_bundle_t *bundle;
+    uint64_t pos;
+    uint64_t end;
+    uint8_t chs[CAP_WORDS_MAX_CH];
+    unsigned n;
+    uint32_t *words;
+};
+
 #include "adc.h"
+#include "file_utils.h"
 
 uint64_t cap_next_edge(cap_t *c, uint64_t from);
 uint64_t cap_prev_edge(cap_t *c, uint64_t from);
+void cap_index_edges(cap_t *c);
+uint64_t cap_get_nedges(cap_t *c);
+uint64_t cap_get_edge(cap_t *c, uint64_t n);
+uint64_t cap_count_edges(cap_t *c, uint64_t begin, uint64_t end);
+size_t cap_get_edges(cap_t *c, uint64_t begin, uint64_t end,
+    uint64_t *dst, size_t max);
 void cap_clone_to_bundle(cap_bundle_t *bun, cap_t *src, unsigned nloops, unsigned skew_us);
 cap_t *cap_create_subcap(cap_t *c, int64_t begin, int64_t end);
 cap_t *cap_get_parent(cap_t *cap);
@@ -46,11 +154,21 @@ int cap_get_nparents(cap_t *c);
 cap_t *cap_get_top(cap_t *c);
 
 void cap_update_analog_minmax(cap_t *c);
+void cap_index_analog(cap_t *c);
+void cap_get_analog_range(cap_t *c, uint64_t begin, uint64_t end,
+    uint16_t *min, uint16_t *max);
+void cap_get_analog_envelope(cap_t *c, uint64_t begin, uint64_t end,
+    size_t n, uint16_t *min, uint16_t *max);
 void cap_analog_adc(cap_t *c, uint16_t v_lo, uint16_t v_hi);
 void cap_analog_adc_ttl(cap_t *c);
+void cap_analog_adc_auto(cap_t *c);
+void cap_analog_histogram(cap_t *c, uint64_t *hist);
+int cap_analog_auto_thresholds(cap_t *c, uint16_t *v_lo, uint16_t *v_hi);
+void cap_get_adc_thresholds(cap_t *c, uint16_t *v_lo, uint16_t *v_hi);
 
 /* Capture lifecycle functions */
 cap_t *cap_create(size_t len);
+cap_t *cap_create_analog12(size_t len);
 cap_t *cap_addref(cap_t *c);
 void cap_dropref(cap_t *c);
 unsigned cap_nref(cap_t *c);
@@ -71,6 +189,14 @@ void cap_set_physical_ch(cap_t *c, uint8_t ch);
 
 uint16_t cap_get_analog(cap_t *c, uint64_t idx);
 void cap_set_analog(cap_t *c, uint64_t idx, uint16_t sample);
+void cap_convert_analog(cap_t *c, uint64_t idx, const float *src, size_t n);
+void cap_span_init(struct cap_span *s, cap_t *c, uint64_t begin,
+    uint64_t end, unsigned what);
+size_t cap_span_next(struct cap_span *s);
+void cap_read_analog(cap_t *c, uint64_t idx, uint16_t *dst, size_t n);
+void cap_write_analog(cap_t *c, uint64_t idx, const uint16_t *src, size_t n);
+void cap_set_analog_minmax(cap_t *c, uint16_t min, uint16_t max);
+uint8_t cap_get_analog_bits(cap_t *c);
 uint16_t cap_get_analog_min(cap_t *c);
 float cap_get_analog_vmin(struct cap *c);
 uint16_t cap_get_analog_max(cap_t *c);
@@ -81,6 +207,15 @@ adc_cal_t *cap_get_analog_cal(cap_t *c);
 
 uint8_t cap_get_digital(cap_t *c, uint64_t idx);
 void cap_set_digital(cap_t *c, uint64_t idx, uint8_t sample);
+void cap_read_digital(cap_t *c, uint64_t idx, uint8_t *dst, size_t n);
+void cap_write_digital(cap_t *c, uint64_t idx, const uint8_t *src, size_t n);
+uint64_t cap_get_digital_word(cap_t *c, uint64_t widx);
+uint64_t cap_get_digital_nwords(cap_t *c);
+
+/* Multi-channel digital captures, kept as the analyzer's sample words */
+cap_t *cap_create_packed(void *words, size_t len, uint8_t width, file_map_t *map);
+uint64_t cap_get_packed(cap_t *c, uint64_t idx);
+uint8_t cap_get_packed_width(cap_t *c);
 
 /* Bundle lifecycle functions */
 cap_bundle_t *cap_bundle_create(void);
@@ -91,8 +226,19 @@ unsigned cap_bundle_nref(cap_bundle_t *b);
 void cap_bundle_add(cap_bundle_t *b, cap_t *c);
 void cap_bundle_remove(cap_bundle_t *b, cap_t *c);
 cap_t *cap_bundle_get(cap_bundle_t *b, unsigned idx);
+cap_t *cap_bundle_get_ch(cap_bundle_t *b, unsigned ch);
 unsigned cap_bundle_len(cap_bundle_t *b);
 
+int cap_bundle_gather(cap_bundle_t *b, const uint8_t *chs, unsigned n,
+    uint64_t begin, uint64_t end, unsigned what, struct cap_gather *g);
+void cap_gather_release(struct cap_gather *g);
+
+void cap_bundle_words_init(struct cap_words *it, cap_bundle_t *b,
+    uint64_t begin, uint64_t end);
+const uint32_t *cap_bundle_words_next(struct cap_words *it, uint64_t *idx,
+    uint64_t *n);
+void cap_bundle_words_release(struct cap_words *it);
+
 cap_t *cap_bundle_first(cap_bundle_t *b);
 cap_t *cap_next(cap_t *c);
 cap_t *cap_bundle_last(cap_bundle_t *b);
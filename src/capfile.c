@@ -0,0 +1,732 @@
+/* File: capfile.c
+ *
+ * Native pav capture files.  Importing a Saleae export means walking
+ * every float in it; a pav capture file stores the processed capture
+ * so it can be loaded back with next to no work.
+ *
+ * Each channel is stored as a column of fixed-size chunks.  A chunk
+ * holds its analog samples (packed 12 bits apiece when they all fit,
+ * 16 bits otherwise) followed by its digital samples packed a bit
+ * apiece, and can optionally be deflated.  The chunk index lives in a
+ * footer with each chunk's min/max and edge count, and the very end of
+ * the file says where the footer starts.  That means any chunk can be
+ * found and read on its own, straight out of a mapping of the file:
+ *
+ *  header - magic and version
+ *  chunks - channel 0's chunks, then channel 1's, ...
+ *  footer - capture info, channel info, then the chunk index
+ *  trailer - offset of the footer
+ *
+ * Author: Jack Bradach <jack@bradach.net>
+ *
+ * Copyright (C) 2016 Jack Bradach <jack@bradach.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "adc.h"
+#include "cap.h"
+#include "capfile.h"
+#include "file_utils.h"
+#include "simd.h"
+
+#define CAPFILE_MAGIC "PAVCAP\r\n"
+#define CAPFILE_TRAILER_MAGIC "PAVCAPIX"
+#define CAPFILE_MAGIC_LEN 8
+#define CAPFILE_VERSION 1
+
+/* Chunks encoded (and written out) at a time, per channel */
+#define CAPFILE_BATCH 64
+
+/* Chunk codec flags */
+#define CHUNK_PACKED12 0x1
+#define CHUNK_DEFLATE 0x2
+
+/* Largest sample that fits in a 12-bit chunk */
+#define PACKED12_MAX 0xfff
+
+struct __attribute__((__packed__)) capfile_header {
+    char magic[CAPFILE_MAGIC_LEN];
+    uint32_t version;
+    uint32_t flags;
+};
+
+struct __attribute__((__packed__)) capfile_footer {
+    uint32_t nchannels;
+    uint32_t chunk_len;
+    uint32_t nchunks;
+    uint32_t reserved;
+};
+
+/* Struct: capfile_channel
+ *
+ * Footer record for a channel.
+ *
+ * Fields:
+ *  nsamples - samples in the channel
+ *  offset - the capture's sample offset
+ *  period - sample period, in seconds
+ *  vmin - calibrated voltage of the lowest sample, if has_cal
+ *  vmax - calibrated voltage of the highest sample, if has_cal
+ *  physical_ch - analyzer channel
+ *  has_cal - whether the capture had a calibration
+ *  first_chunk - index entry of the channel's first chunk
+ *  note - capture note
+ */
+struct __attribute__((__packed__)) capfile_channel {
+    uint64_t nsamples;
+    uint64_t offset;
+    double period;
+    float vmin;
+    float vmax;
+    uint8_t physical_ch;
+    uint8_t has_cal;
+    uint16_t reserved;
+    uint32_t first_chunk;
+    char note[64];
+};
+
+/* Struct: capfile_chunk
+ *
+ * Index entry for a chunk.
+ *
+ * Fields:
+ *  offset - where the chunk's data starts in the file
+ *  len - length of the chunk's data as stored
+ *  min - smallest analog sample
+ *  max - largest analog sample
+ *  nedges - digital edges leading into or inside the chunk
+ *  codec - CHUNK_* flags for how it's stored
+ */
+struct __attribute__((__packed__)) capfile_chunk {
+    uint64_t offset;
+    uint32_t len;
+    uint16_t min;
+    uint16_t max;
+    uint32_t nedges;
+    uint8_t codec;
+    uint8_t reserved[3];
+};
+
+struct __attribute__((__packed__)) capfile_trailer {
+    uint64_t footer;
+    char magic[CAPFILE_MAGIC_LEN];
+};
+
+struct capfile {
+    file_map_t *map;
+    const uint8_t *data;
+    size_t len;
+    struct capfile_footer footer;
+    const struct capfile_channel *channels;
+    const struct capfile_chunk *chunks;
+};
+
+static uint8_t *encode_chunk(cap_t *cap, uint64_t begin, uint32_t n,
+    bool compress, struct capfile_chunk *entry);
+static const struct capfile_chunk *get_chunk(capfile_t *cf, unsigned ch,
+    uint32_t chunk);
+static uint32_t chunk_nsamples(capfile_t *cf, unsigned ch, uint32_t chunk);
+static void pack_bits(const uint8_t *src, uint32_t n, uint8_t *dst);
+static void unpack_bits(const uint8_t *src, uint32_t n, uint8_t *dst);
+
+static inline uint32_t count_chunks(uint64_t nsamples, uint32_t chunk_len)
+{
+    return (nsamples + chunk_len - 1) / chunk_len;
+}
+
+static inline size_t analog_len(uint32_t n, uint8_t codec)
+{
+    return (codec & CHUNK_PACKED12) ? (3 * (size_t) n + 1) / 2 :
+        n * sizeof(uint16_t);
+}
+
+static inline size_t digital_len(uint32_t n)
+{
+    return (n + 7) / 8;
+}
+
+/* Function: capfile_export
+ *
+ * Writes a bundle out as a pav capture file.  Chunks are encoded in
+ * parallel and written in order, so fp can be a pipe.
+ *
+ * Parameters:
+ *  fp - file to write to
+ *  bun - captures to write, one channel each
+ *  opts - chunk size and compression; NULL for the defaults.
+ *
+ * Returns:
+ *  0 on success, -1 on failure with errno set.
+ */
+int capfile_export(FILE *fp, cap_bundle_t *bun, const struct capfile_opts *opts)
+{
+    const struct capfile_opts defaults = { 0 };
+    struct capfile_header hdr = { .version = CAPFILE_VERSION };
+    struct capfile_footer footer = { 0 };
+    struct capfile_trailer trailer;
+    struct capfile_channel *channels;
+    struct capfile_chunk *chunks;
+    uint64_t pos;
+    unsigned ch;
+    cap_t *cap;
+    int rc = 0;
+
+    if (NULL == fp || NULL == bun || 0 == cap_bundle_len(bun)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (NULL == opts)
+        opts = &defaults;
+
+    footer.nchannels = cap_bundle_len(bun);
+    footer.chunk_len = opts->chunk_len ? opts->chunk_len :
+        CAPFILE_DEFAULT_CHUNK_LEN;
+
+    /* Lay out the index up front; it gets filled in as chunks go out */
+    channels = calloc(footer.nchannels, sizeof(struct capfile_channel));
+    for (cap = cap_bundle_first(bun), ch = 0; cap; cap = cap_next(cap), ch++) {
+        struct capfile_channel *c = &channels[ch];
+        adc_cal_t *cal = cap_get_analog_cal(cap);
+
+        c->nsamples = cap_get_nsamples(cap);
+        c->offset = cap_get_offset(cap);
+        c->period = cap_get_period(cap);
+        c->physical_ch = cap_get_physical_ch(cap);
+        c->first_chunk = footer.nchunks;
+        strncpy(c->note, cap_get_note(cap), sizeof(c->note) - 1);
+        if (cal) {
+            c->has_cal = 1;
+            c->vmin = adc_cal_get_vmin(cal);
+            c->vmax = adc_cal_get_vmax(cal);
+        }
+        footer.nchunks += count_chunks(c->nsamples, footer.chunk_len);
+
+        /* Chunks are encoded on several threads, which share this */
+        cap_index_edges(cap);
+    }
+    chunks = calloc(footer.nchunks, sizeof(struct capfile_chunk));
+
+    memcpy(hdr.magic, CAPFILE_MAGIC, CAPFILE_MAGIC_LEN);
+    if (1 != fwrite(&hdr, sizeof(struct capfile_header), 1, fp)) {
+        rc = -1;
+        goto out;
+    }
+    pos = sizeof(struct capfile_header);
+
+    for (cap = cap_bundle_first(bun), ch = 0; cap; cap = cap_next(cap), ch++) {
+        struct capfile_chunk *entries = &chunks[channels[ch].first_chunk];
+        uint64_t nsamples = channels[ch].nsamples;
+        uint32_t nchunks = count_chunks(nsamples, footer.chunk_len);
+
+        for (uint32_t batch = 0; batch < nchunks; batch += CAPFILE_BATCH) {
+            uint8_t *data[CAPFILE_BATCH];
+            uint32_t nbatch = nchunks - batch;
+
+            if (nbatch > CAPFILE_BATCH)
+                nbatch = CAPFILE_BATCH;
+
+            #pragma omp parallel for schedule(dynamic)
+            for (uint32_t i = 0; i < nbatch; i++) {
+                uint64_t begin = (uint64_t) (batch + i) * footer.chunk_len;
+                uint64_t n = nsamples - begin;
+
+                if (n > footer.chunk_len)
+                    n = footer.chunk_len;
+
+                data[i] = encode_chunk(cap, begin, n, opts->compress,
+                    &entries[batch + i]);
+            }
+
+            for (uint32_t i = 0; i < nbatch; i++) {
+                struct capfile_chunk *e = &entries[batch + i];
+
+                e->offset = pos;
+                pos += e->len;
+                if (!rc && 1 != fwrite(data[i], e->len, 1, fp))
+                    rc = -1;
+                free(data[i]);
+            }
+
+            if (rc)
+                goto out;
+        }
+    }
+
+    trailer.footer = pos;
+    memcpy(trailer.magic, CAPFILE_TRAILER_MAGIC, CAPFILE_MAGIC_LEN);
+    if ((1 != fwrite(&footer, sizeof(struct capfile_footer), 1, fp)) ||
+            (footer.nchannels != fwrite(channels,
+                sizeof(struct capfile_channel), footer.nchannels, fp)) ||
+            (footer.nchunks != fwrite(chunks,
+                sizeof(struct capfile_chunk), footer.nchunks, fp)) ||
+            (1 != fwrite(&trailer, sizeof(struct capfile_trailer), 1, fp)) ||
+            fflush(fp)) {
+        rc = -1;
+    }
+
+out:
+    free(channels);
+    free(chunks);
+    if (rc)
+        errno = EIO;
+    return rc;
+}
+
+/* Function: capfile_detect
+ *
+ * Checks whether a file is a pav capture file, without moving its
+ * file position.
+ */
+bool capfile_detect(FILE *fp)
+{
+    char magic[CAPFILE_MAGIC_LEN];
+
+    if (NULL == fp)
+        return false;
+
+    if (sizeof(magic) != pread(fileno(fp), magic, sizeof(magic), 0))
+        return false;
+
+    return 0 == memcmp(magic, CAPFILE_MAGIC, CAPFILE_MAGIC_LEN);
+}
+
+/* Function: capfile_open
+ *
+ * Maps a pav capture file and checks its index.  Nothing but the
+ * index is touched until chunks are asked for.
+ *
+ * Parameters:
+ *  fp - the capture file; it can be closed once this returns.
+ *  cf - handle to the opened file
+ *
+ * Returns:
+ *  0 on success, -1 on failure with errno set (EILSEQ if the file
+ *  isn't a valid capture file).
+ *
+ * See Also:
+ *  <capfile_close>
+ */
+int capfile_open(FILE *fp, capfile_t **new_cf)
+{
+    const struct capfile_header *hdr;
+    const struct capfile_trailer *trailer;
+    struct capfile_footer footer;
+    const uint8_t *data;
+    file_map_t *map;
+    uint64_t index_len;
+    capfile_t *cf;
+    size_t len;
+
+    if (file_load_map(fp, &map))
+        return -1;
+
+    data = file_map_data(map);
+    len = file_map_len(map);
+    if (len < sizeof(struct capfile_header) + sizeof(struct capfile_trailer))
+        goto bad;
+
+    hdr = (const struct capfile_header *) data;
+    trailer = (const struct capfile_trailer *)
+        (data + len - sizeof(struct capfile_trailer));
+    if (memcmp(hdr->magic, CAPFILE_MAGIC, CAPFILE_MAGIC_LEN) ||
+            (CAPFILE_VERSION != hdr->version) ||
+            memcmp(trailer->magic, CAPFILE_TRAILER_MAGIC, CAPFILE_MAGIC_LEN))
+        goto bad;
+
+    if (trailer->footer < sizeof(struct capfile_header) ||
+            trailer->footer + sizeof(struct capfile_footer) >
+            len - sizeof(struct capfile_trailer))
+        goto bad;
+
+    memcpy(&footer, data + trailer->footer, sizeof(struct capfile_footer));
+    index_len = (uint64_t) footer.nchannels * sizeof(struct capfile_channel) +
+        (uint64_t) footer.nchunks * sizeof(struct capfile_chunk);
+    if (0 == footer.chunk_len || trailer->footer + sizeof(footer) + index_len !=
+            len - sizeof(struct capfile_trailer))
+        goto bad;
+
+    cf = calloc(1, sizeof(struct capfile));
+    cf->map = map;
+    cf->data = data;
+    cf->len = len;
+    cf->footer = footer;
+    cf->channels = (const struct capfile_channel *)
+        (data + trailer->footer + sizeof(struct capfile_footer));
+    cf->chunks = (const struct capfile_chunk *)
+        (cf->channels + footer.nchannels);
+
+    /* Everything the index points at has to be inside the file */
+    for (unsigned ch = 0; ch < footer.nchannels; ch++) {
+        const struct capfile_channel *c = &cf->channels[ch];
+        uint32_t nchunks = count_chunks(c->nsamples, footer.chunk_len);
+
+        if ((uint64_t) c->first_chunk + nchunks > footer.nchunks) {
+            free(cf);
+            goto bad;
+        }
+    }
+
+    for (uint32_t i = 0; i < footer.nchunks; i++) {
+        const struct capfile_chunk *c = &cf->chunks[i];
+
+        if (c->offset + c->len > trailer->footer) {
+            free(cf);
+            goto bad;
+        }
+    }
+
+    *new_cf = cf;
+    return 0;
+
+bad:
+    file_map_dropref(map);
+    errno = EILSEQ;
+    return -1;
+}
+
+void capfile_close(capfile_t *cf)
+{
+    if (NULL == cf)
+        return;
+
+    file_map_dropref(cf->map);
+    free(cf);
+}
+
+unsigned capfile_get_nchannels(capfile_t *cf)
+{
+    return cf->footer.nchannels;
+}
+
+uint64_t capfile_get_nsamples(capfile_t *cf, unsigned ch)
+{
+    if (ch >= cf->footer.nchannels)
+        return 0;
+
+    return cf->channels[ch].nsamples;
+}
+
+uint32_t capfile_get_nchunks(capfile_t *cf, unsigned ch)
+{
+    return count_chunks(capfile_get_nsamples(cf, ch), cf->footer.chunk_len);
+}
+
+/* Function: capfile_get_chunk_info
+ *
+ * Looks up a chunk in the index, without reading the chunk.
+ *
+ * Parameters:
+ *  cf - capture file
+ *  ch - channel, in the order they were exported
+ *  chunk - chunk within the channel
+ *  info - filled in with what the index knows
+ *
+ * Returns:
+ *  0 on success, -1 (with errno EINVAL) if there's no such chunk.
+ */
+int capfile_get_chunk_info(capfile_t *cf, unsigned ch, uint32_t chunk,
+    struct capfile_chunk_info *info)
+{
+    const struct capfile_chunk *c = get_chunk(cf, ch, chunk);
+
+    if (NULL == c) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    info->begin = (uint64_t) chunk * cf->footer.chunk_len;
+    info->nsamples = chunk_nsamples(cf, ch, chunk);
+    info->min = c->min;
+    info->max = c->max;
+    info->nedges = c->nedges;
+    info->compressed = !!(c->codec & CHUNK_DEFLATE);
+    return 0;
+}
+
+/* Function: capfile_read_chunk
+ *
+ * Reads a single chunk's samples.
+ *
+ * Parameters:
+ *  cf - capture file
+ *  ch - channel, in the order they were exported
+ *  chunk - chunk within the channel
+ *  analog - room for the chunk's analog samples, or NULL to skip them
+ *  digital - room for the chunk's digital samples, or NULL to skip them
+ *
+ * Returns:
+ *  0 on success, -1 on failure with errno set.
+ */
+int capfile_read_chunk(capfile_t *cf, unsigned ch, uint32_t chunk,
+    uint16_t *analog, uint8_t *digital)
+{
+    const struct capfile_chunk *c = get_chunk(cf, ch, chunk);
+    const uint8_t *raw;
+    uint8_t *buf = NULL;
+    size_t alen, raw_len;
+    uint32_t n;
+
+    if (NULL == c) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    n = chunk_nsamples(cf, ch, chunk);
+    alen = analog_len(n, c->codec);
+    raw_len = alen + digital_len(n);
+    raw = cf->data + c->offset;
+
+    if (c->codec & CHUNK_DEFLATE) {
+        uLongf len = raw_len;
+
+        buf = malloc(raw_len);
+        if (Z_OK != uncompress(buf, &len, raw, c->len) || len != raw_len) {
+            free(buf);
+            errno = EILSEQ;
+            return -1;
+        }
+        raw = buf;
+    } else if (c->len != raw_len) {
+        errno = EILSEQ;
+        return -1;
+    }
+
+    if (analog) {
+        if (c->codec & CHUNK_PACKED12)
+            simd_unpack_u12(raw, n, analog);
+        else
+            memcpy(analog, raw, n * sizeof(uint16_t));
+    }
+
+    if (digital)
+        unpack_bits(raw + alen, n, digital);
+
+    free(buf);
+    return 0;
+}
+
+/* Function: capfile_import
+ *
+ * Loads a sample range of some channels of a capture file into a new
+ * bundle.  Only the chunks that overlap the range are read, and they
+ * are decoded in parallel.  Min/max comes from the index wherever a
+ * whole chunk was loaded.
+ *
+ * Parameters:
+ *  cf - capture file
+ *  begin - first sample to import
+ *  end - one past the last sample to import; 0 for the end of capture.
+ *  ch_mask - bitmask of physical channels to import; 0 for all.
+ *  bun - handle to the new capture bundle
+ *
+ * Returns:
+ *  0 on success, -1 on failure with errno set.
+ */
+int capfile_import(capfile_t *cf, uint64_t begin, uint64_t end,
+    uint32_t ch_mask, cap_bundle_t **new_bundle)
+{
+    const uint32_t chunk_len = cf->footer.chunk_len;
+    cap_bundle_t *bun;
+
+    *new_bundle = NULL;
+    bun = cap_bundle_create();
+
+    for (unsigned ch = 0; ch < cf->footer.nchannels; ch++) {
+        const struct capfile_channel *info = &cf->channels[ch];
+        uint64_t last = end;
+        char note[sizeof(info->note) + 1] = { 0 };
+        uint16_t lo = UINT16_MAX, hi = 0;
+        int err = 0;
+        cap_t *cap;
+
+        if (ch_mask && ((info->physical_ch >= 32) ||
+                !(ch_mask & (1UL << info->physical_ch))))
+            continue;
+
+        if ((0 == last) || (last > info->nsamples))
+            last = info->nsamples;
+
+        if (begin > last) {
+            cap_bundle_dropref(bun);
+            errno = EINVAL;
+            return -1;
+        }
+
+        cap = cap_create(last - begin);
+        cap_set_physical_ch(cap, info->physical_ch);
+        cap_set_period(cap, info->period);
+        cap_set_offset(cap, info->offset);
+        memcpy(note, info->note, sizeof(info->note));
+        cap_set_note(cap, note);
+        if (info->has_cal)
+            cap_set_analog_cal(cap, info->vmin, info->vmax);
+
+        #pragma omp parallel for schedule(dynamic) reduction(min:lo) \
+            reduction(max:hi) reduction(|:err)
+        for (uint64_t k = begin / chunk_len; k < count_chunks(last, chunk_len); k++) {
+            const struct capfile_chunk *c = get_chunk(cf, ch, k);
+            uint64_t cbegin = k * chunk_len;
+            uint32_t n = chunk_nsamples(cf, ch, k);
+            uint64_t from = (begin > cbegin) ? begin : cbegin;
+            uint64_t to = (last < cbegin + n) ? last : cbegin + n;
+            uint16_t *analog = malloc(n * sizeof(uint16_t));
+            uint8_t *digital = malloc(n);
+
+            if (capfile_read_chunk(cf, ch, k, analog, digital)) {
+                err |= 1;
+            } else {
+                cap_write_analog(cap, from - begin, analog + (from - cbegin),
+                    to - from);
+                cap_write_digital(cap, from - begin, digital + (from - cbegin),
+                    to - from);
+
+                if ((from == cbegin) && (to == cbegin + n)) {
+                    lo = (c->min < lo) ? c->min : lo;
+                    hi = (c->max > hi) ? c->max : hi;
+                } else {
+                    for (uint64_t i = from - cbegin; i < to - cbegin; i++) {
+                        lo = (analog[i] < lo) ? analog[i] : lo;
+                        hi = (analog[i] > hi) ? analog[i] : hi;
+                    }
+                }
+            }
+
+            free(analog);
+            free(digital);
+        }
+
+        if (err) {
+            cap_dropref(cap);
+            cap_bundle_dropref(bun);
+            errno = EILSEQ;
+            return -1;
+        }
+
+        cap_set_analog_minmax(cap, lo, hi);
+        cap_index_edges(cap);
+        cap_index_analog(cap);
+        cap_bundle_add(bun, cap);
+    }
+
+    *new_bundle = bun;
+    return 0;
+}
+
+/* Encodes samples [begin, begin + n) of a capture into a chunk, filling
+ * in everything in its index entry except where it goes.  Returns the
+ * chunk's data, which the caller frees.
+ */
+static uint8_t *encode_chunk(cap_t *cap, uint64_t begin, uint32_t n,
+    bool compress, struct capfile_chunk *entry)
+{
+    uint16_t *analog = malloc(n * sizeof(uint16_t));
+    uint8_t *digital = malloc(n);
+    uint16_t min = UINT16_MAX, max = 0;
+    size_t alen, raw_len;
+    uint8_t *raw;
+    uint8_t codec;
+
+    cap_read_analog(cap, begin, analog, n);
+    cap_read_digital(cap, begin, digital, n);
+
+    for (uint32_t i = 0; i < n; i++) {
+        if (analog[i] < min)
+            min = analog[i];
+        if (analog[i] > max)
+            max = analog[i];
+    }
+
+    codec = (max <= PACKED12_MAX) ? CHUNK_PACKED12 : 0;
+    alen = analog_len(n, codec);
+    raw_len = alen + digital_len(n);
+    raw = calloc(raw_len, sizeof(uint8_t));
+
+    if (codec & CHUNK_PACKED12)
+        simd_pack_u12(analog, n, raw);
+    else
+        memcpy(raw, analog, n * sizeof(uint16_t));
+    pack_bits(digital, n, raw + alen);
+
+    /* Only keep the deflated version if it's actually smaller */
+    if (compress) {
+        uLongf zlen = compressBound(raw_len);
+        uint8_t *z = malloc(zlen);
+
+        if (Z_OK == compress2(z, &zlen, raw, raw_len, Z_DEFAULT_COMPRESSION) &&
+                zlen < raw_len) {
+            free(raw);
+            raw = z;
+            raw_len = zlen;
+            codec |= CHUNK_DEFLATE;
+        } else {
+            free(z);
+        }
+    }
+
+    *entry = (struct capfile_chunk) {
+        .len = raw_len,
+        .min = min,
+        .max = max,
+        .nedges = cap_count_edges(cap, begin, begin + n),
+        .codec = codec
+    };
+
+    free(analog);
+    free(digital);
+    return raw;
+}
+
+static const struct capfile_chunk *get_chunk(capfile_t *cf, unsigned ch,
+    uint32_t chunk)
+{
+    if (ch >= cf->footer.nchannels || chunk >= capfile_get_nchunks(cf, ch))
+        return NULL;
+
+    return &cf->chunks[cf->channels[ch].first_chunk + chunk];
+}
+
+/* Samples in a chunk; only a channel's last chunk can come up short. */
+static uint32_t chunk_nsamples(capfile_t *cf, unsigned ch, uint32_t chunk)
+{
+    uint64_t begin = (uint64_t) chunk * cf->footer.chunk_len;
+    uint64_t n = cf->channels[ch].nsamples - begin;
+
+    return (n > cf->footer.chunk_len) ? cf->footer.chunk_len : n;
+}
+
+/* Packs one-bit samples eight to a byte, first sample in the low bit. */
+static void pack_bits(const uint8_t *src, uint32_t n, uint8_t *dst)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        if (src[i])
+            dst[i / 8] |= 1 << (i % 8);
+    }
+}
+
+static void unpack_bits(const uint8_t *src, uint32_t n, uint8_t *dst)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        dst[i] = (src[i / 8] >> (i % 8)) & 1;
+    }
+}
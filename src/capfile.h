@@ -0,0 +1,96 @@
+/* File: capfile.h
+ *
+ * Native pav capture files (headers)
+ *
+ * Author: Jack Bradach <jack@bradach.net>
+ *
+ * Copyright (C) 2016 Jack Bradach <jack@bradach.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _CAPFILE_H_
+#define _CAPFILE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "cap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Samples per column chunk unless asked otherwise */
+#define CAPFILE_DEFAULT_CHUNK_LEN (1 << 16)
+
+typedef struct capfile capfile_t;
+
+/* Struct: capfile_opts
+ *
+ * Export options.  Zeroed fields pick the defaults.
+ *
+ * Fields:
+ *  chunk_len - samples per column chunk
+ *  compress - deflate chunks that get smaller for it
+ */
+struct capfile_opts {
+    uint32_t chunk_len;
+    bool compress;
+};
+
+/* Struct: capfile_chunk_info
+ *
+ * What the index knows about a chunk without having to read it.
+ *
+ * Fields:
+ *  begin - first sample in the chunk
+ *  nsamples - samples in the chunk
+ *  min - smallest analog sample
+ *  max - largest analog sample
+ *  nedges - digital edges, counting one from the previous chunk's
+ *           last sample to this one's first.
+ *  compressed - whether the chunk is deflated
+ */
+struct capfile_chunk_info {
+    uint64_t begin;
+    uint32_t nsamples;
+    uint16_t min;
+    uint16_t max;
+    uint32_t nedges;
+    bool compressed;
+};
+
+int capfile_export(FILE *fp, cap_bundle_t *bun, const struct capfile_opts *opts);
+
+bool capfile_detect(FILE *fp);
+int capfile_open(FILE *fp, capfile_t **cf);
+void capfile_close(capfile_t *cf);
+
+unsigned capfile_get_nchannels(capfile_t *cf);
+uint64_t capfile_get_nsamples(capfile_t *cf, unsigned ch);
+uint32_t capfile_get_nchunks(capfile_t *cf, unsigned ch);
+int capfile_get_chunk_info(capfile_t *cf, unsigned ch, uint32_t chunk,
+    struct capfile_chunk_info *info);
+int capfile_read_chunk(capfile_t *cf, unsigned ch, uint32_t chunk,
+    uint16_t *analog, uint8_t *digital);
+
+int capfile_import(capfile_t *cf, uint64_t begin, uint64_t end,
+    uint32_t ch_mask, cap_bundle_t **bun);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
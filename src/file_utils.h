@@ -26,6 +26,7 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "gzindex.h"
 #include "queue.h"
 #include "refcnt.h"
 
@@ -34,9 +35,36 @@
 extern "C" {
 #endif
 
+typedef struct file_stream file_stream_t;
+typedef struct file_map file_map_t;
+
 int file_load_path(const char *path, void **buf, size_t *len);
 int file_load(FILE *fp, void **buf, size_t *len);
 
+/* Whole-file loads that avoid copying the file when it isn't compressed */
+int file_load_map(FILE *fp, file_map_t **map);
+int file_stream_load_map(FILE *fp, file_map_t **map);
+bool file_is_gzip(FILE *fp);
+bool file_is_bgzf(FILE *fp);
+bool file_is_seekable(FILE *fp);
+const void *file_map_data(file_map_t *m);
+size_t file_map_len(file_map_t *m);
+bool file_map_is_mapped(file_map_t *m);
+file_map_t *file_map_addref(file_map_t *m);
+void file_map_dropref(file_map_t *m);
+unsigned file_map_nref(file_map_t *m);
+
+/* Sequential readers; these inflate gzip'd files on the fly and hold
+ * no more than a fixed-size buffer in memory.
+ */
+int file_stream_open(FILE *fp, file_stream_t **fs);
+int64_t file_stream_read(file_stream_t *fs, void *buf, size_t len);
+int file_stream_skip(file_stream_t *fs, uint64_t len);
+int file_stream_seek(file_stream_t *fs, uint64_t offset);
+void file_stream_set_index(file_stream_t *fs, gzindex_t *idx);
+uint64_t file_stream_tell(file_stream_t *fs);
+void file_stream_close(file_stream_t *fs);
+
 #ifdef __cplusplus
 }
 #endif
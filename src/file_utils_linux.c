@@ -1,6 +1,9 @@
+/* mremap() */
+#define _GNU_SOURCE
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,10 +13,62 @@
 #include <unistd.h>
 #include <zlib.h>
 
+#include "bgzf.h"
 #include "file_utils.h"
 
-static void file_mmap(FILE *fp, void **buf, size_t *len);
+/* Size of zlib's internal read buffer for streams; big enough that
+ * the syscall overhead disappears, small enough not to matter.
+ */
+#define FILE_STREAM_BUF_LEN (1 << 20)
+
+/* Scratch space for skipping forward in a stream that can't seek */
+#define FILE_STREAM_SKIP_LEN (1 << 14)
+
+/* Struct: file_stream
+ *
+ * Handle for sequentially reading a (possibly gzip'd) file.
+ *
+ * Fields:
+ *  fp - file the stream was opened on
+ *  gz - zlib file handle; reads are passed through if not compressed.
+ *  idx - optional access point index for seeking in gzip'd files
+ *  cur - cursor into the file when seeking with an index
+ *  pos - uncompressed offset of the next byte to be read.
+ *  seekable - false for pipes, which can only be read front to back.
+ */
+struct file_stream {
+    FILE *fp;
+    gzFile gz;
+    gzindex_t *idx;
+    gzindex_cursor_t *cur;
+    uint64_t pos;
+    bool seekable;
+};
+
+/* Struct: file_map
+ *
+ * Reference counted view of a whole file's contents.  It's either the
+ * file's pages mapped straight from the page cache or, for gzip'd
+ * files, a heap buffer holding the inflated image.
+ *
+ * Fields:
+ *  data - start of the file contents
+ *  len - length of the contents in bytes
+ *  mapped - true if data is an mmap'd region, false if heap allocated.
+ */
+struct file_map {
+    void *data;
+    size_t len;
+    bool mapped;
+    struct refcnt rcnt;
+};
+
+static int file_mmap(FILE *fp, void **buf, size_t *len);
+static int stream_load(FILE *fp, void **buf, size_t *len);
+static int stream_discard(struct file_stream *fs, uint64_t len);
 static bool inflate_buffer(void *src, size_t src_len, void **dst, size_t *dst_len);
+static size_t inflate_size_hint(const uint8_t *src, size_t len);
+static void file_map_free(const struct refcnt *ref);
 
 int file_load_path(const char *path, void **buf, size_t *len)
 {
@@ -37,10 +92,16 @@ int file_load(FILE *fp, void **buf, size_t *len)
         return -1;
     }
 
+    /* Pipes can't be mapped; read them in as they come. */
+    if (!file_is_seekable(fp))
+        return stream_load(fp, buf, len);
+
     /* Map the file into memory, decompressing if necessary.  If source
      * wasn't compressed, copy it over to a buffer and unmap the file.
      */
-    file_mmap(fp, &src_buf, &src_len);
+    if (file_mmap(fp, &src_buf, &src_len)) {
+        return -1;
+    }
     compressed = inflate_buffer(src_buf, src_len, &dst_buf, &dst_len);
     if (!compressed) {
         dst_len = src_len;
@@ -54,31 +115,214 @@ int file_load(FILE *fp, void **buf, size_t *len)
     return 0;
 }
 
+/* Function: file_load_map
+ *
+ * Loads a file without copying it when possible.  Uncompressed files are
+ * handed out as a read-only mapping of the page cache (with sequential
+ * read-ahead hints), gzip'd files are inflated into a heap buffer
+ * (on every thread, if they're block gzip'd).  Either way the contents stay valid until the last reference to the
+ * map is dropped.
+ *
+ * Parameters:
+ *  fp - file to load; must be a regular file.
+ *  map - handle to the new file map, refcnt = 1.
+ *
+ * Returns:
+ *  0 on success, -1 on failure with errno set.
+ *
+ * See Also:
+ *  <file_map_dropref>, <file_is_gzip>, <file_is_bgzf>
+ */
+int file_load_map(FILE *fp, struct file_map **map)
+{
+    struct file_map *m;
+    void *src_buf, *dst_buf;
+    size_t src_len, dst_len;
+
+    if (NULL == fp) {
+        fprintf(stderr, "Invalid file handle for load!\n");
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (file_mmap(fp, &src_buf, &src_len)) {
+        return -1;
+    }
+
+    m = calloc(1, sizeof(struct file_map));
+    m->rcnt = (struct refcnt) { file_map_free, 1 };
+
+    if (inflate_buffer(src_buf, src_len, &dst_buf, &dst_len)) {
+        munmap(src_buf, src_len);
+        m->data = dst_buf;
+        m->len = dst_len;
+        m->mapped = false;
+    } else {
+        /* Importers walk captures front to back; let the kernel
+         * start reading ahead right away.
+         */
+        madvise(src_buf, src_len, MADV_SEQUENTIAL);
+        madvise(src_buf, src_len, MADV_WILLNEED);
+        m->data = src_buf;
+        m->len = src_len;
+        m->mapped = true;
+    }
+
+    *map = m;
+    return 0;
+}
+
+/* Function: file_is_gzip
+ *
+ * Checks whether a file starts with the gzip magic number, without
+ * disturbing the stream position.
+ */
+bool file_is_gzip(FILE *fp)
+{
+    uint8_t magic[2];
+
+    if (NULL == fp)
+        return false;
+
+    if (pread(fileno(fp), magic, sizeof(magic), 0) != sizeof(magic))
+        return false;
+
+    return (0x1f == magic[0]) && (0x8b == magic[1]);
+}
+
+/* Function: file_is_bgzf
+ *
+ * Checks whether a file starts with a block gzip header, meaning
+ * <file_load_map> can inflate it in parallel.  The stream position
+ * isn't disturbed.
+ */
+bool file_is_bgzf(FILE *fp)
+{
+    uint8_t hdr[512];
+    ssize_t n;
+
+    if (NULL == fp)
+        return false;
+
+    n = pread(fileno(fp), hdr, sizeof(hdr), 0);
+    if (n <= 0)
+        return false;
+
+    return bgzf_detect(hdr, n);
+}
+
+/* Function: file_is_seekable
+ *
+ * Checks whether a file can be mapped and seeked around in, as opposed
+ * to a pipe or socket that can only be read front to back.
+ */
+bool file_is_seekable(FILE *fp)
+{
+    struct stat st;
+
+    if (NULL == fp)
+        return false;
+
+    return (0 == fstat(fileno(fp), &st)) && S_ISREG(st.st_mode);
+}
+
+const void *file_map_data(struct file_map *m)
+{
+    return m->data;
+}
+
+size_t file_map_len(struct file_map *m)
+{
+    return m->len;
+}
+
+/* Returns true if the map is backed by the page cache (zero-copy). */
+bool file_map_is_mapped(struct file_map *m)
+{
+    return m->mapped;
+}
+
+struct file_map *file_map_addref(struct file_map *m)
+{
+    if (NULL == m)
+        return NULL;
+
+    refcnt_inc(&m->rcnt);
+    return m;
+}
+
+void file_map_dropref(struct file_map *m)
+{
+    if (NULL == m)
+        return;
+
+    refcnt_dec(&m->rcnt);
+}
+
+unsigned file_map_nref(struct file_map *m)
+{
+    if (NULL == m)
+        return 0;
+
+    return m->rcnt.count;
+}
+
+static void file_map_free(const struct refcnt *ref)
+{
+    struct file_map *m =
+        container_of(ref, struct file_map, rcnt);
+
+    if (m->mapped) {
+        munmap(m->data, m->len);
+    } else {
+        free(m->data);
+    }
+    free(m);
+}
+
 /* Function: file_mmap
  *
  * Maps a file contents into memory.  Buffer needs to be munmap'ed
  * when done.
  *
+ * Returns:
+ *  0 on success, -1 if the file can't be mapped (eg, it's a pipe).
  */
-static void file_mmap(FILE *fp, void **buf, size_t *len)
+static int file_mmap(FILE *fp, void **buf, size_t *len)
 {
     struct stat st;
     void *addr;
 
-    fstat(fileno(fp), &st);
+    if (!file_is_seekable(fp) || fstat(fileno(fp), &st)) {
+        errno = ESPIPE;
+        return -1;
+    }
+
+    if (0 == st.st_size) {
+        errno = ENODATA;
+        return -1;
+    }
+
     addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (MAP_FAILED == addr) {
+        return -1;
+    }
+
     *len = st.st_size;
     *buf = addr;
+    return 0;
 }
 
 /* Attempts to decompress a memmaped gzip file in-place.  If the buffer
  * doesn't contain a GZIP image, it'll be left untouched.  Otherwise,
  * buf and buf_len will be replaced with the decompressed image.
+ * Block gzip'd files are split up between threads; anything else is
+ * inflated a member at a time into a buffer sized from the trailer.
  */
 static bool inflate_buffer(void *src, size_t src_len, void **dst, size_t *dst_len)
 {
-    size_t buf_len = 4 * (1 << 20); // start with 4 megabytes
-    void *buf = calloc(buf_len, sizeof(uint8_t));
+    size_t buf_len, out = 0;
+    uint8_t *buf;
     z_stream strm  = {
         .next_in = (Bytef *) src,
         .avail_in = src_len,
@@ -86,6 +330,13 @@ static bool inflate_buffer(void *src, size_t src_len, void **dst, size_t *dst_le
 
     int rc;
 
+    if (bgzf_detect(src, src_len) &&
+            (0 == bgzf_inflate(src, src_len, (void **) &buf, &buf_len))) {
+        *dst = buf;
+        *dst_len = buf_len;
+        return true;
+    }
+
     /* Note: this bare value is literally what the dang documentation
      * says to put in there for combining window size and whether or not
      * I wants gzip header detection (spointer alert: I does!)
@@ -95,18 +346,32 @@ static bool inflate_buffer(void *src, size_t src_len, void **dst, size_t *dst_le
         return false;
     }
 
-    for (int retries = 10; retries > 0; retries--) {
-        buf = realloc(buf, buf_len);
-        strm.next_out = (Bytef *) buf;
-        strm.avail_out = buf_len;
-        rc = inflate(&strm, Z_FINISH);
-        assert(rc != Z_STREAM_ERROR);
+    buf_len = inflate_size_hint(src, src_len);
+    buf = malloc(buf_len);
 
-        if (Z_STREAM_END == rc) {
-            break;
-        } else if (Z_BUF_ERROR == rc) {
+    for (;;) {
+        if (out == buf_len) {
             /* Bump the decompression buffer size */
             buf_len *= 2;
+            buf = realloc(buf, buf_len);
+        }
+
+        strm.next_out = buf + out;
+        strm.avail_out = (buf_len - out > UINT_MAX) ? UINT_MAX : buf_len - out;
+        rc = inflate(&strm, Z_NO_FLUSH);
+        assert(rc != Z_STREAM_ERROR);
+        out = strm.next_out - buf;
+
+        if (Z_STREAM_END == rc) {
+            /* Concatenated members all end up in the one buffer */
+            if (strm.avail_in < 2 || 0x1f != strm.next_in[0] ||
+                    0x8b != strm.next_in[1])
+                break;
+            inflateReset(&strm);
+        } else if (Z_OK == rc || Z_BUF_ERROR == rc) {
+            /* Ran out of input partway through; keep what we've got */
+            if (0 == strm.avail_in && 0 != strm.avail_out)
+                break;
         } else {
             /* Not compressed! */
             inflateEnd(&strm);
@@ -117,7 +382,352 @@ static bool inflate_buffer(void *src, size_t src_len, void **dst, size_t *dst_le
         }
     }
 
-    *dst = realloc(buf, strm.total_out);
-    *dst_len = strm.total_out;
+    inflateEnd(&strm);
+    *dst = realloc(buf, out ? out : 1);
+    *dst_len = out;
     return true;
 }
+
+/* Best guess at how big a buffer will be once inflated.  The ISIZE at
+ * the end of a gzip file is exact for a single member under 4GB; for
+ * anything else it's just somewhere to start.
+ */
+static size_t inflate_size_hint(const uint8_t *src, size_t len)
+{
+    const size_t min_len = 4 * (1 << 20);
+    size_t isize;
+
+    if (len < 18 || 0x1f != src[0] || 0x8b != src[1])
+        return min_len;
+
+    isize = src[len - 4] | (src[len - 3] << 8) | (src[len - 2] << 16) |
+        ((size_t) src[len - 1] << 24);
+
+    return isize ? isize : min_len;
+}
+
+/* Function: file_stream_open
+ *
+ * Opens a stream reader on a file.  The reader works on a duplicate of
+ * the file's descriptor, so the caller still owns (and must close) fp.
+ * Data is inflated on the fly if the file is gzip'd, otherwise it's
+ * passed straight through.  Seekable files are always read from the
+ * start; pipes are read from wherever they are.
+ *
+ * Parameters:
+ *  fp - file to read from
+ *  fs - handle to the new stream
+ *
+ * Returns:
+ *  0 on success, -1 on failure with errno set.
+ *
+ * See Also:
+ *  <file_stream_read>, <file_stream_close>
+ */
+int file_stream_open(FILE *fp, struct file_stream **fs)
+{
+    struct file_stream *s;
+    bool seekable;
+    gzFile gz;
+    int fd;
+
+    if (NULL == fp) {
+        fprintf(stderr, "Invalid file handle for load!\n");
+        errno = ENOENT;
+        return -1;
+    }
+
+    fd = dup(fileno(fp));
+    if (fd < 0) {
+        return -1;
+    }
+    seekable = file_is_seekable(fp);
+    if (seekable)
+        lseek(fd, 0, SEEK_SET);
+
+    gz = gzdopen(fd, "rb");
+    if (NULL == gz) {
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+    gzbuffer(gz, FILE_STREAM_BUF_LEN);
+
+    s = calloc(1, sizeof(struct file_stream));
+    s->fp = fp;
+    s->gz = gz;
+    s->seekable = seekable;
+    *fs = s;
+    return 0;
+}
+
+/* Function: file_stream_read
+ *
+ * Reads up to len bytes from a stream.  Only returns short at the end
+ * of the file or on an error.
+ *
+ * Returns:
+ *  Number of bytes read, or -1 on error.
+ */
+int64_t file_stream_read(struct file_stream *fs, void *buf, size_t len)
+{
+    uint8_t *dst = buf;
+    size_t total = 0;
+
+    if (fs->cur) {
+        int64_t rc = gzindex_cursor_read(fs->cur, buf, len);
+        if (rc > 0)
+            fs->pos += rc;
+        return rc;
+    }
+
+    /* gzread() takes an unsigned, so large reads get split up. */
+    while (total < len) {
+        unsigned n = (len - total > INT_MAX) ? INT_MAX : len - total;
+        int rc = gzread(fs->gz, dst + total, n);
+        if (rc < 0) {
+            errno = EIO;
+            return -1;
+        } else if (0 == rc) {
+            break;
+        }
+        total += rc;
+    }
+
+    fs->pos += total;
+    return total;
+}
+
+/* Function: file_stream_skip
+ *
+ * Discards the next len bytes of a stream.
+ *
+ * Returns:
+ *  0 on success, -1 if the stream ended first.
+ */
+int file_stream_skip(struct file_stream *fs, uint64_t len)
+{
+    return file_stream_seek(fs, fs->pos + len);
+}
+
+/* Function: file_stream_seek
+ *
+ * Moves a stream to an absolute (uncompressed) offset.  Plain files
+ * seek directly.  Gzip'd files with an index (see <file_stream_set_index>)
+ * resume inflating from the nearest access point; without one they have
+ * to inflate their way there from the start.  Pipes can only skip
+ * forward, by reading and throwing away what's in between.
+ *
+ * Returns:
+ *  0 on success, -1 on failure (ESPIPE if a pipe was asked to go back).
+ */
+int file_stream_seek(struct file_stream *fs, uint64_t offset)
+{
+    z_off_t rc;
+
+    if (offset == fs->pos)
+        return 0;
+
+    if (!fs->seekable) {
+        if (offset < fs->pos) {
+            errno = ESPIPE;
+            return -1;
+        }
+        return stream_discard(fs, offset - fs->pos);
+    }
+
+    if (fs->idx) {
+        gzindex_cursor_t *cur;
+
+        if (gzindex_cursor_open(fs->idx, fs->fp, offset, &cur))
+            return -1;
+
+        gzindex_cursor_close(fs->cur);
+        fs->cur = cur;
+        fs->pos = offset;
+        return 0;
+    }
+
+    rc = gzseek(fs->gz, offset, SEEK_SET);
+    if (rc < 0 || (uint64_t) rc != offset) {
+        errno = EIO;
+        return -1;
+    }
+
+    fs->pos = offset;
+    return 0;
+}
+
+/* Function: file_stream_set_index
+ *
+ * Attaches an access point index to a stream on a gzip'd file, making
+ * <file_stream_seek> cheap.  The stream holds its own reference to it.
+ */
+void file_stream_set_index(struct file_stream *fs, gzindex_t *idx)
+{
+    gzindex_dropref(fs->idx);
+    fs->idx = gzindex_addref(idx);
+}
+
+/* Function: file_stream_tell
+ *
+ * Returns the uncompressed offset of the stream.
+ */
+uint64_t file_stream_tell(struct file_stream *fs)
+{
+    return fs->pos;
+}
+
+/* Function: file_stream_close
+ *
+ * Closes a stream and frees its resources.  The FILE the stream
+ * was opened on is left open.
+ */
+void file_stream_close(struct file_stream *fs)
+{
+    if (NULL == fs)
+        return;
+
+    gzindex_cursor_close(fs->cur);
+    gzindex_dropref(fs->idx);
+    gzclose(fs->gz);
+    free(fs);
+}
+
+/* Function: file_stream_load_map
+ *
+ * Reads a whole stream (a pipe, say) a buffer's worth at a time into an
+ * anonymous mapping.  The mapping is grown in place with mremap rather
+ * than copied, so the stream's contents are never held twice; past the
+ * contents themselves, only the stream's fixed-size buffer is used.
+ *
+ * Parameters:
+ *  fp - stream to read to the end
+ *  map - handle to the new file map, refcnt = 1.
+ *
+ * Returns:
+ *  0 on success, -1 on failure with errno set (ENODATA if the stream
+ *  was empty).
+ */
+int file_stream_load_map(FILE *fp, struct file_map **map)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t alloc = FILE_STREAM_BUF_LEN, total = 0;
+    struct file_stream *fs;
+    struct file_map *m;
+    uint8_t *dst;
+
+    if (file_stream_open(fp, &fs))
+        return -1;
+
+    dst = mmap(NULL, alloc, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == dst) {
+        file_stream_close(fs);
+        return -1;
+    }
+
+    for (;;) {
+        int64_t rc;
+
+        if (total == alloc) {
+            void *grown = mremap(dst, alloc, 2 * alloc, MREMAP_MAYMOVE);
+
+            if (MAP_FAILED == grown) {
+                munmap(dst, alloc);
+                file_stream_close(fs);
+                return -1;
+            }
+            dst = grown;
+            alloc *= 2;
+        }
+
+        rc = file_stream_read(fs, dst + total, alloc - total);
+        if (rc < 0) {
+            munmap(dst, alloc);
+            file_stream_close(fs);
+            return -1;
+        } else if (0 == rc) {
+            break;
+        }
+        total += rc;
+    }
+    file_stream_close(fs);
+
+    if (0 == total) {
+        munmap(dst, alloc);
+        errno = ENODATA;
+        return -1;
+    }
+
+    /* Hand back the pages past the end */
+    if (alloc - total >= page) {
+        size_t keep = (total + page - 1) & ~(page - 1);
+        munmap(dst + keep, alloc - keep);
+    }
+
+    m = calloc(1, sizeof(struct file_map));
+    m->rcnt = (struct refcnt) { file_map_free, 1 };
+    m->data = dst;
+    m->len = total;
+    m->mapped = true;
+
+    *map = m;
+    return 0;
+}
+
+/* Reads a whole pipe into a buffer, growing it as needed. */
+static int stream_load(FILE *fp, void **buf, size_t *len)
+{
+    size_t alloc = FILE_STREAM_BUF_LEN, total = 0;
+    struct file_stream *fs;
+    uint8_t *dst;
+
+    if (file_stream_open(fp, &fs))
+        return -1;
+
+    dst = malloc(alloc);
+    for (;;) {
+        int64_t rc;
+
+        if (total == alloc) {
+            alloc *= 2;
+            dst = realloc(dst, alloc);
+        }
+
+        rc = file_stream_read(fs, dst + total, alloc - total);
+        if (rc < 0) {
+            free(dst);
+            file_stream_close(fs);
+            return -1;
+        } else if (0 == rc) {
+            break;
+        }
+        total += rc;
+    }
+    file_stream_close(fs);
+
+    *buf = realloc(dst, total ? total : 1);
+    *len = total;
+    return 0;
+}
+
+/* Skips forward by reading into a scratch buffer; the only way to move
+ * through a pipe.
+ */
+static int stream_discard(struct file_stream *fs, uint64_t len)
+{
+    uint8_t scratch[FILE_STREAM_SKIP_LEN];
+
+    while (len) {
+        size_t n = (len > sizeof(scratch)) ? sizeof(scratch) : len;
+
+        if (file_stream_read(fs, scratch, n) != (int64_t) n) {
+            errno = EIO;
+            return -1;
+        }
+        len -= n;
+    }
+
+    return 0;
+}
@@ -0,0 +1,591 @@
+/* File: framelog.c
+ *
+ * Compact, seekable logs of decoded frames
+ *
+ * A frame log keeps a decode on disk so it can be queried again without
+ * re-decoding the capture or holding every frame in memory.  Frames are
+ * written in blocks; within a block each frame is a varint of the
+ * sample index's distance from the frame before, a varint packing the
+ * (zigzag'd) type with the payload length, and the payload bytes.  An
+ * index at the end records where each block starts and the samples it
+ * covers, so a reader can go straight to the blocks for a sample range.
+ *
+ *  header | block | block | ... | footer | index | trailer
+ *
+ * Author: Jack Bradach <jack@bradach.net>
+ *
+ * Copyright (C) 2016 Jack Bradach <jack@bradach.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "file_utils.h"
+#include "framelog.h"
+#include "framesink.h"
+#include "proto.h"
+#include "refcnt.h"
+
+#define FRAMELOG_MAGIC "PAVFLOG\n"
+#define FRAMELOG_TRAILER_MAGIC "PAVFLGIX"
+#define FRAMELOG_MAGIC_LEN 8
+#define FRAMELOG_VERSION 1
+
+/* Longest a frame can encode to: two varints and the payload */
+#define VARINT_MAX 10
+#define FRAME_MAX (2 * VARINT_MAX + PROTO_DFRAME_INLINE)
+
+/* Payload length takes the low bits of the type varint */
+#define LEN_BITS 4
+
+struct __attribute__((__packed__)) framelog_header {
+    char magic[FRAMELOG_MAGIC_LEN];
+    uint32_t version;
+    uint32_t flags;
+};
+
+struct __attribute__((__packed__)) framelog_footer {
+    uint64_t nframes;
+    uint32_t nblocks;
+    uint32_t reserved;
+};
+
+/* Struct: framelog_block
+ *
+ * Index entry for a block.
+ *
+ * Fields:
+ *  offset - where the block starts in the file
+ *  first_idx - sample index of the first frame; the first delta is
+ *              taken from here
+ *  last_idx - sample index of the last frame
+ *  len - bytes the block takes
+ *  nframes - frames in the block
+ */
+struct __attribute__((__packed__)) framelog_block {
+    uint64_t offset;
+    uint64_t first_idx;
+    uint64_t last_idx;
+    uint32_t len;
+    uint32_t nframes;
+};
+
+struct __attribute__((__packed__)) framelog_trailer {
+    uint64_t footer;
+    char magic[FRAMELOG_MAGIC_LEN];
+};
+
+/* Struct: framelog_writer
+ *
+ * Sink that encodes frames into the block it's filling, and writes the
+ * block out once it's full.
+ *
+ * Fields:
+ *  s - the sink
+ *  fp - file being written
+ *  offset - where the next block goes in the file
+ *  buf - block being filled
+ *  len - bytes in buf
+ *  cur - index entry for the block being filled
+ *  blocks - index entries for blocks already written
+ *  nblocks - blocks written
+ *  alloc - index entries allocated
+ *  nframes - frames written
+ *  err - first error writing the file, sticky
+ */
+struct framelog_writer {
+    struct frame_sink s;
+    FILE *fp;
+    uint64_t offset;
+    uint8_t buf[FRAMELOG_BLOCK_LEN * FRAME_MAX];
+    size_t len;
+    struct framelog_block cur;
+    struct framelog_block *blocks;
+    uint32_t nblocks;
+    uint32_t alloc;
+    uint64_t nframes;
+    int err;
+};
+
+struct framelog {
+    file_map_t *map;
+    const uint8_t *data;
+    struct framelog_footer footer;
+    const struct framelog_block *blocks;
+    uint64_t *first;
+};
+
+static inline size_t put_varint(uint8_t *dst, uint64_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        dst[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    dst[n++] = v;
+
+    return n;
+}
+
+/* Decodes a varint that has to end before end; returns false if not */
+static inline bool get_varint(const uint8_t **src, const uint8_t *end,
+    uint64_t *v)
+{
+    const uint8_t *p = *src;
+    uint64_t r = 0;
+
+    for (unsigned shift = 0; (p < end) && (shift < 64); shift += 7) {
+        uint8_t b = *p++;
+
+        r |= (uint64_t) (b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *src = p;
+            *v = r;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static inline uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v)
+{
+    return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+/* Writes out the block being filled, if it has anything in it */
+static int write_block(struct framelog_writer *w)
+{
+    if (0 == w->cur.nframes)
+        return 0;
+
+    if (1 != fwrite(w->buf, w->len, 1, w->fp)) {
+        w->err = errno ? errno : EIO;
+        return -1;
+    }
+
+    if (w->nblocks == w->alloc) {
+        w->alloc = w->alloc ? 2 * w->alloc : 64;
+        w->blocks = realloc(w->blocks, w->alloc * sizeof(struct framelog_block));
+    }
+
+    w->cur.offset = w->offset;
+    w->cur.len = w->len;
+    w->blocks[w->nblocks++] = w->cur;
+    w->offset += w->len;
+    w->len = 0;
+    w->cur.nframes = 0;
+
+    return 0;
+}
+
+static int framelog_put(struct frame_sink *s, uint64_t idx, int type,
+    const void *data, size_t len)
+{
+    struct framelog_writer *w = container_of(s, struct framelog_writer, s);
+    uint64_t prev = w->cur.nframes ? w->cur.last_idx : idx;
+
+    if (w->err) {
+        errno = w->err;
+        return -1;
+    }
+
+    if (idx < prev) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (0 == w->cur.nframes)
+        w->cur.first_idx = idx;
+
+    w->len += put_varint(w->buf + w->len, idx - prev);
+    w->len += put_varint(w->buf + w->len,
+        (zigzag(type) << LEN_BITS) | len);
+    if (len) {
+        memcpy(w->buf + w->len, data, len);
+        w->len += len;
+    }
+    w->cur.last_idx = idx;
+    w->cur.nframes++;
+    w->nframes++;
+
+    if ((FRAMELOG_BLOCK_LEN == w->cur.nframes) && write_block(w)) {
+        errno = w->err;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Cuts the block short, so everything put so far is in the file */
+static int framelog_flush(struct frame_sink *s)
+{
+    struct framelog_writer *w = container_of(s, struct framelog_writer, s);
+
+    if (!w->err && !write_block(w) && fflush(w->fp))
+        w->err = errno ? errno : EIO;
+
+    if (w->err) {
+        errno = w->err;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int framelog_finish(struct framelog_writer *w)
+{
+    struct framelog_footer footer = { 0 };
+    struct framelog_trailer trailer = { 0, FRAMELOG_TRAILER_MAGIC };
+
+    if (framelog_flush(&w->s))
+        return -1;
+
+    footer.nframes = w->nframes;
+    footer.nblocks = w->nblocks;
+    trailer.footer = w->offset;
+    if ((1 != fwrite(&footer, sizeof(footer), 1, w->fp)) ||
+            (w->nblocks != fwrite(w->blocks, sizeof(struct framelog_block),
+                w->nblocks, w->fp)) ||
+            (1 != fwrite(&trailer, sizeof(trailer), 1, w->fp)) ||
+            fflush(w->fp)) {
+        if (!errno)
+            errno = EIO;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int framelog_sink_close(struct frame_sink *s)
+{
+    struct framelog_writer *w = container_of(s, struct framelog_writer, s);
+    int rc = framelog_finish(w);
+
+    free(w->blocks);
+    free(w);
+    return rc;
+}
+
+/* Function: framelog_sink
+ *
+ * Creates a sink that writes frames to a frame log.  Frames have to
+ * come in sample order, with payloads of up to PROTO_DFRAME_INLINE
+ * bytes.  The index goes out when the sink is closed; the file stays
+ * open.
+ *
+ * Parameters:
+ *  fp - file to write, from its current position
+ *
+ * Returns:
+ *  the sink, or NULL with errno set if the header couldn't be written
+ *
+ * See Also:
+ *  <framelog_open>
+ */
+struct frame_sink *framelog_sink(FILE *fp)
+{
+    struct framelog_header hdr = { FRAMELOG_MAGIC, FRAMELOG_VERSION, 0 };
+    struct framelog_writer *w;
+
+    if (NULL == fp) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (1 != fwrite(&hdr, sizeof(hdr), 1, fp))
+        return NULL;
+
+    w = calloc(1, sizeof(struct framelog_writer));
+    w->s = (struct frame_sink) {
+        framelog_put, framelog_flush, framelog_sink_close };
+    w->fp = fp;
+    w->offset = sizeof(hdr);
+
+    return &w->s;
+}
+
+/* Function: framelog_open
+ *
+ * Opens a frame log for replay.  The file is mapped rather than read
+ * in, so only the blocks that get replayed are ever paged in.
+ *
+ * Parameters:
+ *  fp - the frame log; it can be closed once this returns.
+ *  fl - handle to the opened log
+ *
+ * Returns:
+ *  0 on success, -1 on failure with errno set (EILSEQ if the file
+ *  isn't a valid frame log).
+ *
+ * See Also:
+ *  <framelog_close>
+ */
+int framelog_open(FILE *fp, framelog_t **new_fl)
+{
+    const struct framelog_header *hdr;
+    const struct framelog_trailer *trailer;
+    struct framelog_footer footer;
+    const uint8_t *data;
+    file_map_t *map;
+    uint64_t offset = sizeof(struct framelog_header), nframes = 0;
+    framelog_t *fl;
+    size_t len;
+
+    if (file_load_map(fp, &map))
+        return -1;
+
+    data = file_map_data(map);
+    len = file_map_len(map);
+    if (len < sizeof(struct framelog_header) + sizeof(struct framelog_footer) +
+            sizeof(struct framelog_trailer))
+        goto bad;
+
+    hdr = (const struct framelog_header *) data;
+    trailer = (const struct framelog_trailer *)
+        (data + len - sizeof(struct framelog_trailer));
+    if (memcmp(hdr->magic, FRAMELOG_MAGIC, FRAMELOG_MAGIC_LEN) ||
+            (FRAMELOG_VERSION != hdr->version) ||
+            memcmp(trailer->magic, FRAMELOG_TRAILER_MAGIC, FRAMELOG_MAGIC_LEN))
+        goto bad;
+
+    if (trailer->footer < sizeof(struct framelog_header) ||
+            trailer->footer + sizeof(struct framelog_footer) >
+            len - sizeof(struct framelog_trailer))
+        goto bad;
+
+    memcpy(&footer, data + trailer->footer, sizeof(struct framelog_footer));
+    if (trailer->footer + sizeof(footer) +
+            (uint64_t) footer.nblocks * sizeof(struct framelog_block) !=
+            len - sizeof(struct framelog_trailer))
+        goto bad;
+
+    fl = calloc(1, sizeof(struct framelog));
+    fl->map = map;
+    fl->data = data;
+    fl->footer = footer;
+    fl->blocks = (const struct framelog_block *)
+        (data + trailer->footer + sizeof(struct framelog_footer));
+    fl->first = malloc((footer.nblocks + 1) * sizeof(uint64_t));
+
+    /* Blocks have to tile the file and be in sample order */
+    for (uint32_t i = 0; i < footer.nblocks; i++) {
+        const struct framelog_block *b = &fl->blocks[i];
+
+        if ((b->offset != offset) || (0 == b->nframes) ||
+                (b->nframes > FRAMELOG_BLOCK_LEN) ||
+                (b->last_idx < b->first_idx) ||
+                (i && (b->first_idx < fl->blocks[i - 1].last_idx))) {
+            free(fl->first);
+            free(fl);
+            goto bad;
+        }
+        fl->first[i] = nframes;
+        nframes += b->nframes;
+        offset += b->len;
+    }
+    fl->first[footer.nblocks] = nframes;
+
+    if ((offset != trailer->footer) || (nframes != footer.nframes)) {
+        free(fl->first);
+        free(fl);
+        goto bad;
+    }
+
+    *new_fl = fl;
+    return 0;
+
+bad:
+    file_map_dropref(map);
+    errno = EILSEQ;
+    return -1;
+}
+
+void framelog_close(framelog_t *fl)
+{
+    if (NULL == fl)
+        return;
+
+    file_map_dropref(fl->map);
+    free(fl->first);
+    free(fl);
+}
+
+uint64_t framelog_get_nframes(framelog_t *fl)
+{
+    return fl->footer.nframes;
+}
+
+uint32_t framelog_get_nblocks(framelog_t *fl)
+{
+    return fl->footer.nblocks;
+}
+
+/* Function: framelog_get_block_info
+ *
+ * Looks up a block in the index.
+ *
+ * Returns:
+ *  0 on success, -1 with errno set to EINVAL if there's no such block
+ */
+int framelog_get_block_info(framelog_t *fl, uint32_t block,
+    struct framelog_block_info *info)
+{
+    const struct framelog_block *b;
+
+    if (block >= fl->footer.nblocks) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    b = &fl->blocks[block];
+    *info = (struct framelog_block_info) {
+        .first = fl->first[block],
+        .nframes = b->nframes,
+        .first_idx = b->first_idx,
+        .last_idx = b->last_idx,
+        .len = b->len,
+    };
+
+    return 0;
+}
+
+/* Decodes a block into columns; returns false if it's corrupt */
+static bool decode_block(framelog_t *fl, uint32_t block, uint64_t *idx,
+    int32_t *type, uint8_t *len, union proto_payload *data)
+{
+    const struct framelog_block *b = &fl->blocks[block];
+    const uint8_t *p = fl->data + b->offset;
+    const uint8_t *end = p + b->len;
+    uint64_t cur = b->first_idx;
+
+    for (uint32_t i = 0; i < b->nframes; i++) {
+        uint64_t delta, code;
+
+        if (!get_varint(&p, end, &delta) || !get_varint(&p, end, &code))
+            return false;
+
+        cur += delta;
+        idx[i] = cur;
+        type[i] = unzigzag(code >> LEN_BITS);
+        len[i] = code & ((1 << LEN_BITS) - 1);
+        if ((len[i] > PROTO_DFRAME_INLINE) || (end - p < len[i]))
+            return false;
+        memcpy(data[i].bytes, p, len[i]);
+        p += len[i];
+    }
+
+    return (p == end) && (cur == b->last_idx);
+}
+
+/* First block with frames at or after sample idx */
+static uint32_t find_block(framelog_t *fl, uint64_t idx)
+{
+    uint32_t lo = 0, hi = fl->footer.nblocks;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (fl->blocks[mid].last_idx < idx)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/* Function: framelog_replay
+ *
+ * Decodes the frames from sample begin up to, but not including,
+ * sample end, and hands them to a sink a block at a time.  The index
+ * is used to skip straight to the first block in the range.
+ *
+ * Parameters:
+ *  fl - frame log
+ *  begin - first sample index
+ *  end - sample index past the last
+ *  sink - called once per batch of frames, in order
+ *  udata - passed to the sink
+ *
+ * Returns:
+ *  0 if the whole range was replayed, what the sink returned if it
+ *  stopped the replay, or -1 with errno set to EILSEQ if a block is
+ *  corrupt
+ *
+ * See Also:
+ *  <proto_foreach>
+ */
+int framelog_replay(framelog_t *fl, uint64_t begin, uint64_t end,
+    proto_sink_t sink, void *udata)
+{
+    struct {
+        uint64_t idx[FRAMELOG_BLOCK_LEN];
+        int32_t type[FRAMELOG_BLOCK_LEN];
+        uint8_t len[FRAMELOG_BLOCK_LEN];
+        union proto_payload data[FRAMELOG_BLOCK_LEN];
+    } *cols;
+    int rc = 0;
+
+    if (end <= begin)
+        return 0;
+
+    cols = malloc(sizeof(*cols));
+    for (uint32_t i = find_block(fl, begin);
+            (i < fl->footer.nblocks) && (fl->blocks[i].first_idx < end); i++) {
+        const struct framelog_block *b = &fl->blocks[i];
+        size_t lo = 0, hi = b->nframes;
+        struct proto_batch batch;
+
+        if (!decode_block(fl, i, cols->idx, cols->type, cols->len, cols->data)) {
+            errno = EILSEQ;
+            rc = -1;
+            break;
+        }
+
+        /* Only the first and last blocks can be partly out of range */
+        while ((lo < hi) && (cols->idx[lo] < begin))
+            lo++;
+        while ((hi > lo) && (cols->idx[hi - 1] >= end))
+            hi--;
+        if (lo == hi)
+            continue;
+
+        batch = (struct proto_batch) {
+            .first = fl->first[i] + lo,
+            .n = hi - lo,
+            .idx = &cols->idx[lo],
+            .type = &cols->type[lo],
+            .len = &cols->len[lo],
+            .data = &cols->data[lo],
+        };
+        rc = sink(&batch, udata);
+        if (rc)
+            break;
+    }
+
+    free(cols);
+    return rc;
+}
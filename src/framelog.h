@@ -0,0 +1,76 @@
+/* File: framelog.h
+ *
+ * Compact, seekable logs of decoded frames (headers)
+ *
+ * Author: Jack Bradach <jack@bradach.net>
+ *
+ * Copyright (C) 2016 Jack Bradach <jack@bradach.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _FRAMELOG_H_
+#define _FRAMELOG_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "framesink.h"
+#include "proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Frames per block; blocks are the unit the index can seek to */
+#define FRAMELOG_BLOCK_LEN 4096
+
+typedef struct framelog framelog_t;
+
+/* Struct: framelog_block_info
+ *
+ * What the index knows about a block without having to decode it.
+ *
+ * Fields:
+ *  first - number of the block's first frame, counting from zero
+ *  nframes - frames in the block
+ *  first_idx - sample index of the block's first frame
+ *  last_idx - sample index of the block's last frame
+ *  len - bytes the block takes in the file
+ */
+struct framelog_block_info {
+    uint64_t first;
+    uint32_t nframes;
+    uint64_t first_idx;
+    uint64_t last_idx;
+    uint32_t len;
+};
+
+frame_sink_t *framelog_sink(FILE *fp);
+
+int framelog_open(FILE *fp, framelog_t **fl);
+void framelog_close(framelog_t *fl);
+
+uint64_t framelog_get_nframes(framelog_t *fl);
+uint32_t framelog_get_nblocks(framelog_t *fl);
+int framelog_get_block_info(framelog_t *fl, uint32_t block,
+    struct framelog_block_info *info);
+
+int framelog_replay(framelog_t *fl, uint64_t begin, uint64_t end,
+    proto_sink_t sink, void *udata);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,339 @@
+/* File: framesink.c
+ *
+ * Destinations for decoded frames
+ *
+ * A decoder hands each frame it finds to a sink, and the sink decides
+ * where it goes: into a proto in memory, out to a frame log (see
+ * framelog.c), or across a queue to another thread that passes it on
+ * to a sink of its own.  With a frame log or queue sink, decoding runs
+ * in constant memory however long the capture is.
+ *
+ * Author: Jack Bradach <jack@bradach.net>
+ *
+ * Copyright (C) 2016 Jack Bradach <jack@bradach.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "framesink.h"
+#include "proto.h"
+#include "refcnt.h"
+
+/* Times to yield before a waiting queue end starts sleeping */
+#define QUEUE_SPINS 64
+#define QUEUE_SLEEP_NS 100000
+
+/* Function: frame_sink_put
+ *
+ * Hands a frame to a sink.
+ *
+ * Parameters:
+ *  s - sink
+ *  idx - sample index of the frame
+ *  type - protocol-specific frame type
+ *  data - payload; may be NULL if len is zero
+ *  len - payload bytes, up to PROTO_DFRAME_INLINE
+ *
+ * Returns:
+ *  0 on success, or -1 with errno set
+ */
+int frame_sink_put(struct frame_sink *s, uint64_t idx, int type,
+    const void *data, size_t len)
+{
+    if (len > PROTO_DFRAME_INLINE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return s->put(s, idx, type, data, len);
+}
+
+/* Function: frame_sink_flush
+ *
+ * Waits for every frame put so far to reach wherever the sink sends
+ * them.
+ *
+ * Returns:
+ *  0 on success, or -1 with errno set if any frame couldn't be stored
+ */
+int frame_sink_flush(struct frame_sink *s)
+{
+    return s->flush(s);
+}
+
+/* Function: frame_sink_close
+ *
+ * Flushes and frees a sink, along with any sink it passes frames on to.
+ *
+ * Returns:
+ *  0 on success, or -1 with errno set if any frame couldn't be stored
+ */
+int frame_sink_close(struct frame_sink *s)
+{
+    if (NULL == s)
+        return 0;
+
+    return s->close(s);
+}
+
+/* In-memory sink: frames are added to a proto, as decoders always did */
+struct proto_sink {
+    struct frame_sink s;
+    proto_t *pr;
+};
+
+static int proto_sink_put(struct frame_sink *s, uint64_t idx, int type,
+    const void *data, size_t len)
+{
+    struct proto_sink *ps = container_of(s, struct proto_sink, s);
+
+    proto_add_dframe_inline(ps->pr, idx, type, data, len);
+    return 0;
+}
+
+static int proto_sink_flush(struct frame_sink *s)
+{
+    return 0;
+}
+
+static int proto_sink_close(struct frame_sink *s)
+{
+    struct proto_sink *ps = container_of(s, struct proto_sink, s);
+
+    proto_dropref(ps->pr);
+    free(ps);
+    return 0;
+}
+
+/* Function: frame_sink_proto
+ *
+ * Creates a sink that adds frames to a proto, keeping a reference to it
+ * until the sink's closed.
+ */
+struct frame_sink *frame_sink_proto(proto_t *pr)
+{
+    struct proto_sink *ps = calloc(1, sizeof(struct proto_sink));
+
+    ps->s = (struct frame_sink) {
+        proto_sink_put, proto_sink_flush, proto_sink_close };
+    ps->pr = proto_addref(pr);
+
+    return &ps->s;
+}
+
+/* Queue sink: frames go into a single-producer, single-consumer ring
+ * that a thread of the sink's own drains into the next sink.  The
+ * producer only ever writes head and the consumer only ever writes
+ * tail, so neither needs a lock; each just waits (yielding, then
+ * sleeping) while the ring's full or empty.
+ */
+struct queued_frame {
+    uint64_t idx;
+    int32_t type;
+    uint8_t len;
+    uint8_t data[PROTO_DFRAME_INLINE];
+};
+
+struct queue_sink {
+    struct frame_sink s;
+    struct frame_sink *next;
+    struct queued_frame *ring;
+    size_t mask;
+    _Atomic size_t head;
+    _Atomic size_t tail;
+    _Atomic bool done;
+    _Atomic int err;
+    pthread_t thread;
+};
+
+static void queue_wait(unsigned *spins)
+{
+    if (++(*spins) < QUEUE_SPINS) {
+        sched_yield();
+    } else {
+        struct timespec ts = { 0, QUEUE_SLEEP_NS };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void *queue_consumer(void *arg)
+{
+    struct queue_sink *qs = arg;
+    size_t tail = atomic_load_explicit(&qs->tail, memory_order_relaxed);
+    unsigned spins = 0;
+
+    for (;;) {
+        size_t head = atomic_load_explicit(&qs->head, memory_order_acquire);
+
+        if (head == tail) {
+            /* Only quit once the ring's drained after done was set */
+            if (atomic_load_explicit(&qs->done, memory_order_acquire) &&
+                    (tail == atomic_load_explicit(&qs->head, memory_order_acquire)))
+                break;
+            queue_wait(&spins);
+            continue;
+        }
+
+        spins = 0;
+        for (; tail != head; tail++) {
+            struct queued_frame *f = &qs->ring[tail & qs->mask];
+
+            if (qs->next->put(qs->next, f->idx, f->type, f->data, f->len)) {
+                int expected = 0;
+                atomic_compare_exchange_strong(&qs->err, &expected,
+                    errno ? errno : EIO);
+            }
+        }
+        atomic_store_explicit(&qs->tail, tail, memory_order_release);
+    }
+
+    return NULL;
+}
+
+static int queue_sink_put(struct frame_sink *s, uint64_t idx, int type,
+    const void *data, size_t len)
+{
+    struct queue_sink *qs = container_of(s, struct queue_sink, s);
+    size_t head = atomic_load_explicit(&qs->head, memory_order_relaxed);
+    struct queued_frame *f;
+    unsigned spins = 0;
+    int err = atomic_load_explicit(&qs->err, memory_order_relaxed);
+
+    if (err) {
+        errno = err;
+        return -1;
+    }
+
+    while ((head - atomic_load_explicit(&qs->tail, memory_order_acquire)) > qs->mask)
+        queue_wait(&spins);
+
+    f = &qs->ring[head & qs->mask];
+    f->idx = idx;
+    f->type = type;
+    f->len = len;
+    if (len)
+        memcpy(f->data, data, len);
+    atomic_store_explicit(&qs->head, head + 1, memory_order_release);
+
+    return 0;
+}
+
+static int queue_sink_flush(struct frame_sink *s)
+{
+    struct queue_sink *qs = container_of(s, struct queue_sink, s);
+    size_t head = atomic_load_explicit(&qs->head, memory_order_relaxed);
+    unsigned spins = 0;
+    int err;
+
+    while (atomic_load_explicit(&qs->tail, memory_order_acquire) != head)
+        queue_wait(&spins);
+
+    /* The consumer's done with the next sink until more frames come */
+    err = atomic_load(&qs->err);
+    if (!err && qs->next->flush(qs->next))
+        err = errno;
+
+    if (err) {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int queue_sink_close(struct frame_sink *s)
+{
+    struct queue_sink *qs = container_of(s, struct queue_sink, s);
+    int err;
+
+    atomic_store_explicit(&qs->done, true, memory_order_release);
+    pthread_join(qs->thread, NULL);
+
+    err = atomic_load(&qs->err);
+    if (qs->next->close(qs->next) && !err)
+        err = errno;
+
+    free(qs->ring);
+    free(qs);
+
+    if (err) {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Function: frame_sink_queue
+ *
+ * Creates a sink that passes frames to another sink on a thread of its
+ * own, so whatever the other sink does overlaps with decoding.  The
+ * queue takes the other sink over, and closes it when it's closed.
+ *
+ * Parameters:
+ *  next - sink the thread hands frames to
+ *  len - frames the queue can hold before the decoder waits for the
+ *        thread; rounded up to a power of two.  Zero picks
+ *        FRAME_SINK_QUEUE_LEN.
+ *
+ * Returns:
+ *  the sink, or NULL with errno set if the thread couldn't be started,
+ *  in which case next is still the caller's
+ */
+struct frame_sink *frame_sink_queue(struct frame_sink *next, size_t len)
+{
+    struct queue_sink *qs;
+    size_t cap = 1;
+    int rc;
+
+    if (NULL == next) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (0 == len)
+        len = FRAME_SINK_QUEUE_LEN;
+    while (cap < len)
+        cap <<= 1;
+
+    qs = calloc(1, sizeof(struct queue_sink));
+    qs->s = (struct frame_sink) {
+        queue_sink_put, queue_sink_flush, queue_sink_close };
+    qs->next = next;
+    qs->ring = malloc(cap * sizeof(struct queued_frame));
+    qs->mask = cap - 1;
+    atomic_init(&qs->head, 0);
+    atomic_init(&qs->tail, 0);
+    atomic_init(&qs->done, false);
+    atomic_init(&qs->err, 0);
+
+    rc = pthread_create(&qs->thread, NULL, queue_consumer, qs);
+    if (rc) {
+        free(qs->ring);
+        free(qs);
+        errno = rc;
+        return NULL;
+    }
+
+    return &qs->s;
+}
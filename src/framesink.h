@@ -0,0 +1,69 @@
+/* File: framesink.h
+ *
+ * Destinations for decoded frames (headers)
+ *
+ * Author: Jack Bradach <jack@bradach.net>
+ *
+ * Copyright (C) 2016 Jack Bradach <jack@bradach.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _FRAMESINK_H_
+#define _FRAMESINK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Frames a queue sink holds unless asked otherwise */
+#define FRAME_SINK_QUEUE_LEN 4096
+
+typedef struct frame_sink frame_sink_t;
+
+/* Struct: frame_sink
+ *
+ * What every kind of sink does.  Sinks defined elsewhere embed one of
+ * these and get back to themselves with container_of; frames only ever
+ * reach them through <frame_sink_put> and friends.
+ *
+ * Fields:
+ *  put - takes a frame
+ *  flush - pushes out anything the sink is holding on to
+ *  close - flushes and frees the sink
+ */
+struct frame_sink {
+    int (*put)(struct frame_sink *s, uint64_t idx, int type,
+        const void *data, size_t len);
+    int (*flush)(struct frame_sink *s);
+    int (*close)(struct frame_sink *s);
+};
+
+frame_sink_t *frame_sink_proto(proto_t *pr);
+frame_sink_t *frame_sink_queue(frame_sink_t *next, size_t len);
+
+int frame_sink_put(frame_sink_t *s, uint64_t idx, int type,
+    const void *data, size_t len);
+int frame_sink_flush(frame_sink_t *s);
+int frame_sink_close(frame_sink_t *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -93,7 +93,7 @@ static void draw_view(view_t *v)
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, views_get_vbo_idx(v));
-    glDrawElements(GL_LINE_STRIP, views_get_width(v), GL_UNSIGNED_INT, NULL);
+    glDrawElements(GL_LINE_STRIP, views_get_nvertices(v), GL_UNSIGNED_INT, NULL);
     glDisableVertexAttribArray(0);
     glUseProgram(0);
     glPopMatrix();
@@ -118,7 +118,10 @@ static void gui_views_from_fp(FILE *fp)
     cap_bundle_t *b1, *b2, *old;
     struct pav_opts *opts = g->opts;
 
-    saleae_import_analog(fp, &b1);
+    if (pav_import(opts, &b1)) {
+        perror("Unable to import capture");
+        exit(EXIT_FAILURE);
+    }
 
     b2 = cap_bundle_create();
     for (int i = 0; i < opts->duplicate + 1; i++) {
@@ -5,6 +5,11 @@
 #include "gui.h"
 #include "views.h"
 
+/* Past this many samples, a view is drawn as a min/max pair per column
+ * instead of a vertex per sample.
+ */
+#define VIEW_MAX_VERTICES 4096
+
 struct view {
     TAILQ_ENTRY(view) entry;
 
@@ -22,6 +27,7 @@ struct view {
     /* Parameters which affect rendering */
     GLuint vbo_vertices;
     GLuint vbo_idx;
+    unsigned nvertices;
     shader_t *shader;
     float line_width;
     struct {
@@ -76,6 +82,11 @@ GLuint views_get_vbo_vertices(view_t *v)
     return v->vbo_vertices;
 }
 
+unsigned views_get_nvertices(view_t *v)
+{
+    return v->nvertices;
+}
+
 float views_get_line_width(view_t *v)
 {
     return v->line_width;
@@ -227,14 +238,16 @@ struct view *view_from_ch(cap_t *c)
 
 static void views_update_vbo_range(view_t *v)
 {
-    GLsizeiptr len_idx = views_get_width(v) * sizeof(unsigned);
-    unsigned *idx = calloc(views_get_width(v), sizeof(unsigned));
+    GLsizeiptr len_idx = v->nvertices * sizeof(unsigned);
+    unsigned *idx = calloc(v->nvertices, sizeof(unsigned));
 
-    /* Regenerate the indices to match the view range */
-    for (unsigned i = v->begin, j = 0; i < v->end; i++, j++) {
-        idx[j] = i;
+    /* Regenerate the indices to match the vertices for the range */
+    for (unsigned i = 0; i < v->nvertices; i++) {
+        idx[i] = i;
     }
 
+    if (v->vbo_idx)
+        glDeleteBuffers(1, &v->vbo_idx);
     glGenBuffers(1, &v->vbo_idx);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, v->vbo_idx);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, len_idx, idx, GL_DYNAMIC_DRAW);
@@ -245,14 +258,15 @@ static void views_update_vbo_range(view_t *v)
 
 static void views_update_vbo_from_cap(view_t *v)
 {
-    GLsizeiptr len_vertices = 2 * cap_get_nsamples(v->cap) * sizeof(float);
+    GLsizeiptr len_vertices;
     float *points;
 
-    views_to_vertices(v, &points);
+    v->nvertices = views_to_vertices(v, &points);
+    len_vertices = 2 * v->nvertices * sizeof(float);
 
-    /* Bind vertices to a VBO; existing buffers look to get
-     * auto-cleaned when a different binding is set.
-     */
+    /* Bind vertices to a VBO */
+    if (v->vbo_vertices)
+        glDeleteBuffers(1, &v->vbo_vertices);
     glGenBuffers(1, &v->vbo_vertices);
     glBindBuffer(GL_ARRAY_BUFFER, v->vbo_vertices);
     glBufferData(GL_ARRAY_BUFFER, len_vertices, points, GL_STATIC_DRAW);
@@ -262,18 +276,56 @@ static void views_update_vbo_from_cap(view_t *v)
     v->flags &= ~VIEW_VBO_DIRTY;
 }
 
-void views_to_vertices(view_t *v, float **vertices)
+/* Builds the vertices for a view's range, with x scaled to the whole
+ * capture.  Zoomed in, that's a vertex per sample; zoomed out, it's a
+ * min/max pair per column, straight from the capture's min/max pyramid
+ * rather than walking every sample in range.  Returns the count.
+ */
+unsigned views_to_vertices(view_t *v, float **vertices)
 {
+    uint64_t width = views_get_width(v);
+    double nsamples = cap_get_nsamples(v->cap);
+    adc_cal_t *cal = cap_get_analog_cal(v->cap);
     float *points;
-    int idx, i;
-
-    points = calloc(2 * views_get_width(v), sizeof(float));
-    for (i = 0, idx = v->begin; idx < v->end; idx++, i++) {
-        points[(2 * i)] = (float) i / (float) views_get_width(v);
-        points[(2 * i) + 1] = cap_get_analog_voltage(v->cap, i);
+    unsigned n = 0;
+
+    if (width <= VIEW_MAX_VERTICES) {
+        struct cap_span *s = malloc(sizeof(struct cap_span));
+        float volts[CAP_SPAN_LEN];
+
+        points = calloc(2 * width, sizeof(float));
+        cap_span_init(s, v->cap, v->begin, v->end, CAP_GATHER_ANALOG);
+        while (cap_span_next(s)) {
+            adc_samples_to_voltage(s->analog, s->len, volts, cal);
+            for (size_t k = 0; k < s->len; k++, n++) {
+                points[(2 * n)] = (s->idx + k) / nsamples;
+                points[(2 * n) + 1] = volts[k];
+            }
+        }
+        free(s);
+    } else {
+        const unsigned ncols = VIEW_MAX_VERTICES / 2;
+        uint16_t *min = calloc(ncols, sizeof(uint16_t));
+        uint16_t *max = calloc(ncols, sizeof(uint16_t));
+
+        points = calloc(2 * VIEW_MAX_VERTICES, sizeof(float));
+        cap_get_analog_envelope(v->cap, v->begin, v->end, ncols, min, max);
+        for (unsigned i = 0; i < ncols; i++) {
+            float x = (v->begin + (width * i) / ncols) / nsamples;
+
+            points[(2 * n)] = x;
+            points[(2 * n) + 1] = adc_sample_to_voltage(min[i], cal);
+            n++;
+            points[(2 * n)] = x;
+            points[(2 * n) + 1] = adc_sample_to_voltage(max[i], cal);
+            n++;
+        }
+        free(min);
+        free(max);
     }
 
     *vertices = points;
+    return n;
 }
 
 void views_destroy(struct views *vl)
@@ -291,8 +343,10 @@ void views_destroy(struct views *vl)
 
 void views_refresh(struct view *v)
 {
-    /* New capture; a VBO needs to be created from it. */
-    if(v->flags & VIEW_VBO_DIRTY) {
+    /* New capture or range; the vertices only cover what's in view,
+     * so they need to be rebuilt for either.
+     */
+    if (v->flags & (VIEW_VBO_DIRTY | VIEW_DIRTY)) {
         views_update_vbo_from_cap(v);
     }
 
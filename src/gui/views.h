@@ -44,6 +44,7 @@ char *views_get_glyph(view_t *v);
 SDL_Texture *views_get_texture(view_t *v);
 GLuint views_get_vbo_idx(view_t *v);
 GLuint views_get_vbo_vertices(view_t *v);
+unsigned views_get_nvertices(view_t *v);
 float views_get_zoom(view_t *v);
 
 view_t *views_first(views_t *vl);
@@ -52,7 +53,7 @@ view_t *views_prev(view_t *v);
 view_t *views_last(views_t *vl);
 cap_t *views_get_cap(view_t *v);
 
-void views_to_vertices(view_t *v, float **vertices);
+unsigned views_to_vertices(view_t *v, float **vertices);
 
 void views_zoom_in(struct view *v);
 void views_zoom_out(struct view *v);
@@ -0,0 +1,839 @@
+/* File: gzindex.c
+ *
+ * Random access into gzip'd captures.  An index of access points is
+ * built by inflating the file once; each point records where a deflate
+ * block begins in both the compressed and uncompressed streams along
+ * with the 32K window needed to resume inflating from there.  The index
+ * can be stored in a sidecar file next to the capture so later runs can
+ * jump straight to the part of the capture they care about.
+ *
+ * This is the same scheme as zran.c from the zlib examples, extended to
+ * cope with files made of multiple gzip members.
+ *
+ * Author: Jack Bradach <jack@bradach.net>
+ *
+ * Copyright (C) 2016 Jack Bradach <jack@bradach.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "gzindex.h"
+#include "refcnt.h"
+
+#define GZINDEX_MAGIC "PAVGZIX2"
+#define GZINDEX_MAGIC_LEN 8
+
+/* Inflate window size; fixed by the deflate format */
+#define WINSIZE 32768
+
+/* Compressed bytes read from the file at a time */
+#define CHUNK (64 << 10)
+
+/* Window bits for inflateInit2() when expecting gzip headers */
+#define GZIP_WBITS (15 + 16)
+
+/* Struct: gzindex_point
+ *
+ * An access point into the compressed stream.
+ *
+ * Fields:
+ *  out - offset in the uncompressed data
+ *  in - offset in the compressed file of the first complete byte
+ *  bits - number of bits (1-7) of the byte before 'in' in the block
+ *  member - point is the start of a gzip member (no window needed)
+ *  zlen - length of the compressed window
+ *  window - deflate'd copy of the 32K of output preceding the point
+ */
+struct gzindex_point {
+    uint64_t out;
+    uint64_t in;
+    uint8_t bits;
+    uint8_t member;
+    uint32_t zlen;
+    uint8_t *window;
+};
+
+/* Struct: gzindex
+ *
+ * Fields:
+ *  span - minimum distance between access points
+ *  src_len - size of the compressed file
+ *  src_mtime - modification time of the compressed file, in nanoseconds
+ *  tail_in - offset just past the last gzip member's trailer
+ *  tail_crc - CRC-32 from the last member's trailer
+ *  tail_isize - ISIZE from the last member's trailer
+ *  len - total uncompressed length
+ *  npoints - access points in use
+ *  alloc - access points allocated
+ *  points - access points, sorted by offset
+ */
+struct gzindex {
+    struct refcnt rcnt;
+    uint64_t span;
+    uint64_t src_len;
+    uint64_t src_mtime;
+    uint64_t tail_in;
+    uint32_t tail_crc;
+    uint32_t tail_isize;
+    uint64_t len;
+    unsigned npoints;
+    unsigned alloc;
+    struct gzindex_point *points;
+};
+
+/* Struct: gzindex_cursor
+ *
+ * Sequential reader positioned somewhere in the middle of a gzip'd file.
+ *
+ * Fields:
+ *  idx - index the cursor was opened from
+ *  fd - descriptor of the compressed file; reads don't move its offset.
+ *  strm - inflate state
+ *  raw - strm is inflating a raw deflate stream (started at a block).
+ *  member_start - no output has been produced by the current member.
+ *  eof - end of the compressed data was reached
+ *  in_pos - offset of the next compressed byte to read
+ *  pos - uncompressed offset of the next byte returned
+ *  input - compressed input buffer
+ */
+struct gzindex_cursor {
+    gzindex_t *idx;
+    int fd;
+    z_stream strm;
+    bool raw;
+    bool member_start;
+    bool eof;
+    uint64_t in_pos;
+    uint64_t pos;
+    uint8_t input[CHUNK];
+};
+
+static gzindex_t *gzindex_create(uint64_t span);
+static void gzindex_free(const struct refcnt *ref);
+static void add_point(gzindex_t *idx, uint8_t bits, uint64_t in, uint64_t out,
+    unsigned left, const uint8_t *window);
+static int cursor_fill(gzindex_cursor_t *cur);
+static int cursor_skip_input(gzindex_cursor_t *cur, unsigned n);
+static bool fd_is_gzip(int fd);
+static uint64_t stat_mtime(const struct stat *st);
+static bool index_matches(gzindex_t *idx, FILE *gz);
+static bool points_valid(gzindex_t *idx);
+
+/* Function: gzindex_build
+ *
+ * Builds an index for a gzip'd file by inflating it once, dropping an
+ * access point at the first block boundary past every 'span' bytes of
+ * output and at the start of every gzip member.
+ *
+ * Parameters:
+ *  fp - gzip'd file; its stream position isn't disturbed.
+ *  span - minimum uncompressed distance between access points
+ *  idx - handle to the new index
+ *
+ * Returns:
+ *  0 on success, -1 on failure with errno set.
+ */
+int gzindex_build(FILE *fp, uint64_t span, gzindex_t **new_idx)
+{
+    z_stream strm = { 0 };
+    uint8_t *input, *window;
+    uint64_t totin = 0, totout = 0, last = 0, member_out = 0;
+    uint64_t in_off = 0;
+    unsigned nmembers = 0;
+    bool in_member = false;
+    struct stat st;
+    gzindex_t *idx;
+    int fd, rc;
+
+    if (NULL == fp) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    fd = fileno(fp);
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !fd_is_gzip(fd)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (Z_OK != inflateInit2(&strm, GZIP_WBITS)) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    idx = gzindex_create(span);
+    idx->src_len = st.st_size;
+    idx->src_mtime = stat_mtime(&st);
+    input = malloc(CHUNK);
+    window = calloc(WINSIZE, sizeof(uint8_t));
+
+    for (;;) {
+        if (0 == strm.avail_in) {
+            ssize_t n = pread(fd, input, CHUNK, in_off);
+            if (n < 0) {
+                goto fail;
+            } else if (0 == n) {
+                /* Ran out of file in the middle of a member? */
+                if (in_member && (0 == nmembers || totout != member_out))
+                    goto fail_data;
+                break;
+            }
+            in_off += n;
+            strm.avail_in = n;
+            strm.next_in = input;
+        }
+
+        if (!in_member) {
+            /* Member starts don't need a window to resume from */
+            if (0 == idx->npoints || totout - last >= span) {
+                add_point(idx, 0, totin, totout, 0, NULL);
+                idx->points[idx->npoints - 1].member = 1;
+                last = totout;
+            }
+            member_out = totout;
+            in_member = true;
+        }
+
+        if (0 == strm.avail_out) {
+            strm.avail_out = WINSIZE;
+            strm.next_out = window;
+        }
+
+        /* Inflate until the end of a block or the input runs dry */
+        totin += strm.avail_in;
+        totout += strm.avail_out;
+        rc = inflate(&strm, Z_BLOCK);
+        totin -= strm.avail_in;
+        totout -= strm.avail_out;
+
+        if (Z_NEED_DICT == rc || Z_DATA_ERROR == rc) {
+            /* Junk after the last member is ignored, same as gzip. */
+            if (nmembers > 0 && totout == member_out)
+                break;
+            goto fail_data;
+        } else if (Z_MEM_ERROR == rc) {
+            goto fail;
+        } else if (Z_STREAM_END == rc) {
+            /* Remembered so a sidecar can tell if the file's changed */
+            idx->tail_in = totin;
+            idx->tail_crc = strm.adler;
+            idx->tail_isize = totout - member_out;
+            nmembers++;
+            in_member = false;
+            inflateReset(&strm);
+            continue;
+        }
+
+        /* Bit 7 of data_type is set at the end of a block, bit 6 if it
+         * was the last block in the stream.
+         */
+        if ((strm.data_type & 128) && !(strm.data_type & 64) &&
+                (totout - last > span)) {
+            add_point(idx, strm.data_type & 7, totin, totout,
+                strm.avail_out, window);
+            last = totout;
+        }
+    }
+
+    idx->len = totout;
+    inflateEnd(&strm);
+    free(input);
+    free(window);
+    *new_idx = idx;
+    return 0;
+
+fail_data:
+    errno = EILSEQ;
+fail:
+    inflateEnd(&strm);
+    free(input);
+    free(window);
+    gzindex_dropref(idx);
+    return -1;
+}
+
+/* Function: gzindex_save
+ *
+ * Writes an index out to a (sidecar) file.
+ *
+ * Returns:
+ *  0 on success, -1 on failure.
+ */
+int gzindex_save(gzindex_t *idx, FILE *fp)
+{
+    size_t ok = 0;
+
+    if (NULL == idx || NULL == fp) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ok += fwrite(GZINDEX_MAGIC, GZINDEX_MAGIC_LEN, 1, fp);
+    ok += fwrite(&idx->span, sizeof(uint64_t), 1, fp);
+    ok += fwrite(&idx->src_len, sizeof(uint64_t), 1, fp);
+    ok += fwrite(&idx->src_mtime, sizeof(uint64_t), 1, fp);
+    ok += fwrite(&idx->tail_in, sizeof(uint64_t), 1, fp);
+    ok += fwrite(&idx->tail_crc, sizeof(uint32_t), 1, fp);
+    ok += fwrite(&idx->tail_isize, sizeof(uint32_t), 1, fp);
+    ok += fwrite(&idx->len, sizeof(uint64_t), 1, fp);
+    ok += fwrite(&idx->npoints, sizeof(uint32_t), 1, fp);
+    if (ok != 9)
+        goto fail;
+
+    for (unsigned i = 0; i < idx->npoints; i++) {
+        struct gzindex_point *p = &idx->points[i];
+        ok = 0;
+        ok += fwrite(&p->out, sizeof(uint64_t), 1, fp);
+        ok += fwrite(&p->in, sizeof(uint64_t), 1, fp);
+        ok += fwrite(&p->bits, sizeof(uint8_t), 1, fp);
+        ok += fwrite(&p->member, sizeof(uint8_t), 1, fp);
+        ok += fwrite(&p->zlen, sizeof(uint32_t), 1, fp);
+        if (p->zlen)
+            ok += fwrite(p->window, p->zlen, 1, fp);
+        else
+            ok++;
+        if (ok != 6)
+            goto fail;
+    }
+
+    if (fflush(fp))
+        goto fail;
+
+    return 0;
+
+fail:
+    errno = EIO;
+    return -1;
+}
+
+/* Function: gzindex_load
+ *
+ * Reads an index back in from a sidecar file.  The access points are
+ * checked for sanity before they're trusted.
+ *
+ * Parameters:
+ *  fp - sidecar file
+ *  gz - gzip'd file the index belongs to; if provided, the index is
+ *       rejected unless the file's size, modification time and last
+ *       member's trailer (CRC-32 and length) are the ones it was built
+ *       from.
+ *  idx - handle to the loaded index
+ *
+ * Returns:
+ *  0 on success, -1 on failure (ESTALE if the index is out of date,
+ *  EILSEQ if it's corrupt).
+ */
+int gzindex_load(FILE *fp, FILE *gz, gzindex_t **new_idx)
+{
+    char magic[GZINDEX_MAGIC_LEN];
+    uint64_t span, src_len, src_mtime, tail_in, len;
+    uint32_t tail_crc, tail_isize, npoints;
+    gzindex_t *idx;
+    size_t ok = 0;
+
+    if (NULL == fp) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    ok += fread(magic, GZINDEX_MAGIC_LEN, 1, fp);
+    ok += fread(&span, sizeof(uint64_t), 1, fp);
+    ok += fread(&src_len, sizeof(uint64_t), 1, fp);
+    ok += fread(&src_mtime, sizeof(uint64_t), 1, fp);
+    ok += fread(&tail_in, sizeof(uint64_t), 1, fp);
+    ok += fread(&tail_crc, sizeof(uint32_t), 1, fp);
+    ok += fread(&tail_isize, sizeof(uint32_t), 1, fp);
+    ok += fread(&len, sizeof(uint64_t), 1, fp);
+    ok += fread(&npoints, sizeof(uint32_t), 1, fp);
+    if (ok != 9 || memcmp(magic, GZINDEX_MAGIC, GZINDEX_MAGIC_LEN)) {
+        errno = EILSEQ;
+        return -1;
+    }
+
+    /* Every point starts at a different compressed byte, so there
+     * can't be more of them than the file has bytes.
+     */
+    if (0 == npoints || npoints > src_len ||
+            tail_in < 8 || tail_in > src_len) {
+        errno = EILSEQ;
+        return -1;
+    }
+
+    idx = gzindex_create(span);
+    idx->src_len = src_len;
+    idx->src_mtime = src_mtime;
+    idx->tail_in = tail_in;
+    idx->tail_crc = tail_crc;
+    idx->tail_isize = tail_isize;
+    idx->len = len;
+
+    if (gz && !index_matches(idx, gz)) {
+        gzindex_dropref(idx);
+        errno = ESTALE;
+        return -1;
+    }
+
+    idx->alloc = npoints;
+    idx->points = calloc(npoints, sizeof(struct gzindex_point));
+
+    for (unsigned i = 0; i < npoints; i++) {
+        struct gzindex_point *p = &idx->points[i];
+        ok = 0;
+        ok += fread(&p->out, sizeof(uint64_t), 1, fp);
+        ok += fread(&p->in, sizeof(uint64_t), 1, fp);
+        ok += fread(&p->bits, sizeof(uint8_t), 1, fp);
+        ok += fread(&p->member, sizeof(uint8_t), 1, fp);
+        ok += fread(&p->zlen, sizeof(uint32_t), 1, fp);
+        if (ok != 5 || p->zlen > compressBound(WINSIZE))
+            goto fail;
+        idx->npoints++;
+
+        if (p->zlen) {
+            p->window = malloc(p->zlen);
+            if (1 != fread(p->window, p->zlen, 1, fp))
+                goto fail;
+        }
+    }
+
+    if (!points_valid(idx))
+        goto fail;
+
+    *new_idx = idx;
+    return 0;
+
+fail:
+    gzindex_dropref(idx);
+    errno = EILSEQ;
+    return -1;
+}
+
+/* Function: gzindex_open_sidecar
+ *
+ * Loads the index sidecar for a capture, building (and trying to save)
+ * a new one if it's missing or stale.  Failing to write the sidecar
+ * isn't an error; the index just won't be reused next time.
+ *
+ * Parameters:
+ *  gz - the gzip'd capture
+ *  path - path to the capture; the sidecar lives at path + GZINDEX_SUFFIX
+ *  idx - handle to the index
+ *
+ * Returns:
+ *  0 on success, -1 on failure with errno set.
+ */
+int gzindex_open_sidecar(FILE *gz, const char *path, gzindex_t **idx)
+{
+    size_t len = strlen(path) + sizeof(GZINDEX_SUFFIX);
+    char *sidecar = calloc(len, sizeof(char));
+    FILE *fp;
+    int rc;
+
+    snprintf(sidecar, len, "%s%s", path, GZINDEX_SUFFIX);
+
+    fp = fopen(sidecar, "rb");
+    if (fp) {
+        rc = gzindex_load(fp, gz, idx);
+        fclose(fp);
+        if (0 == rc) {
+            free(sidecar);
+            return 0;
+        }
+    }
+
+    rc = gzindex_build(gz, GZINDEX_DEFAULT_SPAN, idx);
+    if (0 == rc) {
+        fp = fopen(sidecar, "wb");
+        if (fp) {
+            if (gzindex_save(*idx, fp)) {
+                fclose(fp);
+                remove(sidecar);
+            } else {
+                fclose(fp);
+            }
+        }
+    }
+
+    free(sidecar);
+    return rc;
+}
+
+gzindex_t *gzindex_addref(gzindex_t *idx)
+{
+    if (NULL == idx)
+        return NULL;
+
+    refcnt_inc(&idx->rcnt);
+    return idx;
+}
+
+void gzindex_dropref(gzindex_t *idx)
+{
+    if (NULL == idx)
+        return;
+
+    refcnt_dec(&idx->rcnt);
+}
+
+unsigned gzindex_nref(gzindex_t *idx)
+{
+    if (NULL == idx)
+        return 0;
+
+    return idx->rcnt.count;
+}
+
+/* Total length of the uncompressed data */
+uint64_t gzindex_get_len(gzindex_t *idx)
+{
+    return idx->len;
+}
+
+unsigned gzindex_get_npoints(gzindex_t *idx)
+{
+    return idx->npoints;
+}
+
+/* Function: gzindex_cursor_open
+ *
+ * Opens a sequential reader that starts at an arbitrary uncompressed
+ * offset.  Inflating resumes from the closest access point at or before
+ * the offset, so at most 'span' bytes are inflated and thrown away.
+ *
+ * Parameters:
+ *  idx - index for the file
+ *  fp - the gzip'd file; must stay open while the cursor is in use.
+ *  offset - uncompressed offset to start reading at
+ *  cur - handle to the new cursor
+ *
+ * Returns:
+ *  0 on success, -1 on failure with errno set.
+ */
+int gzindex_cursor_open(gzindex_t *idx, FILE *fp, uint64_t offset,
+    gzindex_cursor_t **new_cur)
+{
+    struct gzindex_point *p;
+    gzindex_cursor_t *cur;
+    unsigned lo, hi;
+
+    if (NULL == idx || NULL == fp || 0 == idx->npoints || offset > idx->len) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Find the last access point at or before the offset */
+    lo = 0;
+    hi = idx->npoints;
+    while (hi - lo > 1) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (idx->points[mid].out <= offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    p = &idx->points[lo];
+
+    cur = calloc(1, sizeof(struct gzindex_cursor));
+    cur->idx = gzindex_addref(idx);
+    cur->fd = fileno(fp);
+    cur->in_pos = p->in;
+    cur->pos = p->out;
+
+    if (p->member) {
+        inflateInit2(&cur->strm, GZIP_WBITS);
+        cur->member_start = true;
+    } else {
+        uint8_t *window = malloc(WINSIZE);
+        uLongf wlen = WINSIZE;
+
+        inflateInit2(&cur->strm, -15);
+        cur->raw = true;
+
+        if (p->bits) {
+            uint8_t c;
+            if (1 != pread(cur->fd, &c, 1, p->in - 1))
+                goto fail;
+            inflatePrime(&cur->strm, p->bits, c >> (8 - p->bits));
+        }
+
+        if (Z_OK != uncompress(window, &wlen, p->window, p->zlen) ||
+                WINSIZE != wlen) {
+            free(window);
+            goto fail;
+        }
+        inflateSetDictionary(&cur->strm, window, WINSIZE);
+        free(window);
+    }
+
+    /* Throw away everything between the access point and the offset */
+    while (cur->pos < offset) {
+        uint8_t discard[4096];
+        uint64_t n = offset - cur->pos;
+        if (n > sizeof(discard))
+            n = sizeof(discard);
+        if (gzindex_cursor_read(cur, discard, n) != n)
+            goto fail;
+    }
+
+    *new_cur = cur;
+    return 0;
+
+fail:
+    gzindex_cursor_close(cur);
+    errno = EIO;
+    return -1;
+}
+
+/* Function: gzindex_cursor_read
+ *
+ * Reads the next len uncompressed bytes from a cursor; this only comes
+ * up short at the end of the data.
+ *
+ * Returns:
+ *  Number of bytes read, or -1 on error.
+ */
+int64_t gzindex_cursor_read(gzindex_cursor_t *cur, void *buf, size_t len)
+{
+    z_stream *strm = &cur->strm;
+    uint8_t *dst = buf;
+    size_t total = 0;
+
+    while (total < len && !cur->eof) {
+        size_t n = len - total;
+        int rc;
+
+        if (0 == strm->avail_in) {
+            if (cursor_fill(cur) < 0)
+                return -1;
+            if (cur->eof)
+                break;
+        }
+
+        strm->next_out = dst + total;
+        strm->avail_out = (n > UINT_MAX) ? UINT_MAX : n;
+        n = strm->avail_out;
+        rc = inflate(strm, Z_NO_FLUSH);
+        n -= strm->avail_out;
+        total += n;
+        if (n)
+            cur->member_start = false;
+
+        if (Z_STREAM_END == rc) {
+            /* A raw stream doesn't eat the gzip trailer for us. */
+            if (cur->raw && cursor_skip_input(cur, 8))
+                return -1;
+            cur->raw = false;
+            cur->member_start = true;
+            inflateReset2(strm, GZIP_WBITS);
+        } else if (Z_DATA_ERROR == rc && cur->member_start && !cur->raw) {
+            /* Junk after the last member */
+            cur->eof = true;
+        } else if (Z_OK != rc && Z_BUF_ERROR != rc) {
+            errno = EIO;
+            return -1;
+        }
+    }
+
+    cur->pos += total;
+    return total;
+}
+
+/* Uncompressed offset of the next byte the cursor will return */
+uint64_t gzindex_cursor_tell(gzindex_cursor_t *cur)
+{
+    return cur->pos;
+}
+
+void gzindex_cursor_close(gzindex_cursor_t *cur)
+{
+    if (NULL == cur)
+        return;
+
+    inflateEnd(&cur->strm);
+    gzindex_dropref(cur->idx);
+    free(cur);
+}
+
+static gzindex_t *gzindex_create(uint64_t span)
+{
+    gzindex_t *idx = calloc(1, sizeof(struct gzindex));
+    idx->rcnt = (struct refcnt) { gzindex_free, 1 };
+    idx->span = span;
+    return idx;
+}
+
+static void gzindex_free(const struct refcnt *ref)
+{
+    gzindex_t *idx =
+        container_of(ref, struct gzindex, rcnt);
+
+    for (unsigned i = 0; i < idx->npoints; i++) {
+        free(idx->points[i].window);
+    }
+    free(idx->points);
+    free(idx);
+}
+
+/* Appends an access point.  'left' is the free space in the circular
+ * window buffer, which tells us where the most recent output wraps.
+ */
+static void add_point(gzindex_t *idx, uint8_t bits, uint64_t in, uint64_t out,
+    unsigned left, const uint8_t *window)
+{
+    struct gzindex_point *p;
+
+    if (idx->npoints == idx->alloc) {
+        idx->alloc = idx->alloc ? idx->alloc * 2 : 16;
+        idx->points = realloc(idx->points,
+            idx->alloc * sizeof(struct gzindex_point));
+    }
+
+    p = &idx->points[idx->npoints++];
+    *p = (struct gzindex_point) { .out = out, .in = in, .bits = bits };
+
+    if (window) {
+        uint8_t *linear = malloc(WINSIZE);
+        uLongf zlen = compressBound(WINSIZE);
+
+        /* Unroll the circular buffer so the oldest byte comes first */
+        if (left)
+            memcpy(linear, window + WINSIZE - left, left);
+        if (left < WINSIZE)
+            memcpy(linear + left, window, WINSIZE - left);
+
+        p->window = malloc(zlen);
+        compress2(p->window, &zlen, linear, WINSIZE, Z_BEST_SPEED);
+        p->window = realloc(p->window, zlen);
+        p->zlen = zlen;
+        free(linear);
+    }
+}
+
+/* Refills the cursor's input buffer, flagging EOF at the end of file. */
+static int cursor_fill(gzindex_cursor_t *cur)
+{
+    ssize_t n = pread(cur->fd, cur->input, CHUNK, cur->in_pos);
+
+    if (n < 0) {
+        errno = EIO;
+        return -1;
+    } else if (0 == n) {
+        cur->eof = true;
+        return 0;
+    }
+
+    cur->in_pos += n;
+    cur->strm.next_in = cur->input;
+    cur->strm.avail_in = n;
+    return 0;
+}
+
+/* Discards n bytes of compressed input */
+static int cursor_skip_input(gzindex_cursor_t *cur, unsigned n)
+{
+    while (n) {
+        unsigned skip;
+
+        if (0 == cur->strm.avail_in) {
+            if (cursor_fill(cur) < 0 || cur->eof) {
+                errno = EIO;
+                return -1;
+            }
+        }
+
+        skip = (n < cur->strm.avail_in) ? n : cur->strm.avail_in;
+        cur->strm.next_in += skip;
+        cur->strm.avail_in -= skip;
+        n -= skip;
+    }
+    return 0;
+}
+
+static bool fd_is_gzip(int fd)
+{
+    uint8_t magic[2];
+
+    if (pread(fd, magic, sizeof(magic), 0) != sizeof(magic))
+        return false;
+
+    return (0x1f == magic[0]) && (0x8b == magic[1]);
+}
+
+static uint64_t stat_mtime(const struct stat *st)
+{
+    return (uint64_t) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+/* Does the gzip'd file still look like the one the index was built
+ * from?  A file rewritten with the same size (recompressed, or edited
+ * in place) gets caught by its mtime or its last member's trailer.
+ */
+static bool index_matches(gzindex_t *idx, FILE *gz)
+{
+    int fd = fileno(gz);
+    uint8_t trailer[8];
+    uint32_t crc, isize;
+    struct stat st;
+
+    if (fstat(fd, &st) || ((uint64_t) st.st_size != idx->src_len) ||
+            (stat_mtime(&st) != idx->src_mtime))
+        return false;
+
+    if (pread(fd, trailer, sizeof(trailer), idx->tail_in - 8) !=
+            sizeof(trailer))
+        return false;
+
+    /* Trailer fields are little-endian whatever the host is */
+    crc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) |
+        ((uint32_t) trailer[3] << 24);
+    isize = trailer[4] | (trailer[5] << 8) | (trailer[6] << 16) |
+        ((uint32_t) trailer[7] << 24);
+
+    return (crc == idx->tail_crc) && (isize == idx->tail_isize);
+}
+
+/* Access points have to start at the beginning of the file and move
+ * forward through both streams without running off the end of either.
+ */
+static bool points_valid(gzindex_t *idx)
+{
+    for (unsigned i = 0; i < idx->npoints; i++) {
+        struct gzindex_point *p = &idx->points[i];
+
+        if ((p->out > idx->len) || (p->in > idx->src_len) || (p->bits > 7))
+            return false;
+
+        /* Only member starts can resume without a window */
+        if (!p->member && (0 == p->zlen))
+            return false;
+
+        if (0 == i) {
+            if (p->out || p->in || !p->member)
+                return false;
+        } else if ((p->out < p[-1].out) || (p->in <= p[-1].in)) {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,62 @@
+/* File: gzindex.h
+ *
+ * Random access into gzip'd captures (headers)
+ *
+ * Author: Jack Bradach <jack@bradach.net>
+ *
+ * Copyright (C) 2016 Jack Bradach <jack@bradach.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _GZINDEX_H_
+#define _GZINDEX_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Default distance between access points, in uncompressed bytes. */
+#define GZINDEX_DEFAULT_SPAN (4 << 20)
+
+/* Suffix appended to a capture's path to name its index sidecar. */
+#define GZINDEX_SUFFIX ".gzidx"
+
+typedef struct gzindex gzindex_t;
+typedef struct gzindex_cursor gzindex_cursor_t;
+
+int gzindex_build(FILE *fp, uint64_t span, gzindex_t **idx);
+int gzindex_save(gzindex_t *idx, FILE *fp);
+int gzindex_load(FILE *fp, FILE *gz, gzindex_t **idx);
+int gzindex_open_sidecar(FILE *gz, const char *path, gzindex_t **idx);
+
+gzindex_t *gzindex_addref(gzindex_t *idx);
+void gzindex_dropref(gzindex_t *idx);
+unsigned gzindex_nref(gzindex_t *idx);
+
+uint64_t gzindex_get_len(gzindex_t *idx);
+unsigned gzindex_get_npoints(gzindex_t *idx);
+
+int gzindex_cursor_open(gzindex_t *idx, FILE *fp, uint64_t offset, gzindex_cursor_t **cur);
+int64_t gzindex_cursor_read(gzindex_cursor_t *cur, void *buf, size_t len);
+uint64_t gzindex_cursor_tell(gzindex_cursor_t *cur);
+void gzindex_cursor_close(gzindex_cursor_t *cur);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
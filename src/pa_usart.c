@@ -28,6 +28,7 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "framesink.h"
 #include "pa_usart.h"
 #include "proto.h"
 
@@ -84,6 +85,9 @@ struct pa_usart_state {
  *      bit_time - time between bits in microseconds.  This will be
  *                 calculated automatically by default.
  *      state - USART decoder state machine vars
+ *      sink - where decoded frames go
+ *      sink_is_pr - whether sink just adds frames to pr
+ *      sink_err - first error the sink gave back, if any
  */
 struct pa_usart_ctx {
     uint32_t mask_usart;
@@ -91,6 +95,9 @@ struct pa_usart_ctx {
     enum usart_parity parity;
     float sample_period;
     proto_t *pr;
+    frame_sink_t *sink;
+    bool sink_is_pr;
+    int sink_err;
     struct pa_usart_state *state;
     uint64_t sample_cnt;
     uint64_t decode_cnt;
@@ -129,7 +136,9 @@ void pa_usart_decode_stream(struct pa_usart_ctx *ctx, uint32_t raw)
 /* Function: pa_usart_decode_chunk
  *
  * Public interface to the USART chunk decoder; same idea as them
- * stream but it works on all samples in a capture.
+ * stream but it works on all samples in a capture.  Samples are pulled
+ * a span at a time, and while the line sits idle at mark the decoder
+ * skips straight to the next space.
  *
  * Parameters:
  *      ctx - Handle to a USART decode context.
@@ -142,11 +151,62 @@ void pa_usart_decode_stream(struct pa_usart_ctx *ctx, uint32_t raw)
 void pa_usart_decode_chunk(struct pa_usart_ctx *ctx, cap_t *cap)
 {
     struct timespec ts_start, ts_end, ts_delta;
+    struct cap_span *s = malloc(sizeof(struct cap_span));
 
     clock_gettime(CLOCK_MONOTONIC, &ts_start);
-    for (uint64_t i = 0; i < cap_get_nsamples(cap); i++) {
-        stream_decoder(ctx, cap_get_digital(cap, i));
+    cap_span_init(s, cap, 0, cap_get_nsamples(cap), CAP_GATHER_DIGITAL);
+    while (cap_span_next(s)) {
+        const uint8_t *d = s->digital;
+        const uint8_t *end = d + s->len;
+
+        while (d < end) {
+            /* Idle at mark, the state machine does nothing but count */
+            if (USART_SM_IDLE == ctx->state->sm) {
+                const uint8_t *space = memchr(d, USART_PA_SPACE, end - d);
+
+                if (NULL == space)
+                    space = end;
+                ctx->sample_cnt += space - d;
+                d = space;
+                if (d == end)
+                    break;
+            }
+            stream_decoder(ctx, *d++);
+        }
     }
+    free(s);
+    clock_gettime(CLOCK_MONOTONIC, &ts_end);
+
+    ts_delta = ts_diff(&ts_start, &ts_end);
+
+    ctx->elapsed = ts_add(&ctx->elapsed, &ts_delta);
+}
+
+/* Function: pa_usart_decode_bundle
+ *
+ * Decodes a bundle of captures as if they had been sampled together,
+ * with the data line picked out by its physical channel rather than
+ * by being the only capture handed over.
+ *
+ * Parameters:
+ *      ctx - Handle to a USART decode context.
+ *      bun - bundle holding the mapped channel
+ */
+void pa_usart_decode_bundle(struct pa_usart_ctx *ctx, cap_bundle_t *bun)
+{
+    struct timespec ts_start, ts_end, ts_delta;
+    struct cap_words it;
+    const uint32_t *words;
+    uint64_t idx, n;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts_start);
+    cap_bundle_words_init(&it, bun, 0, UINT64_MAX);
+    while (NULL != (words = cap_bundle_words_next(&it, &idx, &n))) {
+        for (uint64_t i = 0; i < n; i++) {
+            stream_decoder(ctx, unswizzle_sample(ctx, words[i]));
+        }
+    }
+    cap_bundle_words_release(&it);
     clock_gettime(CLOCK_MONOTONIC, &ts_end);
 
     ts_delta = ts_diff(&ts_start, &ts_end);
@@ -410,6 +470,8 @@ int pa_usart_ctx_init(struct pa_usart_ctx **new_ctx)
     pr = proto_create();
     proto_set_note(pr, "USART");
     ctx->pr = pr;
+    ctx->sink = frame_sink_proto(pr);
+    ctx->sink_is_pr = true;
 
     *new_ctx = ctx;
     return 0;
@@ -435,6 +497,8 @@ void pa_usart_ctx_cleanup(struct pa_usart_ctx *ctx)
         ctx->state = 0;
     }
 
+    frame_sink_close(ctx->sink);
+
     if (ctx->pr) {
         proto_dropref(ctx->pr);
     }
@@ -442,26 +506,32 @@ void pa_usart_ctx_cleanup(struct pa_usart_ctx *ctx)
     free(ctx);
 }
 
+/* Hands a frame to the sink, remembering the first one it couldn't take */
+static void usart_put_dframe(struct pa_usart_ctx *c, uint64_t idx, int type,
+    const void *data, size_t len)
+{
+    if (frame_sink_put(c->sink, idx, type, data, len) && !c->sink_err)
+        c->sink_err = errno ? errno : EIO;
+}
+
 static void usart_add_dframe_sof(struct pa_usart_ctx *c, uint64_t idx)
 {
-    proto_add_dframe(c->pr, idx, USART_DFRAME_SOF, NULL);
+    usart_put_dframe(c, idx, USART_DFRAME_SOF, NULL, 0);
 }
 
 static void usart_add_dframe_data(struct pa_usart_ctx *ctx, uint64_t idx, uint8_t data)
 {
-    uint8_t *c = calloc(1, sizeof(uint8_t));
-    *c = data;
-    proto_add_dframe(ctx->pr, idx, USART_DFRAME_DATA, c);
+    usart_put_dframe(ctx, idx, USART_DFRAME_DATA, &data, 1);
 }
 
 static void usart_add_dframe_eof(struct pa_usart_ctx *c, uint64_t idx)
 {
-    proto_add_dframe(c->pr, idx, USART_DFRAME_EOF, NULL);
+    usart_put_dframe(c, idx, USART_DFRAME_EOF, NULL, 0);
 }
 
 static void usart_add_dframe_error(struct pa_usart_ctx *c, uint64_t idx)
 {
-    proto_add_dframe(c->pr, idx, USART_DFRAME_ERROR, NULL);
+    usart_put_dframe(c, idx, USART_DFRAME_ERROR, NULL, 0);
 }
 
 proto_t *pa_usart_get_proto(struct pa_usart_ctx *c)
@@ -489,6 +559,47 @@ void pa_usart_reset(struct pa_usart_ctx *ctx)
     proto_set_note(new_pr, proto_get_note(ctx->pr));
     proto_dropref(ctx->pr);
     ctx->pr = new_pr;
+
+    if (ctx->sink_is_pr) {
+        frame_sink_close(ctx->sink);
+        ctx->sink = frame_sink_proto(new_pr);
+    }
+}
+
+/* Function: pa_usart_set_sink
+ *
+ * Sends decoded frames somewhere other than the context's proto, such
+ * as a file, so that decoding a long capture doesn't keep every frame
+ * in memory.  The context takes the sink over; the one it replaces is
+ * closed.  Frames sent to a sink don't show up in
+ * <pa_usart_get_decoded> or the report.
+ *
+ * Parameters:
+ *      ctx - usart context
+ *      sink - where frames go from now on, or NULL to go back to
+ *             keeping them in the context's proto
+ *
+ * Returns:
+ *      0 on success, or -1 with errno set if the old sink failed to
+ *      store any of its frames
+ */
+int pa_usart_set_sink(pa_usart_ctx_t *ctx, frame_sink_t *sink)
+{
+    int err = ctx->sink_err;
+
+    if (frame_sink_close(ctx->sink) && !err)
+        err = errno;
+
+    ctx->sink_is_pr = (NULL == sink);
+    ctx->sink = sink ? sink : frame_sink_proto(ctx->pr);
+    ctx->sink_err = 0;
+
+    if (err) {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
 }
 
 int pa_usart_ctx_map_data(pa_usart_ctx_t *ctx, uint8_t usart_bit)
@@ -525,32 +636,85 @@ int pa_usart_ctx_set_baud(struct pa_usart_ctx *ctx, uint64_t baud)
     return 0;
 }
 
+/* Collects the bytes from data frames, stopping when the buffer's full */
+struct usart_collect {
+    char *d;
+    uint64_t n;
+    uint64_t max;
+};
+
+static int usart_collect_data(const struct proto_batch *b, void *udata)
+{
+    struct usart_collect *uc = udata;
+
+    for (size_t i = 0; i < b->n; i++) {
+        const uint8_t *data;
+
+        if (uc->n == uc->max)
+            return 1;
+        if (USART_DFRAME_DATA != b->type[i])
+            continue;
+
+        /* Payloads may be inline or owned; frames without one are skipped */
+        data = proto_batch_udata(b, i);
+        if (data)
+            uc->d[uc->n++] = data[0];
+    }
+
+    return 0;
+}
+
 /* Returns any data captured as a null-terminated string.
  * String should be free'd when no longer needed.
  */
 uint64_t pa_usart_get_decoded(struct pa_usart_ctx *ctx, char **out)
 {
-    char *d = calloc(ctx->decode_cnt + 1, sizeof(char));
-    proto_dframe_t *df = proto_dframe_first(ctx->pr);
-    uint64_t bytes = 0;
+    struct usart_collect uc = { NULL, 0, ctx->decode_cnt };
 
-    if (NULL == df) {
+    if (0 == proto_get_nframes(ctx->pr)) {
         *out = NULL;
         return 0;
     }
 
-    while (bytes < ctx->decode_cnt) {
-        int type = proto_dframe_type(df);
-        if (USART_DFRAME_DATA == type) {
-            d[bytes] = *(uint8_t *) proto_dframe_udata(df);
-            bytes++;
-        }
-        df = proto_dframe_next(df);
+    uc.d = calloc(ctx->decode_cnt + 1, sizeof(char));
+    proto_foreach(ctx->pr, usart_collect_data, &uc);
+    *out = uc.d;
+
+    return uc.n;
+}
+
+/* Function: pa_usart_get_decoded_range
+ *
+ * Returns the data decoded from sample start up to, but not including,
+ * sample end, as a null-terminated string that should be free'd when
+ * no longer needed.  Only the frames in the range are looked at.
+ *
+ * Parameters:
+ *  ctx - usart context
+ *  start - first sample index
+ *  end - sample index past the last
+ *  out - where to put the string; NULL if nothing was decoded
+ *
+ * Returns:
+ *  bytes decoded in the range
+ */
+uint64_t pa_usart_get_decoded_range(pa_usart_ctx_t *ctx, uint64_t start,
+    uint64_t end, char **out)
+{
+    proto_dframe_t *df;
+    uint64_t nframes = proto_dframe_range(ctx->pr, start, end, &df);
+    struct usart_collect uc = { NULL, 0, nframes };
+
+    if (0 == nframes) {
+        *out = NULL;
+        return 0;
     }
 
-    *out = d;
+    uc.d = calloc(nframes + 1, sizeof(char));
+    proto_foreach_range(ctx->pr, start, end, usart_collect_data, &uc);
+    *out = uc.d;
 
-    return ctx->decode_cnt;
+    return uc.n;
 }
 
 static void fprintf_linebreak(FILE *fp, int n, const char c)
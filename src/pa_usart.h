@@ -25,6 +25,7 @@
 #include <stdint.h>
 
 #include "cap.h"
+#include "framesink.h"
 #include "proto.h"
 
 #ifdef __cplusplus
@@ -74,12 +75,14 @@ int pa_usart_ctx_set_baudrate(pa_usart_ctx_t *ctx, enum usart_baudrates baud);
 /* Proto container functions */
 proto_t *pa_usart_get_proto(pa_usart_ctx_t *ctx);
 void pa_usart_reset_proto(pa_usart_ctx_t *ctx);
+int pa_usart_set_sink(pa_usart_ctx_t *ctx, frame_sink_t *sink);
 
 void pa_usart_decode_stream(pa_usart_ctx_t *ctx, uint32_t raw);
 void pa_usart_decode_chunk(pa_usart_ctx_t *ctx, cap_t *cap);
+void pa_usart_decode_bundle(pa_usart_ctx_t *ctx, cap_bundle_t *bun);
 
 uint64_t pa_usart_get_decoded(struct pa_usart_ctx *ctx, char **out);
-void pa_usart_get_decoded_range(pa_usart_ctx_t *ctx, uint64_t start, uint64_t end, char **out);
+uint64_t pa_usart_get_decoded_range(pa_usart_ctx_t *ctx, uint64_t start, uint64_t end, char **out);
 
 void pa_usart_set_desc(struct pa_usart_ctx *c, const char *s);
 const char *pa_usart_get_desc(struct pa_usart_ctx *c);
@@ -30,8 +30,14 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <zlib.h>
+
+#include "bgzf.h"
+#include "framelog.h"
+#include "framesink.h"
 #include "pa_usart.h"
 #include "cap.h"
+#include "capfile.h"
 #include "saleae.h"
 #include "plot.h"
 
@@ -51,7 +57,29 @@ void do_usart_decode(struct pav_opts *opts)
     pa_usart_ctx_init(&usart);
     pa_usart_ctx_map_data(usart, 0);
     pa_usart_set_desc(usart, opts->fin_name);
-    saleae_import_analog(opts->fin, &bun);
+    if (pav_import(opts, &bun)) {
+        perror("Unable to import capture");
+        if (opts->frames)
+            fclose(opts->frames);
+        pa_usart_ctx_cleanup(usart);
+        return;
+    }
+
+    /* Frames go out to a frame log on their own thread as they're decoded */
+    if (opts->frames) {
+        frame_sink_t *fs = framelog_sink(opts->frames);
+        frame_sink_t *qs = fs ? frame_sink_queue(fs, 0) : NULL;
+
+        if (NULL == qs) {
+            perror("Unable to stream frames");
+            frame_sink_close(fs);
+            fclose(opts->frames);
+            cap_bundle_dropref(bun);
+            pa_usart_ctx_cleanup(usart);
+            return;
+        }
+        pa_usart_set_sink(usart, qs);
+    }
 
     cap = cap_bundle_first(bun);
     pa_usart_ctx_set_freq(usart, 1.0f/cap_get_period(cap));
@@ -59,11 +87,52 @@ void do_usart_decode(struct pav_opts *opts)
         pa_usart_decode_chunk(usart, cap);
     }
 
+    if (opts->frames) {
+        if (pa_usart_set_sink(usart, NULL))
+            perror("Unable to write frames");
+        fclose(opts->frames);
+    }
+
     pa_usart_fprint_report(opts->fout, usart);
 
+    cap_bundle_dropref(bun);
     pa_usart_ctx_cleanup(usart);
 }
 
+/* Rewrites the input capture as block gzip, which can be inflated
+ * on as many threads as there are.
+ */
+void do_bgzf(struct pav_opts *opts)
+{
+    if (bgzf_compress_file(opts->fin, opts->fout, Z_DEFAULT_COMPRESSION)) {
+        perror("Unable to write block gzip'd capture");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Imports the input capture and saves it in pav's own format, which
+ * loads back without any of the conversion work.
+ */
+void do_export(struct pav_opts *opts)
+{
+    struct capfile_opts co = { 0 };
+    cap_bundle_t *bun;
+
+    co.compress = opts->compress;
+    if (pav_import(opts, &bun)) {
+        perror("Unable to import capture");
+        exit(EXIT_FAILURE);
+    }
+
+    if (capfile_export(opts->fout, bun, &co)) {
+        perror("Unable to export capture");
+        cap_bundle_dropref(bun);
+        exit(EXIT_FAILURE);
+    }
+
+    cap_bundle_dropref(bun);
+}
+
 void do_plot_capture_to_png(struct pav_opts *opts)
 {
 #if 0
@@ -103,6 +172,10 @@ int main(int argc, char *argv[])
 
     parse_cmdline(argc, argv, &opts);
 
+    /* Applies to everything parallel, decompression included */
+    if (opts.nthreads)
+        omp_set_num_threads(opts.nthreads);
+
     switch (opts.op) {
         case PAV_OP_DECODE:
             do_usart_decode(&opts);
@@ -112,6 +185,14 @@ int main(int argc, char *argv[])
             do_plot_capture_to_png(&opts);
             break;
 
+        case PAV_OP_BGZF:
+            do_bgzf(&opts);
+            break;
+
+        case PAV_OP_EXPORT:
+            do_export(&opts);
+            break;
+
         case PAV_OP_GUI:
             pav_gui_start(&opts);
             break;
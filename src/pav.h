@@ -23,8 +23,12 @@
 #define _PAV_H_
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <limits.h>
 
+#include "cap.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -34,13 +38,17 @@ enum pav_op {
     PAV_OP_DECODE,
     PAV_OP_PLOTPNG,
     PAV_OP_GUI,
+    PAV_OP_BGZF,
+    PAV_OP_EXPORT,
     PAV_OP_VERSION
 };
 
 struct pav_opts {
     FILE *fin;
     FILE *fout;
+    FILE *frames;
     char fin_name[512];
+    char fin_path[512];
     char fout_name[512];
     enum pav_op op;
     unsigned nloops;
@@ -48,9 +56,17 @@ struct pav_opts {
     uint64_t range_end;
     uint64_t duplicate;
     uint64_t skew_us;
+    uint32_t ch_mask;
+    unsigned nthreads;
+    bool compress;
+    bool analog12;
+    float v_lo;
+    float v_hi;
     bool verbose;
 };
 
+int pav_import(struct pav_opts *opts, cap_bundle_t **bun);
+
 
 #ifdef __cplusplus
 }
@@ -37,12 +37,21 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state);
 static void set_op(struct argp_state *state, enum pav_op op);
 static bool opts_valid(struct pav_opts *opts);
 static void find_demo_capture(struct pav_opts *opts);
+static uint32_t parse_channels(struct argp_state *state, const char *arg);
+static void parse_thresholds(struct argp_state *state, const char *arg,
+    struct pav_opts *opts);
 
 enum opt_keys {
         OPT_KEY_INVALID = 1,
         OPT_KEY_DECODE,
         OPT_KEY_PLOTPNG,
         OPT_KEY_GUI,
+        OPT_KEY_BGZF,
+        OPT_KEY_EXPORT,
+        OPT_KEY_COMPRESS,
+        OPT_KEY_ANALOG12,
+        OPT_KEY_THRESHOLDS,
+        OPT_KEY_FRAMES,
         OPT_KEY_VERSION = 'V',
         OPT_KEY_VERBOSE = 'v',
         OPT_KEY_IN_FILENAME = 'i',
@@ -52,6 +61,8 @@ enum opt_keys {
         OPT_KEY_LOOPS = 'l',
         OPT_KEY_DUPLICATE = 'd',
         OPT_KEY_SKEW = 's',
+        OPT_KEY_CHANNELS = 'c',
+        OPT_KEY_THREADS = 't',
 
 };
 
@@ -67,6 +78,8 @@ static struct argp_option options[] =
     {"decode", OPT_KEY_DECODE, 0, 0, "Decode a USART capture"},
     {"plotpng", OPT_KEY_PLOTPNG, 0, 0, "Plot an analog capture to a PNG"},
     {"gui", OPT_KEY_GUI, 0, 0, "Interactive GUI mode"},
+    {"bgzf", OPT_KEY_BGZF, 0, 0, "Recompress a capture as block gzip, for faster loading"},
+    {"export", OPT_KEY_EXPORT, 0, 0, "Save a capture in pav's own format, for near-instant reloading"},
 
 //    {0, 0, 0, OPTION_DOC, "Requireds:", OPT_GROUP_REQUIRED},
 
@@ -75,7 +88,13 @@ static struct argp_option options[] =
     {"begin", OPT_KEY_RANGE_BEGIN, "IDX", OPTION_ARG_OPTIONAL, "Sample range begin (default zero)", OPT_GROUP_OPTIONAL},
     {"end", OPT_KEY_RANGE_END, "IDX", OPTION_ARG_OPTIONAL, "Sample range end (default last sample)", OPT_GROUP_OPTIONAL},
     {"duplicate", OPT_KEY_DUPLICATE, "NCHANNELS", OPTION_ARG_OPTIONAL, "Duplicates channel 0 'NCHANNELS' times", OPT_GROUP_OPTIONAL},
+    {"channels", OPT_KEY_CHANNELS, "LIST", 0, "Only import channels in comma-separated LIST (default all)", OPT_GROUP_OPTIONAL},
+    {"threads", OPT_KEY_THREADS, "NTHREADS", 0, "Use NTHREADS threads for importing (default one per core)", OPT_GROUP_OPTIONAL},
     {"skew", OPT_KEY_SKEW, "NSAMPLES", OPTION_ARG_OPTIONAL, "Skew each channel by CH_NUM * NSAMPLES", OPT_GROUP_OPTIONAL},
+    {"compress", OPT_KEY_COMPRESS, 0, 0, "Compress chunks when exporting", OPT_GROUP_OPTIONAL},
+    {"12bit", OPT_KEY_ANALOG12, 0, 0, "Store analog samples in 12 bits to save memory", OPT_GROUP_OPTIONAL},
+    {"thresholds", OPT_KEY_THRESHOLDS, "LO,HI", 0, "Logic thresholds in volts (default picked per channel from its levels)", OPT_GROUP_OPTIONAL},
+    {"frames", OPT_KEY_FRAMES, "FILE", 0, "Log decoded frames to FILE as they're found, instead of keeping them for the report", OPT_GROUP_OPTIONAL},
     {"verbose", OPT_KEY_VERBOSE, 0, OPTION_ARG_OPTIONAL, "Write additional information to stdout", OPT_GROUP_OPTIONAL},
 
     {0}
@@ -101,11 +120,21 @@ static void set_defaults(struct pav_opts *opts)
 
         opts->fin = NULL;
         opts->fout = NULL;
+        opts->frames = NULL;
+        opts->fin_name[0] = '\0';
+        opts->fin_path[0] = '\0';
+        opts->fout_name[0] = '\0';
         opts->nloops = 1;
         opts->range_begin = 0;
         opts->range_end = 0;
         opts->skew_us = 0;
         opts->duplicate = 0;
+        opts->ch_mask = 0;
+        opts->nthreads = 0;
+        opts->compress = false;
+        opts->analog12 = false;
+        opts->v_lo = 0.0f;
+        opts->v_hi = 0.0f;
 
         /* Is the capture file being piped in? */
         if (!isatty(fileno(stdin)))
@@ -140,6 +169,33 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
         set_op(state, PAV_OP_GUI);
         break;
 
+    case OPT_KEY_BGZF:
+        set_op(state, PAV_OP_BGZF);
+        break;
+
+    case OPT_KEY_EXPORT:
+        set_op(state, PAV_OP_EXPORT);
+        break;
+
+    case OPT_KEY_COMPRESS:
+        opts->compress = true;
+        break;
+
+    case OPT_KEY_ANALOG12:
+        opts->analog12 = true;
+        break;
+
+    case OPT_KEY_THRESHOLDS:
+        parse_thresholds(state, arg, opts);
+        break;
+
+    case OPT_KEY_FRAMES:
+        opts->frames = fopen(arg, "wb");
+        if (!opts->frames) {
+            argp_error(state, "Unable to open frame file '%s'", arg);
+        }
+        break;
+
     case OPT_KEY_RANGE_BEGIN:
         opts->range_begin = atoll(arg);
         break;
@@ -156,8 +212,20 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
         opts->skew_us = atoll(arg);
         break;
 
+    case OPT_KEY_CHANNELS:
+        opts->ch_mask = parse_channels(state, arg);
+        break;
+
+    case OPT_KEY_THREADS:
+        if (atoi(arg) < 1) {
+            argp_error(state, "Invalid thread count '%s'", arg);
+        }
+        opts->nthreads = atoi(arg);
+        break;
+
     case OPT_KEY_VERBOSE:
         g_verbose = true;
+        opts->verbose = true;
         break;
 
     case OPT_KEY_LOOPS:
@@ -170,6 +238,10 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
          */
         if (!opts->fin) {
             strncpy(opts->fin_name, arg, 64);
+            if (snprintf(opts->fin_path, sizeof(opts->fin_path), "%s", arg) >=
+                    (int) sizeof(opts->fin_path)) {
+                argp_error(state, "Input path '%s' is too long", arg);
+            }
             opts->fin = fopen(arg, "rb");
             if (!opts->fin) {
                 fprintf(stderr, "Unable to open input file '%s'!\n", arg);
@@ -257,8 +329,19 @@ static void find_demo_capture(struct pav_opts *opts)
     strncat(full, demo_path, 512);
     strncat(full, demo_file, 512);
 
+    /* The path is kept for finding the capture's index; don't use one
+     * that got cut short.
+     */
+    if (snprintf(opts->fin_path, sizeof(opts->fin_path), "%s", full) >=
+            (int) sizeof(opts->fin_path)) {
+        opts->fin_path[0] = '\0';
+        printf("Demo capture path < %s > is too long\n", full);
+        return;
+    }
+
     fp = fopen(full, "rb");
     if (!fp) {
+        opts->fin_path[0] = '\0';
         printf("Unable to find demo capture at < %s >\n", full);
         return;
     }
@@ -266,3 +349,43 @@ static void find_demo_capture(struct pav_opts *opts)
     opts->fin = fp;
     strncpy(opts->fin_name, demo_file, 512);
 }
+
+/* Turns a list of channel numbers like "0,2,3" into a channel mask. */
+static uint32_t parse_channels(struct argp_state *state, const char *arg)
+{
+    uint32_t mask = 0;
+    const char *s = arg;
+
+    while (*s) {
+        char *end;
+        long ch = strtol(s, &end, 10);
+
+        if ((end == s) || (ch < 0) || (ch > 31)) {
+            argp_error(state, "Invalid channel list '%s'", arg);
+        }
+        mask |= (1UL << ch);
+
+        s = end;
+        if (',' == *s)
+            s++;
+    }
+
+    return mask;
+}
+
+/* Parses a "LO,HI" pair of thresholds in volts */
+static void parse_thresholds(struct argp_state *state, const char *arg,
+    struct pav_opts *opts)
+{
+    char *mid, *end;
+
+    opts->v_lo = strtof(arg, &mid);
+    if ((mid == arg) || (',' != *mid)) {
+        argp_error(state, "Invalid thresholds '%s'", arg);
+    }
+
+    opts->v_hi = strtof(mid + 1, &end);
+    if ((end == mid + 1) || *end || (opts->v_hi < opts->v_lo)) {
+        argp_error(state, "Invalid thresholds '%s'", arg);
+    }
+}
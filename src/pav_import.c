@@ -0,0 +1,107 @@
+/* File: pav_import.c
+ *
+ * Protocol Analyzer Viewer - capture import, driven by the command line.
+ *
+ * Author: Jack Bradach <jack@bradach.net>
+ *
+ * Copyright (C) 2016 Jack Bradach <jack@bradach.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <stdio.h>
+
+#include "adc.h"
+#include "cap.h"
+#include "capfile.h"
+#include "pav.h"
+#include "saleae.h"
+
+static int import_capfile(struct pav_opts *opts, cap_bundle_t **bun);
+
+/* Function: pav_import
+ *
+ * Imports the input capture, restricted to the sample range and
+ * channels selected on the command line.  The input can be a Saleae
+ * analog export or a capture saved with --export.  In verbose mode,
+ * how long each stage of the import took is written to stderr.
+ *
+ * Parameters:
+ *  opts - parsed command line options
+ *  bun - handle to the new capture bundle
+ *
+ * Returns:
+ *  0 on success, -1 on failure with errno set.
+ */
+int pav_import(struct pav_opts *opts, cap_bundle_t **bun)
+{
+    struct saleae_timing t;
+    struct saleae_opts so = {
+        .begin = opts->range_begin,
+        .end = opts->range_end,
+        .ch_mask = opts->ch_mask,
+        .path = opts->fin_path[0] ? opts->fin_path : NULL,
+        .nthreads = opts->nthreads,
+        .timing = &t,
+        .analog12 = opts->analog12,
+        .v_lo = opts->v_lo,
+        .v_hi = opts->v_hi
+    };
+
+    if (capfile_detect(opts->fin))
+        return import_capfile(opts, bun);
+
+    if (saleae_import_analog_opts(opts->fin, &so, bun))
+        return -1;
+
+    if (opts->verbose) {
+        fprintf(stderr, "Imported %u channel(s) on %u thread(s) in %.1f ms\n",
+            cap_bundle_len(*bun), t.nthreads, t.total * 1E3);
+        fprintf(stderr, "    read    %9.1f ms\n", t.read * 1E3);
+        fprintf(stderr, "    convert %9.1f ms\n", t.convert * 1E3);
+        fprintf(stderr, "    adc     %9.1f ms\n", t.adc * 1E3);
+
+        for (cap_t *c = cap_bundle_first(*bun); c; c = cap_next(c)) {
+            adc_cal_t *cal = cap_get_analog_cal(c);
+            uint16_t v_lo, v_hi;
+
+            cap_get_adc_thresholds(c, &v_lo, &v_hi);
+            fprintf(stderr, "    ch %-2u thresholds %.2f V / %.2f V\n",
+                cap_get_physical_ch(c), adc_sample_to_voltage(v_lo, cal),
+                adc_sample_to_voltage(v_hi, cal));
+        }
+    }
+
+    return 0;
+}
+
+/* Loads a capture saved by pav itself; only the chunks in range are read. */
+static int import_capfile(struct pav_opts *opts, cap_bundle_t **bun)
+{
+    capfile_t *cf;
+    int rc;
+
+    if (capfile_open(opts->fin, &cf))
+        return -1;
+
+    rc = capfile_import(cf, opts->range_begin, opts->range_end,
+        opts->ch_mask, bun);
+    capfile_close(cf);
+
+    if (!rc && opts->verbose)
+        fprintf(stderr, "Loaded %u channel(s) from pav capture file\n",
+            cap_bundle_len(*bun));
+
+    return rc;
+}
@@ -39,6 +39,11 @@
 
 #define PLOT_LABEL_MAXLEN 64
 
+/* Past this many samples, a plot gets a min/max pair per column instead
+ * of a point per sample.
+ */
+#define PLOT_MAX_POINTS 4096
+
 struct plot {
     double *x, *y;
     double ymin, ymax;
@@ -69,6 +74,7 @@ void plot_from_view(view_t *v, struct plot **plot)
     cap_t *cap = views_get_cap(v);
     adc_cal_t *cal;
     uint64_t begin, end;
+    int64_t target;
 
     pl = plot_create();
 
@@ -80,25 +86,64 @@ void plot_from_view(view_t *v, struct plot **plot)
     pl->ymax = adc_sample_to_voltage(smax, cal);
 
     nsamples = views_get_width(v);
-    pl->x = calloc(nsamples, sizeof(double));
-    pl->y = calloc(nsamples, sizeof(double));
-    pl->len = nsamples;
-
     pl->glyph = views_get_glyph(v);
 
     begin = views_get_begin(v);
     end = views_get_end(v);
-    for (uint64_t i = 0, j = begin; j < end; i++, j++) {
-        uint16_t sample = cap_get_analog(cap, j);
-        float volt = adc_sample_to_voltage(sample, cal);
-        pl->x[i] = j;
-        pl->y[i] = volt;
+    target = views_get_target(v);
+
+    /* The reticle indexes the plot's points, not the capture's samples;
+     * it's -1 when the target isn't in view.
+     */
+    pl->reticle = -1;
+    if (nsamples <= PLOT_MAX_POINTS) {
+        struct cap_span *s = malloc(sizeof(struct cap_span));
+        float volts[CAP_SPAN_LEN];
+        uint64_t i = 0;
+
+        pl->x = calloc(nsamples, sizeof(double));
+        pl->y = calloc(nsamples, sizeof(double));
+        pl->len = nsamples;
+
+        cap_span_init(s, cap, begin, end, CAP_GATHER_ANALOG);
+        while (cap_span_next(s)) {
+            adc_samples_to_voltage(s->analog, s->len, volts, cal);
+            for (size_t k = 0; k < s->len; k++, i++) {
+                pl->x[i] = s->idx + k;
+                pl->y[i] = volts[k];
+            }
+        }
+        free(s);
+
+        if ((target >= (int64_t) begin) && (target - begin < nsamples))
+            pl->reticle = target - begin;
+    } else {
+        /* Zoomed out; each column's extremes come from the pyramid */
+        const unsigned ncols = PLOT_MAX_POINTS / 2;
+        uint16_t *min = calloc(ncols, sizeof(uint16_t));
+        uint16_t *max = calloc(ncols, sizeof(uint16_t));
+
+        pl->x = calloc(PLOT_MAX_POINTS, sizeof(double));
+        pl->y = calloc(PLOT_MAX_POINTS, sizeof(double));
+        pl->len = PLOT_MAX_POINTS;
+
+        cap_get_analog_envelope(cap, begin, end, ncols, min, max);
+        for (unsigned i = 0; i < ncols; i++) {
+            pl->x[2 * i] = pl->x[(2 * i) + 1] = begin + (nsamples * i) / ncols;
+            pl->y[2 * i] = adc_sample_to_voltage(min[i], cal);
+            pl->y[(2 * i) + 1] = adc_sample_to_voltage(max[i], cal);
+        }
+        free(min);
+        free(max);
+
+        /* Land on the min point of the column the target falls in */
+        if ((target >= (int64_t) begin) && (target - begin < nsamples))
+            pl->reticle = 2 * (((target - begin) * ncols) / nsamples);
     }
 
-    pl->reticle = views_get_target(v) - views_get_begin(v);
-    if (pl->reticle > 0) {
+    if (target > (int64_t) begin) {
         snprintf(str_label, PLOT_LABEL_MAXLEN, "Sample @ %'lu = %.02f V",
-            views_get_target(v), pl->y[pl->reticle]);
+            target, cap_get_analog_voltage(cap, target));
         plot_set_xlabel(pl, str_label);
     }
 //    plot_set_ylabel(pl, "Volts");
@@ -135,7 +180,6 @@ void plot_to_cairo_surface(struct plot *pl, cairo_surface_t *cs)
     cairo_t *c;
     int w, h;
     char res_str[] = "XXXXxYYYY";
-    PLFLT x_ret = pl->x[pl->reticle];
 
     c = cairo_create(cs);
     w = cairo_image_surface_get_width(cs);
@@ -164,9 +208,13 @@ void plot_to_cairo_surface(struct plot *pl, cairo_surface_t *cs)
     plline(pl->len, (PLFLT *) pl->x, (PLFLT *) pl->y);
 
     /* Draw reticle */
-    plcol0(12);
-    pljoin(x_ret, pl->ymin, x_ret, 2 * pl->ymax);
-    plstring(1, &x_ret, &pl->y[pl->reticle], "X");
+    if (pl->reticle >= 0) {
+        PLFLT x_ret = pl->x[pl->reticle];
+
+        plcol0(12);
+        pljoin(x_ret, pl->ymin, x_ret, 2 * pl->ymax);
+        plstring(1, &x_ret, &pl->y[pl->reticle], "X");
+    }
 
     plend();
     cairo_surface_flush(cs);
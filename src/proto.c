@@ -19,57 +19,191 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include "refcnt.h"
-#include "queue.h"
 
 #include "proto.h"
 
+/* Each chunk of the frame store takes PROTO_CHUNK_BYTES, aligned to
+ * that size, so a frame handle (a pointer into a chunk's idx column)
+ * can find its chunk by masking off the low bits.
+ */
+#define PROTO_CHUNK_BYTES (1 << 17)
+#define PROTO_CHUNK_LEN 6144
 
-/* Struct: proto_dframe
- *
- * A decoded data frame list entry.
+/* Struct: proto_chunk
  *
- * Elements:
- *  idx - sample index from protocol analyzer.
- *  frame - data byte
+ * A fixed-size block of frames, stored a column per field so scanning
+ * one field (say, sample indexes for a range lookup) only touches that
+ * field's memory.
  *
+ * Fields:
+ *  idx - sample index from protocol analyzer, per frame
+ *  data - inline payload, or an owned udata pointer, per frame
+ *  type - protocol-specific frame type, per frame
+ *  len - bytes of inline payload, or PROTO_UDATA_OWNED, per frame
+ *  seq - where the chunk is in the store
+ *  n - frames used
+ *  pr - store the chunk belongs to
  */
-struct proto_dframe {
-    TAILQ_ENTRY(proto_dframe) entry;
-    uint64_t idx;
-    int type;
-    void *udata;
+struct proto_chunk {
+    uint64_t idx[PROTO_CHUNK_LEN];
+    union proto_payload data[PROTO_CHUNK_LEN];
+    int32_t type[PROTO_CHUNK_LEN];
+    uint8_t len[PROTO_CHUNK_LEN];
+    size_t seq;
+    size_t n;
+    struct proto *pr;
 };
-TAILQ_HEAD(dframes_list, proto_dframe);
 
 /* Struct: proto
  *
  * Container for holding data frames that a protocol analyzer decodes.
+ * Frames are kept in chunks that are only ever appended to, so adding
+ * one is a handful of stores; there's an allocation per few thousand
+ * frames rather than a few per frame.  Frames go in in sample order,
+ * and as every chunk but the last is full, the n'th frame is at a known
+ * spot; that's what lets range lookups binary search the idx column.
  *
+ * Fields:
+ *  chunks - the frame store's chunks, in order
+ *  nchunks - chunks in use
+ *  alloc - slots allocated in chunks
  */
 struct proto {
     char note[PROTO_MAX_NOTE_LEN];
     struct refcnt rcnt;
     float period;
     uint64_t nframes;
-    struct dframes_list head;
+    struct proto_chunk **chunks;
+    size_t nchunks;
+    size_t alloc;
 };
 
+_Static_assert(sizeof(struct proto_chunk) <= PROTO_CHUNK_BYTES,
+    "proto chunk doesn't fit its allocation");
+
+/* Frame handles are pointers into a chunk's idx column */
+static inline struct proto_chunk *dframe_chunk(struct proto_dframe *df)
+{
+    return (struct proto_chunk *) ((uintptr_t) df & ~(uintptr_t) (PROTO_CHUNK_BYTES - 1));
+}
+
+static inline size_t dframe_pos(struct proto_dframe *df)
+{
+    return (uint64_t *) df - dframe_chunk(df)->idx;
+}
+
+static inline struct proto_dframe *make_dframe(struct proto_chunk *ch, size_t i)
+{
+    return (struct proto_dframe *) &ch->idx[i];
+}
+
+/* Sample index of the n'th frame */
+static inline uint64_t nth_idx(struct proto *pr, uint64_t n)
+{
+    return pr->chunks[n / PROTO_CHUNK_LEN]->idx[n % PROTO_CHUNK_LEN];
+}
+
+static inline struct proto_dframe *nth_dframe(struct proto *pr, uint64_t n)
+{
+    return make_dframe(pr->chunks[n / PROTO_CHUNK_LEN], n % PROTO_CHUNK_LEN);
+}
+
+/* Returns how many frames come before sample idx */
+static uint64_t lower_bound(struct proto *pr, uint64_t idx)
+{
+    uint64_t lo = 0, hi = pr->nframes;
+
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+
+        if (nth_idx(pr, mid) < idx)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/* Returns the chunk the next frame goes in, adding one if need be */
+static struct proto_chunk *tail_chunk(struct proto *pr)
+{
+    struct proto_chunk *ch;
+
+    if (pr->nchunks && (pr->chunks[pr->nchunks - 1]->n < PROTO_CHUNK_LEN))
+        return pr->chunks[pr->nchunks - 1];
+
+    if (pr->nchunks == pr->alloc) {
+        pr->alloc = pr->alloc ? 2 * pr->alloc : 8;
+        pr->chunks = realloc(pr->chunks, pr->alloc * sizeof(struct proto_chunk *));
+    }
+
+    ch = aligned_alloc(PROTO_CHUNK_BYTES, PROTO_CHUNK_BYTES);
+    ch->seq = pr->nchunks;
+    ch->n = 0;
+    ch->pr = pr;
+    pr->chunks[pr->nchunks++] = ch;
+
+    return ch;
+}
+
+/* Function: proto_add_dframe
+ *
+ * Adds a frame whose payload is a heap pointer; the proto takes it
+ * over and frees it along with itself.  Frames have to be added in
+ * sample order.
+ */
 void proto_add_dframe(struct proto *pr, uint64_t idx, int type, void *udata)
 {
-    struct proto_dframe *df;
+    struct proto_chunk *ch;
+    size_t i;
 
-    df = calloc(1, sizeof(struct proto_dframe));
-    df->idx = idx;
-    df->type = type;
-    df->udata = udata;
-    TAILQ_INSERT_TAIL(&pr->head, df, entry);
+    assert(!pr->nframes || (idx >= nth_idx(pr, pr->nframes - 1)));
+    ch = tail_chunk(pr);
+    i = ch->n++;
+
+    ch->idx[i] = idx;
+    ch->type[i] = type;
+    ch->data[i].ptr = udata;
+    ch->len[i] = udata ? PROTO_UDATA_OWNED : 0;
     pr->nframes++;
 }
 
+/* Function: proto_add_dframe_inline
+ *
+ * Adds a frame with a small payload copied into the frame store, so
+ * nothing needs allocating for it.
+ *
+ * Parameters:
+ *  pr - proto to add to
+ *  idx - sample index of the frame
+ *  type - protocol-specific frame type
+ *  data - payload; may be NULL if len is zero
+ *  len - payload bytes, up to PROTO_DFRAME_INLINE
+ */
+void proto_add_dframe_inline(struct proto *pr, uint64_t idx, int type,
+    const void *data, size_t len)
+{
+    struct proto_chunk *ch;
+    size_t i;
+
+    assert(len <= PROTO_DFRAME_INLINE);
+    assert(!pr->nframes || (idx >= nth_idx(pr, pr->nframes - 1)));
+    ch = tail_chunk(pr);
+    i = ch->n++;
+
+    ch->idx[i] = idx;
+    ch->type[i] = type;
+    if (len)
+        memcpy(ch->data[i].bytes, data, len);
+    ch->len[i] = len;
+    pr->nframes++;
+}
 
 static void proto_free(const struct refcnt *ref);
 
@@ -85,7 +219,6 @@ struct proto *proto_create(void)
 
     pr = calloc(1, sizeof(struct proto));
     pr->rcnt = (struct refcnt) { proto_free, 1 };
-    TAILQ_INIT(&pr->head);
     return pr;
 }
 
@@ -149,48 +282,216 @@ unsigned proto_getref(struct proto *p)
 
 static void proto_free(const struct refcnt *ref)
 {
-    proto_dframe_t *cur, *tmp;
     struct proto *pr =
         container_of(ref, struct proto, rcnt);
 
-    TAILQ_FOREACH_SAFE(cur, &pr->head, entry, tmp) {
-        TAILQ_REMOVE(&pr->head, cur, entry);
-        if (cur->udata)
-            free(cur->udata);
-        free(cur);
+    for (size_t c = 0; c < pr->nchunks; c++) {
+        struct proto_chunk *ch = pr->chunks[c];
+
+        for (size_t i = 0; i < ch->n; i++) {
+            if (PROTO_UDATA_OWNED == ch->len[i])
+                free(ch->data[i].ptr);
+        }
+        free(ch);
     }
 
+    free(pr->chunks);
     free(pr);
 }
 
+/* Returns a frame's payload: the pointer it was added with, its inline
+ * bytes, or NULL if it has none.
+ */
 void *proto_dframe_udata(struct proto_dframe *df)
 {
-    return df->udata;
+    struct proto_chunk *ch = dframe_chunk(df);
+    size_t i = dframe_pos(df);
+
+    if (PROTO_UDATA_OWNED == ch->len[i])
+        return ch->data[i].ptr;
+
+    return ch->len[i] ? ch->data[i].bytes : NULL;
 }
 
 uint64_t proto_dframe_idx(struct proto_dframe *df)
 {
-    return df->idx;
+    return *(uint64_t *) df;
 }
 
 int proto_dframe_type(struct proto_dframe *df)
 {
-    return df->type;
+    return dframe_chunk(df)->type[dframe_pos(df)];
 }
 
 struct proto_dframe *proto_dframe_first(struct proto *pr)
 {
-    return TAILQ_FIRST(&pr->head);
+    return pr->nframes ? make_dframe(pr->chunks[0], 0) : NULL;
 }
 
 struct proto_dframe *proto_dframe_next(struct proto_dframe *df)
 {
-    return TAILQ_NEXT(df, entry);
+    struct proto_chunk *ch = dframe_chunk(df);
+    size_t i = dframe_pos(df) + 1;
+
+    if (i < ch->n)
+        return make_dframe(ch, i);
+
+    if (ch->seq + 1 < ch->pr->nchunks)
+        return make_dframe(ch->pr->chunks[ch->seq + 1], 0);
+
+    return NULL;
 }
 
 struct proto_dframe *proto_dframe_last(struct proto *pr)
 {
-    return TAILQ_LAST(&pr->head, dframes_list);
+    struct proto_chunk *ch;
+
+    if (0 == pr->nframes)
+        return NULL;
+
+    ch = pr->chunks[pr->nchunks - 1];
+    return make_dframe(ch, ch->n - 1);
+}
+
+/* Function: proto_dframe_lower_bound
+ *
+ * Finds the first frame at or after a sample, in O(log n).
+ *
+ * Parameters:
+ *  pr - proto to search
+ *  idx - sample index
+ *
+ * Returns:
+ *  the frame, or NULL if every frame is before idx
+ */
+struct proto_dframe *proto_dframe_lower_bound(struct proto *pr, uint64_t idx)
+{
+    uint64_t n = lower_bound(pr, idx);
+
+    return (n < pr->nframes) ? nth_dframe(pr, n) : NULL;
+}
+
+/* Function: proto_dframe_nearest
+ *
+ * Finds the frame closest to a sample, in O(log n).  A tie goes to the
+ * earlier frame.
+ *
+ * Parameters:
+ *  pr - proto to search
+ *  idx - sample index
+ *
+ * Returns:
+ *  the frame, or NULL if the proto is empty
+ */
+struct proto_dframe *proto_dframe_nearest(struct proto *pr, uint64_t idx)
+{
+    uint64_t n = lower_bound(pr, idx);
+
+    if (0 == pr->nframes)
+        return NULL;
+
+    if (n == pr->nframes)
+        return nth_dframe(pr, n - 1);
+
+    if ((n > 0) && ((idx - nth_idx(pr, n - 1)) <= (nth_idx(pr, n) - idx)))
+        return nth_dframe(pr, n - 1);
+
+    return nth_dframe(pr, n);
+}
+
+/* Function: proto_dframe_range
+ *
+ * Finds the frames from sample begin up to, but not including, sample
+ * end, in O(log n).  They can be walked from the first with
+ * <proto_dframe_next>.
+ *
+ * Parameters:
+ *  pr - proto to search
+ *  begin - first sample index
+ *  end - sample index past the last
+ *  first - where to put the first frame in the range; NULL if empty
+ *
+ * Returns:
+ *  number of frames in the range
+ */
+uint64_t proto_dframe_range(struct proto *pr, uint64_t begin, uint64_t end,
+    struct proto_dframe **first)
+{
+    uint64_t lo, hi;
+
+    if (end <= begin) {
+        *first = NULL;
+        return 0;
+    }
+
+    lo = lower_bound(pr, begin);
+    hi = lower_bound(pr, end);
+    *first = (lo < hi) ? nth_dframe(pr, lo) : NULL;
+
+    return hi - lo;
+}
+
+/* Hands frames lo up to hi to a sink, a chunk's worth at a time */
+static int foreach_frames(struct proto *pr, uint64_t lo, uint64_t hi,
+    proto_sink_t sink, void *udata)
+{
+    while (lo < hi) {
+        struct proto_chunk *ch = pr->chunks[lo / PROTO_CHUNK_LEN];
+        size_t i = lo % PROTO_CHUNK_LEN;
+        size_t n = (hi - lo < ch->n - i) ? hi - lo : ch->n - i;
+        struct proto_batch b = {
+            .first = lo,
+            .n = n,
+            .idx = &ch->idx[i],
+            .type = &ch->type[i],
+            .len = &ch->len[i],
+            .data = &ch->data[i],
+        };
+        int ret = sink(&b, udata);
+
+        if (ret)
+            return ret;
+        lo += n;
+    }
+
+    return 0;
+}
+
+/* Function: proto_foreach
+ *
+ * Walks every frame, handing them to a sink in batches of up to a few
+ * thousand so it can loop over plain arrays.
+ *
+ * Parameters:
+ *  pr - proto to walk
+ *  sink - called once per batch, in order
+ *  udata - passed to the sink
+ *
+ * Returns:
+ *  0 if every batch was visited, otherwise what the sink returned
+ *  to stop the walk
+ *
+ * See Also:
+ *  <proto_foreach_range>
+ */
+int proto_foreach(struct proto *pr, proto_sink_t sink, void *udata)
+{
+    return foreach_frames(pr, 0, pr->nframes, sink, udata);
+}
+
+/* Function: proto_foreach_range
+ *
+ * Like <proto_foreach>, but only for the frames from sample begin up
+ * to, but not including, sample end.
+ */
+int proto_foreach_range(struct proto *pr, uint64_t begin, uint64_t end,
+    proto_sink_t sink, void *udata)
+{
+    if (end <= begin)
+        return 0;
+
+    return foreach_frames(pr, lower_bound(pr, begin), lower_bound(pr, end),
+        sink, udata);
 }
 
 void proto_set_note(proto_t *pr, const char *s)
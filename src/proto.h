@@ -22,6 +22,8 @@
 #ifndef _PROTO_H_
 #define _PROTO_H_
 
+#include <stddef.h>
+#include <stdint.h>
 #include "queue.h"
 
 #ifdef __cplusplus
@@ -33,6 +35,52 @@ typedef struct proto_dframe proto_dframe_t;
 
 #define PROTO_MAX_NOTE_LEN 64
 
+/* Largest payload a frame can keep inline */
+#define PROTO_DFRAME_INLINE 8
+
+/* Payload length marking a frame whose payload is a caller's pointer
+ * that the proto owns, rather than bytes kept inline.
+ */
+#define PROTO_UDATA_OWNED 0xff
+
+/* A frame's payload: inline bytes, or an owned pointer */
+union proto_payload {
+    uint8_t bytes[PROTO_DFRAME_INLINE];
+    void *ptr;
+};
+
+/* Struct: proto_batch
+ *
+ * A run of consecutive frames, handed to a <proto_sink_t> as one array
+ * per field.  The arrays belong to the proto and are only good for the
+ * length of the call.
+ *
+ * Fields:
+ *  first - number of the first frame in the batch, counting from zero
+ *  n - frames in the batch
+ *  idx - sample index, per frame
+ *  type - protocol-specific frame type, per frame
+ *  len - bytes of inline payload, or PROTO_UDATA_OWNED, per frame
+ *  data - payload, per frame; see <proto_batch_udata>
+ */
+struct proto_batch {
+    uint64_t first;
+    size_t n;
+    const uint64_t *idx;
+    const int32_t *type;
+    const uint8_t *len;
+    const union proto_payload *data;
+};
+
+/* Returns the i'th frame's payload in a batch, as proto_dframe_udata would */
+static inline const void *proto_batch_udata(const struct proto_batch *b, size_t i)
+{
+    if (PROTO_UDATA_OWNED == b->len[i])
+        return b->data[i].ptr;
+
+    return b->len[i] ? b->data[i].bytes : NULL;
+}
+
 /* Accessors for the sample index and frame */
 void *proto_dframe_udata(struct proto_dframe *df);
 uint64_t proto_dframe_idx(proto_dframe_t *df);
@@ -41,6 +89,12 @@ proto_dframe_t *proto_dframe_first(proto_t *pr);
 proto_dframe_t *proto_dframe_next(proto_dframe_t *df);
 proto_dframe_t *proto_dframe_last(proto_t *pr);
 
+/* Lookups by sample index */
+proto_dframe_t *proto_dframe_lower_bound(proto_t *pr, uint64_t idx);
+proto_dframe_t *proto_dframe_nearest(proto_t *pr, uint64_t idx);
+uint64_t proto_dframe_range(proto_t *pr, uint64_t begin, uint64_t end,
+    proto_dframe_t **first);
+
 proto_t *proto_create(void);
 proto_t *proto_addref(proto_t *pr);
 unsigned proto_getref(proto_t *pr);
@@ -53,9 +107,14 @@ float proto_get_period(proto_t *pr);
 uint64_t proto_get_nframes(proto_t *pr);
 
 void proto_add_dframe(proto_t *pr, uint64_t idx, int type, void *udata);
+void proto_add_dframe_inline(proto_t *pr, uint64_t idx, int type,
+    const void *data, size_t len);
 
-typedef void (*proto_sink_t)(proto_dframe_t *df, void *udata);
-void proto_foreach(proto_t *pr, proto_sink_t *sink);
+/* Batch visitors; a sink returning non-zero stops the walk */
+typedef int (*proto_sink_t)(const struct proto_batch *b, void *udata);
+int proto_foreach(proto_t *pr, proto_sink_t sink, void *udata);
+int proto_foreach_range(proto_t *pr, uint64_t begin, uint64_t end,
+    proto_sink_t sink, void *udata);
 
 
 
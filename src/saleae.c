@@ -23,6 +23,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <math.h>
+#include <omp.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -32,6 +33,7 @@
 
 #include "adc.h"
 #include "file_utils.h"
+#include "saleae.h"
 
 struct __attribute__((__packed__)) saleae_analog_header {
     uint64_t sample_total;
@@ -39,62 +41,428 @@ struct __attribute__((__packed__)) saleae_analog_header {
     double sample_period;
 };
 
+/* Number of samples converted per read when streaming in a channel;
+ * this is the only buffer held beyond the final capture arrays.
+ */
+#define SALEAE_CHUNK_SAMPLES (1 << 16)
+
+#define SALEAE_MAX_CHANNELS 16
+
+/* Struct: analog_range
+ *
+ * The part of an analog export that's been asked for.
+ *
+ * Fields:
+ *  begin - first sample to import
+ *  n - number of samples to import per channel
+ *  ch_mask - bitmask of channels to import
+ */
+struct analog_range {
+    uint64_t begin;
+    uint64_t n;
+    uint32_t ch_mask;
+};
+
 /* Local prototypes */
-static void import_analog_channel(void *abuf, unsigned ch, cap_t *cap);
+static int import_analog_mapped(file_map_t *map, const struct saleae_opts *opts,
+    cap_t **caps, struct saleae_timing *t);
+static int import_analog_stream(FILE *fp, const struct saleae_opts *opts,
+    cap_t **caps, struct saleae_timing *t);
+static int import_analog_channel(file_stream_t *fs, float *chunk,
+    uint64_t nsamples, cap_t *cap, struct saleae_timing *t);
+static int check_analog_header(struct saleae_analog_header *hdr,
+    const struct saleae_opts *opts, struct analog_range *r);
+static cap_t *create_analog_channel(struct saleae_analog_header *hdr,
+    struct analog_range *r, const struct saleae_opts *opts, unsigned ch);
+static void finish_analog_channel(cap_t *cap, const struct saleae_opts *opts,
+    struct saleae_timing *t);
+static void add_time(double *stage, double start);
 
+/* Function: saleae_import_analog
+ *
+ * Imports an entire Saleae analog export; see <saleae_import_analog_opts>.
+ */
 int saleae_import_analog(FILE *fp, struct cap_bundle **new_bundle)
 {
-    void *abuf;
-    size_t abuf_len;
+    return saleae_import_analog_opts(fp, NULL, new_bundle);
+}
+
+/* Function: saleae_import_analog_opts
+ *
+ * Imports a Saleae analog export (optionally gzip'd) into a bundle with
+ * one capture per channel.  Uncompressed files are converted straight
+ * out of the page cache, and block gzip'd ones (see bgzf.c) are
+ * inflated in parallel and converted from there.  Other compressed
+ * files, and anything piped in, are streamed; each channel is read into its capture in fixed-size chunks
+ * so the whole file is never held in memory.  Pipes can't seek, so
+ * unwanted samples and channels are read past rather than skipped.
+ *
+ * If only part of a gzip'd capture is asked for and its path is known,
+ * an access point index is kept in a sidecar file next to it so only
+ * the requested samples and channels need to be inflated.
+ *
+ * Channels are independent, so they're converted (and run through
+ * min/max and the ADC) in parallel, on opts->nthreads threads.  A
+ * compressed file can only be inflated in order, so there the next
+ * channel is read in while the previous ones are being processed.
+ *
+ * Parameters:
+ *  fp - file containing the capture
+ *  opts - sample range, channels, etc; NULL imports everything.
+ *  new_bundle - handle to the new capture bundle
+ *
+ * Returns:
+ *  0 on success, -1 on failure with errno set.
+ */
+int saleae_import_analog_opts(FILE *fp, const struct saleae_opts *opts,
+    struct cap_bundle **new_bundle)
+{
+    const struct saleae_opts defaults = { 0 };
+    cap_t *caps[SALEAE_MAX_CHANNELS] = { 0 };
+    struct saleae_timing scratch, *t;
     struct cap_bundle *bun;
-    struct saleae_analog_header *hdr;
+    double start;
+    file_map_t *map;
     int rc;
 
-    rc = file_load(fp, &abuf, &abuf_len);
+    *new_bundle = NULL;
+
+    if (NULL == fp) {
+        errno = EIO;
+        return -1;
+    }
+
+    if (NULL == opts)
+        opts = &defaults;
+
+    t = opts->timing ? opts->timing : &scratch;
+    memset(t, 0, sizeof(struct saleae_timing));
+    t->nthreads = opts->nthreads ? opts->nthreads : omp_get_max_threads();
+    start = omp_get_wtime();
+
+    /* Block gzip'd files can be inflated whole on every thread, which
+     * beats inflating them in order on one.
+     */
+    if (file_is_seekable(fp) && (!file_is_gzip(fp) || file_is_bgzf(fp)) &&
+            (0 == file_load_map(fp, &map))) {
+        add_time(&t->read, start);
+        t->mapped = true;
+        rc = import_analog_mapped(map, opts, caps, t);
+        file_map_dropref(map);
+    } else {
+        rc = import_analog_stream(fp, opts, caps, t);
+    }
+
+    /* Channels go into the bundle in order, whichever finished first */
+    bun = cap_bundle_create();
+    for (unsigned ch = 0; ch < SALEAE_MAX_CHANNELS; ch++) {
+        if (NULL == caps[ch])
+            continue;
+
+        if (rc)
+            cap_dropref(caps[ch]);
+        else
+            cap_bundle_add(bun, caps[ch]);
+    }
+
     if (rc) {
-        *new_bundle = NULL;
+        cap_bundle_dropref(bun);
+        return -1;
+    }
+
+    t->total = omp_get_wtime() - start;
+    *new_bundle = bun;
+    return 0;
+}
+
+/* Zero-copy import; converts each channel directly from the mapped file. */
+static int import_analog_mapped(file_map_t *map, const struct saleae_opts *opts,
+    cap_t **caps, struct saleae_timing *t)
+{
+    const uint8_t *buf = file_map_data(map);
+    size_t len = file_map_len(map);
+    struct saleae_analog_header hdr;
+    struct analog_range r;
+    const float *samples;
+    uint64_t avail;
+
+    if (len < sizeof(struct saleae_analog_header)) {
+        errno = EIO;
+        return -1;
+    }
+    memcpy(&hdr, buf, sizeof(struct saleae_analog_header));
+
+    if (check_analog_header(&hdr, opts, &r))
+        return -1;
+
+    /* Divided rather than multiplied, so a bogus header can't overflow */
+    avail = (len - sizeof(struct saleae_analog_header)) / sizeof(float);
+    if (hdr.channel_count &&
+            (hdr.sample_total > avail / hdr.channel_count)) {
         errno = EIO;
         return -1;
     }
 
+    samples = (const float *) (buf + sizeof(struct saleae_analog_header));
+
+    #pragma omp parallel for schedule(dynamic) num_threads(t->nthreads)
+    for (unsigned ch = 0; ch < hdr.channel_count; ch++) {
+        double start;
+
+        if (!(r.ch_mask & (1 << ch)))
+            continue;
+
+        caps[ch] = create_analog_channel(&hdr, &r, opts, ch);
+        start = omp_get_wtime();
+        cap_convert_analog(caps[ch], 0,
+            samples + (ch * hdr.sample_total) + r.begin, r.n);
+        add_time(&t->convert, start);
+        finish_analog_channel(caps[ch], opts, t);
+    }
+
+    return 0;
+}
+
+/* Streaming import; reads the header and then each channel block,
+ * handing each channel off to be finished as soon as it's read.
+ */
+static int import_analog_stream(FILE *fp, const struct saleae_opts *opts,
+    cap_t **caps, struct saleae_timing *t)
+{
+    struct saleae_analog_header hdr;
+    struct analog_range r;
+    file_stream_t *fs;
+    float *chunk;
+    int64_t rc;
+    double start;
+
+    if (file_stream_open(fp, &fs)) {
+        errno = EIO;
+        return -1;
+    }
+
+    start = omp_get_wtime();
+    rc = file_stream_read(fs, &hdr, sizeof(struct saleae_analog_header));
+    add_time(&t->read, start);
+    if (rc != sizeof(struct saleae_analog_header)) {
+        file_stream_close(fs);
+        errno = EIO;
+        return -1;
+    }
+
+    if (check_analog_header(&hdr, opts, &r)) {
+        file_stream_close(fs);
+        return -1;
+    }
+
+    /* Skipping around in a gzip'd file means inflating everything
+     * in between, unless there's an index to jump in with.
+     */
+    if (opts->path && file_is_gzip(fp) &&
+            ((r.n != hdr.sample_total) || (opts->ch_mask))) {
+        gzindex_t *idx;
+        if (0 == gzindex_open_sidecar(fp, opts->path, &idx)) {
+            file_stream_set_index(fs, idx);
+            gzindex_dropref(idx);
+        }
+    }
+
+    chunk = calloc(SALEAE_CHUNK_SAMPLES, sizeof(float));
+    rc = 0;
+
+    #pragma omp parallel num_threads(t->nthreads)
+    #pragma omp single
+    for (unsigned ch = 0; ch < hdr.channel_count; ch++) {
+        uint64_t offset = sizeof(struct saleae_analog_header) +
+            ((ch * hdr.sample_total) + r.begin) * sizeof(float);
+
+        if (!(r.ch_mask & (1 << ch)))
+            continue;
+
+        caps[ch] = create_analog_channel(&hdr, &r, opts, ch);
+        if (file_stream_seek(fs, offset) ||
+                import_analog_channel(fs, chunk, r.n, caps[ch], t)) {
+            rc = -1;
+            break;
+        }
+
+        #pragma omp task firstprivate(ch)
+        finish_analog_channel(caps[ch], opts, t);
+    }
+
+    free(chunk);
+    file_stream_close(fs);
+
+    if (rc) {
+        errno = EIO;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Sanity checks a header and works out what part of the capture
+ * the import options are asking for.
+ */
+static int check_analog_header(struct saleae_analog_header *hdr,
+    const struct saleae_opts *opts, struct analog_range *r)
+{
+    uint64_t end;
+
     /* TODO - better sanity check on header contents */
-    hdr = (struct saleae_analog_header *) abuf;
-    if (hdr->channel_count > 16) {
+    if (hdr->channel_count > SALEAE_MAX_CHANNELS) {
         errno = ENODATA;
         return -1;
     }
 
-    bun = cap_bundle_create();
+    end = opts->end;
+    if ((0 == end) || (end > hdr->sample_total))
+        end = hdr->sample_total;
 
-    for (uint16_t ch = 0; ch < hdr->channel_count; ch++) {
-        cap_t *cap = cap_create(hdr->sample_total);
-        cap_set_physical_ch(cap, ch);
-        cap_set_period(cap, hdr->sample_period);
-        import_analog_channel(abuf, ch, cap);
-        cap_update_analog_minmax(cap);
+    if (opts->begin > end) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    r->begin = opts->begin;
+    r->n = end - opts->begin;
+    r->ch_mask = (1 << hdr->channel_count) - 1;
+    if (opts->ch_mask)
+        r->ch_mask &= opts->ch_mask;
 
-        /* Make a digital version of the analog capture */
-        cap_analog_adc_ttl(cap);
-        cap_bundle_add(bun, cap);
+    return 0;
+}
+
+static cap_t *create_analog_channel(struct saleae_analog_header *hdr,
+    struct analog_range *r, const struct saleae_opts *opts, unsigned ch)
+{
+    cap_t *cap = opts->analog12 ? cap_create_analog12(r->n) : cap_create(r->n);
+    cap_set_physical_ch(cap, ch);
+    cap_set_period(cap, hdr->sample_period);
+    return cap;
+}
+/* Post-processing once a channel's analog samples are in place; the
+ * min/max was already picked up while converting.
+ */
+static void finish_analog_channel(cap_t *cap, const struct saleae_opts *opts,
+    struct saleae_timing *t)
+{
+    double start = omp_get_wtime();
+    adc_cal_t *cal = cap_get_analog_cal(cap);
+
+    /* Make a digital version of the analog capture, and the min/max
+     * pyramid for plotting it.
+     */
+    if ((0.0f != opts->v_lo) || (0.0f != opts->v_hi))
+        cap_analog_adc(cap, adc_voltage_to_sample(opts->v_lo, cal),
+            adc_voltage_to_sample(opts->v_hi, cal));
+    else
+        cap_analog_adc_auto(cap);
+    cap_index_analog(cap);
+    add_time(&t->adc, start);
+}
+
+/* Adds the time since start to a stage's running total. */
+static void add_time(double *stage, double start)
+{
+    double dt = omp_get_wtime() - start;
+
+    #pragma omp atomic
+    *stage += dt;
+}
+
+/* Reads the next channel's worth of float samples from the stream,
+ * converting them to raw samples in the capture a chunk at a time.
+ */
+static int import_analog_channel(file_stream_t *fs, float *chunk,
+    uint64_t nsamples, cap_t *cap, struct saleae_timing *t)
+{
+    uint64_t done = 0;
+
+    while (done < nsamples) {
+        uint64_t n = nsamples - done;
+        double start;
+        int64_t rc;
+
+        if (n > SALEAE_CHUNK_SAMPLES)
+            n = SALEAE_CHUNK_SAMPLES;
+
+        start = omp_get_wtime();
+        rc = file_stream_read(fs, chunk, n * sizeof(float));
+        add_time(&t->read, start);
+        if (rc != n * sizeof(float))
+            return -1;
+
+        start = omp_get_wtime();
+        cap_convert_analog(cap, done, chunk, n);
+        add_time(&t->convert, start);
+        done += n;
     }
 
-    free(abuf);
-    *new_bundle = bun;
     return 0;
 }
 
-static void import_analog_channel(void *abuf, unsigned ch, cap_t *cap)
+/* Function: saleae_import_digital
+ *
+ * Imports a Saleae digital export (optionally gzip'd), which is a
+ * string of sample words with one bit per channel.  The words are kept
+ * packed as-is rather than being split out into a byte per channel, so
+ * a 16 channel capture costs two bytes a sample instead of sixteen.
+ *
+ * Regular files are mapped (or inflated straight into the capture's
+ * storage) and pipes are streamed in a chunk at a time, straight into
+ * the capture's storage.
+ *
+ * Parameters:
+ *  fp - file containing the capture
+ *  sample_width - bytes per sample word; 1, 2, 4 or 8.
+ *  freq - sample rate, in Hz
+ *  dcap - handle to the new packed capture
+ *
+ * Returns:
+ *  0 on success, -1 on failure with errno set.
+ *
+ * See Also:
+ *  <cap_get_packed>
+ */
+int saleae_import_digital(FILE *fp, size_t sample_width, float freq, cap_t **dcap)
 {
-    struct saleae_analog_header *hdr = (struct saleae_analog_header *) abuf;
-    float *ch_start;
+    file_map_t *map;
+    cap_t *cap;
 
-    ch_start = (float *) (abuf + sizeof(struct saleae_analog_header) +
-        (ch * (sizeof(float) * hdr->sample_total)));
+    *dcap = NULL;
 
-    /* The loop instead of memcpy is to convert from float
-     * to uint16_t.
-     */
-    for (uint64_t i = 0; i < hdr->sample_total; i++) {
-        cap_set_analog(cap, i, (uint16_t) ch_start[i]);
-     }
+    if (NULL == fp) {
+        errno = EIO;
+        return -1;
+    }
+
+    if ((1 != sample_width && 2 != sample_width && 4 != sample_width &&
+            8 != sample_width) || !(freq > 0.0f)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (0 == file_load_map(fp, &map)) {
+        cap = cap_create_packed((void *) file_map_data(map),
+            file_map_len(map) / sample_width, sample_width, map);
+        file_map_dropref(map);
+    } else if ((ESPIPE == errno) && (0 == file_stream_load_map(fp, &map))) {
+        /* Any partial word at the end is dropped */
+        cap = cap_create_packed((void *) file_map_data(map),
+            file_map_len(map) / sample_width, sample_width, map);
+        file_map_dropref(map);
+    } else {
+        return -1;
+    }
+
+    if (0 == cap_get_nsamples(cap)) {
+        cap_dropref(cap);
+        errno = ENODATA;
+        return -1;
+    }
+
+    cap_set_period(cap, 1.0f / freq);
+    *dcap = cap;
+    return 0;
 }
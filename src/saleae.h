@@ -22,11 +22,68 @@
 #ifndef _SALEAE_H_
 #define _SALEAE_H_
 
+#include <stdbool.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Struct: saleae_opts
+ *
+ * Import options.  Zeroed fields pick the defaults.
+ *
+ * Fields:
+ *  begin - first sample to import
+ *  end - one past the last sample to import; 0 for the end of capture.
+ *  ch_mask - bitmask of physical channels to import; 0 for all.
+ *  path - path of the capture, used to find its gzip index sidecar.
+ *  nthreads - threads to spread the channels across; 0 for one per core.
+ *  timing - if not NULL, filled in with how long each stage took.
+ *  analog12 - store analog samples packed 12 bits apiece.
+ *  v_lo - ADC low threshold, in volts
+ *  v_hi - ADC high threshold, in volts; if both are zero, each
+ *         channel's are picked from the levels in its samples.
+ */
+struct saleae_opts {
+    uint64_t begin;
+    uint64_t end;
+    uint32_t ch_mask;
+    const char *path;
+    unsigned nthreads;
+    struct saleae_timing *timing;
+    bool analog12;
+    float v_lo;
+    float v_hi;
+};
+
+/* Struct: saleae_timing
+ *
+ * Where the time went during an import.  The stages are summed across
+ * all the threads, so comparing them to the total shows how well the
+ * import scaled.
+ *
+ * Fields:
+ *  read - mapping or inflating the file, in seconds
+ *  convert - converting float samples to raw ones and finding min/max
+ *  adc - converting analog channels to digital
+ *  total - wall clock time for the whole import
+ *  nthreads - threads used
+ *  mapped - the capture was converted from a whole image of the file
+ *           (mapped, or block gzip inflated in parallel) instead of
+ *           being streamed
+ */
+struct saleae_timing {
+    double read;
+    double convert;
+    double adc;
+    double total;
+    unsigned nthreads;
+    bool mapped;
+};
+
 int saleae_import_analog(FILE *fp, cap_bundle_t **new_bundle);
+int saleae_import_analog_opts(FILE *fp, const struct saleae_opts *opts,
+    cap_bundle_t **new_bundle);
 int saleae_import_digital(FILE *fp, size_t sample_width, float freq, cap_t **dcap);
 
 #ifdef __cplusplus
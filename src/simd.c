@@ -0,0 +1,799 @@
+/* File: simd.c
+ *
+ * Vectorized sample kernels.  Each kernel has a plain C version that
+ * defines exactly what it does, plus SSE2 and AVX2 versions that must
+ * give bit-for-bit the same results.  The best version the CPU can
+ * run is picked once at startup.
+ *
+ * Author: Jack Bradach <jack@bradach.net>
+ *
+ * Copyright (C) 2016 Jack Bradach <jack@bradach.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+#include "simd.h"
+
+typedef void (*f32_to_u16_fn)(const float *src, uint16_t *dst, size_t n,
+    uint16_t *min, uint16_t *max);
+
+static void f32_to_u16_scalar(const float *src, uint16_t *dst, size_t n,
+    uint16_t *min, uint16_t *max);
+#ifdef SIMD_X86
+static void f32_to_u16_sse2(const float *src, uint16_t *dst, size_t n,
+    uint16_t *min, uint16_t *max);
+static void f32_to_u16_avx2(const float *src, uint16_t *dst, size_t n,
+    uint16_t *min, uint16_t *max);
+#endif
+
+typedef void (*u16_thresholds_fn)(const uint16_t *src, size_t n,
+    uint16_t lo, uint16_t hi, uint64_t *below, uint64_t *above);
+
+static void u16_thresholds_scalar(const uint16_t *src, size_t n,
+    uint16_t lo, uint16_t hi, uint64_t *below, uint64_t *above);
+#ifdef SIMD_X86
+static void u16_thresholds_sse2(const uint16_t *src, size_t n,
+    uint16_t lo, uint16_t hi, uint64_t *below, uint64_t *above);
+static void u16_thresholds_avx2(const uint16_t *src, size_t n,
+    uint16_t lo, uint16_t hi, uint64_t *below, uint64_t *above);
+#endif
+
+typedef void (*unpack_u12_fn)(const uint8_t *src, size_t n, uint16_t *dst);
+
+static void unpack_u12_scalar(const uint8_t *src, size_t n, uint16_t *dst);
+#ifdef SIMD_X86
+static void unpack_u12_avx2(const uint8_t *src, size_t n, uint16_t *dst);
+#endif
+
+typedef void (*u12_histogram_fn)(const uint16_t *src, size_t n,
+    uint32_t *hist);
+
+static void u12_histogram_scalar(const uint16_t *src, size_t n, uint32_t *hist);
+#ifdef SIMD_X86
+static void u12_histogram_sse2(const uint16_t *src, size_t n, uint32_t *hist);
+static void u12_histogram_avx2(const uint16_t *src, size_t n, uint32_t *hist);
+#endif
+
+typedef void (*transpose_bits_fn)(const uint64_t *const *planes,
+    unsigned nplanes, size_t nwords, uint32_t *dst);
+
+static void transpose_bits_scalar(const uint64_t *const *planes,
+    unsigned nplanes, size_t nwords, uint32_t *dst);
+#ifdef SIMD_X86
+static void transpose_bits_sse2(const uint64_t *const *planes,
+    unsigned nplanes, size_t nwords, uint32_t *dst);
+static void transpose_bits_avx2(const uint64_t *const *planes,
+    unsigned nplanes, size_t nwords, uint32_t *dst);
+#endif
+
+static enum simd_level level;
+static f32_to_u16_fn f32_to_u16 = f32_to_u16_scalar;
+static u16_thresholds_fn u16_thresholds = u16_thresholds_scalar;
+static unpack_u12_fn unpack_u12 = unpack_u12_scalar;
+static u12_histogram_fn u12_histogram = u12_histogram_scalar;
+static transpose_bits_fn transpose_bits = transpose_bits_scalar;
+
+/* Picks the fastest kernels before anything gets a chance to run. */
+__attribute__((constructor))
+static void simd_init(void)
+{
+    simd_set_level(simd_max_level());
+}
+
+/* Function: simd_max_level
+ *
+ * Returns the most capable instruction set this CPU supports.
+ */
+enum simd_level simd_max_level(void)
+{
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SIMD_SSE2;
+#endif
+    return SIMD_SCALAR;
+}
+
+enum simd_level simd_get_level(void)
+{
+    return level;
+}
+
+/* Function: simd_set_level
+ *
+ * Switches the kernels over to a given instruction set, or the best
+ * one the CPU supports if it can't run that one.  This isn't meant to
+ * be called while kernels are running on other threads; it's for
+ * testing and benchmarking the different versions.
+ *
+ * Returns:
+ *  The level actually in use.
+ */
+enum simd_level simd_set_level(enum simd_level want)
+{
+    enum simd_level max = simd_max_level();
+
+    if (want > max)
+        want = max;
+
+    switch (want) {
+#ifdef SIMD_X86
+    case SIMD_AVX2:
+        f32_to_u16 = f32_to_u16_avx2;
+        u16_thresholds = u16_thresholds_avx2;
+        unpack_u12 = unpack_u12_avx2;
+        u12_histogram = u12_histogram_avx2;
+        transpose_bits = transpose_bits_avx2;
+        break;
+    case SIMD_SSE2:
+        /* Unpacking wants a byte shuffle, which SSE2 doesn't have */
+        f32_to_u16 = f32_to_u16_sse2;
+        u16_thresholds = u16_thresholds_sse2;
+        unpack_u12 = unpack_u12_scalar;
+        u12_histogram = u12_histogram_sse2;
+        transpose_bits = transpose_bits_sse2;
+        break;
+#endif
+    default:
+        want = SIMD_SCALAR;
+        f32_to_u16 = f32_to_u16_scalar;
+        u16_thresholds = u16_thresholds_scalar;
+        unpack_u12 = unpack_u12_scalar;
+        u12_histogram = u12_histogram_scalar;
+        transpose_bits = transpose_bits_scalar;
+        break;
+    }
+
+    level = want;
+    return level;
+}
+
+/* Function: simd_f32_to_u16
+ *
+ * Converts float samples to raw 16-bit ones, truncating toward zero
+ * and keeping the low 16 bits, while widening a running min/max to
+ * cover the new samples.  Doing both at once means the samples are
+ * only passed over once.
+ *
+ * Parameters:
+ *  src - float samples
+ *  dst - where the raw samples go
+ *  n - number of samples
+ *  min - running minimum; start it at UINT16_MAX.
+ *  max - running maximum; start it at zero.
+ */
+void simd_f32_to_u16(const float *src, uint16_t *dst, size_t n,
+    uint16_t *min, uint16_t *max)
+{
+    f32_to_u16(src, dst, n, min, max);
+}
+
+/* Function: simd_u16_thresholds
+ *
+ * Compares raw samples against a pair of thresholds, producing bitmasks
+ * a bit per sample (sample i is bit i % 64 of word i / 64).  This is
+ * the part of a hysteresis ADC that doesn't depend on what came before.
+ *
+ * Parameters:
+ *  src - raw samples
+ *  n - number of samples
+ *  lo - low threshold
+ *  hi - high threshold
+ *  below - set for samples <= lo; (n + 63) / 64 words.
+ *  above - set for samples >= hi; (n + 63) / 64 words.
+ *
+ * Bits past the last sample are zero.
+ */
+void simd_u16_thresholds(const uint16_t *src, size_t n, uint16_t lo,
+    uint16_t hi, uint64_t *below, uint64_t *above)
+{
+    u16_thresholds(src, n, lo, hi, below, above);
+}
+
+/* Function: simd_pack_u12
+ *
+ * Packs samples 12 bits apiece, each pair into three bytes with the
+ * low bits first.  An odd sample at the end takes two bytes, so n
+ * samples take (3n + 1) / 2.  Samples too big for 12 bits saturate.
+ *
+ * Parameters:
+ *  src - samples to pack
+ *  n - number of samples
+ *  dst - where the packed samples go
+ */
+void simd_pack_u12(const uint16_t *src, size_t n, uint8_t *dst)
+{
+    size_t i;
+
+    for (i = 0; i + 1 < n; i += 2) {
+        uint16_t a = (src[i] > 0xfff) ? 0xfff : src[i];
+        uint16_t b = (src[i + 1] > 0xfff) ? 0xfff : src[i + 1];
+
+        dst[0] = a;
+        dst[1] = (a >> 8) | (b << 4);
+        dst[2] = b >> 4;
+        dst += 3;
+    }
+
+    if (i < n) {
+        uint16_t a = (src[i] > 0xfff) ? 0xfff : src[i];
+
+        dst[0] = a;
+        dst[1] = a >> 8;
+    }
+}
+
+/* Function: simd_unpack_u12
+ *
+ * Unpacks samples packed by <simd_pack_u12>.
+ *
+ * Parameters:
+ *  src - packed samples, starting at the first of a pair
+ *  n - number of samples
+ *  dst - where the samples go
+ */
+void simd_unpack_u12(const uint8_t *src, size_t n, uint16_t *dst)
+{
+    unpack_u12(src, n, dst);
+}
+
+/* Function: simd_u12_histogram
+ *
+ * Counts samples into a histogram with a bin per 12-bit value; samples
+ * too big for 12 bits go in the last bin.  A logic signal sits at one
+ * level for long stretches, so consecutive samples tend to land in the
+ * same bin; they're counted into SIMD_HIST_WAYS interleaved copies of
+ * the histogram so those increments don't wait on each other.
+ *
+ * Parameters:
+ *  src - raw samples
+ *  n - number of samples
+ *  hist - SIMD_HIST_WAYS * SIMD_HIST_BINS counts, added to; way w's
+ *         bin b is hist[w * SIMD_HIST_BINS + b].  The histogram is the
+ *         sum of the ways.
+ */
+void simd_u12_histogram(const uint16_t *src, size_t n, uint32_t *hist)
+{
+    u12_histogram(src, n, hist);
+}
+
+/* Function: simd_transpose_bits
+ *
+ * Turns bitplanes, a 64-bit word per 64 samples of each channel, into
+ * sample words holding a bit per channel, which is what the stream
+ * decoders take.  It works on 8x8 bit tiles: eight channels' bytes for
+ * the same eight samples get gathered into a tile and transposed, so
+ * each byte of the result is one sample's bits for those channels.
+ *
+ * Parameters:
+ *  planes - channel k's samples, (sample i is bit i % 64 of word
+ *           i / 64); NULL for a channel whose bit should stay clear.
+ *  nplanes - number of channels, up to 32
+ *  nwords - words of each channel to transpose
+ *  dst - 64 * nwords sample words; bit k of dst[i] is channel k's
+ *        sample i.
+ */
+void simd_transpose_bits(const uint64_t *const *planes, unsigned nplanes,
+    size_t nwords, uint32_t *dst)
+{
+    transpose_bits(planes, (nplanes > 32) ? 32 : nplanes, nwords, dst);
+}
+
+static void f32_to_u16_scalar(const float *src, uint16_t *dst, size_t n,
+    uint16_t *min, uint16_t *max)
+{
+    uint16_t lo = *min;
+    uint16_t hi = *max;
+
+    for (size_t i = 0; i < n; i++) {
+        uint16_t sample = (uint16_t) (int32_t) src[i];
+        dst[i] = sample;
+        if (sample < lo)
+            lo = sample;
+        if (sample > hi)
+            hi = sample;
+    }
+
+    *min = lo;
+    *max = hi;
+}
+
+static void u16_thresholds_scalar(const uint16_t *src, size_t n,
+    uint16_t lo, uint16_t hi, uint64_t *below, uint64_t *above)
+{
+    for (size_t w = 0; w < (n + 63) / 64; w++) {
+        size_t len = (n - w * 64 < 64) ? n - w * 64 : 64;
+        uint64_t b = 0, a = 0;
+
+        for (size_t i = 0; i < len; i++) {
+            uint16_t sample = src[w * 64 + i];
+            b |= (uint64_t) (sample <= lo) << i;
+            a |= (uint64_t) (sample >= hi) << i;
+        }
+        below[w] = b;
+        above[w] = a;
+    }
+}
+
+static void unpack_u12_scalar(const uint8_t *src, size_t n, uint16_t *dst)
+{
+    size_t i;
+
+    for (i = 0; i + 1 < n; i += 2) {
+        dst[i] = src[0] | ((src[1] & 0xf) << 8);
+        dst[i + 1] = (src[1] >> 4) | (src[2] << 4);
+        src += 3;
+    }
+
+    if (i < n)
+        dst[i] = src[0] | ((src[1] & 0xf) << 8);
+}
+
+static void u12_histogram_scalar(const uint16_t *src, size_t n, uint32_t *hist)
+{
+    for (size_t i = 0; i < n; i++) {
+        uint16_t bin = (src[i] < SIMD_HIST_BINS) ? src[i] : SIMD_HIST_BINS - 1;
+        hist[(i % SIMD_HIST_WAYS) * SIMD_HIST_BINS + bin]++;
+    }
+}
+
+/* Transposes an 8x8 bit matrix with a row per byte (Hacker's Delight,
+ * transpose8rS64).
+ */
+static inline uint64_t transpose8x8(uint64_t x)
+{
+    uint64_t t;
+
+    t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+    x = x ^ t ^ (t << 28);
+
+    return x;
+}
+
+/* Word w of channel k, or nothing for a channel that isn't there */
+static inline uint64_t plane_word(const uint64_t *const *planes,
+    unsigned nplanes, unsigned k, size_t w)
+{
+    return (k < nplanes && planes[k]) ? planes[k][w] : 0;
+}
+
+static void transpose_bits_scalar(const uint64_t *const *planes,
+    unsigned nplanes, size_t nwords, uint32_t *dst)
+{
+    for (size_t w = 0; w < nwords; w++, dst += 64) {
+        memset(dst, 0, 64 * sizeof(uint32_t));
+
+        for (unsigned g = 0; g < (nplanes + 7) / 8; g++) {
+            uint64_t r[8];
+
+            for (unsigned k = 0; k < 8; k++)
+                r[k] = plane_word(planes, nplanes, 8 * g + k, w);
+
+            for (unsigned b = 0; b < 8; b++) {
+                uint64_t t = 0;
+
+                for (unsigned k = 0; k < 8; k++)
+                    t |= ((r[k] >> (8 * b)) & 0xff) << (8 * k);
+                t = transpose8x8(t);
+
+                for (unsigned j = 0; j < 8; j++)
+                    dst[8 * b + j] |= ((t >> (8 * j)) & 0xff) << (8 * g);
+            }
+        }
+    }
+}
+
+#ifdef SIMD_X86
+/* SSE2 has no unsigned 16-bit min/max, so the samples get biased into
+ * signed range for comparing and unbiased at the end.
+ */
+__attribute__((target("sse2")))
+static void f32_to_u16_sse2(const float *src, uint16_t *dst, size_t n,
+    uint16_t *min, uint16_t *max)
+{
+    const __m128i bias = _mm_set1_epi16((short) 0x8000);
+    __m128i vmin = _mm_set1_epi16(0x7fff);
+    __m128i vmax = _mm_set1_epi16((short) 0x8000);
+    uint16_t lanes_min[8], lanes_max[8];
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_cvttps_epi32(_mm_loadu_ps(src + i));
+        __m128i b = _mm_cvttps_epi32(_mm_loadu_ps(src + i + 4));
+        __m128i s;
+
+        /* Sign extend the low halves so the saturating pack can't
+         * saturate; that's the same as the scalar cast's truncation.
+         */
+        a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+        b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+        s = _mm_packs_epi32(a, b);
+        _mm_storeu_si128((__m128i *) (dst + i), s);
+
+        s = _mm_xor_si128(s, bias);
+        vmin = _mm_min_epi16(vmin, s);
+        vmax = _mm_max_epi16(vmax, s);
+    }
+
+    _mm_storeu_si128((__m128i *) lanes_min, _mm_xor_si128(vmin, bias));
+    _mm_storeu_si128((__m128i *) lanes_max, _mm_xor_si128(vmax, bias));
+    for (int j = 0; j < 8; j++) {
+        if (lanes_min[j] < *min)
+            *min = lanes_min[j];
+        if (lanes_max[j] > *max)
+            *max = lanes_max[j];
+    }
+
+    f32_to_u16_scalar(src + i, dst + i, n - i, min, max);
+}
+
+__attribute__((target("avx2")))
+static void f32_to_u16_avx2(const float *src, uint16_t *dst, size_t n,
+    uint16_t *min, uint16_t *max)
+{
+    __m256i vmin = _mm256_set1_epi16((short) 0xffff);
+    __m256i vmax = _mm256_setzero_si256();
+    uint16_t lanes_min[16], lanes_max[16];
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m256i a = _mm256_cvttps_epi32(_mm256_loadu_ps(src + i));
+        __m256i b = _mm256_cvttps_epi32(_mm256_loadu_ps(src + i + 8));
+        __m256i s;
+
+        a = _mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16);
+        b = _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16);
+
+        /* The pack works within 128-bit lanes; put them back in order */
+        s = _mm256_packs_epi32(a, b);
+        s = _mm256_permute4x64_epi64(s, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i *) (dst + i), s);
+
+        vmin = _mm256_min_epu16(vmin, s);
+        vmax = _mm256_max_epu16(vmax, s);
+    }
+
+    _mm256_storeu_si256((__m256i *) lanes_min, vmin);
+    _mm256_storeu_si256((__m256i *) lanes_max, vmax);
+    for (int j = 0; j < 16; j++) {
+        if (lanes_min[j] < *min)
+            *min = lanes_min[j];
+        if (lanes_max[j] > *max)
+            *max = lanes_max[j];
+    }
+
+    f32_to_u16_scalar(src + i, dst + i, n - i, min, max);
+}
+/* Same biasing trick as above, with signed compares.  Each pass packs
+ * sixteen comparisons down to bytes and pulls out their sign bits.
+ */
+__attribute__((target("sse2")))
+static void u16_thresholds_sse2(const uint16_t *src, size_t n,
+    uint16_t lo, uint16_t hi, uint64_t *below, uint64_t *above)
+{
+    const __m128i bias = _mm_set1_epi16((short) 0x8000);
+    const __m128i vlo = _mm_xor_si128(_mm_set1_epi16(lo), bias);
+    const __m128i vhi = _mm_xor_si128(_mm_set1_epi16(hi), bias);
+    size_t i = 0;
+
+    for (; i + 64 <= n; i += 64) {
+        uint64_t b = 0, a = 0;
+
+        for (unsigned j = 0; j < 64; j += 16) {
+            __m128i s0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (src + i + j)), bias);
+            __m128i s1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (src + i + j + 8)), bias);
+
+            /* These are the opposite tests; flipped back below */
+            __m128i gt_lo = _mm_packs_epi16(_mm_cmpgt_epi16(s0, vlo),
+                _mm_cmpgt_epi16(s1, vlo));
+            __m128i lt_hi = _mm_packs_epi16(_mm_cmpgt_epi16(vhi, s0),
+                _mm_cmpgt_epi16(vhi, s1));
+
+            b |= (uint64_t) (~_mm_movemask_epi8(gt_lo) & 0xffff) << j;
+            a |= (uint64_t) (~_mm_movemask_epi8(lt_hi) & 0xffff) << j;
+        }
+        below[i / 64] = b;
+        above[i / 64] = a;
+    }
+
+    u16_thresholds_scalar(src + i, n - i, lo, hi, below + i / 64, above + i / 64);
+}
+
+__attribute__((target("avx2")))
+static void u16_thresholds_avx2(const uint16_t *src, size_t n,
+    uint16_t lo, uint16_t hi, uint64_t *below, uint64_t *above)
+{
+    const __m256i vlo = _mm256_set1_epi16(lo);
+    const __m256i vhi = _mm256_set1_epi16(hi);
+    size_t i = 0;
+
+    for (; i + 64 <= n; i += 64) {
+        uint64_t b = 0, a = 0;
+
+        for (unsigned j = 0; j < 64; j += 32) {
+            __m256i s0 = _mm256_loadu_si256((const __m256i *) (src + i + j));
+            __m256i s1 = _mm256_loadu_si256((const __m256i *) (src + i + j + 16));
+            __m256i le0 = _mm256_cmpeq_epi16(_mm256_min_epu16(s0, vlo), s0);
+            __m256i le1 = _mm256_cmpeq_epi16(_mm256_min_epu16(s1, vlo), s1);
+            __m256i ge0 = _mm256_cmpeq_epi16(_mm256_max_epu16(s0, vhi), s0);
+            __m256i ge1 = _mm256_cmpeq_epi16(_mm256_max_epu16(s1, vhi), s1);
+
+            /* The pack works within 128-bit lanes; put them back in order */
+            __m256i le = _mm256_permute4x64_epi64(_mm256_packs_epi16(le0, le1),
+                _MM_SHUFFLE(3, 1, 2, 0));
+            __m256i ge = _mm256_permute4x64_epi64(_mm256_packs_epi16(ge0, ge1),
+                _MM_SHUFFLE(3, 1, 2, 0));
+
+            b |= (uint64_t) (uint32_t) _mm256_movemask_epi8(le) << j;
+            a |= (uint64_t) (uint32_t) _mm256_movemask_epi8(ge) << j;
+        }
+        below[i / 64] = b;
+        above[i / 64] = a;
+    }
+
+    u16_thresholds_scalar(src + i, n - i, lo, hi, below + i / 64, above + i / 64);
+}
+
+/* Each 128-bit lane takes twelve bytes, eight samples, and shuffles the
+ * pair of bytes each sample straddles into its own word.  Even samples
+ * are then the low twelve bits and odd ones the high twelve.
+ */
+__attribute__((target("avx2")))
+static void unpack_u12_avx2(const uint8_t *src, size_t n, uint16_t *dst)
+{
+    const __m256i shuf = _mm256_setr_epi8(
+        0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11,
+        0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+    const __m256i mask = _mm256_set1_epi16(0xfff);
+    size_t i = 0;
+
+    /* Each pass loads four bytes past what it uses; stay clear of the
+     * end of the packed samples.
+     */
+    for (; i + 20 <= n; i += 16) {
+        const uint8_t *p = src + (i / 2) * 3;
+        __m256i x = _mm256_inserti128_si256(_mm256_castsi128_si256(
+            _mm_loadu_si128((const __m128i *) p)),
+            _mm_loadu_si128((const __m128i *) (p + 12)), 1);
+
+        x = _mm256_shuffle_epi8(x, shuf);
+        x = _mm256_blend_epi16(_mm256_and_si256(x, mask),
+            _mm256_srli_epi16(x, 4), 0xaa);
+        _mm256_storeu_si256((__m256i *) (dst + i), x);
+    }
+
+    unpack_u12_scalar(src + (i / 2) * 3, n - i, dst + i);
+}
+/* The SSE2 and AVX2 transposes take a group of eight channels at a
+ * time.  Unpacking bytes, then words, then dwords lines the channels'
+ * bytes up into tiles, two to a 128-bit lane, and the tile transpose
+ * runs on both at once.  The groups' tiles then get interleaved a byte
+ * apiece into sample words.
+ */
+#define TRANSPOSE_TILES(V, unpacklo8, unpacklo16, unpackhi16, unpacklo32, \
+        unpackhi32, a, d) do { \
+    V b0 = unpacklo8(a[0], a[1]), b1 = unpacklo8(a[2], a[3]); \
+    V b2 = unpacklo8(a[4], a[5]), b3 = unpacklo8(a[6], a[7]); \
+    V c0 = unpacklo16(b0, b1), c1 = unpackhi16(b0, b1); \
+    V c2 = unpacklo16(b2, b3), c3 = unpackhi16(b2, b3); \
+    d[0] = unpacklo32(c0, c2); \
+    d[1] = unpackhi32(c0, c2); \
+    d[2] = unpacklo32(c1, c3); \
+    d[3] = unpackhi32(c1, c3); \
+} while (0)
+
+__attribute__((target("sse2")))
+static inline __m128i transpose8x8_sse2(__m128i x)
+{
+    __m128i t;
+
+    t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, 7)),
+        _mm_set1_epi64x(0x00aa00aa00aa00aaLL));
+    x = _mm_xor_si128(_mm_xor_si128(x, t), _mm_slli_epi64(t, 7));
+    t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, 14)),
+        _mm_set1_epi64x(0x0000cccc0000ccccLL));
+    x = _mm_xor_si128(_mm_xor_si128(x, t), _mm_slli_epi64(t, 14));
+    t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, 28)),
+        _mm_set1_epi64x(0x00000000f0f0f0f0LL));
+    x = _mm_xor_si128(_mm_xor_si128(x, t), _mm_slli_epi64(t, 28));
+
+    return x;
+}
+
+/* Transposes word w of the channels into 64 sample words */
+__attribute__((target("sse2")))
+static void transpose_word_sse2(const uint64_t *const *planes,
+    unsigned nplanes, size_t w, uint32_t *dst)
+{
+    /* d[g][i] holds group g's bytes for samples 16i to 16i + 15 */
+    __m128i d[4][4];
+
+    for (unsigned g = 0; g < 4; g++) {
+        __m128i a[8];
+
+        if (8 * g >= nplanes) {
+            for (unsigned i = 0; i < 4; i++)
+                d[g][i] = _mm_setzero_si128();
+            continue;
+        }
+
+        for (unsigned k = 0; k < 8; k++)
+            a[k] = _mm_set_epi64x(0, plane_word(planes, nplanes, 8 * g + k, w));
+        TRANSPOSE_TILES(__m128i, _mm_unpacklo_epi8, _mm_unpacklo_epi16,
+            _mm_unpackhi_epi16, _mm_unpacklo_epi32, _mm_unpackhi_epi32,
+            a, d[g]);
+        for (unsigned i = 0; i < 4; i++)
+            d[g][i] = transpose8x8_sse2(d[g][i]);
+    }
+
+    for (unsigned i = 0; i < 4; i++) {
+        __m128i lo01 = _mm_unpacklo_epi8(d[0][i], d[1][i]);
+        __m128i hi01 = _mm_unpackhi_epi8(d[0][i], d[1][i]);
+        __m128i lo23 = _mm_unpacklo_epi8(d[2][i], d[3][i]);
+        __m128i hi23 = _mm_unpackhi_epi8(d[2][i], d[3][i]);
+        __m128i *out = (__m128i *) (dst + 16 * i);
+
+        _mm_storeu_si128(out, _mm_unpacklo_epi16(lo01, lo23));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(lo01, lo23));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(hi01, hi23));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(hi01, hi23));
+    }
+}
+
+__attribute__((target("sse2")))
+static void transpose_bits_sse2(const uint64_t *const *planes,
+    unsigned nplanes, size_t nwords, uint32_t *dst)
+{
+    for (size_t w = 0; w < nwords; w++)
+        transpose_word_sse2(planes, nplanes, w, dst + 64 * w);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i transpose8x8_avx2(__m256i x)
+{
+    __m256i t;
+
+    t = _mm256_and_si256(_mm256_xor_si256(x, _mm256_srli_epi64(x, 7)),
+        _mm256_set1_epi64x(0x00aa00aa00aa00aaLL));
+    x = _mm256_xor_si256(_mm256_xor_si256(x, t), _mm256_slli_epi64(t, 7));
+    t = _mm256_and_si256(_mm256_xor_si256(x, _mm256_srli_epi64(x, 14)),
+        _mm256_set1_epi64x(0x0000cccc0000ccccLL));
+    x = _mm256_xor_si256(_mm256_xor_si256(x, t), _mm256_slli_epi64(t, 14));
+    t = _mm256_and_si256(_mm256_xor_si256(x, _mm256_srli_epi64(x, 28)),
+        _mm256_set1_epi64x(0x00000000f0f0f0f0LL));
+    x = _mm256_xor_si256(_mm256_xor_si256(x, t), _mm256_slli_epi64(t, 28));
+
+    return x;
+}
+
+/* Two words of samples at a time, one per 128-bit lane */
+__attribute__((target("avx2")))
+static void transpose_bits_avx2(const uint64_t *const *planes,
+    unsigned nplanes, size_t nwords, uint32_t *dst)
+{
+    size_t w = 0;
+
+    for (; w + 2 <= nwords; w += 2, dst += 128) {
+        __m256i d[4][4];
+
+        for (unsigned g = 0; g < 4; g++) {
+            __m256i a[8];
+
+            if (8 * g >= nplanes) {
+                for (unsigned i = 0; i < 4; i++)
+                    d[g][i] = _mm256_setzero_si256();
+                continue;
+            }
+
+            for (unsigned k = 0; k < 8; k++) {
+                unsigned ch = 8 * g + k;
+                __m128i x = (ch < nplanes && planes[ch]) ?
+                    _mm_loadu_si128((const __m128i *) (planes[ch] + w)) :
+                    _mm_setzero_si128();
+
+                a[k] = _mm256_permute4x64_epi64(_mm256_castsi128_si256(x),
+                    _MM_SHUFFLE(1, 1, 0, 0));
+            }
+            TRANSPOSE_TILES(__m256i, _mm256_unpacklo_epi8,
+                _mm256_unpacklo_epi16, _mm256_unpackhi_epi16,
+                _mm256_unpacklo_epi32, _mm256_unpackhi_epi32, a, d[g]);
+            for (unsigned i = 0; i < 4; i++)
+                d[g][i] = transpose8x8_avx2(d[g][i]);
+        }
+
+        for (unsigned i = 0; i < 4; i++) {
+            __m256i lo01 = _mm256_unpacklo_epi8(d[0][i], d[1][i]);
+            __m256i hi01 = _mm256_unpackhi_epi8(d[0][i], d[1][i]);
+            __m256i lo23 = _mm256_unpacklo_epi8(d[2][i], d[3][i]);
+            __m256i hi23 = _mm256_unpackhi_epi8(d[2][i], d[3][i]);
+            __m256i o0 = _mm256_unpacklo_epi16(lo01, lo23);
+            __m256i o1 = _mm256_unpackhi_epi16(lo01, lo23);
+            __m256i o2 = _mm256_unpacklo_epi16(hi01, hi23);
+            __m256i o3 = _mm256_unpackhi_epi16(hi01, hi23);
+            __m256i *out = (__m256i *) (dst + 16 * i);
+            __m256i *out2 = (__m256i *) (dst + 64 + 16 * i);
+
+            /* Low lanes are the first word's samples, high the second's */
+            _mm256_storeu_si256(out, _mm256_permute2x128_si256(o0, o1, 0x20));
+            _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(o2, o3, 0x20));
+            _mm256_storeu_si256(out2, _mm256_permute2x128_si256(o0, o1, 0x31));
+            _mm256_storeu_si256(out2 + 1, _mm256_permute2x128_si256(o2, o3, 0x31));
+        }
+    }
+
+    if (w < nwords)
+        transpose_word_sse2(planes, nplanes, w, dst);
+}
+/* The vector histograms clamp a block of samples and add each one's
+ * way offset in one go, leaving only the increments scalar; there's no
+ * scatter to do those with.  Four ways of 4096 bins still fit the
+ * offsets in 16 bits.
+ */
+__attribute__((target("sse2")))
+static void u12_histogram_sse2(const uint16_t *src, size_t n, uint32_t *hist)
+{
+    const __m128i top = _mm_set1_epi16(SIMD_HIST_BINS - 1);
+    const __m128i ways = _mm_setr_epi16(0, 4096, 8192, 12288,
+        0, 4096, 8192, 12288);
+    uint16_t idx[8];
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (src + i));
+
+        /* min(x, top) without SSE4.1's unsigned min */
+        x = _mm_sub_epi16(x, _mm_subs_epu16(x, top));
+        _mm_storeu_si128((__m128i *) idx, _mm_add_epi16(x, ways));
+        for (unsigned k = 0; k < 8; k++)
+            hist[idx[k]]++;
+    }
+
+    u12_histogram_scalar(src + i, n - i, hist);
+}
+
+__attribute__((target("avx2")))
+static void u12_histogram_avx2(const uint16_t *src, size_t n, uint32_t *hist)
+{
+    const __m256i top = _mm256_set1_epi16(SIMD_HIST_BINS - 1);
+    const __m256i ways = _mm256_setr_epi16(0, 4096, 8192, 12288,
+        0, 4096, 8192, 12288, 0, 4096, 8192, 12288, 0, 4096, 8192, 12288);
+    uint16_t idx[16];
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (src + i));
+
+        x = _mm256_add_epi16(_mm256_min_epu16(x, top), ways);
+        _mm256_storeu_si256((__m256i *) idx, x);
+        for (unsigned k = 0; k < 16; k++)
+            hist[idx[k]]++;
+    }
+
+    u12_histogram_scalar(src + i, n - i, hist);
+}
+#endif
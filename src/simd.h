@@ -0,0 +1,70 @@
+/* File: simd.h
+ *
+ * Vectorized sample kernels, picked at runtime (headers)
+ *
+ * Author: Jack Bradach <jack@bradach.net>
+ *
+ * Copyright (C) 2016 Jack Bradach <jack@bradach.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Enum: simd_level
+ *
+ * Instruction sets the kernels come in, from least to most capable.
+ *
+ * SIMD_SCALAR - plain C
+ * SIMD_SSE2 - 128-bit SSE2
+ * SIMD_AVX2 - 256-bit AVX2
+ */
+enum simd_level {
+    SIMD_SCALAR = 0,
+    SIMD_SSE2,
+    SIMD_AVX2
+};
+
+/* Bins in a sample histogram, one per 12-bit sample value, and how
+ * many interleaved copies of it <simd_u12_histogram> counts into.
+ */
+#define SIMD_HIST_BINS 4096
+#define SIMD_HIST_WAYS 4
+
+enum simd_level simd_get_level(void);
+enum simd_level simd_set_level(enum simd_level level);
+enum simd_level simd_max_level(void);
+
+void simd_f32_to_u16(const float *src, uint16_t *dst, size_t n,
+    uint16_t *min, uint16_t *max);
+void simd_u16_thresholds(const uint16_t *src, size_t n, uint16_t lo,
+    uint16_t hi, uint64_t *below, uint64_t *above);
+void simd_pack_u12(const uint16_t *src, size_t n, uint8_t *dst);
+void simd_unpack_u12(const uint8_t *src, size_t n, uint16_t *dst);
+void simd_u12_histogram(const uint16_t *src, size_t n, uint32_t *hist);
+void simd_transpose_bits(const uint64_t *const *planes, unsigned nplanes,
+    size_t nwords, uint32_t *dst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -35,3 +35,20 @@ TEST(AdcTest, SampleToVoltage) {
         last_v = v;
     }
 }
+
+TEST(AdcTest, SamplesToVoltage) {
+    adc_cal_t *cal = adc_cal_create(-5.0, 5.0);
+    uint16_t samples[4096];
+    float volts[4096];
+
+    for (uint16_t i = 0; i < 4096; i++)
+        samples[i] = i;
+
+    for (adc_cal_t *c : { (adc_cal_t *) NULL, cal }) {
+        adc_samples_to_voltage(samples, 4096, volts, c);
+        for (uint16_t i = 0; i < 4096; i++)
+            ASSERT_NEAR(adc_sample_to_voltage(i, c), volts[i], 1E-5) << i;
+    }
+
+    free(cal);
+}
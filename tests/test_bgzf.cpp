@@ -0,0 +1,103 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <gtest/gtest.h>
+#include "test_utils.hpp"
+
+#include "bgzf.h"
+#include "file_utils.h"
+
+static const char test_file[] = "uart_analog_115200_50mHz.bin.gz";
+
+/* Block gzips the test capture into a temporary file. */
+static FILE *make_bgzf(void **gold, size_t *len)
+{
+    FILE *in = fopen(test_file, "rb");
+    FILE *out = tmpfile();
+
+    EXPECT_EQ(0, file_load(in, gold, len));
+    EXPECT_EQ(0, bgzf_compress_file(in, out, Z_DEFAULT_COMPRESSION));
+    fclose(in);
+    rewind(out);
+    return out;
+}
+
+TEST(BgzfTest, RoundTrip) {
+    TEST_DESC("Block gzip'd captures load back identical");
+    void *gold, *buf;
+    size_t gold_len, len;
+    FILE *fp = make_bgzf(&gold, &gold_len);
+
+    ASSERT_TRUE(file_is_gzip(fp));
+    ASSERT_EQ(0, file_load(fp, &buf, &len));
+    ASSERT_EQ(gold_len, len);
+    ASSERT_EQ(0, memcmp(gold, buf, len));
+
+    free(buf);
+    free(gold);
+    fclose(fp);
+}
+
+TEST(BgzfTest, PlainGzipReader) {
+    TEST_DESC("Block gzip'd captures are still regular gzip files");
+    void *gold;
+    size_t gold_len;
+    FILE *fp = make_bgzf(&gold, &gold_len);
+    uint8_t *buf = new uint8_t[gold_len + 1];
+    file_stream_t *fs;
+
+    ASSERT_EQ(0, file_stream_open(fp, &fs));
+    ASSERT_EQ((int64_t) gold_len, file_stream_read(fs, buf, gold_len + 1));
+    ASSERT_EQ(0, memcmp(gold, buf, gold_len));
+    file_stream_close(fs);
+
+    delete[] buf;
+    free(gold);
+    fclose(fp);
+}
+
+TEST(BgzfTest, ParallelInflate) {
+    TEST_DESC("Blocks inflate straight into place; anything else is refused");
+    void *gold, *src, *buf;
+    size_t gold_len, len;
+    uint8_t raw[4096];
+    FILE *fp = make_bgzf(&gold, &gold_len);
+    FILE *gz = fopen(test_file, "rb");
+    off_t src_len;
+    size_t bsize;
+
+    fseek(fp, 0, SEEK_END);
+    src_len = ftell(fp);
+    src = mmap(NULL, src_len, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+        fileno(fp), 0);
+    ASSERT_NE(MAP_FAILED, src);
+
+    /* Several blocks plus the end of file marker */
+    ASSERT_TRUE(bgzf_detect(src, src_len));
+    ASSERT_EQ(0, bgzf_inflate(src, src_len, &buf, &len));
+    ASSERT_EQ(gold_len, len);
+    ASSERT_EQ(0, memcmp(gold, buf, len));
+    free(buf);
+
+    /* A regular gzip file isn't block gzip */
+    len = fread(raw, 1, sizeof(raw), gz);
+    ASSERT_FALSE(bgzf_detect(raw, len));
+    errno = 0;
+    ASSERT_EQ(-1, bgzf_inflate(raw, len, &buf, &len));
+    ASSERT_EQ(EINVAL, errno);
+
+    /* Corrupting the second block's data gets caught */
+    bsize = ((uint8_t *) src)[16] + (((uint8_t *) src)[17] << 8) + 1;
+    ((uint8_t *) src)[bsize + 100] ^= 0x55;
+    errno = 0;
+    ASSERT_EQ(-1, bgzf_inflate(src, src_len, &buf, &len));
+    ASSERT_EQ(EILSEQ, errno);
+
+    munmap(src, src_len);
+    free(gold);
+    fclose(gz);
+    fclose(fp);
+}
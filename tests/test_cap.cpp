@@ -1,6 +1,11 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <vector>
 #include <gtest/gtest.h>
 
 #include "cap.h"
+#include "simd.h"
 #include "saleae.h"
 
 TEST(CapTest, CaptureLifecycle) {
@@ -89,3 +94,755 @@ TEST(CapTest, CloneToBundle) {
     ASSERT_TRUE(cap_get_analog_cal(c1) == cap_get_analog_cal(cap_src));
 
 }
+
+/* The edge searches as they worked on a byte per sample */
+static uint64_t ref_next_edge(const std::vector<uint8_t> &d, uint64_t from)
+{
+    uint64_t next = from + 1;
+
+    for (int i = 0; i < 2 && next < d.size(); next++) {
+        if (d[from] != d[next])
+            i++;
+    }
+
+    return (next > d.size()) ? d.size() : next;
+}
+
+static uint64_t ref_prev_edge(const std::vector<uint8_t> &d, uint64_t from)
+{
+    int64_t prev;
+
+    for (prev = from - 2; prev > 0; prev--) {
+        if (d[from] != d[prev])
+            break;
+    }
+
+    return (prev < 0) ? 0 : prev;
+}
+
+TEST(CapTest, DigitalPacked) {
+    /* Runs from a single sample up to several words long */
+    const uint64_t nsamples = 20000 + 37;
+    std::vector<uint8_t> gold(nsamples);
+    cap_t *c = cap_create(nsamples);
+    uint8_t level = 1;
+
+    srand(42);
+    for (uint64_t i = 0; i < nsamples; ) {
+        uint64_t run = 1 + rand() % ((i / 1000) % 2 ? 300 : 5);
+        for (; run && i < nsamples; run--, i++) {
+            gold[i] = level;
+            cap_set_digital(c, i, level);
+        }
+        level = !level;
+    }
+
+    ASSERT_EQ((nsamples + 63) / 64, cap_get_digital_nwords(c));
+    for (uint64_t i = 0; i < nsamples; i++) {
+        ASSERT_EQ(gold[i], cap_get_digital(c, i));
+        ASSERT_EQ(gold[i], (cap_get_digital_word(c, i / 64) >> (i % 64)) & 1);
+    }
+    ASSERT_EQ(0, cap_get_digital_word(c, nsamples / 64) >> (nsamples % 64));
+
+    for (uint64_t i = 0; i < nsamples; i++) {
+        ASSERT_EQ(ref_next_edge(gold, i), cap_next_edge(c, i)) << i;
+        ASSERT_EQ(ref_prev_edge(gold, i), cap_prev_edge(c, i)) << i;
+    }
+
+    /* The edge index agrees with the samples, before and after a
+     * change forces it to be rebuilt.
+     */
+    for (int pass = 0; pass < 2; pass++) {
+        std::vector<uint64_t> edges;
+        uint64_t buf[100];
+
+        for (uint64_t i = 1; i < nsamples; i++) {
+            if (gold[i] != gold[i - 1])
+                edges.push_back(i);
+        }
+        ASSERT_EQ(edges.size(), cap_get_nedges(c));
+        for (size_t k = 0; k < edges.size(); k++) {
+            ASSERT_EQ(edges[k], cap_get_edge(c, k));
+        }
+        ASSERT_EQ(nsamples, cap_get_edge(c, edges.size()));
+
+        for (uint64_t begin = 0; begin < nsamples; begin += 997) {
+            uint64_t end = begin + 1500;
+            size_t n = 0;
+
+            for (uint64_t e : edges)
+                n += (e >= begin) && (e < end);
+            ASSERT_EQ(n, cap_count_edges(c, begin, end)) << begin;
+            ASSERT_EQ(std::min(n, (size_t) 100),
+                cap_get_edges(c, begin, end, buf, 100));
+        }
+
+        for (uint64_t i = 0; i < nsamples; i += 7) {
+            ASSERT_EQ(ref_next_edge(gold, i), cap_next_edge(c, i)) << i;
+            ASSERT_EQ(ref_prev_edge(gold, i), cap_prev_edge(c, i)) << i;
+        }
+
+        gold[5000] = !gold[5000];
+        cap_set_digital(c, 5000, gold[5000]);
+    }
+
+    /* Clearing bits works too */
+    cap_set_digital(c, 100, !gold[100]);
+    ASSERT_EQ(!gold[100], cap_get_digital(c, 100));
+
+    cap_dropref(c);
+}
+
+/* Random runs from a single sample up to a few hundred long */
+static cap_t *make_runs(uint64_t len, unsigned seed)
+{
+    cap_t *c = cap_create(len);
+    uint8_t level = 1;
+
+    srand(seed);
+    for (uint64_t i = 0; i < len; ) {
+        uint64_t run = 1 + rand() % ((i / 500) % 2 ? 200 : 4);
+        for (; run && i < len; run--, i++) {
+            cap_set_analog(c, i, rand() % 4096);
+            cap_set_digital(c, i, level);
+        }
+        level = !level;
+    }
+    cap_set_period(c, 1.0E-06);
+    cap_update_analog_minmax(c);
+
+    return c;
+}
+
+/* Checks a view against the samples it's meant to hold, and its edges
+ * against a real capture of those samples.
+ */
+static void expect_view(cap_t *c, const std::vector<uint8_t> &gold,
+    const std::vector<uint16_t> &analog)
+{
+    std::vector<uint16_t> buf(analog.size());
+    cap_t *ref = cap_create(gold.size());
+
+    for (uint64_t i = 0; i < gold.size(); i++)
+        cap_set_digital(ref, i, gold[i]);
+
+    ASSERT_EQ(gold.size(), cap_get_nsamples(c));
+    cap_read_analog(c, 0, buf.data(), buf.size());
+    ASSERT_TRUE(analog == buf);
+    for (uint64_t i = 0; i < gold.size(); i++) {
+        ASSERT_EQ(gold[i], cap_get_digital(c, i)) << i;
+        ASSERT_EQ(analog[i], cap_get_analog(c, i)) << i;
+    }
+    for (uint64_t w = 0; w < cap_get_digital_nwords(c); w++) {
+        ASSERT_EQ(cap_get_digital_word(ref, w), cap_get_digital_word(c, w)) << w;
+    }
+
+    ASSERT_EQ(cap_get_nedges(ref), cap_get_nedges(c));
+    for (uint64_t k = 0; k <= cap_get_nedges(ref); k++) {
+        ASSERT_EQ(cap_get_edge(ref, k), cap_get_edge(c, k)) << k;
+    }
+    for (uint64_t begin = 0; begin < gold.size(); begin += 331) {
+        ASSERT_EQ(cap_count_edges(ref, begin, begin + 900),
+            cap_count_edges(c, begin, begin + 900)) << begin;
+    }
+    for (uint64_t i = 0; i < gold.size(); i++) {
+        ASSERT_EQ(ref_next_edge(gold, i), cap_next_edge(c, i)) << i;
+        ASSERT_EQ(ref_prev_edge(gold, i), cap_prev_edge(c, i)) << i;
+    }
+
+    cap_dropref(ref);
+}
+
+/* The samples a view of [begin, end) holds */
+template <typename T>
+static std::vector<T> slice(const std::vector<T> &v, uint64_t begin, uint64_t end)
+{
+    return std::vector<T>(v.begin() + begin, v.begin() + end);
+}
+
+/* The samples of a capture looped twice over */
+template <typename T>
+static std::vector<T> twice(const std::vector<T> &v)
+{
+    std::vector<T> dst(v);
+
+    dst.insert(dst.end(), v.begin(), v.end());
+    return dst;
+}
+
+TEST(CapTest, LoopedClone) {
+    /* Not a multiple of a word, so loops land mid-word */
+    const uint64_t len = 3000 + 21;
+    const unsigned nloops = 3, skew_us = 1234;
+    cap_t *src = make_runs(len, 7);
+
+    /* With and without an edge where the source wraps around */
+    for (int pass = 0; pass < 2; pass++) {
+        cap_bundle_t *bun = cap_bundle_create(), *bun2 = cap_bundle_create();
+        uint64_t skew = (skew_us * 1E-6) / cap_get_period(src);
+        uint64_t nsamples = len * nloops;
+        std::vector<uint8_t> gold(nsamples);
+        std::vector<uint16_t> analog(nsamples);
+        cap_t *c, *c2;
+
+        cap_set_digital(src, len - 1, pass ? cap_get_digital(src, 0) :
+            !cap_get_digital(src, 0));
+        for (uint64_t i = 0; i < nsamples; i++) {
+            gold[i] = cap_get_digital(src, (i + skew) % len);
+            analog[i] = cap_get_analog(src, (i + skew) % len);
+        }
+
+        cap_clone_to_bundle(bun, src, nloops, skew_us);
+        c = cap_bundle_first(bun);
+        ASSERT_EQ(2, cap_nref(src));
+        ASSERT_EQ(cap_get_analog_max(src), cap_get_analog_max(c));
+        expect_view(c, gold, analog);
+
+        /* Looping a loop maps straight back to the original */
+        cap_clone_to_bundle(bun2, c, 2, skew_us);
+        c2 = cap_bundle_first(bun2);
+        ASSERT_EQ(3, cap_nref(src));
+        for (uint64_t i = 0; i < cap_get_nsamples(c2); i += 5) {
+            ASSERT_EQ(gold[(i + skew) % nsamples], cap_get_digital(c2, i)) << i;
+        }
+
+        cap_bundle_dropref(bun2);
+        cap_bundle_dropref(bun);
+        ASSERT_EQ(1, cap_nref(src));
+    }
+
+    cap_dropref(src);
+}
+
+TEST(CapTest, Subcap) {
+    const uint64_t len = 5000 + 3;
+    cap_t *src = make_runs(len, 11);
+    cap_bundle_t *bun = cap_bundle_create();
+    std::vector<uint8_t> gold(len);
+    std::vector<uint16_t> analog(len);
+    cap_t *sub, *sub2, *loop, *c;
+
+    for (uint64_t i = 0; i < len; i++) {
+        gold[i] = cap_get_digital(src, i);
+        analog[i] = cap_get_analog(src, i);
+    }
+
+    sub = cap_create_subcap(src, 1000, 4000);
+    ASSERT_EQ(3, cap_nref(src));
+    ASSERT_EQ(1, cap_get_nparents(sub));
+    ASSERT_TRUE(src == cap_get_parent(sub));
+    ASSERT_TRUE(src == cap_get_top(sub));
+    ASSERT_EQ(1000, cap_get_offset(sub));
+    ASSERT_EQ(cap_get_period(src), cap_get_period(sub));
+    ASSERT_EQ(cap_get_analog_min(src), cap_get_analog_min(sub));
+    expect_view(sub, slice(gold, 1000, 4000), slice(analog, 1000, 4000));
+
+    /* Subcaps of subcaps are relative to their parent */
+    sub2 = cap_create_subcap(sub, 77, 2000);
+    ASSERT_EQ(2, cap_get_nparents(sub2));
+    ASSERT_TRUE(src == cap_get_top(sub2));
+    ASSERT_EQ(1077, cap_get_offset(sub2));
+    expect_view(sub2, slice(gold, 1077, 3000), slice(analog, 1077, 3000));
+    cap_dropref(sub2);
+
+    /* Ranges past either end get clamped */
+    sub2 = cap_create_subcap(sub, -5, 1 << 20);
+    expect_view(sub2, slice(gold, 1000, 4000), slice(analog, 1000, 4000));
+    cap_dropref(sub2);
+    sub2 = cap_create_subcap(sub, 10, 5);
+    ASSERT_EQ(0, cap_get_nsamples(sub2));
+    ASSERT_EQ(0, cap_get_nedges(sub2));
+    cap_dropref(sub2);
+
+    /* A loop of a subcap just loops its slice */
+    cap_clone_to_bundle(bun, sub, 2, 100);
+    loop = cap_bundle_first(bun);
+    {
+        std::vector<uint8_t> g;
+        std::vector<uint16_t> a;
+        for (uint64_t i = 0; i < 6000; i++) {
+            g.push_back(gold[1000 + (i + 100) % 3000]);
+            a.push_back(analog[1000 + (i + 100) % 3000]);
+        }
+        expect_view(loop, g, a);
+
+        /* A slice across where the loop wraps, looped again, has to be
+         * copied but still comes out right.
+         */
+        sub2 = cap_create_subcap(loop, 2500, 3700);
+        expect_view(sub2, slice(g, 2500, 3700), slice(a, 2500, 3700));
+        cap_clone_to_bundle(bun, sub2, 2, 0);
+        c = cap_bundle_last(bun);
+        expect_view(c, twice(slice(g, 2500, 3700)), twice(slice(a, 2500, 3700)));
+        cap_dropref(sub2);
+    }
+
+    cap_bundle_dropref(bun);
+    cap_dropref(sub);
+    ASSERT_EQ(1, cap_nref(src));
+    cap_dropref(src);
+}
+
+/* Dropping one of several references to a subcap keeps its parents */
+TEST(CapTest, SubcapExtraRefs) {
+    const uint64_t len = 5000;
+    cap_t *src = make_runs(len, 7);
+    std::vector<uint8_t> gold(len);
+    std::vector<uint16_t> analog(len);
+    cap_t *sub, *sub2;
+
+    for (uint64_t i = 0; i < len; i++) {
+        gold[i] = cap_get_digital(src, i);
+        analog[i] = cap_get_analog(src, i);
+    }
+
+    sub = cap_create_subcap(src, 500, 4500);
+    sub2 = cap_create_subcap(sub, 100, 2000);
+    cap_dropref(sub);
+
+    ASSERT_TRUE(sub2 == cap_addref(sub2));
+    cap_dropref(sub2);
+    ASSERT_EQ(2, cap_get_nparents(sub2));
+    ASSERT_TRUE(sub == cap_get_parent(sub2));
+    ASSERT_TRUE(src == cap_get_parent(sub));
+
+    /* The source can go too; the views still hold its samples */
+    cap_dropref(src);
+    expect_view(sub2, slice(gold, 600, 2500), slice(analog, 600, 2500));
+
+    cap_dropref(sub2);
+}
+
+/* Brute force extremes of samples [begin, end) of a view */
+static void ref_range(cap_t *c, uint64_t begin, uint64_t end,
+    uint16_t *min, uint16_t *max)
+{
+    *min = UINT16_MAX;
+    *max = 0;
+    for (uint64_t i = begin; i < end && i < cap_get_nsamples(c); i++) {
+        *min = std::min(*min, cap_get_analog(c, i));
+        *max = std::max(*max, cap_get_analog(c, i));
+    }
+}
+
+TEST(CapTest, AnalogLod) {
+    /* Deep enough for a few levels, and not a whole number of blocks */
+    const uint64_t len = 64 * 64 * 70 + 13;
+    cap_t *c = cap_create(len);
+    cap_bundle_t *bun = cap_bundle_create();
+    uint16_t min, max, gold_min, gold_max;
+    uint16_t env_min[100], env_max[100];
+    cap_t *sub;
+
+    srand(3);
+    for (uint64_t i = 0; i < len; i++)
+        cap_set_analog(c, i, 1000 + rand() % 2000);
+    cap_set_analog(c, 123456, 7);
+    cap_set_analog(c, len - 1, 4000);
+    cap_update_analog_minmax(c);
+    ASSERT_EQ(7, cap_get_analog_min(c));
+    ASSERT_EQ(4000, cap_get_analog_max(c));
+
+    for (int i = 0; i < 2000; i++) {
+        uint64_t begin = rand() % len;
+        uint64_t end = begin + ((i % 2) ? rand() % 200 : rand() % len);
+
+        cap_get_analog_range(c, begin, end, &min, &max);
+        ref_range(c, begin, end, &gold_min, &gold_max);
+        ASSERT_EQ(gold_min, min) << begin << " " << end;
+        ASSERT_EQ(gold_max, max) << begin << " " << end;
+    }
+
+    cap_get_analog_range(c, 10, 10, &min, &max);
+    ASSERT_EQ(UINT16_MAX, min);
+    ASSERT_EQ(0, max);
+
+    cap_get_analog_envelope(c, 1000, 200000, 100, env_min, env_max);
+    for (int i = 0; i < 100; i++) {
+        ref_range(c, 1000 + 1990 * i, 1000 + 1990 * (i + 1), &gold_min, &gold_max);
+        ASSERT_EQ(gold_min, env_min[i]) << i;
+        ASSERT_EQ(gold_max, env_max[i]) << i;
+    }
+
+    /* Changing a sample rebuilds it */
+    cap_set_analog(c, 5000, 1);
+    cap_get_analog_range(c, 0, len, &min, &max);
+    ASSERT_EQ(1, min);
+
+    /* Views query their top capture, wrapping where they loop */
+    sub = cap_create_subcap(c, 100000, 200000);
+    cap_clone_to_bundle(bun, sub, 3, 0);
+    for (cap_t *v : { sub, cap_bundle_first(bun) }) {
+        for (int i = 0; i < 200; i++) {
+            uint64_t begin = rand() % cap_get_nsamples(v);
+            uint64_t end = begin + rand() % 150000;
+
+            cap_get_analog_range(v, begin, end, &min, &max);
+            ref_range(v, begin, end, &gold_min, &gold_max);
+            ASSERT_EQ(gold_min, min) << begin << " " << end;
+            ASSERT_EQ(gold_max, max) << begin << " " << end;
+        }
+    }
+
+    cap_bundle_dropref(bun);
+    cap_dropref(sub);
+    cap_dropref(c);
+}
+
+TEST(CapTest, Analog12) {
+    /* Odd lengths and offsets keep the pairs honest */
+    const uint64_t len = 100001;
+    std::vector<float> src(len);
+    std::vector<uint16_t> buf(len);
+    cap_t *c = cap_create(len), *c12 = cap_create_analog12(len);
+    uint16_t min, max, min12, max12;
+
+    srand(12);
+    for (uint64_t i = 0; i < len; i++)
+        src[i] = ((i / 1000) % 2) ? 3000 + rand() % 1000 : rand() % 1000;
+
+    cap_convert_analog(c, 0, src.data(), 5001);
+    cap_convert_analog(c, 5001, src.data() + 5001, len - 5001);
+    cap_convert_analog(c12, 0, src.data(), 5001);
+    cap_convert_analog(c12, 5001, src.data() + 5001, len - 5001);
+    ASSERT_EQ(16, cap_get_analog_bits(c));
+    ASSERT_EQ(12, cap_get_analog_bits(c12));
+    ASSERT_EQ(cap_get_analog_min(c), cap_get_analog_min(c12));
+    ASSERT_EQ(cap_get_analog_max(c), cap_get_analog_max(c12));
+
+    for (uint64_t i = 0; i < len; i++)
+        ASSERT_EQ(cap_get_analog(c, i), cap_get_analog(c12, i)) << i;
+
+    for (uint64_t idx : { 0, 1, 2, 777 }) {
+        cap_read_analog(c12, idx, buf.data(), len - idx - 1);
+        for (uint64_t i = 0; i < len - idx - 1; i++)
+            ASSERT_EQ(cap_get_analog(c, idx + i), buf[i]) << idx << " " << i;
+    }
+
+    /* Writes either side of a pair leave its other half alone */
+    buf.assign({ 1, 2, 3 });
+    cap_write_analog(c12, 11, buf.data(), 3);
+    cap_write_analog(c, 11, buf.data(), 3);
+    cap_set_analog(c12, 20, 0xabc);
+    cap_set_analog(c, 20, 0xabc);
+    for (uint64_t i = 9; i < 23; i++)
+        ASSERT_EQ(cap_get_analog(c, i), cap_get_analog(c12, i)) << i;
+
+    /* Too big for 12 bits saturates */
+    cap_set_analog(c12, 30, 0x1234);
+    ASSERT_EQ(0xfff, cap_get_analog(c12, 30));
+    ASSERT_EQ(cap_get_analog(c, 31), cap_get_analog(c12, 31));
+    cap_set_analog(c, 30, 0xfff);
+
+    /* Everything built on the samples comes out the same */
+    cap_analog_adc(c, 1500, 2500);
+    cap_analog_adc(c12, 1500, 2500);
+    for (uint64_t w = 0; w < cap_get_digital_nwords(c); w++)
+        ASSERT_EQ(cap_get_digital_word(c, w), cap_get_digital_word(c12, w));
+
+    for (uint64_t begin : { 0, 3, 4095, 50000 }) {
+        cap_get_analog_range(c, begin, begin + 33333, &min, &max);
+        cap_get_analog_range(c12, begin, begin + 33333, &min12, &max12);
+        ASSERT_EQ(min, min12);
+        ASSERT_EQ(max, max12);
+    }
+
+    cap_dropref(c);
+    cap_dropref(c12);
+}
+
+TEST(CapTest, BundleLookup) {
+    cap_bundle_t *bun = cap_bundle_create();
+    cap_t *caps[4];
+
+    for (unsigned i = 0; i < 4; i++) {
+        caps[i] = cap_create(100);
+        cap_set_physical_ch(caps[i], 10 - i);
+        cap_bundle_add(bun, caps[i]);
+    }
+    ASSERT_EQ(4, cap_bundle_len(bun));
+    for (unsigned i = 0; i < 4; i++) {
+        ASSERT_EQ(caps[i], cap_bundle_get(bun, i));
+        ASSERT_EQ(caps[i], cap_bundle_get_ch(bun, 10 - i));
+    }
+    ASSERT_TRUE(NULL == cap_bundle_get(bun, 4));
+    ASSERT_TRUE(NULL == cap_bundle_get_ch(bun, 0));
+    ASSERT_TRUE(NULL == cap_bundle_get_ch(bun, 1000));
+
+    /* Renumbering a channel moves it in the table */
+    cap_set_physical_ch(caps[3], 0);
+    ASSERT_EQ(caps[3], cap_bundle_get_ch(bun, 0));
+    ASSERT_TRUE(NULL == cap_bundle_get_ch(bun, 7));
+
+    /* The rest close up behind a removed capture */
+    cap_addref(caps[1]);
+    cap_bundle_remove(bun, caps[1]);
+    ASSERT_EQ(1, cap_nref(caps[1]));
+    ASSERT_EQ(3, cap_bundle_len(bun));
+    ASSERT_TRUE(NULL == cap_bundle_get_ch(bun, 9));
+    ASSERT_EQ(caps[2], cap_bundle_get(bun, 1));
+    ASSERT_EQ(caps[2], cap_next(caps[0]));
+    ASSERT_EQ(caps[3], cap_bundle_last(bun));
+    ASSERT_TRUE(NULL == cap_next(caps[3]));
+    ASSERT_TRUE(NULL == cap_next(caps[1]));
+
+    /* Out of one bundle, it can go in another */
+    cap_t *c = caps[1];
+    cap_bundle_t *bun2 = cap_bundle_create();
+    cap_bundle_add(bun2, c);
+    ASSERT_EQ(c, cap_bundle_get_ch(bun2, 9));
+
+    cap_bundle_dropref(bun2);
+    cap_bundle_dropref(bun);
+}
+
+TEST(CapTest, BundleGather) {
+    const uint64_t len = 10000;
+    cap_bundle_t *bun = cap_bundle_create();
+    cap_t *c = make_runs(len, 17), *c12 = cap_create_analog12(len);
+    const uint8_t chs[] = { 1, 2, 3 };
+    struct cap_gather g;
+
+    for (uint64_t i = 0; i < len; i++) {
+        cap_set_analog(c12, i, cap_get_analog(c, i));
+        cap_set_digital(c12, i, !cap_get_digital(c, i));
+    }
+    cap_set_physical_ch(c12, 2);
+    cap_set_physical_ch(c, 1);
+    cap_bundle_add(bun, cap_addref(c));
+    cap_bundle_add(bun, c12);
+    cap_clone_to_bundle(bun, c, 2, 0);
+    cap_set_physical_ch(cap_bundle_last(bun), 3);
+
+    for (auto r : { std::make_pair(0, 640), std::make_pair(64, 9999),
+            std::make_pair(100, 5000), std::make_pair(5000, 30000),
+            std::make_pair(128, 128) }) {
+        uint64_t begin = r.first, end = std::min<uint64_t>(r.second, len);
+
+        ASSERT_EQ(0, cap_bundle_gather(bun, chs, 3, begin, r.second,
+            CAP_GATHER_DIGITAL | CAP_GATHER_ANALOG, &g));
+        ASSERT_EQ(begin, g.begin);
+        ASSERT_EQ(end - begin, g.nsamples);
+        ASSERT_EQ(3, g.n);
+
+        for (unsigned k = 0; k < 3; k++) {
+            cap_t *src = cap_bundle_get_ch(bun, chs[k]);
+
+            ASSERT_EQ(0, (uintptr_t) g.digital[k] % sizeof(uint64_t));
+            for (uint64_t i = 0; i < g.nsamples; i++) {
+                ASSERT_EQ(cap_get_digital(src, begin + i),
+                    (g.digital[k][i / 64] >> (i % 64)) & 1) << k << " " << i;
+                ASSERT_EQ(cap_get_analog(src, begin + i), g.analog[k][i])
+                    << k << " " << i;
+            }
+        }
+        cap_gather_release(&g);
+    }
+
+    /* Aligned ranges of plain 16-bit captures aren't copied */
+    ASSERT_EQ(0, cap_bundle_gather(bun, chs, 1, 64, 6400,
+        CAP_GATHER_DIGITAL | CAP_GATHER_ANALOG, &g));
+    ASSERT_TRUE(NULL == g.buf);
+    ASSERT_EQ(cap_get_digital_word(c, 1), g.digital[0][0]);
+    cap_gather_release(&g);
+
+    /* Digital only leaves the analog blocks out */
+    ASSERT_EQ(0, cap_bundle_gather(bun, chs, 1, 1, 65, CAP_GATHER_DIGITAL, &g));
+    ASSERT_TRUE(NULL == g.analog[0]);
+    ASSERT_EQ(cap_get_digital_word(c, 0) >> 1 | cap_get_digital_word(c, 1) << 63,
+        g.digital[0][0]);
+    cap_gather_release(&g);
+
+    const uint8_t missing[] = { 1, 4 };
+    ASSERT_EQ(-1, cap_bundle_gather(bun, missing, 2, 0, 10,
+        CAP_GATHER_DIGITAL, &g));
+    ASSERT_EQ(EINVAL, errno);
+
+    cap_bundle_dropref(bun);
+    cap_dropref(c);
+}
+
+/* Reads a range of a capture back through spans */
+static void span_read(cap_t *c, uint64_t begin, uint64_t end,
+    std::vector<uint16_t> &analog, std::vector<uint8_t> &digital)
+{
+    struct cap_span *s = new struct cap_span;
+    uint64_t next = begin;
+
+    analog.clear();
+    digital.clear();
+    cap_span_init(s, c, begin, end, CAP_GATHER_ANALOG | CAP_GATHER_DIGITAL);
+    while (cap_span_next(s)) {
+        ASSERT_EQ(next, s->idx);
+        ASSERT_LE(s->len, CAP_SPAN_LEN);
+        analog.insert(analog.end(), s->analog, s->analog + s->len);
+        digital.insert(digital.end(), s->digital, s->digital + s->len);
+        next += s->len;
+    }
+    ASSERT_EQ(0, cap_span_next(s));
+    delete s;
+}
+
+TEST(CapTest, Spans) {
+    const uint64_t len = 10001;
+    cap_bundle_t *bun = cap_bundle_create();
+    cap_t *c = make_runs(len, 20), *c12 = cap_create_analog12(len), *sub;
+    std::vector<uint16_t> analog;
+    std::vector<uint8_t> digital;
+    struct cap_span *s = new struct cap_span;
+
+    for (uint64_t i = 0; i < len; i++) {
+        cap_set_analog(c12, i, cap_get_analog(c, i));
+        cap_set_digital(c12, i, cap_get_digital(c, i));
+    }
+    sub = cap_create_subcap(c, 1234, 5678);
+    cap_clone_to_bundle(bun, sub, 3, 700);
+
+    for (cap_t *v : { c, c12, sub, cap_bundle_first(bun) }) {
+        uint64_t n = cap_get_nsamples(v);
+
+        for (auto r : { std::make_pair<uint64_t, uint64_t>(0, n + 0),
+                std::make_pair<uint64_t, uint64_t>(1, n - 5),
+                std::make_pair<uint64_t, uint64_t>(n - 3, n + 100),
+                std::make_pair<uint64_t, uint64_t>(n + 0, n + 0) }) {
+            span_read(v, r.first, r.second, analog, digital);
+            ASSERT_EQ(std::min(r.second, n) - r.first, analog.size());
+            for (uint64_t i = 0; i < analog.size(); i++) {
+                ASSERT_EQ(cap_get_analog(v, r.first + i), analog[i]) << i;
+                ASSERT_EQ(cap_get_digital(v, r.first + i), digital[i]) << i;
+            }
+        }
+    }
+
+    /* 16-bit samples aren't copied */
+    cap_span_init(s, c, 100, len, CAP_GATHER_ANALOG);
+    ASSERT_EQ(CAP_SPAN_LEN, cap_span_next(s));
+    ASSERT_TRUE(s->analog != s->abuf);
+    ASSERT_TRUE(NULL == s->digital);
+
+    delete s;
+    cap_bundle_dropref(bun);
+    cap_dropref(sub);
+    cap_dropref(c);
+    cap_dropref(c12);
+}
+
+/* A noisy logic signal between two voltages, changing level every
+ * few hundred samples.
+ */
+static cap_t *make_logic(uint64_t len, float v_low, float v_high,
+    std::vector<uint8_t> &levels)
+{
+    const uint16_t lo = adc_voltage_to_sample(v_low, NULL);
+    const uint16_t hi = adc_voltage_to_sample(v_high, NULL);
+    cap_t *c = cap_create(len);
+
+    levels.resize(len);
+    srand(18);
+    for (uint64_t i = 0; i < len; ) {
+        uint8_t level = rand() % 2;
+
+        for (uint64_t run = 50 + rand() % 500; run && i < len; run--, i++) {
+            cap_set_analog(c, i, (level ? hi : lo) + rand() % 9 - 4);
+            levels[i] = level;
+        }
+    }
+    cap_update_analog_minmax(c);
+
+    return c;
+}
+
+TEST(CapTest, AutoThresholds) {
+    const uint64_t len = 3000000;
+    std::vector<uint64_t> hist(CAP_HIST_BINS);
+    std::vector<uint8_t> levels;
+    uint16_t v_lo, v_hi;
+
+    for (float v : { 1.2f, 1.8f, 3.3f, 5.0f }) {
+        cap_t *c = make_logic(len, 0.0f, v, levels);
+        uint64_t total = 0;
+
+        /* Spans several segments, so it's counted in parallel */
+        cap_analog_histogram(c, hist.data());
+        for (uint64_t b = 0; b < CAP_HIST_BINS; b++)
+            total += hist[b];
+        ASSERT_EQ(len, total);
+        ASSERT_EQ(0, hist[adc_voltage_to_sample(v / 2, NULL)]);
+
+        ASSERT_EQ(0, cap_analog_auto_thresholds(c, &v_lo, &v_hi)) << v;
+        ASSERT_LT(adc_voltage_to_sample(0.0f, NULL) + 4, v_lo) << v;
+        ASSERT_LT(v_lo, v_hi) << v;
+        ASSERT_GT(adc_voltage_to_sample(v, NULL) - 4, v_hi) << v;
+
+        cap_analog_adc_auto(c);
+        cap_get_adc_thresholds(c, &v_lo, &v_hi);
+        ASSERT_LT(v_lo, v_hi);
+        for (uint64_t i = 0; i < len; i += 7)
+            ASSERT_EQ(levels[i], cap_get_digital(c, i)) << v << " " << i;
+
+        /* TTL thresholds never see a 1.2 V bus go high */
+        if (v < 2.0f) {
+            cap_analog_adc_ttl(c);
+            ASSERT_EQ(0, cap_get_nedges(c));
+        }
+
+        cap_dropref(c);
+    }
+
+    /* A line that never moves has nothing to go on */
+    cap_t *flat = cap_create(1000);
+    for (uint64_t i = 0; i < 1000; i++)
+        cap_set_analog(flat, i, 2500 + i % 3);
+    ASSERT_EQ(-1, cap_analog_auto_thresholds(flat, &v_lo, &v_hi));
+    ASSERT_EQ(ERANGE, errno);
+    cap_analog_adc_auto(flat);
+    cap_get_adc_thresholds(flat, &v_lo, &v_hi);
+    ASSERT_EQ(adc_voltage_to_sample(0.8f, NULL), v_lo);
+    cap_dropref(flat);
+}
+
+TEST(CapTest, AnalogAdc) {
+    /* Long enough for several parallel segments, with stretches between
+     * the thresholds that hold a level across segment boundaries.
+     */
+    const uint64_t nsamples = (3 << 20) + 4321;
+    std::vector<uint8_t> gold(nsamples);
+    cap_t *c = cap_create(nsamples);
+
+    srand(7);
+    for (uint64_t i = 0; i < nsamples; i++) {
+        uint16_t s;
+
+        if ((i >> 18) % 3 == 1)
+            s = 1500 + rand() % 1000;
+        else
+            s = rand() % 4096;
+        cap_set_analog(c, i, s);
+    }
+
+    for (auto th : { std::make_pair(1000, 3000), std::make_pair(3000, 1000) }) {
+        uint8_t adc = 0;
+
+        for (uint64_t i = 0; i < nsamples; i++) {
+            uint16_t s = cap_get_analog(c, i);
+            if (s <= th.first)
+                adc = 0;
+            else if (s >= th.second)
+                adc = 1;
+            gold[i] = adc;
+        }
+
+        for (int level = SIMD_SCALAR; level <= simd_max_level(); level++) {
+            simd_set_level((enum simd_level) level);
+            cap_analog_adc(c, th.first, th.second);
+            for (uint64_t i = 0; i < nsamples; i++) {
+                ASSERT_EQ(gold[i], cap_get_digital(c, i))
+                    << "level " << level << " sample " << i;
+            }
+            ASSERT_EQ(0, cap_get_digital_word(c, nsamples / 64) >> (nsamples % 64));
+        }
+    }
+    simd_set_level(simd_max_level());
+
+    cap_dropref(c);
+}
@@ -0,0 +1,180 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <gtest/gtest.h>
+#include "test_utils.hpp"
+
+#include "cap.h"
+#include "capfile.h"
+#include "saleae.h"
+
+static cap_bundle_t *load_uart(void)
+{
+    cap_bundle_t *bun = NULL;
+    FILE *fp = fopen("uart_analog_115200_50mHz.bin.gz", "rb");
+
+    EXPECT_EQ(0, saleae_import_analog(fp, &bun));
+    fclose(fp);
+    return bun;
+}
+
+static void expect_same_samples(cap_t *a, cap_t *b, uint64_t offset)
+{
+    for (uint64_t i = 0; i < cap_get_nsamples(b); i++) {
+        ASSERT_EQ(cap_get_analog(a, i + offset), cap_get_analog(b, i)) << i;
+        ASSERT_EQ(cap_get_digital(a, i + offset), cap_get_digital(b, i)) << i;
+    }
+}
+
+TEST(CapfileTest, RoundTrip) {
+    TEST_DESC("Exporting and reloading a capture gives back the same capture");
+    const struct capfile_opts co = { 10000, false };
+    cap_bundle_t *bun = load_uart(), *bun2;
+    cap_t *cap, *cap2;
+    struct capfile_chunk_info info;
+    uint64_t nedges = 0, gold_nedges = 0;
+    capfile_t *cf;
+    FILE *fp = tmpfile();
+
+    ASSERT_EQ(0, capfile_export(fp, bun, &co));
+    ASSERT_TRUE(capfile_detect(fp));
+    ASSERT_EQ(0, capfile_open(fp, &cf));
+    fclose(fp);
+
+    cap = cap_bundle_first(bun);
+    ASSERT_EQ(1, capfile_get_nchannels(cf));
+    ASSERT_EQ(cap_get_nsamples(cap), capfile_get_nsamples(cf, 0));
+    ASSERT_EQ(12, capfile_get_nchunks(cf, 0));
+
+    /* The index's stats match the samples they cover */
+    for (uint32_t i = 0; i < capfile_get_nchunks(cf, 0); i++) {
+        ASSERT_EQ(0, capfile_get_chunk_info(cf, 0, i, &info));
+        ASSERT_EQ(i * 10000, info.begin);
+        ASSERT_FALSE(info.compressed);
+        nedges += info.nedges;
+    }
+    ASSERT_EQ(cap_get_nsamples(cap) - 110000, info.nsamples);
+    ASSERT_EQ(-1, capfile_get_chunk_info(cf, 0, 12, &info));
+    ASSERT_EQ(EINVAL, errno);
+
+    for (uint64_t i = 1; i < cap_get_nsamples(cap); i++) {
+        if (cap_get_digital(cap, i) != cap_get_digital(cap, i - 1))
+            gold_nedges++;
+    }
+    ASSERT_EQ(gold_nedges, nedges);
+
+    ASSERT_EQ(0, capfile_import(cf, 0, 0, 0, &bun2));
+    capfile_close(cf);
+
+    cap2 = cap_bundle_first(bun2);
+    ASSERT_EQ(cap_get_nsamples(cap), cap_get_nsamples(cap2));
+    ASSERT_EQ(cap_get_period(cap), cap_get_period(cap2));
+    ASSERT_EQ(cap_get_physical_ch(cap), cap_get_physical_ch(cap2));
+    ASSERT_EQ(cap_get_analog_min(cap), cap_get_analog_min(cap2));
+    ASSERT_EQ(cap_get_analog_max(cap), cap_get_analog_max(cap2));
+    ASSERT_STREQ(cap_get_note(cap), cap_get_note(cap2));
+    expect_same_samples(cap, cap2, 0);
+
+    cap_bundle_dropref(bun);
+    cap_bundle_dropref(bun2);
+}
+
+TEST(CapfileTest, CompressedRange) {
+    TEST_DESC("A sample range of a compressed capture file only reads its chunks");
+    const struct capfile_opts co = { 4096, true };
+    const uint64_t begin = 5000, end = 20000;
+    cap_bundle_t *bun = load_uart(), *bun2;
+    cap_t *cap, *cap2;
+    struct capfile_chunk_info info;
+    uint16_t min = UINT16_MAX, max = 0;
+    capfile_t *cf;
+    FILE *fp = tmpfile();
+
+    ASSERT_EQ(0, capfile_export(fp, bun, &co));
+    ASSERT_EQ(0, capfile_open(fp, &cf));
+    fclose(fp);
+
+    ASSERT_EQ(0, capfile_get_chunk_info(cf, 0, 0, &info));
+    ASSERT_TRUE(info.compressed);
+
+    ASSERT_EQ(0, capfile_import(cf, begin, end, 0, &bun2));
+    cap = cap_bundle_first(bun);
+    cap2 = cap_bundle_first(bun2);
+    ASSERT_EQ(end - begin, cap_get_nsamples(cap2));
+    expect_same_samples(cap, cap2, begin);
+
+    /* Min/max covers just the range, even where it splits chunks */
+    for (uint64_t i = begin; i < end; i++) {
+        uint16_t s = cap_get_analog(cap, i);
+        min = (s < min) ? s : min;
+        max = (s > max) ? s : max;
+    }
+    ASSERT_EQ(min, cap_get_analog_min(cap2));
+    ASSERT_EQ(max, cap_get_analog_max(cap2));
+    cap_bundle_dropref(bun2);
+
+    /* Channels that aren't asked for aren't loaded */
+    ASSERT_EQ(0, capfile_import(cf, 0, 0, 1 << 3, &bun2));
+    ASSERT_EQ(0, cap_bundle_len(bun2));
+    cap_bundle_dropref(bun2);
+
+    capfile_close(cf);
+    cap_bundle_dropref(bun);
+}
+
+TEST(CapfileTest, WideSamples) {
+    TEST_DESC("Samples too wide for 12 bits survive the trip");
+    cap_bundle_t *bun = cap_bundle_create(), *bun2;
+    cap_t *cap = cap_create(1001);
+    capfile_t *cf;
+    FILE *fp = tmpfile();
+
+    for (unsigned i = 0; i < 1001; i++) {
+        cap_set_analog(cap, i, (i < 500) ? i : 0xffff - i);
+        cap_set_digital(cap, i, (i / 3) & 1);
+    }
+    cap_update_analog_minmax(cap);
+    cap_bundle_add(bun, cap);
+
+    ASSERT_EQ(0, capfile_export(fp, bun, NULL));
+    ASSERT_EQ(0, capfile_open(fp, &cf));
+    fclose(fp);
+    ASSERT_EQ(0, capfile_import(cf, 0, 0, 0, &bun2));
+    expect_same_samples(cap, cap_bundle_first(bun2), 0);
+    ASSERT_EQ(cap_get_analog_max(cap), cap_get_analog_max(cap_bundle_first(bun2)));
+
+    capfile_close(cf);
+    cap_bundle_dropref(bun);
+    cap_bundle_dropref(bun2);
+}
+
+TEST(CapfileTest, BogusInput) {
+    cap_bundle_t *bun = load_uart();
+    capfile_t *cf;
+    FILE *fp = tmpfile();
+    long len;
+
+    ASSERT_EQ(-1, capfile_export(fp, NULL, NULL));
+    ASSERT_EQ(EINVAL, errno);
+
+    /* Not a capture file at all */
+    fputs("definitely not a capture", fp);
+    fflush(fp);
+    ASSERT_FALSE(capfile_detect(fp));
+    ASSERT_EQ(-1, capfile_open(fp, &cf));
+    ASSERT_EQ(EILSEQ, errno);
+    fclose(fp);
+
+    /* Chopping off the end loses the index */
+    fp = tmpfile();
+    ASSERT_EQ(0, capfile_export(fp, bun, NULL));
+    len = ftell(fp);
+    ASSERT_EQ(0, ftruncate(fileno(fp), len - 1));
+    ASSERT_TRUE(capfile_detect(fp));
+    ASSERT_EQ(-1, capfile_open(fp, &cf));
+    ASSERT_EQ(EILSEQ, errno);
+    fclose(fp);
+
+    cap_bundle_dropref(bun);
+}
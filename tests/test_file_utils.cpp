@@ -0,0 +1,193 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+#include <zlib.h>
+#include <gtest/gtest.h>
+#include "test_utils.hpp"
+
+#include "file_utils.h"
+
+TEST(FileUtilsTest, MapUncompressed) {
+    TEST_DESC("Uncompressed files are handed out straight from the page cache");
+    const char gold_data[] = "+++Test Data Stream+++";
+    file_map_t *m;
+    FILE *fp = tmpfile();
+    int rc;
+
+    fwrite(gold_data, sizeof(gold_data), 1, fp);
+    fflush(fp);
+
+    ASSERT_FALSE(file_is_gzip(fp));
+    rc = file_load_map(fp, &m);
+    ASSERT_EQ(rc, 0);
+    ASSERT_TRUE(file_map_is_mapped(m));
+    ASSERT_EQ(file_map_len(m), sizeof(gold_data));
+    ASSERT_EQ(0, memcmp(file_map_data(m), gold_data, sizeof(gold_data)));
+
+    /* Mapping outlives the file handle and tracks its references */
+    fclose(fp);
+    ASSERT_EQ(file_map_addref(m), m);
+    ASSERT_EQ(2, file_map_nref(m));
+    file_map_dropref(m);
+    ASSERT_EQ(1, file_map_nref(m));
+    ASSERT_EQ(0, memcmp(file_map_data(m), gold_data, sizeof(gold_data)));
+    file_map_dropref(m);
+
+    ASSERT_EQ(NULL, file_map_addref(NULL));
+    ASSERT_EQ(0, file_map_nref(NULL));
+    file_map_dropref(NULL);
+}
+
+TEST(FileUtilsTest, MapCompressed) {
+    TEST_DESC("Compressed files are inflated into a private buffer");
+    const size_t gold_len = 464724;
+    FILE *fp = fopen("uart_analog_115200_50mHz.bin.gz", "rb");
+    file_map_t *m;
+    int rc;
+
+    ASSERT_TRUE(file_is_gzip(fp));
+    rc = file_load_map(fp, &m);
+    ASSERT_EQ(rc, 0);
+    ASSERT_FALSE(file_map_is_mapped(m));
+    ASSERT_EQ(file_map_len(m), gold_len);
+
+    file_map_dropref(m);
+    fclose(fp);
+}
+
+TEST(FileUtilsTest, StreamCompressed) {
+    TEST_DESC("Streams inflate on the fly and match a whole-file load");
+    FILE *fp = fopen("uart_analog_115200_50mHz.bin.gz", "rb");
+    file_stream_t *fs;
+    file_map_t *m;
+    uint8_t buf[4096];
+    size_t off = 0;
+    int64_t n;
+
+    ASSERT_EQ(0, file_load_map(fp, &m));
+    ASSERT_EQ(0, file_stream_open(fp, &fs));
+
+    ASSERT_EQ(0, file_stream_skip(fs, 100));
+    off = 100;
+    while ((n = file_stream_read(fs, buf, sizeof(buf))) > 0) {
+        ASSERT_EQ(0, memcmp((const uint8_t *) file_map_data(m) + off, buf, n));
+        off += n;
+    }
+    ASSERT_EQ(off, file_map_len(m));
+    ASSERT_EQ(off, file_stream_tell(fs));
+
+    file_stream_close(fs);
+    file_map_dropref(m);
+    fclose(fp);
+}
+
+TEST(FileUtilsTest, LoadMultiMember) {
+    TEST_DESC("Every member of a concatenated gzip file gets loaded");
+    const size_t member_len = 3 << 20;
+    uint8_t *gold = new uint8_t[3 * member_len];
+    FILE *fp = tmpfile();
+    void *buf;
+    size_t len;
+
+    for (size_t i = 0; i < 3 * member_len; i++) {
+        gold[i] = (i * 7) ^ (i >> 9);
+    }
+
+    for (int m = 0; m < 3; m++) {
+        gzFile gz = gzdopen(dup(fileno(fp)), "wb");
+        gzwrite(gz, gold + m * member_len, member_len);
+        gzclose(gz);
+        fseek(fp, 0, SEEK_END);
+    }
+
+    ASSERT_EQ(0, file_load(fp, &buf, &len));
+    ASSERT_EQ(3 * member_len, len);
+    ASSERT_EQ(0, memcmp(gold, buf, len));
+
+    free(buf);
+    delete[] gold;
+    fclose(fp);
+}
+
+TEST(FileUtilsTest, StreamPipe) {
+    TEST_DESC("Pipes stream front to back and can only skip forward");
+    FILE *fp = fopen("uart_analog_115200_50mHz.bin.gz", "rb");
+    file_stream_t *fs;
+    file_map_t *m;
+    uint8_t buf[4096];
+    FILE *pipe_in;
+    int fds[2];
+    void *gz;
+    size_t gz_len;
+
+    ASSERT_EQ(0, file_load_map(fp, &m));
+    fseek(fp, 0, SEEK_END);
+    gz_len = ftell(fp);
+    rewind(fp);
+    gz = malloc(gz_len);
+    ASSERT_EQ(1, fread(gz, gz_len, 1, fp));
+
+    ASSERT_EQ(0, pipe(fds));
+    std::thread writer([&] {
+        write(fds[1], gz, gz_len);
+        close(fds[1]);
+    });
+    pipe_in = fdopen(fds[0], "rb");
+    ASSERT_FALSE(file_is_seekable(pipe_in));
+
+    ASSERT_EQ(0, file_stream_open(pipe_in, &fs));
+    ASSERT_EQ(0, file_stream_seek(fs, 300000));
+    ASSERT_EQ(sizeof(buf), file_stream_read(fs, buf, sizeof(buf)));
+    ASSERT_EQ(0, memcmp((const uint8_t *) file_map_data(m) + 300000, buf,
+        sizeof(buf)));
+
+    ASSERT_EQ(-1, file_stream_seek(fs, 100));
+    ASSERT_EQ(ESPIPE, errno);
+    ASSERT_EQ(-1, file_stream_seek(fs, file_map_len(m) + 1));
+
+    file_stream_close(fs);
+    writer.join();
+    fclose(pipe_in);
+    free(gz);
+    file_map_dropref(m);
+    fclose(fp);
+}
+
+TEST(FileUtilsTest, StreamLoadMap) {
+    TEST_DESC("Pipes load whole, however many buffers they take");
+    FILE *fp = fopen("uart_digital_115200_500mHz.bin.gz", "rb");
+    file_map_t *m, *piped;
+    FILE *pipe_in;
+    int fds[2];
+    void *gz;
+    size_t gz_len;
+
+    ASSERT_EQ(0, file_load_map(fp, &m));
+    ASSERT_GT(file_map_len(m), 2 << 20);
+    fseek(fp, 0, SEEK_END);
+    gz_len = ftell(fp);
+    rewind(fp);
+    gz = malloc(gz_len);
+    ASSERT_EQ(1, fread(gz, gz_len, 1, fp));
+
+    ASSERT_EQ(0, pipe(fds));
+    std::thread writer([&] {
+        write(fds[1], gz, gz_len);
+        close(fds[1]);
+    });
+    pipe_in = fdopen(fds[0], "rb");
+
+    ASSERT_EQ(0, file_stream_load_map(pipe_in, &piped));
+    ASSERT_EQ(file_map_len(m), file_map_len(piped));
+    ASSERT_EQ(0, memcmp(file_map_data(m), file_map_data(piped),
+        file_map_len(m)));
+
+    writer.join();
+    fclose(pipe_in);
+    free(gz);
+    file_map_dropref(piped);
+    file_map_dropref(m);
+    fclose(fp);
+}
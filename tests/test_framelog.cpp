@@ -0,0 +1,197 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <gtest/gtest.h>
+#include "test_utils.hpp"
+
+#include "framelog.h"
+#include "framesink.h"
+#include "proto.h"
+
+struct gold_frame {
+    uint64_t idx;
+    int type;
+    uint8_t len;
+    uint8_t data[PROTO_DFRAME_INLINE];
+};
+
+/* Mostly small steps, with the odd long gap and repeated sample */
+static std::vector<gold_frame> make_frames(size_t n)
+{
+    std::vector<gold_frame> frames(n);
+    uint64_t idx = 12345;
+
+    srand(25);
+    for (size_t i = 0; i < n; i++) {
+        gold_frame &f = frames[i];
+
+        idx += (i % 1000 == 999) ? (1ULL << 40) : (i % 7) ? rand() % 2000 : 0;
+        f.idx = idx;
+        f.type = (i % 11) - 5;
+        f.len = i % (PROTO_DFRAME_INLINE + 1);
+        for (unsigned k = 0; k < f.len; k++)
+            f.data[k] = rand();
+    }
+    frames[n / 2].type = INT32_MIN;
+
+    return frames;
+}
+
+static void write_log(FILE *fp, const std::vector<gold_frame> &frames,
+    size_t flush_at)
+{
+    frame_sink_t *s = framelog_sink(fp);
+
+    ASSERT_TRUE(NULL != s);
+    for (size_t i = 0; i < frames.size(); i++) {
+        const gold_frame &f = frames[i];
+        ASSERT_EQ(0, frame_sink_put(s, f.idx, f.type, f.data, f.len));
+        if (i == flush_at) {
+            ASSERT_EQ(0, frame_sink_flush(s));
+        }
+    }
+    ASSERT_EQ(0, frame_sink_close(s));
+}
+
+struct replay_check {
+    const std::vector<gold_frame> *frames;
+    uint64_t next;
+    uint64_t nbatches;
+};
+
+static int check_replay(const struct proto_batch *b, void *udata)
+{
+    struct replay_check *rc = (struct replay_check *) udata;
+
+    EXPECT_EQ(rc->next, b->first);
+    for (size_t i = 0; i < b->n; i++) {
+        const gold_frame &f = (*rc->frames)[b->first + i];
+
+        EXPECT_EQ(f.idx, b->idx[i]);
+        EXPECT_EQ(f.type, b->type[i]);
+        EXPECT_EQ(f.len, b->len[i]);
+        if (f.len)
+            EXPECT_EQ(0, memcmp(f.data, proto_batch_udata(b, i), f.len));
+        else
+            EXPECT_EQ(NULL, proto_batch_udata(b, i));
+    }
+    rc->next = b->first + b->n;
+    rc->nbatches++;
+
+    return 0;
+}
+
+TEST(FramelogTest, RoundTrip) {
+    TEST_DESC("Every frame written to a log replays the same, and small");
+    const size_t nframes = 3 * FRAMELOG_BLOCK_LEN + 100;
+    std::vector<gold_frame> frames = make_frames(nframes);
+    struct replay_check rc = { &frames, 0, 0 };
+    struct framelog_block_info info;
+    framelog_t *fl;
+    FILE *fp = tmpfile();
+    size_t payload = 0;
+
+    write_log(fp, frames, SIZE_MAX);
+    for (const gold_frame &f : frames)
+        payload += f.len;
+
+    /* Small deltas and types take a byte each */
+    ASSERT_GT(payload + 4 * nframes, (size_t) ftell(fp));
+
+    ASSERT_EQ(0, framelog_open(fp, &fl));
+    fclose(fp);
+    ASSERT_EQ(nframes, framelog_get_nframes(fl));
+    ASSERT_EQ(4, framelog_get_nblocks(fl));
+
+    ASSERT_EQ(0, framelog_get_block_info(fl, 3, &info));
+    ASSERT_EQ(3 * FRAMELOG_BLOCK_LEN, info.first);
+    ASSERT_EQ(100, info.nframes);
+    ASSERT_EQ(frames[3 * FRAMELOG_BLOCK_LEN].idx, info.first_idx);
+    ASSERT_EQ(frames.back().idx, info.last_idx);
+    ASSERT_EQ(-1, framelog_get_block_info(fl, 4, &info));
+    ASSERT_EQ(EINVAL, errno);
+
+    ASSERT_EQ(0, framelog_replay(fl, 0, UINT64_MAX, check_replay, &rc));
+    ASSERT_EQ(nframes, rc.next);
+    ASSERT_EQ(4, rc.nbatches);
+
+    framelog_close(fl);
+}
+
+TEST(FramelogTest, Ranges) {
+    TEST_DESC("Replaying a sample range only decodes the blocks it covers");
+    const size_t nframes = 5 * FRAMELOG_BLOCK_LEN;
+    std::vector<gold_frame> frames = make_frames(nframes);
+    framelog_t *fl;
+    FILE *fp = tmpfile();
+
+    /* Flushing partway cuts a block short */
+    write_log(fp, frames, 1000);
+    ASSERT_EQ(0, framelog_open(fp, &fl));
+    fclose(fp);
+    ASSERT_EQ(6, framelog_get_nblocks(fl));
+
+    for (auto r : { std::pair<size_t, size_t>(0, 1),
+            std::pair<size_t, size_t>(999, 1003),
+            std::pair<size_t, size_t>(5000, 9000),
+            std::pair<size_t, size_t>(2 * FRAMELOG_BLOCK_LEN + 5, nframes) }) {
+        uint64_t begin = frames[r.first].idx;
+        uint64_t end = (r.second < nframes) ? frames[r.second].idx : UINT64_MAX;
+        size_t first = r.first, last = r.second;
+        struct replay_check rc = { &frames, 0, 0 };
+
+        /* Frames sharing a sample with the range's ends */
+        while (first && (frames[first - 1].idx == begin))
+            first--;
+        while ((last < nframes) && (last > 0) && (frames[last - 1].idx == end))
+            last--;
+
+        rc.next = first;
+        ASSERT_EQ(0, framelog_replay(fl, begin, end, check_replay, &rc));
+        ASSERT_EQ(last, rc.next) << r.first << " " << r.second;
+        ASSERT_GE((last - first) / FRAMELOG_BLOCK_LEN + 3, rc.nbatches);
+    }
+
+    framelog_close(fl);
+}
+
+TEST(FramelogTest, BogusInput) {
+    std::vector<gold_frame> frames = make_frames(2 * FRAMELOG_BLOCK_LEN);
+    struct replay_check rc = { &frames, 0, 0 };
+    uint8_t junk[8];
+    framelog_t *fl;
+    FILE *fp = tmpfile();
+    long len;
+
+    /* Out of order frames are refused */
+    frame_sink_t *s = framelog_sink(fp);
+    ASSERT_EQ(0, frame_sink_put(s, 10, 0, NULL, 0));
+    ASSERT_EQ(-1, frame_sink_put(s, 9, 0, NULL, 0));
+    ASSERT_EQ(EINVAL, errno);
+    ASSERT_EQ(0, frame_sink_close(s));
+    fclose(fp);
+
+    /* Chopping off the end loses the index */
+    fp = tmpfile();
+    write_log(fp, frames, SIZE_MAX);
+    len = ftell(fp);
+    ASSERT_EQ(0, ftruncate(fileno(fp), len - 1));
+    ASSERT_EQ(-1, framelog_open(fp, &fl));
+    ASSERT_EQ(EILSEQ, errno);
+    fclose(fp);
+
+    /* Scribbling on a block is caught when it's replayed */
+    fp = tmpfile();
+    write_log(fp, frames, SIZE_MAX);
+    memset(junk, 0xff, sizeof(junk));
+    ASSERT_EQ(0, fseek(fp, 100, SEEK_SET));
+    ASSERT_EQ(1, fwrite(junk, sizeof(junk), 1, fp));
+    fflush(fp);
+    ASSERT_EQ(0, framelog_open(fp, &fl));
+    fclose(fp);
+    ASSERT_EQ(-1, framelog_replay(fl, 0, UINT64_MAX, check_replay, &rc));
+    ASSERT_EQ(EILSEQ, errno);
+    framelog_close(fl);
+}
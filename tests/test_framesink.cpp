@@ -0,0 +1,201 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <gtest/gtest.h>
+#include "test_utils.hpp"
+
+#include "framelog.h"
+#include "framesink.h"
+#include "pa_usart.h"
+#include "proto.h"
+#include "saleae.h"
+
+static void put_frames(frame_sink_t *s, uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++) {
+        uint32_t v = (uint32_t) (i * 7);
+        ASSERT_EQ(0, frame_sink_put(s, 3 * i, (int) (i % 5) - 2, &v, i % 5));
+    }
+}
+
+static void expect_frames(proto_t *pr, uint64_t n)
+{
+    proto_dframe_t *df = proto_dframe_first(pr);
+
+    ASSERT_EQ(n, proto_get_nframes(pr));
+    for (uint64_t i = 0; i < n; i++, df = proto_dframe_next(df)) {
+        uint32_t v = (uint32_t) (i * 7);
+
+        ASSERT_EQ(3 * i, proto_dframe_idx(df)) << i;
+        ASSERT_EQ((int) (i % 5) - 2, proto_dframe_type(df)) << i;
+        if (i % 5) {
+            ASSERT_EQ(0, memcmp(&v, proto_dframe_udata(df), i % 5)) << i;
+        } else {
+            ASSERT_EQ(NULL, proto_dframe_udata(df)) << i;
+        }
+    }
+}
+
+/* Adds replayed frames to a proto */
+static int add_to_proto(const struct proto_batch *b, void *udata)
+{
+    for (size_t i = 0; i < b->n; i++) {
+        proto_add_dframe_inline((proto_t *) udata, b->idx[i], b->type[i],
+            proto_batch_udata(b, i), b->len[i]);
+    }
+    return 0;
+}
+
+TEST(FrameSinkTest, Queue) {
+    TEST_DESC("A queue passes every frame on in order, however small it is");
+    const uint64_t nframes = 100000;
+
+    uint8_t big[PROTO_DFRAME_INLINE + 1] = { 0 };
+
+    for (size_t len : { (size_t) 1, (size_t) 5, (size_t) 0 }) {
+        proto_t *pr = proto_create();
+        frame_sink_t *s = frame_sink_queue(frame_sink_proto(pr), len);
+
+        ASSERT_TRUE(NULL != s);
+        ASSERT_EQ(-1, frame_sink_put(s, 0, 0, big, sizeof(big)));
+        ASSERT_EQ(EINVAL, errno);
+        put_frames(s, nframes / 2);
+        ASSERT_EQ(0, frame_sink_flush(s));
+        ASSERT_EQ(nframes / 2, proto_get_nframes(pr));
+        put_frames(s, 0);
+        for (uint64_t i = nframes / 2; i < nframes; i++) {
+            uint32_t v = (uint32_t) (i * 7);
+            ASSERT_EQ(0, frame_sink_put(s, 3 * i, (int) (i % 5) - 2, &v, i % 5));
+        }
+        ASSERT_EQ(0, frame_sink_close(s));
+        expect_frames(pr, nframes);
+        proto_dropref(pr);
+    }
+}
+
+TEST(FrameSinkTest, QueueErrors) {
+    TEST_DESC("A sink behind a queue failing shows up on the decoder's side");
+    FILE *fp = fopen("/dev/full", "w");
+    frame_sink_t *s;
+    int rc = 0;
+
+    if (NULL == fp)
+        GTEST_SKIP() << "no /dev/full";
+
+    s = frame_sink_queue(framelog_sink(fp), 16);
+    for (uint64_t i = 0; (i < 1000000) && !rc; i++)
+        rc = frame_sink_put(s, i, 0, &i, sizeof(i));
+    ASSERT_EQ(-1, rc);
+    ASSERT_EQ(ENOSPC, errno);
+    ASSERT_EQ(-1, frame_sink_close(s));
+    fclose(fp);
+}
+
+TEST(FrameSinkTest, UsartToFramelog) {
+    TEST_DESC("Streaming USART frames to a frame log gives the frames kept in memory");
+    FILE *fin = fopen("uart_analog_115200_50mHz.bin.gz", "rb");
+    FILE *fp = tmpfile();
+    pa_usart_ctx_t *usart;
+    cap_bundle_t *bun;
+    proto_t *gold, *pr = proto_create();
+    proto_dframe_t *df, *gold_df;
+    framelog_t *fl;
+    char *decoded;
+
+    ASSERT_EQ(0, saleae_import_analog(fin, &bun));
+    fclose(fin);
+
+    pa_usart_ctx_init(&usart);
+    pa_usart_ctx_map_data(usart, 0);
+    pa_usart_ctx_set_freq(usart, 50.0E6);
+    pa_usart_decode_chunk(usart, cap_bundle_first(bun));
+    gold = pa_usart_get_proto(usart);
+    ASSERT_LT(0, proto_get_nframes(gold));
+
+    pa_usart_reset(usart);
+    ASSERT_EQ(0, pa_usart_set_sink(usart, frame_sink_queue(framelog_sink(fp), 0)));
+    pa_usart_decode_chunk(usart, cap_bundle_first(bun));
+
+    /* Nothing piles up in memory */
+    ASSERT_EQ(0, pa_usart_get_decoded(usart, &decoded));
+    ASSERT_EQ(NULL, decoded);
+    ASSERT_EQ(0, pa_usart_set_sink(usart, NULL));
+
+    ASSERT_EQ(0, framelog_open(fp, &fl));
+    ASSERT_EQ(0, framelog_replay(fl, 0, UINT64_MAX, add_to_proto, pr));
+    framelog_close(fl);
+    ASSERT_EQ(proto_get_nframes(gold), proto_get_nframes(pr));
+    gold_df = proto_dframe_first(gold);
+    for (df = proto_dframe_first(pr); df; df = proto_dframe_next(df)) {
+        ASSERT_EQ(proto_dframe_idx(gold_df), proto_dframe_idx(df));
+        ASSERT_EQ(proto_dframe_type(gold_df), proto_dframe_type(df));
+        if (USART_DFRAME_DATA == proto_dframe_type(df)) {
+            ASSERT_EQ(*(uint8_t *) proto_dframe_udata(gold_df),
+                *(uint8_t *) proto_dframe_udata(df));
+        }
+        gold_df = proto_dframe_next(gold_df);
+    }
+
+    proto_dropref(pr);
+    proto_dropref(gold);
+    pa_usart_ctx_cleanup(usart);
+    cap_bundle_dropref(bun);
+    fclose(fp);
+}
+
+/* Takes a few frames, then refuses the rest; closing always works */
+struct picky_sink {
+    struct frame_sink s;
+    unsigned nput;
+};
+
+static int picky_put(struct frame_sink *s, uint64_t idx, int type,
+    const void *data, size_t len)
+{
+    struct picky_sink *ps = (struct picky_sink *) s;
+
+    if (++ps->nput > 3) {
+        errno = ENOSPC;
+        return -1;
+    }
+    return 0;
+}
+
+static int picky_flush(struct frame_sink *s)
+{
+    return 0;
+}
+
+static int picky_close(struct frame_sink *s)
+{
+    delete (struct picky_sink *) s;
+    return 0;
+}
+
+TEST(FrameSinkTest, UsartSinkErrors) {
+    TEST_DESC("Frames a decoder's sink refuses aren't dropped silently");
+    FILE *fin = fopen("uart_analog_115200_50mHz.bin.gz", "rb");
+    struct picky_sink *ps = new picky_sink { { picky_put, picky_flush, picky_close }, 0 };
+    pa_usart_ctx_t *usart;
+    cap_bundle_t *bun;
+
+    ASSERT_EQ(0, saleae_import_analog(fin, &bun));
+    fclose(fin);
+
+    pa_usart_ctx_init(&usart);
+    pa_usart_ctx_map_data(usart, 0);
+    pa_usart_ctx_set_freq(usart, 50.0E6);
+    ASSERT_EQ(0, pa_usart_set_sink(usart, &ps->s));
+    pa_usart_decode_chunk(usart, cap_bundle_first(bun));
+
+    errno = 0;
+    ASSERT_EQ(-1, pa_usart_set_sink(usart, NULL));
+    ASSERT_EQ(ENOSPC, errno);
+
+    /* The error goes with the sink that had it */
+    ASSERT_EQ(0, pa_usart_set_sink(usart, NULL));
+
+    pa_usart_ctx_cleanup(usart);
+    cap_bundle_dropref(bun);
+}
@@ -0,0 +1,228 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <gtest/gtest.h>
+#include "test_utils.hpp"
+
+#include "file_utils.h"
+#include "gzindex.h"
+
+static const char test_file[] = "uart_analog_115200_50mHz.bin.gz";
+
+/* Reads len bytes at offset through a fresh cursor and compares them
+ * against the fully inflated image.
+ */
+static void check_range(gzindex_t *idx, FILE *fp, const uint8_t *gold,
+    uint64_t offset, size_t len)
+{
+    gzindex_cursor_t *cur;
+    uint8_t *buf = new uint8_t[len];
+
+    ASSERT_EQ(0, gzindex_cursor_open(idx, fp, offset, &cur));
+    ASSERT_EQ(offset, gzindex_cursor_tell(cur));
+    ASSERT_EQ((int64_t) len, gzindex_cursor_read(cur, buf, len));
+    ASSERT_EQ(0, memcmp(buf, gold + offset, len));
+    gzindex_cursor_close(cur);
+    delete[] buf;
+}
+
+TEST(GzIndexTest, RandomAccess) {
+    TEST_DESC("Reads from the middle of a gzip'd capture via access points");
+    FILE *fp = fopen(test_file, "rb");
+    gzindex_t *idx;
+    void *gold;
+    size_t len;
+
+    ASSERT_EQ(0, file_load(fp, &gold, &len));
+    ASSERT_EQ(0, gzindex_build(fp, 16 << 10, &idx));
+    ASSERT_EQ(len, gzindex_get_len(idx));
+
+    check_range(idx, fp, (uint8_t *) gold, 0, 1000);
+    check_range(idx, fp, (uint8_t *) gold, 12345, 100000);
+    check_range(idx, fp, (uint8_t *) gold, len / 2, len / 2);
+    check_range(idx, fp, (uint8_t *) gold, len - 20, 20);
+
+    gzindex_dropref(idx);
+    free(gold);
+    fclose(fp);
+}
+
+TEST(GzIndexTest, AccessPoints) {
+    TEST_DESC("Access points are dropped every span bytes");
+    FILE *fp = fopen("16ch_quadspi_100mHz.bin.gz", "rb");
+    gzindex_t *idx;
+    void *gold;
+    size_t len;
+
+    ASSERT_EQ(0, file_load(fp, &gold, &len));
+    ASSERT_EQ(0, gzindex_build(fp, 1 << 20, &idx));
+    ASSERT_TRUE(gzindex_get_npoints(idx) > 1);
+
+    check_range(idx, fp, (uint8_t *) gold, len - (1 << 20), 1 << 20);
+    check_range(idx, fp, (uint8_t *) gold, 3 * (len / 4), 1 << 10);
+
+    gzindex_dropref(idx);
+    free(gold);
+    fclose(fp);
+}
+
+TEST(GzIndexTest, SaveLoad) {
+    TEST_DESC("Index survives a round trip through a sidecar file");
+    FILE *fp = fopen(test_file, "rb");
+    FILE *side = tmpfile();
+    gzindex_t *idx, *loaded;
+    void *gold;
+    size_t len;
+
+    ASSERT_EQ(0, file_load(fp, &gold, &len));
+    ASSERT_EQ(0, gzindex_build(fp, 16 << 10, &idx));
+    ASSERT_EQ(0, gzindex_save(idx, side));
+    rewind(side);
+    ASSERT_EQ(0, gzindex_load(side, fp, &loaded));
+    ASSERT_EQ(gzindex_get_npoints(idx), gzindex_get_npoints(loaded));
+    ASSERT_EQ(gzindex_get_len(idx), gzindex_get_len(loaded));
+
+    check_range(loaded, fp, (uint8_t *) gold, 200000, 5000);
+
+    gzindex_dropref(loaded);
+    gzindex_dropref(idx);
+    free(gold);
+    fclose(side);
+    fclose(fp);
+}
+
+TEST(GzIndexTest, MultiMember) {
+    TEST_DESC("Access points span concatenated gzip members");
+    FILE *fp = tmpfile();
+    const size_t member_len = 50000;
+    uint8_t *gold = new uint8_t[3 * member_len];
+    gzindex_t *idx;
+
+    for (size_t i = 0; i < 3 * member_len; i++) {
+        gold[i] = (i * 7) ^ (i >> 9);
+    }
+
+    for (int m = 0; m < 3; m++) {
+        gzFile gz = gzdopen(dup(fileno(fp)), "wb");
+        gzwrite(gz, gold + m * member_len, member_len);
+        gzclose(gz);
+        fseek(fp, 0, SEEK_END);
+    }
+
+    ASSERT_EQ(0, gzindex_build(fp, 1 << 10, &idx));
+    ASSERT_EQ(3 * member_len, gzindex_get_len(idx));
+
+    check_range(idx, fp, gold, member_len - 10, 20);
+    check_range(idx, fp, gold, 2 * member_len + 1, member_len - 1);
+    check_range(idx, fp, gold, 0, 3 * member_len);
+
+    gzindex_dropref(idx);
+    delete[] gold;
+    fclose(fp);
+}
+
+TEST(GzIndexTest, NotCompressed) {
+    FILE *fp = tmpfile();
+    gzindex_t *idx;
+
+    fputs("not a gzip file", fp);
+    fflush(fp);
+    ASSERT_EQ(-1, gzindex_build(fp, 1 << 10, &idx));
+    ASSERT_EQ(EINVAL, errno);
+    fclose(fp);
+}
+
+/* Writes len bytes of pattern to a new file as a stored (level 0) gzip
+ * member, so the compressed size depends only on len.
+ */
+static FILE *stored_gzip(size_t len, uint8_t pattern)
+{
+    FILE *fp = tmpfile();
+    uint8_t *buf = new uint8_t[len];
+    gzFile gz;
+
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = (i * pattern) ^ (i >> 7);
+    }
+
+    gz = gzdopen(dup(fileno(fp)), "wb0");
+    gzwrite(gz, buf, len);
+    gzclose(gz);
+    delete[] buf;
+    return fp;
+}
+
+TEST(GzIndexTest, StaleSidecar) {
+    TEST_DESC("Sidecars for a different file of the same size are rejected");
+    FILE *a = stored_gzip(50000, 3);
+    FILE *b = stored_gzip(50000, 5);
+    FILE *side = tmpfile();
+    struct timespec times[2] = { { 1000000000, 0 }, { 1000000000, 0 } };
+    gzindex_t *idx, *loaded;
+    struct stat sa, sb;
+
+    ASSERT_EQ(0, futimens(fileno(a), times));
+    ASSERT_EQ(0, futimens(fileno(b), times));
+    ASSERT_EQ(0, fstat(fileno(a), &sa));
+    ASSERT_EQ(0, fstat(fileno(b), &sb));
+    ASSERT_EQ(sa.st_size, sb.st_size);
+
+    ASSERT_EQ(0, gzindex_build(a, 1 << 10, &idx));
+    ASSERT_EQ(0, gzindex_save(idx, side));
+    rewind(side);
+    ASSERT_EQ(0, gzindex_load(side, a, &loaded));
+    gzindex_dropref(loaded);
+
+    /* Same size and mtime, different trailer */
+    rewind(side);
+    ASSERT_EQ(-1, gzindex_load(side, b, &loaded));
+    ASSERT_EQ(ESTALE, errno);
+
+    /* Same file, touched since */
+    times[1].tv_sec++;
+    ASSERT_EQ(0, futimens(fileno(a), times));
+    rewind(side);
+    ASSERT_EQ(-1, gzindex_load(side, a, &loaded));
+    ASSERT_EQ(ESTALE, errno);
+
+    gzindex_dropref(idx);
+    fclose(side);
+    fclose(b);
+    fclose(a);
+}
+
+TEST(GzIndexTest, CorruptSidecar) {
+    TEST_DESC("Sidecars with impossible access points are rejected");
+    /* Header is 60 bytes, then the first point (a member start with no
+     * window) is 22 bytes; the second point's 'out' comes right after.
+     */
+    const long npoints_off = 56, second_out_off = 82;
+    const uint32_t bogus_npoints = 0xffffffff;
+    const uint64_t bogus_out = 1ULL << 40;
+    FILE *fp = stored_gzip(50000, 3);
+    FILE *side = tmpfile();
+    gzindex_t *idx, *loaded;
+
+    ASSERT_EQ(0, gzindex_build(fp, 1 << 10, &idx));
+    ASSERT_TRUE(gzindex_get_npoints(idx) > 1);
+    ASSERT_EQ(0, gzindex_save(idx, side));
+
+    fseek(side, second_out_off, SEEK_SET);
+    fwrite(&bogus_out, sizeof(bogus_out), 1, side);
+    rewind(side);
+    ASSERT_EQ(-1, gzindex_load(side, fp, &loaded));
+    ASSERT_EQ(EILSEQ, errno);
+
+    fseek(side, npoints_off, SEEK_SET);
+    fwrite(&bogus_npoints, sizeof(bogus_npoints), 1, side);
+    rewind(side);
+    ASSERT_EQ(-1, gzindex_load(side, fp, &loaded));
+    ASSERT_EQ(EILSEQ, errno);
+
+    gzindex_dropref(idx);
+    fclose(side);
+    fclose(fp);
+}
@@ -5,8 +5,7 @@
 #include "saleae.h"
 
 
-TEST(PaSpiTest, DISABLED_Functional) {
-#if 0
+TEST(PaSpiTest, Functional) {
     pa_spi_ctx_t *spi_ctx;
 
     uint64_t sample_count = 0;
@@ -24,19 +23,15 @@ TEST(PaSpiTest, DISABLED_Functional) {
     pa_spi_ctx_map_cs(spi_ctx, 3);
     pa_spi_ctx_set_flags(spi_ctx, SPI_FLAG_ENDIANESS);
 
-    /* Map sample file into memory */
-    // XXX - need to convert these to text fixtures!
-    rc = saleae_import_analog(fp, &cap);
-    if (rc) {
-        printf("rc: %d\n", rc);
-    }
+    rc = saleae_import_digital(fp, sizeof(uint32_t), 100E6, &cap);
+    ASSERT_EQ(0, rc);
 
-    for (unsigned long i = 0; i < cap_get_nsamples((cap_t *) dcap); i++)
+    for (unsigned long i = 0; i < cap_get_nsamples(cap); i++)
     {
         uint32_t sample;
         uint8_t dout, din;
         int rc;
-        sample = cap_digital_get_sample(dcap, i);
+        sample = cap_get_packed(cap, i);
         rc = pa_spi_stream(spi_ctx, sample, &dout, &din);
         if (PA_SPI_DATA_VALID == rc) {
             decode_count++;
@@ -47,7 +42,86 @@ TEST(PaSpiTest, DISABLED_Functional) {
     ASSERT_TRUE(decode_count > 0);
     ASSERT_TRUE(sample_count > 0);
 
+    cap_dropref(cap);
+    pa_spi_ctx_cleanup(spi_ctx);
+    fclose(fp);
+}
+
+TEST(PaSpiTest, BundleWords) {
+    const char test_file[] = "16ch_quadspi_100mHz.bin.gz";
+    FILE *fp = fopen(test_file, "rb");
+    pa_spi_ctx_t *spi_ctx, *spi_ctx2;
+    cap_bundle_t *bun = cap_bundle_create();
+    struct cap_words it;
+    const uint32_t *words;
+    uint64_t idx, n, nsamples, decode_count = 0, decode_count2 = 0;
+    uint8_t dout, din, dout2, din2;
+    cap_t *cap;
+
+    pa_spi_ctx_init(&spi_ctx);
+    pa_spi_ctx_init(&spi_ctx2);
+    for (pa_spi_ctx_t *ctx : { spi_ctx, spi_ctx2 }) {
+        pa_spi_ctx_map_mosi(ctx, 0);
+        pa_spi_ctx_map_miso(ctx, 1);
+        pa_spi_ctx_map_sclk(ctx, 2);
+        pa_spi_ctx_map_cs(ctx, 3);
+        pa_spi_ctx_set_flags(ctx, SPI_FLAG_ENDIANESS);
+    }
+
+    ASSERT_EQ(0, saleae_import_digital(fp, sizeof(uint32_t), 100E6, &cap));
+    nsamples = cap_get_nsamples(cap);
+
+    /* Split the analyzer's sample words out a channel per capture, the
+     * way an analog import comes in, and not in channel order.
+     */
+    for (unsigned ch : { 0, 1, 3, 2 }) {
+        cap_t *c = cap_create(nsamples);
+
+        for (uint64_t i = 0; i < nsamples; i++)
+            cap_set_digital(c, i, (cap_get_packed(cap, i) >> ch) & 1);
+        cap_set_physical_ch(c, ch);
+        cap_bundle_add(bun, c);
+    }
+
+    /* Rebuilt words match the originals, from an unaligned start too */
+    for (uint64_t begin : { (uint64_t) 0, (uint64_t) 4100, (uint64_t) 77 }) {
+        uint64_t next = begin;
+
+        cap_bundle_words_init(&it, bun, begin, nsamples - 3);
+        while (NULL != (words = cap_bundle_words_next(&it, &idx, &n))) {
+            ASSERT_EQ(next, idx);
+            for (uint64_t i = 0; i < n; i++)
+                ASSERT_EQ(cap_get_packed(cap, idx + i) & 0xf, words[i]) << idx + i;
+            next += n;
+        }
+        ASSERT_EQ(nsamples - 3, next);
+        cap_bundle_words_release(&it);
+    }
+
+    /* And decode the same */
+    cap_bundle_words_init(&it, bun, 0, nsamples);
+    while (NULL != (words = cap_bundle_words_next(&it, &idx, &n))) {
+        for (uint64_t i = 0; i < n; i++) {
+            int rc = pa_spi_stream(spi_ctx, words[i], &dout, &din);
+            int rc2 = pa_spi_stream(spi_ctx2, cap_get_packed(cap, idx + i),
+                &dout2, &din2);
+
+            ASSERT_EQ(rc2, rc);
+            if (PA_SPI_DATA_VALID == rc) {
+                ASSERT_EQ(dout2, dout);
+                ASSERT_EQ(din2, din);
+                decode_count++;
+            }
+            decode_count2 += (PA_SPI_DATA_VALID == rc2);
+        }
+    }
+    cap_bundle_words_release(&it);
+    ASSERT_TRUE(decode_count > 0);
+    ASSERT_EQ(decode_count2, decode_count);
+
+    cap_bundle_dropref(bun);
+    cap_dropref(cap);
     pa_spi_ctx_cleanup(spi_ctx);
+    pa_spi_ctx_cleanup(spi_ctx2);
     fclose(fp);
-#endif
 }
@@ -3,6 +3,7 @@
 
 #include "cap.h"
 #include "pa_usart.h"
+#include "proto.h"
 #include "saleae.h"
 
 TEST(PaUsartTest, UsartStream) {
@@ -56,7 +57,76 @@ TEST(PaUsartTest, UsartBlock) {
     ASSERT_STREQ(usart_recv, gold_usart_recv);
 
     free(usart_recv);
-    pa_usart_ctx_cleanup(usart);
     pa_usart_reset(usart);
+    pa_usart_ctx_cleanup(usart);
+    fclose(fp);
+}
+
+TEST(PaUsartTest, DecodedPayloads) {
+    TEST_DESC("Decoded data comes from inline and owned payloads alike");
+    const char gold_usart_recv[] = "AB";
+    pa_usart_ctx_t *usart;
+    char *usart_recv;
+    char *owned = (char *) malloc(1);
+    proto_t *pr;
+
+    pa_usart_ctx_init(&usart);
+    pr = pa_usart_get_proto(usart);
+
+    owned[0] = 'A';
+    proto_add_dframe(pr, 10, USART_DFRAME_DATA, owned);
+    proto_add_dframe_inline(pr, 20, USART_DFRAME_DATA, NULL, 0);
+    proto_add_dframe_inline(pr, 30, USART_DFRAME_DATA, "B", 1);
+
+    ASSERT_EQ(2, pa_usart_get_decoded_range(usart, 0, 100, &usart_recv));
+    ASSERT_STREQ(gold_usart_recv, usart_recv);
+
+    free(usart_recv);
+    proto_dropref(pr);
+    pa_usart_ctx_cleanup(usart);
+}
+
+TEST(PaUsartTest, UsartBundle) {
+    TEST_DESC("Tests the USART decoder on sample words built from a bundle");
+    const char gold_usart_recv[] = "Uart Decode Test PASS!";
+    FILE *fp = fopen("uart_analog_115200_50mHz.bin.gz", "rb");
+    char *usart_recv;
+    pa_usart_ctx_t *usart;
+    cap_bundle_t *bun;
+
+    pa_usart_ctx_init(&usart);
+    pa_usart_ctx_map_data(usart, 0);
+    pa_usart_ctx_set_freq(usart, 50.0E6);
+
+    ASSERT_EQ(0, saleae_import_analog(fp, &bun));
+    pa_usart_decode_bundle(usart, bun);
+
+    ASSERT_EQ(strlen(gold_usart_recv), pa_usart_get_decoded(usart, &usart_recv));
+    ASSERT_STREQ(gold_usart_recv, usart_recv);
+
+    free(usart_recv);
+
+    /* Splitting the capture in two at a frame gives back both halves */
+    proto_dframe_t *df = proto_dframe_first(pa_usart_get_proto(usart));
+    uint64_t split, nbytes;
+    for (int i = 0; i < 30; i++)
+        df = proto_dframe_next(df);
+    split = proto_dframe_idx(df);
+
+    nbytes = pa_usart_get_decoded_range(usart, 0, split, &usart_recv);
+    ASSERT_LT(0, nbytes);
+    ASSERT_GT(strlen(gold_usart_recv), nbytes);
+    ASSERT_EQ(0, strncmp(gold_usart_recv, usart_recv, nbytes));
+    free(usart_recv);
+
+    ASSERT_EQ(strlen(gold_usart_recv) - nbytes,
+        pa_usart_get_decoded_range(usart, split, UINT64_MAX, &usart_recv));
+    ASSERT_STREQ(gold_usart_recv + nbytes, usart_recv);
+    free(usart_recv);
+
+    ASSERT_EQ(0, pa_usart_get_decoded_range(usart, split, split, &usart_recv));
+    ASSERT_EQ(NULL, usart_recv);
+    pa_usart_ctx_cleanup(usart);
+    cap_bundle_dropref(bun);
     fclose(fp);
 }
@@ -1,4 +1,6 @@
 #include <cstdio>
+#include <cstring>
+#include <utility>
 #include <gtest/gtest.h>
 #include "test_utils.hpp"
 
@@ -76,3 +78,167 @@ TEST(Proto, ProtoLifeCycle) {
     proto_add_dframe(pr, 0, 0, NULL);
     proto_dropref(pr);
 }
+
+TEST(Proto, ManyFrames) {
+    TEST_DESC("Frames spanning many chunks come back in order, payloads intact");
+    const uint64_t nframes = 50000;
+    proto_t *pr = proto_create();
+    proto_dframe_t *df;
+    uint64_t i = 0;
+
+    ASSERT_EQ(NULL, proto_dframe_first(pr));
+    ASSERT_EQ(NULL, proto_dframe_last(pr));
+
+    /* Mix inline payloads, owned ones and none at all */
+    for (i = 0; i < nframes; i++) {
+        uint64_t v = i * 3;
+
+        if (0 == (i % 3)) {
+            proto_add_dframe_inline(pr, v, (int) i, &v, sizeof(v));
+        } else if (1 == (i % 3)) {
+            uint64_t *p = (uint64_t *) malloc(sizeof(*p));
+            *p = v;
+            proto_add_dframe(pr, v, (int) i, p);
+        } else {
+            proto_add_dframe_inline(pr, v, (int) i, NULL, 0);
+        }
+    }
+    ASSERT_EQ(nframes, proto_get_nframes(pr));
+
+    i = 0;
+    for (df = proto_dframe_first(pr); df; df = proto_dframe_next(df), i++) {
+        ASSERT_EQ(i * 3, proto_dframe_idx(df));
+        ASSERT_EQ((int) i, proto_dframe_type(df));
+        if (2 == (i % 3)) {
+            ASSERT_EQ(NULL, proto_dframe_udata(df)) << i;
+        } else {
+            uint64_t v;
+            memcpy(&v, proto_dframe_udata(df), sizeof(v));
+            ASSERT_EQ(i * 3, v) << i;
+        }
+    }
+    ASSERT_EQ(nframes, i);
+    ASSERT_EQ((nframes - 1) * 3, proto_dframe_idx(proto_dframe_last(pr)));
+
+    proto_dropref(pr);
+}
+
+TEST(Proto, SampleRanges) {
+    TEST_DESC("Range and nearest lookups agree with walking every frame");
+    const uint64_t nframes = 20000;
+    proto_t *pr = proto_create();
+    proto_dframe_t *df;
+
+    ASSERT_EQ(NULL, proto_dframe_nearest(pr, 5));
+    ASSERT_EQ(0, proto_dframe_range(pr, 0, 100, &df));
+    ASSERT_EQ(NULL, df);
+
+    /* Frames every 10 samples from 100, with pairs sharing a sample */
+    for (uint64_t i = 0; i < nframes; i++)
+        proto_add_dframe_inline(pr, 100 + 10 * (i / 2), (int) i, NULL, 0);
+
+    for (uint64_t s : { (uint64_t) 0, (uint64_t) 100, (uint64_t) 104,
+            (uint64_t) 105, (uint64_t) 106, (uint64_t) 61543,
+            (uint64_t) 100 + 10 * (nframes / 2 - 1), (uint64_t) 1000000 }) {
+        df = proto_dframe_lower_bound(pr, s);
+        if (s > 100 + 10 * (nframes / 2 - 1)) {
+            ASSERT_EQ(NULL, df);
+        } else {
+            ASSERT_LE(s, proto_dframe_idx(df));
+            ASSERT_GT((s < 100) ? 101 : s + 10, proto_dframe_idx(df));
+            ASSERT_EQ(0, proto_dframe_type(df) % 2) << s;
+        }
+    }
+
+    ASSERT_EQ(100, proto_dframe_idx(proto_dframe_nearest(pr, 0)));
+    ASSERT_EQ(100, proto_dframe_idx(proto_dframe_nearest(pr, 105)));
+    ASSERT_EQ(110, proto_dframe_idx(proto_dframe_nearest(pr, 106)));
+    ASSERT_EQ(proto_dframe_last(pr), proto_dframe_nearest(pr, 1000000));
+
+    /* Ranges crossing chunk boundaries, and ones that miss every frame */
+    for (auto r : { std::make_pair<uint64_t, uint64_t>(0, 100),
+            std::make_pair<uint64_t, uint64_t>(100, 101),
+            std::make_pair<uint64_t, uint64_t>(101, 110),
+            std::make_pair<uint64_t, uint64_t>(0, 1000000),
+            std::make_pair<uint64_t, uint64_t>(30005, 95000),
+            std::make_pair<uint64_t, uint64_t>(500, 400) }) {
+        uint64_t gold = 0, n;
+        proto_dframe_t *gold_first = NULL;
+
+        for (df = proto_dframe_first(pr); df; df = proto_dframe_next(df)) {
+            uint64_t idx = proto_dframe_idx(df);
+            if ((idx >= r.first) && (idx < r.second)) {
+                if (0 == gold++)
+                    gold_first = df;
+            }
+        }
+
+        n = proto_dframe_range(pr, r.first, r.second, &df);
+        ASSERT_EQ(gold, n) << r.first << " " << r.second;
+        ASSERT_EQ(gold_first, df) << r.first << " " << r.second;
+    }
+
+    proto_dropref(pr);
+}
+
+struct batch_check {
+    uint64_t next;
+    uint64_t nbatches;
+    uint64_t stop_at;
+};
+
+static int check_batch(const struct proto_batch *b, void *udata)
+{
+    struct batch_check *bc = (struct batch_check *) udata;
+
+    EXPECT_EQ(bc->next, b->first);
+    EXPECT_LT(0, b->n);
+    for (size_t i = 0; i < b->n; i++) {
+        uint64_t v;
+
+        EXPECT_EQ((b->first + i) * 2, b->idx[i]);
+        EXPECT_EQ((int32_t) (b->first + i), b->type[i]);
+        memcpy(&v, proto_batch_udata(b, i), sizeof(v));
+        EXPECT_EQ(b->first + i, v);
+    }
+    bc->next += b->n;
+    bc->nbatches++;
+
+    return (bc->next >= bc->stop_at) ? -7 : 0;
+}
+
+TEST(Proto, Foreach) {
+    TEST_DESC("Batched visitors see every frame once, in order, in big batches");
+    const uint64_t nframes = 20000;
+    proto_t *pr = proto_create();
+    struct batch_check bc = { 0, 0, UINT64_MAX };
+
+    ASSERT_EQ(0, proto_foreach(pr, check_batch, &bc));
+    ASSERT_EQ(0, bc.nbatches);
+
+    for (uint64_t i = 0; i < nframes; i++) {
+        if (i % 2) {
+            proto_add_dframe_inline(pr, 2 * i, (int) i, &i, sizeof(i));
+        } else {
+            uint64_t *p = (uint64_t *) malloc(sizeof(*p));
+            *p = i;
+            proto_add_dframe(pr, 2 * i, (int) i, p);
+        }
+    }
+
+    ASSERT_EQ(0, proto_foreach(pr, check_batch, &bc));
+    ASSERT_EQ(nframes, bc.next);
+    ASSERT_GT(10, bc.nbatches);
+
+    /* Ranges start and end mid-batch */
+    bc = (struct batch_check) { 1001, 0, UINT64_MAX };
+    ASSERT_EQ(0, proto_foreach_range(pr, 2001, 30001, check_batch, &bc));
+    ASSERT_EQ(15001, bc.next);
+
+    /* A sink can stop the walk early */
+    bc = (struct batch_check) { 0, 0, 1 };
+    ASSERT_EQ(-7, proto_foreach(pr, check_batch, &bc));
+    ASSERT_EQ(1, bc.nbatches);
+
+    proto_dropref(pr);
+}
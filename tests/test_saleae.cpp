@@ -1,8 +1,13 @@
 #include <cerrno>
+#include <thread>
+#include <unistd.h>
+#include <zlib.h>
 #include <gtest/gtest.h>
 
 
+#include "bgzf.h"
 #include "cap.h"
+#include "file_utils.h"
 #include "saleae.h"
 
 extern char SAMPLE_PATH[];
@@ -38,6 +43,288 @@ TEST(SaleaeTest, ImportAnalogCapture) {
     fclose(fp);
 }
 
+TEST(SaleaeTest, ImportAnalogUncompressed) {
+    /* Mapped (uncompressed) and streamed (gzip'd) imports must agree */
+    cap_bundle_t *bun_gz, *bun_raw;
+    cap_t *c_gz, *c_raw;
+    FILE *fp_gz = fopen("uart_analog_115200_50mHz.bin.gz", "rb");
+    FILE *fp_raw = tmpfile();
+    void *buf;
+    size_t len;
+
+    ASSERT_EQ(0, file_load(fp_gz, &buf, &len));
+    fwrite(buf, len, 1, fp_raw);
+    fflush(fp_raw);
+    free(buf);
+
+    ASSERT_EQ(0, saleae_import_analog(fp_gz, &bun_gz));
+    ASSERT_EQ(0, saleae_import_analog(fp_raw, &bun_raw));
+    ASSERT_EQ(cap_bundle_len(bun_gz), cap_bundle_len(bun_raw));
+
+    c_gz = cap_bundle_first(bun_gz);
+    c_raw = cap_bundle_first(bun_raw);
+    ASSERT_EQ(cap_get_nsamples(c_gz), cap_get_nsamples(c_raw));
+    ASSERT_EQ(cap_get_analog_min(c_gz), cap_get_analog_min(c_raw));
+    ASSERT_EQ(cap_get_analog_max(c_gz), cap_get_analog_max(c_raw));
+    for (uint64_t i = 0; i < cap_get_nsamples(c_gz); i++) {
+        ASSERT_EQ(cap_get_analog(c_gz, i), cap_get_analog(c_raw, i));
+        ASSERT_EQ(cap_get_digital(c_gz, i), cap_get_digital(c_raw, i));
+    }
+
+    cap_bundle_dropref(bun_gz);
+    cap_bundle_dropref(bun_raw);
+    fclose(fp_gz);
+    fclose(fp_raw);
+}
+
+TEST(SaleaeTest, ImportAnalogRange) {
+    /* A sample range pulled out of a gzip'd capture through its index
+     * sidecar has to match the same range from a full import.
+     */
+    const char test_file[] = "uart_analog_115200_50mHz.bin.gz";
+    const char sidecar[] = "uart_analog_115200_50mHz.bin.gz.gzidx";
+    struct saleae_opts opts = { 0 };
+    cap_bundle_t *bun_all, *bun_range;
+    cap_t *c_all, *c_range;
+    FILE *fp = fopen(test_file, "rb");
+
+    ASSERT_EQ(0, saleae_import_analog(fp, &bun_all));
+
+    opts.begin = 1000;
+    opts.end = 51000;
+    opts.ch_mask = 0x1;
+    opts.path = test_file;
+    ASSERT_EQ(0, saleae_import_analog_opts(fp, &opts, &bun_range));
+    ASSERT_EQ(1, cap_bundle_len(bun_range));
+
+    c_all = cap_bundle_first(bun_all);
+    c_range = cap_bundle_first(bun_range);
+    ASSERT_EQ(opts.end - opts.begin, cap_get_nsamples(c_range));
+    for (uint64_t i = 0; i < cap_get_nsamples(c_range); i++) {
+        ASSERT_EQ(cap_get_analog(c_all, opts.begin + i), cap_get_analog(c_range, i));
+    }
+
+    /* Selecting nothing that exists gives an empty bundle */
+    opts.ch_mask = 0x2;
+    cap_bundle_dropref(bun_range);
+    ASSERT_EQ(0, saleae_import_analog_opts(fp, &opts, &bun_range));
+    ASSERT_EQ(0, cap_bundle_len(bun_range));
+
+    /* Backwards range */
+    opts.begin = 2000;
+    opts.end = 1000;
+    ASSERT_EQ(-1, saleae_import_analog_opts(fp, &opts, &bun_range));
+    ASSERT_EQ(EINVAL, errno);
+
+    cap_bundle_dropref(bun_all);
+    remove(sidecar);
+    fclose(fp);
+}
+
+TEST(SaleaeTest, ImportAnalogThresholds) {
+    /* Thresholds are picked between the capture's own levels unless
+     * they're given, in volts.
+     */
+    const char test_file[] = "uart_analog_115200_50mHz.bin.gz";
+    struct saleae_opts opts = { 0 };
+    cap_bundle_t *bun_auto, *bun_ttl;
+    cap_t *c_auto, *c_ttl;
+    uint16_t v_lo, v_hi;
+    FILE *fp = fopen(test_file, "rb");
+
+    ASSERT_EQ(0, saleae_import_analog(fp, &bun_auto));
+    c_auto = cap_bundle_first(bun_auto);
+    cap_get_adc_thresholds(c_auto, &v_lo, &v_hi);
+    ASSERT_LT(cap_get_analog_min(c_auto), v_lo);
+    ASSERT_LT(v_lo, v_hi);
+    ASSERT_GT(cap_get_analog_max(c_auto), v_hi);
+
+    opts.v_lo = 0.8f;
+    opts.v_hi = 2.0f;
+    ASSERT_EQ(0, saleae_import_analog_opts(fp, &opts, &bun_ttl));
+    c_ttl = cap_bundle_first(bun_ttl);
+    cap_get_adc_thresholds(c_ttl, &v_lo, &v_hi);
+    ASSERT_EQ(adc_voltage_to_sample(0.8f, NULL), v_lo);
+    ASSERT_EQ(adc_voltage_to_sample(2.0f, NULL), v_hi);
+
+    /* A clean capture comes out the same either way, give or take
+     * where along each edge it crosses
+     */
+    ASSERT_EQ(cap_get_nedges(c_auto), cap_get_nedges(c_ttl));
+    for (uint64_t k = 0; k < cap_get_nedges(c_ttl); k++) {
+        ASSERT_NEAR(cap_get_edge(c_auto, k), cap_get_edge(c_ttl, k), 2) << k;
+    }
+
+    cap_bundle_dropref(bun_auto);
+    cap_bundle_dropref(bun_ttl);
+    fclose(fp);
+}
+
+TEST(SaleaeTest, ImportAnalogThreads) {
+    /* Channels come out the same, and in order, however many threads
+     * import them, on both the mapped and streamed paths, and whether
+     * or not they're stored in 12 bits.
+     */
+    const uint64_t nsamples = 50000;
+    const uint32_t nchannels = 8;
+    const struct __attribute__((__packed__)) {
+        uint64_t sample_total;
+        uint32_t channel_count;
+        double sample_period;
+    } hdr = { nsamples, nchannels, 2.0E-08 };
+    struct saleae_timing t;
+    struct saleae_opts opts = { 0 };
+    cap_bundle_t *gold, *bun;
+    FILE *fp_raw = tmpfile();
+    FILE *fp_gz = tmpfile();
+    gzFile gz = gzdopen(dup(fileno(fp_gz)), "wb");
+    float *samples = new float[nsamples];
+
+    fwrite(&hdr, sizeof(hdr), 1, fp_raw);
+    gzwrite(gz, &hdr, sizeof(hdr));
+    for (uint32_t ch = 0; ch < nchannels; ch++) {
+        for (uint64_t i = 0; i < nsamples; i++) {
+            samples[i] = ((i * (ch + 1)) / 1000) % 2 ? 4000.0f : 100.0f + ch;
+        }
+        fwrite(samples, sizeof(float), nsamples, fp_raw);
+        gzwrite(gz, samples, sizeof(float) * nsamples);
+    }
+    fflush(fp_raw);
+    gzclose(gz);
+    delete[] samples;
+
+    opts.nthreads = 1;
+    ASSERT_EQ(0, saleae_import_analog_opts(fp_raw, &opts, &gold));
+    ASSERT_EQ(nchannels, cap_bundle_len(gold));
+
+    opts.nthreads = 4;
+    opts.timing = &t;
+    for (int pass = 0; pass < 4; pass++) {
+        FILE *fp = (pass % 2) ? fp_gz : fp_raw;
+        cap_t *c_gold, *c;
+
+        opts.analog12 = pass >= 2;
+        ASSERT_EQ(0, saleae_import_analog_opts(fp, &opts, &bun));
+        ASSERT_EQ(opts.analog12 ? 12 : 16,
+            cap_get_analog_bits(cap_bundle_first(bun)));
+        ASSERT_EQ(4, t.nthreads);
+        ASSERT_TRUE(t.total > 0);
+        ASSERT_EQ(nchannels, cap_bundle_len(bun));
+
+        c_gold = cap_bundle_first(gold);
+        c = cap_bundle_first(bun);
+        for (uint32_t ch = 0; ch < nchannels; ch++) {
+            ASSERT_EQ(ch, cap_get_physical_ch(c));
+            ASSERT_EQ(cap_get_analog_min(c_gold), cap_get_analog_min(c));
+            ASSERT_EQ(cap_get_analog_max(c_gold), cap_get_analog_max(c));
+            for (uint64_t i = 0; i < nsamples; i++) {
+                ASSERT_EQ(cap_get_analog(c_gold, i), cap_get_analog(c, i));
+                ASSERT_EQ(cap_get_digital(c_gold, i), cap_get_digital(c, i));
+            }
+            c_gold = cap_next(c_gold);
+            c = cap_next(c);
+        }
+        cap_bundle_dropref(bun);
+    }
+
+    cap_bundle_dropref(gold);
+    fclose(fp_raw);
+    fclose(fp_gz);
+}
+
+TEST(SaleaeTest, ImportAnalogPipe) {
+    /* Captures piped in, gzip'd or not, match ones read from a file,
+     * including when samples and channels have to be read past.
+     */
+    const char test_file[] = "uart_analog_115200_50mHz.bin.gz";
+    struct saleae_opts opts = { 0 };
+    cap_bundle_t *gold, *bun;
+    FILE *fp = fopen(test_file, "rb");
+    void *raw, *gz;
+    size_t raw_len, gz_len;
+
+    ASSERT_EQ(0, file_load(fp, &raw, &raw_len));
+    fseek(fp, 0, SEEK_END);
+    gz_len = ftell(fp);
+    rewind(fp);
+    gz = malloc(gz_len);
+    ASSERT_EQ(1, fread(gz, gz_len, 1, fp));
+
+    opts.begin = 1000;
+    opts.end = 90000;
+    ASSERT_EQ(0, saleae_import_analog_opts(fp, &opts, &gold));
+
+    for (auto src : { std::make_pair(raw, raw_len), std::make_pair(gz, gz_len) }) {
+        cap_t *c_gold = cap_bundle_first(gold), *c;
+        FILE *pipe_in;
+        int fds[2];
+
+        ASSERT_EQ(0, pipe(fds));
+        std::thread writer([&] {
+            write(fds[1], src.first, src.second);
+            close(fds[1]);
+        });
+        pipe_in = fdopen(fds[0], "rb");
+
+        ASSERT_EQ(0, saleae_import_analog_opts(pipe_in, &opts, &bun));
+
+        /* The import stops reading at the end of the range */
+        char drain[4096];
+        while (read(fds[0], drain, sizeof(drain)) > 0)
+            ;
+        writer.join();
+        fclose(pipe_in);
+
+        ASSERT_EQ(1, cap_bundle_len(bun));
+        c = cap_bundle_first(bun);
+        ASSERT_EQ(cap_get_nsamples(c_gold), cap_get_nsamples(c));
+        for (uint64_t i = 0; i < cap_get_nsamples(c); i++) {
+            ASSERT_EQ(cap_get_analog(c_gold, i), cap_get_analog(c, i));
+            ASSERT_EQ(cap_get_digital(c_gold, i), cap_get_digital(c, i));
+        }
+        cap_bundle_dropref(bun);
+    }
+
+    cap_bundle_dropref(gold);
+    free(raw);
+    free(gz);
+    fclose(fp);
+}
+
+TEST(SaleaeTest, ImportAnalogBgzf) {
+    /* Block gzip'd captures are inflated in parallel instead of being
+     * streamed, and come out the same as the regular gzip'd ones.
+     */
+    FILE *gz = fopen("uart_analog_115200_50mHz.bin.gz", "rb");
+    FILE *fp = tmpfile();
+    struct saleae_timing timing;
+    struct saleae_opts opts = { 0 };
+    cap_bundle_t *gold, *bun;
+    cap_t *a, *b;
+
+    opts.timing = &timing;
+    ASSERT_EQ(0, saleae_import_analog_opts(gz, &opts, &gold));
+    ASSERT_FALSE(timing.mapped);
+
+    ASSERT_EQ(0, bgzf_compress_file(gz, fp, Z_DEFAULT_COMPRESSION));
+    ASSERT_TRUE(file_is_bgzf(fp));
+    ASSERT_EQ(0, saleae_import_analog_opts(fp, &opts, &bun));
+    ASSERT_TRUE(timing.mapped);
+
+    a = cap_bundle_first(gold);
+    b = cap_bundle_first(bun);
+    ASSERT_TRUE(NULL != b);
+    ASSERT_EQ(cap_get_nsamples(a), cap_get_nsamples(b));
+    for (uint64_t i = 0; i < cap_get_nsamples(a); i++) {
+        ASSERT_EQ(cap_get_analog(a, i), cap_get_analog(b, i));
+    }
+
+    cap_bundle_dropref(bun);
+    cap_bundle_dropref(gold);
+    fclose(fp);
+    fclose(gz);
+}
+
 TEST(SaleaeTest, ImportAnalogBogusInput) {
     cap_bundle_t *bun = (cap_bundle_t *) 0xf00fb00b;
     int rc;
@@ -47,3 +334,103 @@ TEST(SaleaeTest, ImportAnalogBogusInput) {
     ASSERT_EQ(errno, EIO);
 
 }
+
+TEST(SaleaeTest, ImportAnalogTruncated) {
+    /* Header claims more samples than the file holds */
+    const struct __attribute__((__packed__)) {
+        uint64_t sample_total;
+        uint32_t channel_count;
+        double sample_period;
+    } hdr = { 1000, 2, 2.0E-08 };
+    const float samples[10] = { 0 };
+    cap_bundle_t *bun = (cap_bundle_t *) 0xf00fb00b;
+    FILE *fp = tmpfile();
+    int rc;
+
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    fwrite(samples, sizeof(float), 10, fp);
+    rewind(fp);
+
+    rc = saleae_import_analog(fp, &bun);
+    ASSERT_TRUE(rc < 0);
+    ASSERT_EQ(errno, EIO);
+    ASSERT_TRUE(NULL == bun);
+
+    fclose(fp);
+}
+
+TEST(SaleaeTest, ImportAnalogOverflow) {
+    /* sample_total * channel_count wraps around to 4 */
+    const struct __attribute__((__packed__)) {
+        uint64_t sample_total;
+        uint32_t channel_count;
+        double sample_period;
+    } hdr = { (1ULL << 62) + 1, 4, 2.0E-08 };
+    const float samples[10] = { 0 };
+    struct saleae_opts opts = { 0 };
+    cap_bundle_t *bun = (cap_bundle_t *) 0xf00fb00b;
+    FILE *fp = tmpfile();
+    int rc;
+
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    fwrite(samples, sizeof(float), 10, fp);
+    rewind(fp);
+
+    opts.end = 2;
+    rc = saleae_import_analog_opts(fp, &opts, &bun);
+    ASSERT_TRUE(rc < 0);
+    ASSERT_EQ(errno, EIO);
+    ASSERT_TRUE(NULL == bun);
+
+    fclose(fp);
+}
+
+TEST(SaleaeTest, ImportDigitalCapture) {
+    const char test_file[] = "uart_digital_115200_500mHz.bin.gz";
+    const uint64_t gold_nsamples = 990910;
+    FILE *fp = fopen(test_file, "rb");
+    FILE *pipe;
+    cap_t *cap, *piped;
+    int rc;
+
+    rc = saleae_import_digital(fp, sizeof(uint32_t), 500E6, &cap);
+    ASSERT_EQ(0, rc);
+    ASSERT_EQ(gold_nsamples, cap_get_nsamples(cap));
+    ASSERT_EQ(sizeof(uint32_t), cap_get_packed_width(cap));
+    ASSERT_FLOAT_EQ(2E-9, cap_get_period(cap));
+    ASSERT_EQ(1, cap_get_packed(cap, 0));
+    ASSERT_EQ(0, cap_get_packed(cap, 114800 / sizeof(uint32_t)));
+    ASSERT_EQ(1, cap_get_packed(cap, 132208 / sizeof(uint32_t)));
+
+    /* Piped in captures get streamed rather than mapped */
+    pipe = popen("cat uart_digital_115200_500mHz.bin.gz", "r");
+    rc = saleae_import_digital(pipe, sizeof(uint32_t), 500E6, &piped);
+    ASSERT_EQ(0, rc);
+    ASSERT_EQ(gold_nsamples, cap_get_nsamples(piped));
+    for (uint64_t i = 0; i < gold_nsamples; i++) {
+        ASSERT_EQ(cap_get_packed(cap, i), cap_get_packed(piped, i));
+    }
+    pclose(pipe);
+
+    cap_dropref(piped);
+    cap_dropref(cap);
+    fclose(fp);
+}
+
+TEST(SaleaeTest, ImportDigitalBogusInput) {
+    FILE *fp = tmpfile();
+    cap_t *cap = (cap_t *) 0xf00fb00b;
+
+    ASSERT_EQ(-1, saleae_import_digital(NULL, 4, 100E6, &cap));
+    ASSERT_EQ(EIO, errno);
+    ASSERT_TRUE(NULL == cap);
+
+    ASSERT_EQ(-1, saleae_import_digital(fp, 3, 100E6, &cap));
+    ASSERT_EQ(EINVAL, errno);
+
+    /* Empty file */
+    ASSERT_EQ(-1, saleae_import_digital(fp, 4, 100E6, &cap));
+    ASSERT_EQ(ENODATA, errno);
+
+    fclose(fp);
+}
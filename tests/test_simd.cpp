@@ -0,0 +1,229 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <gtest/gtest.h>
+#include "test_utils.hpp"
+
+#include "simd.h"
+
+TEST(SimdTest, FloatToU16MatchesScalar) {
+    TEST_DESC("Every vectorized conversion is bit-exact with the scalar one");
+    const size_t len = 10007;
+    float *src = new float[len];
+    uint16_t *gold = new uint16_t[len];
+    uint16_t *dst = new uint16_t[len];
+    enum simd_level max = simd_max_level();
+    uint16_t gold_min = UINT16_MAX, gold_max = 0;
+
+    /* Typical samples, plus fractions, negatives and values that don't
+     * fit in 16 bits to pin down the edge cases.
+     */
+    srand(1234);
+    for (size_t i = 0; i < len; i++) {
+        switch (i % 5) {
+        case 0:
+            src[i] = rand() % 4096;
+            break;
+        case 1:
+            src[i] = (rand() % 409600) / 100.0f;
+            break;
+        case 2:
+            src[i] = -(rand() % 1000) / 7.0f;
+            break;
+        case 3:
+            src[i] = rand() % 1000000;
+            break;
+        default:
+            src[i] = 65535.9f;
+            break;
+        }
+    }
+
+    simd_set_level(SIMD_SCALAR);
+    ASSERT_EQ(SIMD_SCALAR, simd_get_level());
+    simd_f32_to_u16(src, gold, len, &gold_min, &gold_max);
+    ASSERT_EQ((uint16_t) (int32_t) src[2 * 5 + 2], gold[2 * 5 + 2]);
+
+    for (int level = SIMD_SCALAR; level <= max; level++) {
+        ASSERT_EQ(level, simd_set_level((enum simd_level) level));
+
+        /* Odd lengths and offsets exercise the scalar tails */
+        for (size_t n : { (size_t) 0, (size_t) 1, (size_t) 7, (size_t) 15,
+                (size_t) 17, (size_t) 33, len - 3, len }) {
+            uint16_t min = UINT16_MAX, max = 0;
+            uint16_t exp_min = UINT16_MAX, exp_max = 0;
+            size_t off = len - n;
+
+            for (size_t i = off; i < len; i++) {
+                if (gold[i] < exp_min)
+                    exp_min = gold[i];
+                if (gold[i] > exp_max)
+                    exp_max = gold[i];
+            }
+
+            memset(dst, 0, len * sizeof(uint16_t));
+            simd_f32_to_u16(src + off, dst, n, &min, &max);
+            ASSERT_EQ(0, memcmp(gold + off, dst, n * sizeof(uint16_t)))
+                << "level " << level << " n " << n;
+            ASSERT_EQ(exp_min, min) << "level " << level << " n " << n;
+            ASSERT_EQ(exp_max, max) << "level " << level << " n " << n;
+        }
+    }
+
+    /* Asking for more than the CPU has gets the best it can do */
+    ASSERT_EQ(max, simd_set_level(SIMD_AVX2));
+
+    delete[] src;
+    delete[] gold;
+    delete[] dst;
+}
+
+TEST(SimdTest, ThresholdsMatchScalar) {
+    TEST_DESC("Vectorized threshold compares are bit-exact with the scalar ones");
+    const size_t len = 1000;
+    const size_t nwords = (len + 63) / 64;
+    uint16_t src[len];
+    uint64_t gold_below[nwords], gold_above[nwords];
+    uint64_t below[nwords], above[nwords];
+
+    srand(99);
+    for (size_t i = 0; i < len; i++) {
+        src[i] = (i % 7) ? rand() % 4096 : 0xffff - (rand() % 16);
+    }
+
+    simd_set_level(SIMD_SCALAR);
+    simd_u16_thresholds(src, len, 1000, 3000, gold_below, gold_above);
+    ASSERT_EQ((uint64_t) (src[65] <= 1000), (gold_below[1] >> 1) & 1);
+    ASSERT_EQ((uint64_t) (src[65] >= 3000), (gold_above[1] >> 1) & 1);
+
+    for (int level = SIMD_SCALAR; level <= simd_max_level(); level++) {
+        simd_set_level((enum simd_level) level);
+
+        for (size_t n : { (size_t) 1, (size_t) 63, (size_t) 64, (size_t) 129, len }) {
+            size_t nw = (n + 63) / 64;
+            uint64_t last_mask = (n % 64) ? (1ULL << (n % 64)) - 1 : UINT64_MAX;
+
+            simd_u16_thresholds(src, n, 1000, 3000, below, above);
+            for (size_t w = 0; w + 1 < nw; w++) {
+                ASSERT_EQ(gold_below[w], below[w]) << "level " << level << " n " << n;
+                ASSERT_EQ(gold_above[w], above[w]) << "level " << level << " n " << n;
+            }
+            ASSERT_EQ(gold_below[nw - 1] & last_mask, below[nw - 1]);
+            ASSERT_EQ(gold_above[nw - 1] & last_mask, above[nw - 1]);
+        }
+    }
+
+    simd_set_level(simd_max_level());
+}
+
+TEST(SimdTest, UnpackU12MatchesScalar) {
+    TEST_DESC("Vectorized 12-bit unpacking is bit-exact with the scalar one");
+    const size_t len = 1001;
+    uint16_t src[len], dst[len];
+    uint8_t packed[(3 * len + 1) / 2];
+
+    srand(12);
+    for (size_t i = 0; i < len; i++) {
+        src[i] = rand() % 4096;
+    }
+    src[7] = 0xffff;
+
+    simd_pack_u12(src, len, packed);
+    src[7] = 0xfff;
+
+    for (int level = SIMD_SCALAR; level <= simd_max_level(); level++) {
+        simd_set_level((enum simd_level) level);
+
+        for (size_t n : { (size_t) 0, (size_t) 1, (size_t) 19, (size_t) 20,
+                (size_t) 37, len - 1, len }) {
+            memset(dst, 0, sizeof(dst));
+            simd_unpack_u12(packed, n, dst);
+            ASSERT_EQ(0, memcmp(src, dst, n * sizeof(uint16_t)))
+                << "level " << level << " n " << n;
+        }
+    }
+
+    simd_set_level(simd_max_level());
+}
+
+TEST(SimdTest, TransposeBitsMatchesReference) {
+    TEST_DESC("Every bitplane transpose matches transposing a bit at a time");
+    const size_t nwords = 7;
+    uint64_t planes[32][nwords];
+    const uint64_t *ptrs[32];
+    uint32_t gold[64 * nwords], dst[64 * nwords];
+
+    srand(32);
+    for (unsigned k = 0; k < 32; k++) {
+        for (size_t w = 0; w < nwords; w++)
+            planes[k][w] = ((uint64_t) rand() << 40) ^ ((uint64_t) rand() << 20) ^ rand();
+        ptrs[k] = planes[k];
+    }
+    planes[5][3] = UINT64_MAX;
+    planes[31][0] = 1ULL << 63;
+
+    for (unsigned nplanes : { 1, 4, 8, 13, 24, 32 }) {
+        /* A missing channel in the middle reads as zeros */
+        ptrs[2] = NULL;
+        for (size_t i = 0; i < 64 * nwords; i++) {
+            gold[i] = 0;
+            for (unsigned k = 0; k < nplanes; k++) {
+                if (ptrs[k])
+                    gold[i] |= (uint32_t) ((planes[k][i / 64] >> (i % 64)) & 1) << k;
+            }
+        }
+
+        for (int level = SIMD_SCALAR; level <= simd_max_level(); level++) {
+            simd_set_level((enum simd_level) level);
+
+            for (size_t n : { (size_t) 1, (size_t) 2, nwords }) {
+                memset(dst, 0xa5, sizeof(dst));
+                simd_transpose_bits(ptrs, nplanes, n, dst);
+                ASSERT_EQ(0, memcmp(gold, dst, 64 * n * sizeof(uint32_t)))
+                    << "level " << level << " nplanes " << nplanes << " n " << n;
+            }
+        }
+        ptrs[2] = planes[2];
+    }
+
+    simd_set_level(simd_max_level());
+}
+
+TEST(SimdTest, U12HistogramMatchesScalar) {
+    TEST_DESC("Every histogram kernel counts the same as the scalar one");
+    const size_t len = 10007;
+    static uint16_t src[len];
+    static uint32_t gold[SIMD_HIST_WAYS * SIMD_HIST_BINS];
+    static uint32_t ways[SIMD_HIST_WAYS * SIMD_HIST_BINS];
+
+    /* Runs of the same value, and values past 12 bits */
+    srand(4096);
+    for (size_t i = 0; i < len; i++)
+        src[i] = ((i / 100) % 2) ? 3000 + rand() % 8 : rand() % 0x10000;
+
+    for (int level = SIMD_SCALAR; level <= simd_max_level(); level++) {
+        simd_set_level((enum simd_level) level);
+
+        for (size_t n : { (size_t) 0, (size_t) 5, (size_t) 17, len }) {
+            uint64_t total = 0;
+
+            memset(gold, 0, sizeof(gold));
+            for (size_t i = 0; i < n; i++)
+                gold[(src[i] < 4096) ? src[i] : 4095]++;
+
+            memset(ways, 0, sizeof(ways));
+            simd_u12_histogram(src, n, ways);
+            for (size_t b = 0; b < SIMD_HIST_BINS; b++) {
+                uint32_t count = 0;
+
+                for (size_t w = 0; w < SIMD_HIST_WAYS; w++)
+                    count += ways[w * SIMD_HIST_BINS + b];
+                ASSERT_EQ(gold[b], count) << "level " << level << " bin " << b;
+                total += count;
+            }
+            ASSERT_EQ(n, total);
+        }
+    }
+
+    simd_set_level(simd_max_level());
+}